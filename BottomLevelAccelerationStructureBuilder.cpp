@@ -16,53 +16,92 @@ void BottomLevelAccelerationStructureBuilder::Build(
 	VkQueue& graphicsQueue,
 	std::vector<std::shared_ptr<Mesh>>& meshes)
 {
-	// ȡǰҪȾģ
-	const size_t numMeshes = meshes.size();
-	std::vector geometries(numMeshes, VkAccelerationStructureGeometryKHR{});
-	std::vector ranges(numMeshes, VkAccelerationStructureBuildRangeInfoKHR{});
-	std::vector buildInfos(numMeshes, VkAccelerationStructureBuildGeometryInfoKHR{});
-	std::vector sizeInfos(numMeshes, VkAccelerationStructureBuildSizesInfoKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR });
-
-	// һScratchBufferʱ漸
+	// 流式加载的场景一开始可能一个常驻的Mesh都没有
+	if (meshes.empty())
+	{
+		return;
+	}
+
+	// 创建一个ScratchBuffer，用来临时储存几何数据
 	Buffer scratchBuffer(mVmaAllocator);
-	// Ҫ֪ǼļУĸռĿռ
-	// ΪScratchBufferᱻʹãֱеײٽṹ
+	VkCommandBuffer commandBuffer = RecordBuild(logicalDevice, cmdPool, meshes, scratchBuffer);
+
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	const auto vkResult = vkQueueWaitIdle(graphicsQueue);
+	assert(vkResult == VK_SUCCESS);
+	vkFreeCommandBuffers(logicalDevice, cmdPool, 1, &commandBuffer);
+
+	// 释放临时缓存
+	scratchBuffer.Free();
+}
+
+VkCommandBuffer BottomLevelAccelerationStructureBuilder::RecordBuild(
+	VkDevice& logicalDevice,
+	VkCommandPool& cmdPool,
+	std::vector<std::shared_ptr<Mesh>>& meshes,
+	Buffer& scratchBuffer)
+{
+	// 每个Mesh的每一级LOD都有自己的底层加速结构
+	std::vector<std::pair<Mesh*, uint32_t>> targets;
+	for (auto& mesh : meshes)
+	{
+		for (uint32_t lod = 0; lod < mesh->GetLodCount(); lod++)
+		{
+			targets.emplace_back(mesh.get(), lod);
+		}
+	}
+
+	const size_t numTargets = targets.size();
+	std::vector geometries(numTargets, VkAccelerationStructureGeometryKHR{});
+	std::vector ranges(numTargets, VkAccelerationStructureBuildRangeInfoKHR{});
+	std::vector buildInfos(numTargets, VkAccelerationStructureBuildGeometryInfoKHR{});
+	std::vector sizeInfos(numTargets, VkAccelerationStructureBuildSizesInfoKHR{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR });
+
+	// 我们需要知道我们即将构建的几个几何体中，哪个会占用最大的空间
+	// 因为ScratchBuffer会被反复使用，直到所有底层加速结构均构建完毕
 	VkDeviceSize maximumBlasSize = 0;
 	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
-	// ʼÿMesh
-	for (size_t i = 0; i < numMeshes; i++)
+	// 开始对于每个Mesh的每一级LOD操作
+	for (size_t i = 0; i < numTargets; i++)
 	{
-		auto& mesh = meshes[i];
+		auto& [mesh, lod] = targets[i];
 
 		VkAccelerationStructureGeometryKHR& geometry = geometries[i];
 		VkAccelerationStructureBuildRangeInfoKHR& range = ranges[i];
 		VkAccelerationStructureBuildGeometryInfoKHR& buildInfo = buildInfos[i];
-		// ָ˵ǰMeshж
-		range.primitiveCount = mesh->GetIndexCount() / FACE_NUM;
+		// 这里指定了当前Mesh有多少三角形
+		range.primitiveCount = mesh->GetIndexCount(lod) / FACE_NUM;
 
 		geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
 		geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
 		geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
-		// ָMeshVertices
+		// 这里指定Mesh的Vertices数据
 		geometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
 		geometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
 		geometry.geometry.triangles.vertexData = GetBufferDeviceAddressConst(logicalDevice, mesh->GetPositionBuffer());
 		geometry.geometry.triangles.vertexStride = sizeof(vec3);
 		geometry.geometry.triangles.maxVertex = mesh->GetPositionCount();
-		// ָMeshIndex
-		geometry.geometry.triangles.indexData = GetBufferDeviceAddressConst(logicalDevice, mesh->GetIndexBuffer());
+		// 这里指定Mesh的Index数据
+		geometry.geometry.triangles.indexData = GetBufferDeviceAddressConst(logicalDevice, mesh->GetIndexBuffer(lod));
 		geometry.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
 
-		// ĬϲͿ
+		// 这里用默认参数就可以了
 		buildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
 		buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
 		buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-		// DemoУڹļٽṹܹײʱЧ
+		// 在这个Demo中，我们倾向于构建出来的加速结构能够在射线碰撞的时候更有效率
 		buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
 		buildInfo.geometryCount = 1;
 		buildInfo.pGeometries = &geometry;
 
-		// ȡҪǰĵײٽṹҪĻ
+		// 获取如果需要构建当前的底层加速结构需要多大的缓存
 		vkGetAccelerationStructureBuildSizesKHR(logicalDevice,
 			VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
 			&buildInfo,
@@ -70,13 +109,13 @@ void BottomLevelAccelerationStructureBuilder::Build(
 			&sizeInfos[i]);
 
 	}
-	// ¼Ǹ
+	// 记录最大的那个缓存
 	for (const auto& sizeInfo : sizeInfos)
 	{
 		maximumBlasSize = std::max(sizeInfo.buildScratchSize, maximumBlasSize);
 	}
 
-	// Size
+	// 以最大的Size构建缓存
 	auto vkResult = scratchBuffer.CreateBuffer(maximumBlasSize,
 		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
 		| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT);
@@ -96,18 +135,18 @@ void BottomLevelAccelerationStructureBuilder::Build(
 	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 	vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-	// 趨һڴϣԱ֤ٽṹܹ
+	// 设定一个内存屏障，以保证加速结构能够完整构建
 	VkMemoryBarrier memoryBarrier = {};
 	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
 	memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
 	memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
 
-	for (size_t i = 0; i < numMeshes; i++)
+	for (size_t i = 0; i < numTargets; i++)
 	{
-		auto& mesh = meshes[i];
+		auto& [mesh, lod] = targets[i];
 
-		// ׼ײٽṹ
-		auto& acclerationStructure = mesh->GetAccelerationStructure();
+		// 准备创建底层加速结构
+		auto& acclerationStructure = mesh->GetAccelerationStructure(lod);
 
 		acclerationStructure.buffer = std::make_shared<Buffer>(mVmaAllocator);
 		acclerationStructure.buffer->CreateBuffer(sizeInfos[i].accelerationStructureSize,
@@ -120,54 +159,36 @@ void BottomLevelAccelerationStructureBuilder::Build(
 		createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
 		createInfo.size = sizeInfos[i].accelerationStructureSize;
 		createInfo.buffer = acclerationStructure.buffer->GetVkBuffer();
-		// ײٽṹ
+		// 创建底层加速结构
 		vkResult = vkCreateAccelerationStructureKHR(logicalDevice,
 			&createInfo,
 			nullptr,
 			&acclerationStructure.accelerationStructure);
 		assert(vkResult == VK_SUCCESS);
 
-		// ʼײٽṹ
-		// ע⣺ǴٽṹҪCommandBufferǹҪCommandBuffer
+		// 加速结构的地址在创建之后就能拿到，不需要等构建完成
+		VkAccelerationStructureDeviceAddressInfoKHR addressInfo = {};
+		addressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+		addressInfo.accelerationStructure = acclerationStructure.accelerationStructure;
+		acclerationStructure.handle = vkGetAccelerationStructureDeviceAddressKHR(logicalDevice, &addressInfo);
+
+		// 开始构建底层加速结构
+		// 注意：如果是创建加速结构不需要CommandBuffer，但如果是构建，则需要CommandBuffer
 		VkAccelerationStructureBuildGeometryInfoKHR& buildInfo = buildInfos[i];
 		buildInfo.scratchData = Device::GetBufferDeviceAddress(scratchBuffer);
 		buildInfo.srcAccelerationStructure = VK_NULL_HANDLE;
 		buildInfo.dstAccelerationStructure = acclerationStructure.accelerationStructure;
 
 		const VkAccelerationStructureBuildRangeInfoKHR* range[1] = { &ranges[i] };
-		// ʼ
+		// 开始构建
 		vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildInfo, range);
 
-		// ʹMemoryBufferԷֹļٽṹǰScratchBuffer
+		// 使用MemoryBuffer，以防止后面来构建的加速结构抢当前的ScratchBuffer
 		vkCmdPipelineBarrier(commandBuffer,
 			VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
 			VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
 			0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
 	}
 
-	vkEndCommandBuffer(commandBuffer);
-
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-
-	vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkResult = vkQueueWaitIdle(graphicsQueue);
-	assert(vkResult == VK_SUCCESS);
-	vkFreeCommandBuffers(logicalDevice, cmdPool, 1, &commandBuffer);
-
-	// ѹõļٽṹMesh
-	for (size_t i = 0; i < numMeshes; ++i) 
-	{
-		auto& mesh = meshes[i];
-		auto& accelerationStructure = mesh->GetAccelerationStructure();
-		VkAccelerationStructureDeviceAddressInfoKHR addressInfo = {};
-		addressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
-		addressInfo.accelerationStructure = accelerationStructure.accelerationStructure;
-		accelerationStructure.handle = vkGetAccelerationStructureDeviceAddressKHR(logicalDevice, &addressInfo);
-	}
-
-	// ͷʱ
-	scratchBuffer.Free();
+	return commandBuffer;
 }
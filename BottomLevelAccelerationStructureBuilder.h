@@ -3,7 +3,7 @@
 
 #include "Mesh.h"
 
-// It builds the bottom level acceleration structure for each mesh, and then it stores the result in each mesh.
+// It builds the bottom level acceleration structure for each LOD of each mesh, and then it stores the result in the mesh.
 class BottomLevelAccelerationStructureBuilder
 {
 public:
@@ -12,6 +12,14 @@ public:
 		VkCommandPool& cmdPool,
 		VkQueue& graphicsQueue,
 		std::vector<std::shared_ptr<Mesh>>& meshes);
+
+	// Creates the acceleration structures and records their builds into a new command buffer that is left open,
+	// so the caller can append barriers and submit it on whichever queue it likes.
+	// scratchBuffer must stay alive until the submitted work has finished.
+	VkCommandBuffer RecordBuild(VkDevice& logicalDevice,
+		VkCommandPool& cmdPool,
+		std::vector<std::shared_ptr<Mesh>>& meshes,
+		Buffer& scratchBuffer);
 private:
 	VmaAllocator& mVmaAllocator;
 };
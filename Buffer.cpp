@@ -13,16 +13,16 @@ VkResult Buffer::CreateBuffer(const VkDeviceSize& bufferSize,
     const VmaAllocationCreateFlags& allocationCreateFlags,
     const VmaMemoryUsage& allocationUsage)
 {
-    // ָBufferС
+    // 指定Buffer大小
     mSize = bufferSize;
 
-    // VkBufferһЩ
+    // 创建VkBuffer的一些参数
     VkBufferCreateInfo bufferCreateInfo = { };
     bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferCreateInfo.size = bufferSize;
     bufferCreateInfo.usage = usageFlags;
 
-    // VmaAllocationһЩ
+    // 创建VmaAllocation的一些参数
     VmaAllocationCreateInfo bufferAllocationCreateInfo = {};
     bufferAllocationCreateInfo.usage = allocationUsage;
     bufferAllocationCreateInfo.flags = allocationCreateFlags;
@@ -30,7 +30,7 @@ VkResult Buffer::CreateBuffer(const VkDeviceSize& bufferSize,
     VmaAllocationInfo bufferAllocationInfo = {};
     const auto error = vmaCreateBuffer(mAllocator, &bufferCreateInfo, &bufferAllocationCreateInfo, &mVkBuffer, &mVmaAllocation, &bufferAllocationInfo);
 
-    // ش
+    // 返回创建结果
     return error;
 }
 
@@ -65,6 +65,16 @@ void Buffer::Unmap() const
     vmaUnmapMemory(mAllocator, mVmaAllocation);
 }
 
+void Buffer::Flush() const
+{
+    vmaFlushAllocation(mAllocator, mVmaAllocation, 0, VK_WHOLE_SIZE);
+}
+
+void Buffer::Invalidate() const
+{
+    vmaInvalidateAllocation(mAllocator, mVmaAllocation, 0, VK_WHOLE_SIZE);
+}
+
 void Buffer::Free()
 {
     vmaDestroyBuffer(mAllocator, mVkBuffer, mVmaAllocation);
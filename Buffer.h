@@ -15,6 +15,9 @@ public:
 	void UploadData(const void* data);
 	void* Map() const;
 	void Unmap() const;
+	// Host memory that is not HOST_COHERENT: make CPU writes visible to the device / device writes visible to the CPU
+	void Flush() const;
+	void Invalidate() const;
 
 	VkBuffer GetVkBuffer() const
 	{
@@ -34,7 +37,7 @@ private:
 
 	VmaAllocator mAllocator;
 
-	VmaAllocation mVmaAllocation;
-	VkBuffer mVkBuffer;
+	VmaAllocation mVmaAllocation = VK_NULL_HANDLE;
+	VkBuffer mVkBuffer = VK_NULL_HANDLE;
 };
 
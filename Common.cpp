@@ -95,6 +95,7 @@ VkResult DoOneTimeCommand(VkDevice logicalDevice, VkCommandPool commandPool, VkQ
 
     vkDeviceWaitIdle(logicalDevice);
     vkFreeCommandBuffers(logicalDevice, commandPool, 1, &commandBuffer);
+    return VK_SUCCESS;
 }
 
 uint32_t AlignUp(const uint32_t value, const uint32_t align)
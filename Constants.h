@@ -10,3 +10,4 @@
 #define DEFAULT_MODEL_DIR "models\\"
 #define DEFAULT_SHADER_DIR "shaders\\"
 #define DEFAULT_TEXTURE_DIR "textures\\"
+#define DEFAULT_SCENE_DIR "scenes\\"
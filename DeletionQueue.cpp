@@ -0,0 +1,28 @@
+﻿#include "DeletionQueue.h"
+
+void DeletionQueue::Push(std::function<void()>&& deleter)
+{
+	mPending.push_back({ mFrame, std::move(deleter) });
+}
+
+void DeletionQueue::NextFrame()
+{
+	mFrame++;
+	// 按压入的顺序释放，先压入的一定先到期
+	while (!mPending.empty() && mPending.front().frame + FRAMES_IN_FLIGHT <= mFrame)
+	{
+		auto deleter = std::move(mPending.front().deleter);
+		mPending.pop_front();
+		deleter();
+	}
+}
+
+void DeletionQueue::Flush()
+{
+	while (!mPending.empty())
+	{
+		auto deleter = std::move(mPending.front().deleter);
+		mPending.pop_front();
+		deleter();
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+/*
+ * Destroys GPU resources only after the frames that might still reference them have finished.
+ * Resources that are replaced while the application runs (hot reload) are pushed here instead of being freed in place.
+ */
+class DeletionQueue
+{
+public:
+	// ProcessFrame等设备空闲之后才开始下一帧，所以一帧之后就可以释放；去掉那个等待的话要改成交换链图片的数量
+	static constexpr uint64_t FRAMES_IN_FLIGHT = 1;
+
+	void Push(std::function<void()>&& deleter);
+
+	// Call once at the start of every frame, after waiting for the frame FRAMES_IN_FLIGHT frames ago.
+	void NextFrame();
+
+	// Runs every pending deleter; the device has to be idle.
+	void Flush();
+
+private:
+	struct PendingDeletion
+	{
+		uint64_t frame;
+		std::function<void()> deleter;
+	};
+
+	std::deque<PendingDeletion> mPending;
+	uint64_t mFrame = 0;
+};
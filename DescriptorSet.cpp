@@ -35,7 +35,9 @@ void DescriptorSet::InitPool(
 	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
 	descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	descriptorPoolCreateInfo.pNext = VK_NULL_HANDLE;
-	descriptorPoolCreateInfo.flags = 0;
+	// 只要有一个Set要在绑定之后更新，整个Pool都要带上这个标志
+	descriptorPoolCreateInfo.flags = std::any_of(layouts.begin(), layouts.end(), [](const DescriptorSetLayout* layout) { return layout->IsUpdateAfterBind(); })
+		? VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT : 0;
 	descriptorPoolCreateInfo.maxSets = layouts.size();
 	descriptorPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
 	descriptorPoolCreateInfo.pPoolSizes = poolSizes.data();
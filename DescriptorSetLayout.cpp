@@ -7,7 +7,7 @@ DescriptorSetLayout::DescriptorSetLayout(VkDevice& logicalDevice, uint32_t setNu
 
 }
 
-void DescriptorSetLayout::AddBinding(const VkDescriptorSetLayoutBinding& binding)
+void DescriptorSetLayout::AddBinding(const VkDescriptorSetLayoutBinding& binding, const VkDescriptorBindingFlags& flags)
 {
 	if (mIsLayoutCreated)
 	{
@@ -15,15 +15,42 @@ void DescriptorSetLayout::AddBinding(const VkDescriptorSetLayoutBinding& binding
 	}
 
 	mBindings.push_back(binding);
+	mBindingFlags.push_back(flags);
+}
+
+bool DescriptorSetLayout::IsUpdateAfterBind() const
+{
+	for (const auto& flags : mBindingFlags)
+	{
+		if (flags & VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT)
+		{
+			return true;
+		}
+	}
+	return false;
 }
 
 void DescriptorSetLayout::CreateDescriptorSet()
 {
+	// 有Binding带了标志位才需要挂上这个结构体
+	VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+		.pNext = VK_NULL_HANDLE,
+		.bindingCount = static_cast<uint32_t>(mBindingFlags.size()),
+		.pBindingFlags = mBindingFlags.data(),
+	};
+	bool hasBindingFlags = false;
+	for (const auto& flags : mBindingFlags)
+	{
+		hasBindingFlags |= flags != 0;
+	}
+
 	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo
 	{
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-		.pNext = VK_NULL_HANDLE,
-		.flags = 0,
+		.pNext = hasBindingFlags ? &bindingFlagsCreateInfo : VK_NULL_HANDLE,
+		.flags = IsUpdateAfterBind() ? static_cast<VkDescriptorSetLayoutCreateFlags>(VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT) : 0u,
 		.bindingCount = static_cast<uint32_t>(mBindings.size()),
 		.pBindings = mBindings.data(),
 	};
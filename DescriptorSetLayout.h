@@ -7,7 +7,8 @@ class DescriptorSetLayout
 public:
 	DescriptorSetLayout(VkDevice& logicalDevice, uint32_t setNum);
 
-	void AddBinding(const VkDescriptorSetLayoutBinding& binding);
+	// flags: VkDescriptorBindingFlags of descriptor indexing, e.g. UPDATE_AFTER_BIND for arrays patched while in use
+	void AddBinding(const VkDescriptorSetLayoutBinding& binding, const VkDescriptorBindingFlags& flags = 0);
 
 	void CreateDescriptorSet();
 
@@ -16,6 +17,9 @@ public:
 	{
 		return mSetNum;
 	}
+	// The pool of a set with an UPDATE_AFTER_BIND binding needs VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT
+	[[nodiscard]]
+	bool IsUpdateAfterBind() const;
 	[[nodiscard]]
 	VkDescriptorSetLayout GetSetLayout() const
 	{
@@ -28,6 +32,7 @@ private:
 	VkDevice& mLogicalDevice;
 
 	std::vector<VkDescriptorSetLayoutBinding> mBindings;
+	std::vector<VkDescriptorBindingFlags> mBindingFlags;
 
 	bool mIsLayoutCreated = false;
 	const uint32_t mSetNum = 0;
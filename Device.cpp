@@ -1,5 +1,7 @@
 #include "Device.h"
 
+#include <cstring>
+
 #include "Buffer.h"
 
 VkPhysicalDevice Device::PhysicalDevice;
@@ -13,6 +15,9 @@ VkQueue Device::TransferQueue;
 Queue Device::Queue;
 
 VkPhysicalDeviceRayTracingPipelinePropertiesKHR Device::RTProps;
+bool Device::MemoryBudgetSupported = false;
+bool Device::SampledImageUpdateAfterBindSupported = false;
+bool Device::PipelineCreationFeedbackSupported = false;
 
 void Device::Init(VkInstance& instance)
 {
@@ -28,20 +33,20 @@ void Device::Init(VkInstance& instance)
 
 void Device::InitPhysicalDevice(VkInstance& instance)
 {
-    // ȡǰж豸
+    // 获取当前有多少物理设备
     uint32_t numPhysDevices = 0;
     VkResult error = vkEnumeratePhysicalDevices(instance, &numPhysDevices, nullptr);
 
     assert(VK_SUCCESS == error && numPhysDevices);
 
-    // ȡ豸
+    // 获取所有物理设备
     std::vector<VkPhysicalDevice> totalPhysicalDevices;
     totalPhysicalDevices.resize(numPhysDevices, nullptr);
     vkEnumeratePhysicalDevices(instance, &numPhysDevices, totalPhysicalDevices.data());
 
     VkDeviceSize deviceSize = 0;
     std::cout << "Available devices: " << std::endl;
-    // ͨһ򵥴ֱķʽȡ豸ѡԴǸ
+    // 这里通过一个简单粗暴的方式获取设备：选显存最大的那个
     for (const auto& physicalDevice : totalPhysicalDevices)
     {
         if (physicalDevice == nullptr)
@@ -50,26 +55,26 @@ void Device::InitPhysicalDevice(VkInstance& instance)
         }
         VkPhysicalDeviceProperties deviceProperties;
         VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
-        // ȡ豸
+        // 获取设备的物理属性
         vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
         vkGetPhysicalDeviceMemoryProperties(physicalDevice, &deviceMemoryProperties);
-        // ȡԴǸ
+        // 获取其物理属性中描述显存的那个部分
         auto currentDeviceSize = deviceMemoryProperties.memoryHeaps[VK_MEMORY_HEAP_DEVICE_LOCAL_BIT].size;
         if (currentDeviceSize > deviceSize && deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
         {
             PhysicalDevice = physicalDevice;
             deviceSize = currentDeviceSize;
         }
-        // ӡǰ豸
+        // 打印当前设备名称
         std::cout << deviceProperties.deviceName << std::endl;
     }
-    // PhysicalDevice豸һԱȫֿɷ
+    // PhysicalDevice是设备单例类的一个成员，全局可访问
     if (!PhysicalDevice)
     {
         PhysicalDevice = totalPhysicalDevices.front();
     }
 
-    // ȡǰ豸׷ٹйص
+    // 获取当前设备与光线追踪管线有关的属性
     RTProps = {};
     RTProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR;
 
@@ -83,11 +88,11 @@ void Device::InitPhysicalDevice(VkInstance& instance)
 
 void Device::InitQueue()
 {
-    // ¼ҪЩĶ
+    // 这里记录我们需要哪些种类的队列
     const VkQueueFlagBits askingFlags[3] = { VK_QUEUE_GRAPHICS_BIT, VK_QUEUE_COMPUTE_BIT, VK_QUEUE_TRANSFER_BIT };
     uint32_t queuesIndices[3] = { ~0u, ~0u, ~0u };
 
-    // ȡǰ豸һжٶ
+    // 获取当前设备一共有多少队列
     uint32_t queueFamilyPropertyCount;
     vkGetPhysicalDeviceQueueFamilyProperties(PhysicalDevice, &queueFamilyPropertyCount, nullptr);
     std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyPropertyCount);
@@ -95,13 +100,13 @@ void Device::InitQueue()
 
     for (size_t i = 0; i < 3; ++i)
     {
-        // ȡǰҪҵǸ
+        // 获取当前需要找到的那个队列
         const VkQueueFlagBits& flag = askingFlags[i];
         uint32_t& queueIdx = queuesIndices[i];
 
         if (flag == VK_QUEUE_COMPUTE_BIT)
         {
-            // ǰĶֻ
+            // 如果当前的队列只能做计算
             for (uint32_t j = 0; j < queueFamilyPropertyCount; ++j)
             {
                 if ((queueFamilyProperties[j].queueFlags & VK_QUEUE_COMPUTE_BIT) &&
@@ -114,7 +119,7 @@ void Device::InitQueue()
         }
         else if (flag == VK_QUEUE_TRANSFER_BIT)
         {
-        	// ǰĶֻݴ
+        	// 如果当前的队列只能做数据传输
             for (uint32_t j = 0; j < queueFamilyPropertyCount; ++j)
             {
                 if ((queueFamilyProperties[j].queueFlags & VK_QUEUE_TRANSFER_BIT) &&
@@ -127,7 +132,7 @@ void Device::InitQueue()
             }
         }
 
-        // ߵ˵ǰĶпͬʱ
+        // 能走到这里则说明如果当前的队列可以同时干三件事情
         if (queueIdx == ~0u)
         {
             for (uint32_t j = 0; j < queueFamilyPropertyCount; ++j)
@@ -151,8 +156,8 @@ void Device::InitLogicalDevice()
     std::vector<VkDeviceQueueCreateInfo> deviceQueueCreateInfos;
     const float priority = 0.0f;
 
-    // ﶨϣ߼豸֧Щ
-    // ںܶԿ˵ͼΡݴ䶼һQueue FamilyȻųڲͬQueue Family
+    // 这里定义了我们希望逻辑设备可以支持哪些队列
+    // 对于很多显卡来说，图形、计算和数据传输都是一个Queue Family，不过我们依然不能排除三件事在不同的Queue Family的情况
     VkDeviceQueueCreateInfo deviceQueueCreateInfo;
     deviceQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
     deviceQueueCreateInfo.pNext = nullptr;
@@ -161,7 +166,7 @@ void Device::InitLogicalDevice()
     deviceQueueCreateInfo.queueCount = 1;
     deviceQueueCreateInfo.pQueuePriorities = &priority;
     deviceQueueCreateInfos.push_back(deviceQueueCreateInfo);
-    // Compute QueueFamilyһIndex
+    // 如果Compute QueueFamily是一个单独的Index
     if (Queue.ComputeQueueFamilyIndex != Queue.GraphicsQueueFamilyIndex)
     {
         deviceQueueCreateInfo.queueFamilyIndex = Queue.ComputeQueueFamilyIndex;
@@ -174,8 +179,8 @@ void Device::InitLogicalDevice()
         deviceQueueCreateInfos.push_back(deviceQueueCreateInfo);
     }
 
-    // ҪָҪ߼豸Ҫֹ֧׷ٹٽṹ
-    // Ҫָǰ߼豸ҪЩչ
+    // 这里需要指定我们要创建的逻辑设备需要支持光线追踪管线与加速结构
+    // 所以我们需要指定当前逻辑设备需要加载哪些扩展
     VkPhysicalDeviceFeatures2 features2 = { };
     features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
 
@@ -207,15 +212,37 @@ void Device::InitLogicalDevice()
 
     deviceExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
 
+    // 显存预算扩展是可选的：有它的话VMA拿到的是驱动实际分给这个进程的预算（同一张卡上其它进程用掉的会扣掉），
+    // 没有的话VMA只能按堆大小的80%估算
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(PhysicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(PhysicalDevice, nullptr, &extensionCount, extensions.data());
+    for (const auto& extension : extensions)
+    {
+        if (strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+        {
+            MemoryBudgetSupported = true;
+            deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        }
+        // 同样是可选的：创建管线的时候驱动报告耗时和有没有命中管线缓存
+        else if (strcmp(extension.extensionName, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME) == 0)
+        {
+            PipelineCreationFeedbackSupported = true;
+            deviceExtensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+        }
+    }
+
     if (features2.pNext)
     {
         descriptorIndexing.pNext = features2.pNext;
     }
 
     features2.pNext = &descriptorIndexing;
-    vkGetPhysicalDeviceFeatures2(PhysicalDevice, &features2); // Կеȫ
+    vkGetPhysicalDeviceFeatures2(PhysicalDevice, &features2); // 把显卡所有的特性全部激活
+    SampledImageUpdateAfterBindSupported = descriptorIndexing.descriptorBindingSampledImageUpdateAfterBind == VK_TRUE;
 
-    // ʼ豸
+    // 开始创建设备
     VkDeviceCreateInfo deviceCreateInfo;
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     deviceCreateInfo.pNext = &features2;
@@ -231,8 +258,8 @@ void Device::InitLogicalDevice()
     auto error = vkCreateDevice(PhysicalDevice, &deviceCreateInfo, nullptr, &LogicalDevice);
     assert(VK_SUCCESS == error);
 
-    // ȡʵʴͼΡʹHandlesΪָ룩
-    // ֮ʵҪCommandBuffer͸ԿҪָĸеʱ򣬾ҪʹЩHandles
+    // 获取到实际处理图形、计算和传输的Handles（可以理解为指针）
+    // 之后实际要把CommandBuffer推送给显卡，需要指定哪个队列的时候，就需要使用这些Handles
     vkGetDeviceQueue(LogicalDevice, Queue.GraphicsQueueFamilyIndex, 0, &GraphicsQueue);
     vkGetDeviceQueue(LogicalDevice, Queue.ComputeQueueFamilyIndex, 0, &ComputeQueue);
     vkGetDeviceQueue(LogicalDevice, Queue.TransferQueueFamilyIndex, 0, &TransferQueue);
@@ -20,6 +20,12 @@ public:
 	STATIC_INLINE_GETTER(VkDevice, LogicalDevice);
 	STATIC_INLINE_GETTER(Queue, Queue);
 	STATIC_INLINE_GETTER(VkPhysicalDeviceRayTracingPipelinePropertiesKHR, RTProps);
+	// VK_EXT_memory_budget is enabled, so VMA reports the budget the driver gives this process
+	STATIC_INLINE_GETTER(bool, MemoryBudgetSupported);
+	// Sampled image descriptors can be written after the set has been bound (descriptorBindingSampledImageUpdateAfterBind)
+	STATIC_INLINE_GETTER(bool, SampledImageUpdateAfterBindSupported);
+	// VK_EXT_pipeline_creation_feedback is enabled, so pipeline creation reports its duration and pipeline cache hits
+	STATIC_INLINE_GETTER(bool, PipelineCreationFeedbackSupported);
 
 	STATIC_INLINE_GETTER(VkQueue, GraphicsQueue);
 	STATIC_INLINE_GETTER(VkQueue, ComputeQueue);
@@ -38,6 +44,9 @@ private:
 	static VkQueue TransferQueue;
 
 	static VkPhysicalDeviceRayTracingPipelinePropertiesKHR RTProps;
+	static bool MemoryBudgetSupported;
+	static bool SampledImageUpdateAfterBindSupported;
+	static bool PipelineCreationFeedbackSupported;
 
 	static void InitPhysicalDevice(VkInstance& instance);
 	static void InitQueue();
@@ -0,0 +1,244 @@
+﻿#include "EnvironmentMap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <glm/gtc/packing.hpp>
+
+#include "Buffer.h"
+
+namespace
+{
+	constexpr float PI = 3.14159265358979323846f;
+
+	// 按纬度经度采样，横向环绕，纵向在两极截断
+	vec4 SampleLatLong(const std::vector<vec4>& texels, const uint32_t& width, const uint32_t& height, const vec3& direction)
+	{
+		const vec3 dir = glm::normalize(direction);
+		const float u = (PI + std::atan2(dir.x, dir.z)) * (0.5f / PI);
+		const float v = std::acos(std::clamp(dir.y, -1.0f, 1.0f)) / PI;
+
+		const float x = u * static_cast<float>(width) - 0.5f;
+		const float y = v * static_cast<float>(height) - 0.5f;
+		const float x0f = std::floor(x);
+		const float y0f = std::floor(y);
+		const float fx = x - x0f;
+		const float fy = y - y0f;
+		const auto wrapX = [width](const int64_t& column) { return static_cast<size_t>(((column % width) + width) % width); };
+		const auto clampY = [height](const int64_t& row) { return static_cast<size_t>(std::clamp<int64_t>(row, 0, height - 1)); };
+		const size_t x0 = wrapX(static_cast<int64_t>(x0f));
+		const size_t x1 = wrapX(static_cast<int64_t>(x0f) + 1);
+		const size_t y0 = clampY(static_cast<int64_t>(y0f));
+		const size_t y1 = clampY(static_cast<int64_t>(y0f) + 1);
+
+		const vec4 top = glm::mix(texels[y0 * width + x0], texels[y0 * width + x1], fx);
+		const vec4 bottom = glm::mix(texels[y1 * width + x0], texels[y1 * width + x1], fx);
+		return glm::mix(top, bottom, fy);
+	}
+
+	DecodedLevel PackHalf(const std::vector<vec4>& texels)
+	{
+		std::vector<uint8_t> bytes(texels.size() * 4 * sizeof(uint16_t));
+		auto* halves = reinterpret_cast<uint16_t*>(bytes.data());
+		for (size_t i = 0; i < texels.size(); i++)
+		{
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				halves[i * 4 + c] = glm::packHalf1x16(texels[i][c]);
+			}
+		}
+		return DecodedLevel::FromVector(std::move(bytes));
+	}
+}
+
+vec3 EnvironmentMap::FaceTexelDirection(const uint32_t& face, const float& x, const float& y, const uint32_t& faceSize)
+{
+	// s、t是面上的坐标，范围[-1, 1]
+	const float s = 2.0f * x / static_cast<float>(faceSize) - 1.0f;
+	const float t = 2.0f * y / static_cast<float>(faceSize) - 1.0f;
+	switch (face)
+	{
+	case 0: return vec3(1.0f, -t, -s);
+	case 1: return vec3(-1.0f, -t, s);
+	case 2: return vec3(s, 1.0f, t);
+	case 3: return vec3(s, -1.0f, -t);
+	case 4: return vec3(s, -t, 1.0f);
+	default: return vec3(-s, -t, -1.0f);
+	}
+}
+
+bool EnvironmentMap::ConvertEquirectToCube(const char* path, CubeFaces& cube)
+{
+	// 烘焙过的KTX2是块压缩的，CPU上没法采样，所以总是读源文件
+	DecodedImage source;
+	const bool succeeded = Image::DecodeFile(path, true, false, false, source);
+
+	// 源图片先统一转换成线性空间的float：8位的是sRGB编码，HDR的是半精度
+	const size_t texelCount = static_cast<size_t>(source.width) * source.height;
+	std::vector<vec4> texels(texelCount);
+	if (source.format == VK_FORMAT_R16G16B16A16_SFLOAT)
+	{
+		const auto* halves = reinterpret_cast<const uint16_t*>(source.levels[0].data.get());
+		for (size_t i = 0; i < texelCount; i++)
+		{
+			texels[i] = vec4(glm::unpackHalf1x16(halves[i * 4 + 0]), glm::unpackHalf1x16(halves[i * 4 + 1]),
+				glm::unpackHalf1x16(halves[i * 4 + 2]), glm::unpackHalf1x16(halves[i * 4 + 3]));
+		}
+	}
+	else
+	{
+		std::array<float, 256> toLinear;
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			const float c = static_cast<float>(i) / 255.0f;
+			toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		const uint8_t* bytes = source.levels[0].data.get();
+		for (size_t i = 0; i < texelCount; i++)
+		{
+			texels[i] = vec4(toLinear[bytes[i * 4 + 0]], toLinear[bytes[i * 4 + 1]], toLinear[bytes[i * 4 + 2]],
+				static_cast<float>(bytes[i * 4 + 3]) / 255.0f);
+		}
+	}
+
+	// 赤道一圈是4个面，面的大小取宽度的1/4附近的2的幂，这样Mip每一级正好减半
+	uint32_t faceSize = 1;
+	while (faceSize * 2 <= std::min(source.width / 4, MAX_FACE_SIZE))
+	{
+		faceSize *= 2;
+	}
+	// 源图片比面大很多的时候每个像素多采几个点，不然会有锯齿
+	const uint32_t samplesPerAxis = std::clamp(source.width / 4 / faceSize, 1u, 4u);
+	cube.faceSize = faceSize;
+
+	// 每个面一个线程，互相之间没有依赖
+	std::array<std::future<void>, 6> conversions;
+	for (uint32_t face = 0; face < 6; face++)
+	{
+		conversions[face] = std::async(std::launch::async, [&, face]()
+		{
+			std::vector<vec4> level(static_cast<size_t>(faceSize) * faceSize);
+			const float sampleWeight = 1.0f / static_cast<float>(samplesPerAxis * samplesPerAxis);
+			for (uint32_t y = 0; y < faceSize; y++)
+			{
+				for (uint32_t x = 0; x < faceSize; x++)
+				{
+					vec4 sum(0.0f);
+					for (uint32_t sy = 0; sy < samplesPerAxis; sy++)
+					{
+						for (uint32_t sx = 0; sx < samplesPerAxis; sx++)
+						{
+							const float px = static_cast<float>(x) + (static_cast<float>(sx) + 0.5f) / static_cast<float>(samplesPerAxis);
+							const float py = static_cast<float>(y) + (static_cast<float>(sy) + 0.5f) / static_cast<float>(samplesPerAxis);
+							sum += SampleLatLong(texels, source.width, source.height, FaceTexelDirection(face, px, py, faceSize));
+						}
+					}
+					level[static_cast<size_t>(y) * faceSize + x] = sum * sampleWeight;
+				}
+			}
+
+			// 每一级在线性空间里2x2平均
+			auto& levels = cube.faces[face];
+			levels.clear();
+			for (uint32_t size = faceSize; ; size /= 2)
+			{
+				levels.push_back(PackHalf(level));
+				if (size == 1)
+				{
+					break;
+				}
+				const uint32_t next = size / 2;
+				std::vector<vec4> smaller(static_cast<size_t>(next) * next);
+				for (uint32_t y = 0; y < next; y++)
+				{
+					for (uint32_t x = 0; x < next; x++)
+					{
+						smaller[static_cast<size_t>(y) * next + x] = 0.25f * (level[(y * 2) * size + x * 2] + level[(y * 2) * size + x * 2 + 1]
+							+ level[(y * 2 + 1) * size + x * 2] + level[(y * 2 + 1) * size + x * 2 + 1]);
+					}
+				}
+				level = std::move(smaller);
+			}
+		});
+	}
+	for (auto& conversion : conversions)
+	{
+		conversion.get();
+	}
+	return succeeded;
+}
+
+std::unique_ptr<Image> EnvironmentMap::LoadCubemap(const char* path,
+	VmaAllocator& allocator,
+	VkDevice& logicalDevice,
+	const VkCommandPool& commandPool,
+	const VkQueue& graphicsQueue)
+{
+	CubeFaces cube;
+	if (!ConvertEquirectToCube(path, cube))
+	{
+		std::cerr << "Failed to load environment map " << path << std::endl;
+	}
+	const auto mipLevels = static_cast<uint32_t>(cube.faces[0].size());
+
+	auto image = std::make_unique<Image>(allocator, logicalDevice, CUBE_FORMAT);
+	VkResult error = image->Create(VK_IMAGE_TYPE_2D,
+		{ cube.faceSize, cube.faceSize, 1 },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		mipLevels,
+		6,
+		VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT);
+	CHECK_VK_ERROR(error, "Failed to create the environment cubemap.");
+
+	// 六个面的所有Mip放在一个Staging Buffer里，一次拷贝
+	VkDeviceSize stagingSize = 0;
+	std::vector<VkBufferImageCopy> regions;
+	for (uint32_t face = 0; face < 6; face++)
+	{
+		for (uint32_t level = 0; level < mipLevels; level++)
+		{
+			VkBufferImageCopy region = {};
+			region.bufferOffset = stagingSize;
+			region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, face, 1 };
+			region.imageExtent = { std::max(cube.faceSize >> level, 1u), std::max(cube.faceSize >> level, 1u), 1 };
+			regions.push_back(region);
+			stagingSize += cube.faces[face][level].size;
+		}
+	}
+	Buffer stagingBuffer(allocator);
+	error = stagingBuffer.CreateBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+	CHECK_VK_ERROR(error, "Failed to create the staging buffer of the environment cubemap.");
+	auto* staging = static_cast<uint8_t*>(stagingBuffer.Map());
+	for (uint32_t face = 0; face < 6; face++)
+	{
+		for (uint32_t level = 0; level < mipLevels; level++)
+		{
+			const auto& region = regions[face * mipLevels + level];
+			std::memcpy(staging + region.bufferOffset, cube.faces[face][level].data.get(), cube.faces[face][level].size);
+		}
+	}
+	stagingBuffer.Unmap();
+
+	const VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 6 };
+	error = DoOneTimeCommand(logicalDevice, commandPool, graphicsQueue, [&](VkCommandBuffer& commandBuffer)
+	{
+		Image::ImageBarrier(commandBuffer, image->GetImage(), range,
+			0, VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+		vkCmdCopyBufferToImage(commandBuffer, stagingBuffer.GetVkBuffer(), image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(regions.size()), regions.data());
+		Image::ImageBarrier(commandBuffer, image->GetImage(), range,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		return VK_SUCCESS;
+	});
+	stagingBuffer.Free();
+	CHECK_VK_ERROR(error, "Failed to upload the environment cubemap.");
+
+	CHECK_VK_ERROR(image->CreateImageView(VK_IMAGE_VIEW_TYPE_CUBE, range), "Failed to create the environment cubemap view.");
+	return image;
+}
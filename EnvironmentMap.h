@@ -0,0 +1,45 @@
+#pragma once
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "Image.h"
+
+/*
+ * Converts a lat-long environment image into a mip-mapped cubemap once at load time, so the miss shader
+ * samples it with the ray direction instead of computing atan / acos for every ray, and wide ray cones
+ * read small mips instead of aliasing near the poles.
+ * The conversion runs on the CPU with one thread per face, so it needs neither a compute pipeline nor a window.
+ */
+class EnvironmentMap
+{
+public:
+	// Faces are stored in linear space whatever the source was, so LDR and HDR skies go through the same path
+	static constexpr VkFormat CUBE_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+	static constexpr uint32_t MAX_FACE_SIZE = 1024;
+
+	// Faces in the layer order of a Vulkan cube image (+X, -X, +Y, -Y, +Z, -Z), every one with levels down to 1x1
+	struct CubeFaces
+	{
+		uint32_t faceSize = 0;
+		std::array<std::vector<DecodedLevel>, 6> faces;
+	};
+
+	/*
+	 * Reads the lat-long image at path (the error texture when it cannot be read, returning false) and resamples it
+	 * into faces of a power of two size close to a quarter of its width, following the u = atan(x, z), v = acos(y)
+	 * mapping the miss shader used to sample the lat-long image with.
+	 */
+	static bool ConvertEquirectToCube(const char* path, CubeFaces& cube);
+
+	// ConvertEquirectToCube and an upload into a cube image with a cube view; the sampler is up to the caller
+	static std::unique_ptr<Image> LoadCubemap(const char* path,
+		VmaAllocator& allocator,
+		VkDevice& logicalDevice,
+		const VkCommandPool& commandPool,
+		const VkQueue& graphicsQueue);
+
+private:
+	// 立方体某个面上一个像素中心对应的方向（没有归一化），和Vulkan选择立方体面的规则一致
+	static vec3 FaceTexelDirection(const uint32_t& face, const float& x, const float& y, const uint32_t& faceSize);
+};
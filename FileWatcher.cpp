@@ -0,0 +1,258 @@
+﻿#include "FileWatcher.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+FileWatcher::FileWatcher(const std::vector<std::string>& directories)
+{
+	for (const auto& directory : directories)
+	{
+		const std::string normalized = NormalizePath(directory);
+		std::error_code error;
+		if (std::filesystem::is_directory(normalized, error))
+		{
+			mDirectories.push_back(normalized);
+		}
+	}
+
+#ifdef _WIN32
+	mStopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+#endif
+	mWatchThread = std::thread(&FileWatcher::WatchLoop, this);
+}
+
+FileWatcher::~FileWatcher()
+{
+	mStop = true;
+#ifdef _WIN32
+	SetEvent(static_cast<HANDLE>(mStopEvent));
+#endif
+	if (mWatchThread.joinable())
+	{
+		mWatchThread.join();
+	}
+#ifdef _WIN32
+	CloseHandle(static_cast<HANDLE>(mStopEvent));
+#endif
+}
+
+std::vector<std::string> FileWatcher::PollChanges()
+{
+	const auto now = std::chrono::steady_clock::now();
+	std::vector<std::string> changes;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (auto it = mPendingChanges.begin(); it != mPendingChanges.end();)
+	{
+		if (now - it->second >= DEBOUNCE_TIME)
+		{
+			changes.push_back(it->first);
+			it = mPendingChanges.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	return changes;
+}
+
+std::string FileWatcher::NormalizePath(const std::string& path)
+{
+	// 场景文件和代码里的路径用的是反斜杠，Linux上反斜杠不是分隔符，先统一换掉
+	std::string result = path;
+	std::replace(result.begin(), result.end(), '\\', '/');
+	result = std::filesystem::absolute(result).lexically_normal().generic_string();
+#ifdef _WIN32
+	// Windows的路径不区分大小写
+	std::transform(result.begin(), result.end(), result.begin(), [](const unsigned char c) { return static_cast<char>(std::tolower(c)); });
+#endif
+	return result;
+}
+
+void FileWatcher::AddChange(const std::string& path)
+{
+	const std::string normalized = NormalizePath(path);
+	std::error_code error;
+	if (std::filesystem::is_directory(normalized, error))
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mPendingChanges[normalized] = std::chrono::steady_clock::now();
+}
+
+#ifdef _WIN32
+void FileWatcher::WatchLoop()
+{
+	struct Watch
+	{
+		std::string directory;
+		HANDLE handle = INVALID_HANDLE_VALUE;
+		OVERLAPPED overlapped = {};
+		// ReadDirectoryChangesW要求DWORD对齐，new出来的内存满足这个要求
+		std::vector<uint8_t> buffer = std::vector<uint8_t>(64 * 1024);
+	};
+
+	constexpr DWORD NOTIFY_FILTER = FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE;
+
+	std::vector<Watch> watches(mDirectories.size());
+	std::vector<HANDLE> waitHandles;
+	for (size_t i = 0; i < mDirectories.size(); i++)
+	{
+		auto& watch = watches[i];
+		watch.directory = mDirectories[i];
+		watch.handle = CreateFileA(watch.directory.c_str(),
+			FILE_LIST_DIRECTORY,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			nullptr,
+			OPEN_EXISTING,
+			FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+			nullptr);
+		watch.overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+		if (watch.handle == INVALID_HANDLE_VALUE
+			|| !ReadDirectoryChangesW(watch.handle, watch.buffer.data(), static_cast<DWORD>(watch.buffer.size()), TRUE, NOTIFY_FILTER, nullptr, &watch.overlapped, nullptr))
+		{
+			std::cerr << "Failed to watch " << watch.directory << std::endl;
+		}
+		waitHandles.push_back(watch.overlapped.hEvent);
+	}
+	waitHandles.push_back(static_cast<HANDLE>(mStopEvent));
+
+	while (!mStop)
+	{
+		const DWORD signaled = WaitForMultipleObjects(static_cast<DWORD>(waitHandles.size()), waitHandles.data(), FALSE, INFINITE);
+		if (signaled < WAIT_OBJECT_0 || signaled >= WAIT_OBJECT_0 + watches.size())
+		{
+			break;
+		}
+
+		auto& watch = watches[signaled - WAIT_OBJECT_0];
+		DWORD bytes = 0;
+		if (GetOverlappedResult(watch.handle, &watch.overlapped, &bytes, FALSE) && bytes > 0)
+		{
+			// 缓冲区里是一串变长的FILE_NOTIFY_INFORMATION
+			const auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(watch.buffer.data());
+			while (true)
+			{
+				if (info->Action != FILE_ACTION_REMOVED && info->Action != FILE_ACTION_RENAMED_OLD_NAME)
+				{
+					const std::wstring name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+					AddChange((std::filesystem::path(watch.directory) / name).string());
+				}
+				if (info->NextEntryOffset == 0)
+				{
+					break;
+				}
+				info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(reinterpret_cast<const uint8_t*>(info) + info->NextEntryOffset);
+			}
+		}
+
+		ResetEvent(watch.overlapped.hEvent);
+		ReadDirectoryChangesW(watch.handle, watch.buffer.data(), static_cast<DWORD>(watch.buffer.size()), TRUE, NOTIFY_FILTER, nullptr, &watch.overlapped, nullptr);
+	}
+
+	for (auto& watch : watches)
+	{
+		if (watch.handle != INVALID_HANDLE_VALUE)
+		{
+			CancelIoEx(watch.handle, &watch.overlapped);
+			GetOverlappedResult(watch.handle, &watch.overlapped, nullptr, TRUE);
+			CloseHandle(watch.handle);
+		}
+		CloseHandle(watch.overlapped.hEvent);
+	}
+}
+#elif defined(__linux__)
+void FileWatcher::WatchLoop()
+{
+	const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+	{
+		std::cerr << "Failed to initialize inotify, hot reload is disabled." << std::endl;
+		return;
+	}
+
+	// inotify不会递归，每个子目录单独监视
+	constexpr uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+	std::unordered_map<int, std::string> watchDirectories;
+	const auto addWatch = [&](const std::string& directory)
+	{
+		const int wd = inotify_add_watch(fd, directory.c_str(), WATCH_MASK);
+		if (wd >= 0)
+		{
+			watchDirectories[wd] = directory;
+		}
+	};
+	for (const auto& directory : mDirectories)
+	{
+		addWatch(directory);
+		std::error_code error;
+		for (const auto& entry : std::filesystem::recursive_directory_iterator(directory, error))
+		{
+			if (entry.is_directory())
+			{
+				addWatch(entry.path().generic_string());
+			}
+		}
+	}
+
+	alignas(inotify_event) char buffer[16 * 1024];
+	while (!mStop)
+	{
+		// 定时醒来检查是否需要退出
+		pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 100) <= 0)
+		{
+			continue;
+		}
+
+		const ssize_t length = read(fd, buffer, sizeof(buffer));
+		for (ssize_t offset = 0; offset < length;)
+		{
+			const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+			offset += sizeof(inotify_event) + event->len;
+
+			const auto directory = watchDirectories.find(event->wd);
+			if (directory == watchDirectories.end() || event->len == 0)
+			{
+				continue;
+			}
+			const std::string path = directory->second + "/" + event->name;
+			if (event->mask & IN_ISDIR)
+			{
+				if (event->mask & (IN_CREATE | IN_MOVED_TO))
+				{
+					addWatch(path);
+				}
+				continue;
+			}
+			// 新建的空文件等写完（IN_CLOSE_WRITE）再报告
+			if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+			{
+				AddChange(path);
+			}
+		}
+	}
+
+	close(fd);
+}
+#else
+void FileWatcher::WatchLoop()
+{
+	std::cerr << "File watching is not supported on this platform, hot reload is disabled." << std::endl;
+}
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Watches directory trees for modified files on a background thread
+ * (ReadDirectoryChangesW on Windows, inotify on Linux).
+ * Editors often write a file in several steps, so a path is only reported once it has been quiet for a moment.
+ */
+class FileWatcher
+{
+public:
+	explicit FileWatcher(const std::vector<std::string>& directories);
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	// Files that changed since the last call, as NormalizePath returns them
+	std::vector<std::string> PollChanges();
+
+	// Absolute path with forward slashes (lower case on Windows), so paths from the scene and from the watcher compare equal
+	static std::string NormalizePath(const std::string& path);
+
+private:
+	// 最后一次改动之后安静这么久才报告
+	static constexpr std::chrono::milliseconds DEBOUNCE_TIME{ 250 };
+
+	void WatchLoop();
+	void AddChange(const std::string& path);
+
+	std::vector<std::string> mDirectories;
+	std::thread mWatchThread;
+	std::atomic<bool> mStop = false;
+
+	std::mutex mMutex;
+	std::unordered_map<std::string, std::chrono::steady_clock::time_point> mPendingChanges;
+
+	// Windows上用来唤醒监视线程的事件
+	void* mStopEvent = nullptr;
+};
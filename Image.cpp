@@ -1,11 +1,56 @@
 #include "Image.h"
 
 #include "Common.h"
+#include <algorithm>
+#include <cmath>
 #include <string>
+#include <glm/gtc/packing.hpp>
 
 #include "Buffer.h"
+#include "Device.h"
+#include "Ktx2File.h"
+#include "TextureCooker.h"
 #include "VKRTApp.h"
 
+// MSVC没有__F16C__，只在/arch:AVX2的时候定义__AVX2__，x64的工程配置里打开了
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+#if defined(__F16C__) || defined(__AVX2__)
+#define IMAGE_F16C 1
+#include <immintrin.h>
+#endif
+#endif
+
+namespace
+{
+    // HDR贴图存成半精度，显存和带宽都只要一半，而且所有显卡都能对R16G16B16A16_SFLOAT做线性过滤和Blit
+    void ConvertFloatToHalf(const float* src, uint16_t* dst, const size_t& count)
+    {
+        size_t i = 0;
+#ifdef IMAGE_F16C
+        // 一次转换一个像素的4个通道
+        for (; i + 4 <= count; i += 4)
+        {
+            const __m128i half = _mm_cvtps_ph(_mm_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), half);
+        }
+#endif
+        for (; i < count; i++)
+        {
+            dst[i] = glm::packHalf1x16(src[i]);
+        }
+    }
+}
+
+DecodedLevel DecodedLevel::FromVector(std::vector<uint8_t>&& bytes)
+{
+    auto owner = std::make_shared<std::vector<uint8_t>>(std::move(bytes));
+    DecodedLevel level;
+    level.size = owner->size();
+    // 别名构造：指向数据，但引用计数管的是整个vector
+    level.data = std::shared_ptr<const uint8_t>(owner, owner->data());
+    return level;
+}
+
 Image::Image(VmaAllocator& allocator, VkDevice& logicalDevice, const VkFormat& format):
 	mLogicalDevice(logicalDevice),
 	mAllocator(allocator),
@@ -16,15 +61,20 @@ Image::Image(VmaAllocator& allocator, VkDevice& logicalDevice, const VkFormat& f
 
 
 VkResult Image::Create(const VkImageType& imageType, const VkExtent3D& extent,
-                       const VkImageTiling& tiling, const VkImageUsageFlags& usage, const VkMemoryPropertyFlags& memoryProperties)
+                       const VkImageTiling& tiling, const VkImageUsageFlags& usage, const VkMemoryPropertyFlags& memoryProperties,
+                       const uint32_t& mipLevels, const uint32_t& arrayLayers, const VkImageCreateFlags& flags)
 {
+    mMipLevels = mipLevels;
+    mExtent = extent;
+
     VkImageCreateInfo imageCreateInfo = {};
     imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCreateInfo.flags = flags;
     imageCreateInfo.imageType = imageType;
     imageCreateInfo.format = mFormat;
     imageCreateInfo.extent = extent;
-    imageCreateInfo.mipLevels = 1;
-    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.mipLevels = mMipLevels;
+    imageCreateInfo.arrayLayers = arrayLayers;
     imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageCreateInfo.tiling = tiling;
     imageCreateInfo.usage = usage;
@@ -34,11 +84,7 @@ VkResult Image::Create(const VkImageType& imageType, const VkExtent3D& extent,
     VmaAllocationCreateInfo allocationCreateInfo = {};
     allocationCreateInfo.usage = VMA_MEMORY_USAGE_AUTO;
 
-    auto error = vmaCreateImage(mAllocator, &imageCreateInfo, &allocationCreateInfo, &mImage, &mAllocation, nullptr);
-    if (error != VK_SUCCESS)
-    {
-        return error;
-    }
+    return vmaCreateImage(mAllocator, &imageCreateInfo, &allocationCreateInfo, &mImage, &mAllocation, nullptr);
 }
 
 VkResult Image::MapMemory(void** data)
@@ -59,20 +105,25 @@ void Image::UploadData(void* data, const VkDeviceSize& size)
     UnmapMemory();
 }
 
-bool Image::LoadImageFromFile(const char* path,
-	    const VkCommandPool& commandPool,
-	    const VkQueue& graphicsQueue,
-		const VkImageUsageFlags& usage, const VkMemoryPropertyFlags& memoryProperties,
-		const VkImageType& imageType,
-		const VkImageTiling& tiling)
+bool Image::DecodeFile(const char* path,
+    const bool& srgb,
+    const bool& allowCompressed,
+    const bool& generateMipmaps,
+    DecodedImage& decoded)
 {
-#pragma region ȴļȡͼƬ
+    // 有离线烘焙好的块压缩贴图就直接用，比源文件旧或者显卡不支持这个格式的时候还是读源文件
+    if (allowCompressed && TextureCooker::IsCookedUpToDate(path) && DecodeKtx2File(TextureCooker::GetCookedPath(path).c_str(), decoded, srgb))
+    {
+        return true;
+    }
+
+#pragma region 首先从文件读取图片数据
     int width, height, channels;
     bool textureHDR = false;
     stbi_uc* imageData = nullptr;
 
     std::string fileNameString(path);
-    const std::string extension = fileNameString.substr(fileNameString.length() - 3);
+    const std::string extension = fileNameString.length() >= 3 ? fileNameString.substr(fileNameString.length() - 3) : "";
 
     if (extension == "hdr") 
     {
@@ -86,129 +137,328 @@ bool Image::LoadImageFromFile(const char* path,
 
     if (!imageData)
     {
+        textureHDR = false;
         imageData = stbi_load(DEFAULT_TEXTURE_DIR"error.png", &width, &height, &channels, STBI_rgb_alpha);
     }
-    // ȡʧ
+    // 如果读取失败
     if (!imageData)
     {
         return false;
     }
 #pragma endregion
 
-    if (imageData) 
+    // 图片按文件里的RGBA顺序直接上传，不再交换通道
+    const size_t texelCount = static_cast<size_t>(width) * height;
+    decoded.levels.assign(1, DecodedLevel());
+    if (textureHDR)
+    {
+        // 浮点数据只能转换成半精度，这是唯一需要逐像素处理的情况
+        std::vector<uint8_t> halfPixels(texelCount * sizeof(uint16_t[4]));
+        ConvertFloatToHalf(reinterpret_cast<const float*>(imageData), reinterpret_cast<uint16_t*>(halfPixels.data()), texelCount * 4);
+        stbi_image_free(imageData);
+        decoded.levels.front() = DecodedLevel::FromVector(std::move(halfPixels));
+        decoded.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+    }
+    else
+    {
+        // 8位的数据不用拷贝，上传之前一直由stb_image的内存持有
+        decoded.levels.front().data = std::shared_ptr<const uint8_t>(imageData, stbi_image_free);
+        decoded.levels.front().size = texelCount * sizeof(uint8_t[4]);
+        // 颜色贴图是sRGB编码的，采样的时候由硬件转换成线性值
+        decoded.format = srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    }
+
+    decoded.width = static_cast<uint32_t>(width);
+    decoded.height = static_cast<uint32_t>(height);
+    decoded.generateMipmaps = generateMipmaps;
+    return true;
+}
+
+bool Image::DecodeKtx2File(const char* path, DecodedImage& decoded, const bool& srgb)
+{
+    Ktx2Image ktx;
+    if (!Ktx2File::Read(path, ktx))
+    {
+        return false;
+    }
+
+    // 以前烘焙的颜色贴图标的是UNORM，块里面存的其实就是sRGB的值，换成对应的sRGB格式就行
+    if (srgb && ktx.format == VK_FORMAT_BC1_RGB_UNORM_BLOCK)
+    {
+        ktx.format = VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+    }
+    else if (srgb && ktx.format == VK_FORMAT_BC7_UNORM_BLOCK)
+    {
+        ktx.format = VK_FORMAT_BC7_SRGB_BLOCK;
+    }
+
+    // 没有开启textureCompressionBC的显卡不能采样BC格式
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(Device::GetPhysicalDevice(), ktx.format, &formatProperties);
+    if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+    {
+        return false;
+    }
+
+    decoded.format = ktx.format;
+    decoded.width = ktx.width;
+    decoded.height = ktx.height;
+    decoded.levels.clear();
+    for (auto& level : ktx.levels)
+    {
+        decoded.levels.push_back(DecodedLevel::FromVector(std::move(level)));
+    }
+    decoded.generateMipmaps = false;
+    return true;
+}
+
+VkResult Image::RecordUpload(VkCommandBuffer commandBuffer,
+    const DecodedImage& decoded,
+    Buffer& stagingBuffer,
+    const VkImageUsageFlags& usage,
+    const VkMemoryPropertyFlags& memoryProperties,
+    const VkImageType& imageType,
+    const VkImageTiling& tiling)
+{
+    mFormat = decoded.format;
+
+    // 申请一个临时的Staging Buffer，所有Mip放在一起，每一级一个拷贝区域
+    VkDeviceSize stagingSize = 0;
+    std::vector<VkBufferImageCopy> regions(decoded.levels.size());
+    for (uint32_t level = 0; level < decoded.levels.size(); level++)
+    {
+        regions[level] = {};
+        regions[level].bufferOffset = stagingSize;
+        regions[level].imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+        regions[level].imageExtent = { std::max(decoded.width >> level, 1u), std::max(decoded.height >> level, 1u), 1 };
+        stagingSize += decoded.levels[level].size;
+    }
+    RETURN_IF_NOT_SUCCESS(stagingBuffer.CreateBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT));
+    auto* staging = static_cast<uint8_t*>(stagingBuffer.Map());
+    for (uint32_t level = 0; level < decoded.levels.size(); level++)
     {
-        // ΪߵԿʾʽBGRAPIȡĸʽRGBҪһ˳
-        const int bpp = textureHDR ? sizeof(float[4]) : sizeof(uint8_t[4]);
-        VkDeviceSize imageSize = static_cast<VkDeviceSize>(width * height * bpp);
+        std::memcpy(staging + regions[level].bufferOffset, decoded.levels[level].data.get(), decoded.levels[level].size);
+    }
+    stagingBuffer.Unmap();
 
-        for (size_t i = 0; i < width * height; i ++)
+    // 文件里没有Mip的话，完整的Mip链用Blit一级一级缩小生成，需要这个格式支持Blit和线性过滤
+    uint32_t mipLevels = static_cast<uint32_t>(decoded.levels.size());
+    if (mipLevels == 1 && decoded.generateMipmaps && tiling == VK_IMAGE_TILING_OPTIMAL)
+    {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(Device::GetPhysicalDevice(), mFormat, &formatProperties);
+        const VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT
+            | VK_FORMAT_FEATURE_BLIT_DST_BIT
+            | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        if ((formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures)
         {
-            std::swap(imageData[i * 4], imageData[i * 4 + 2]);
+            mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(decoded.width, decoded.height)))) + 1;
         }
-        // һʱStaging Buffer
-        Buffer stagingBuffer(mAllocator);
-        VkResult error = stagingBuffer.CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
-        if (VK_SUCCESS == error) 
+    }
+    const bool blitMips = mipLevels > decoded.levels.size();
+    const VkImageUsageFlags mipUsage = blitMips ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0;
+
+    // 调用刚刚写的方法创建VkImage
+    const VkExtent3D imageExtent{ decoded.width, decoded.height, 1 };
+    RETURN_IF_NOT_SUCCESS(Create(imageType, imageExtent, tiling, usage | mipUsage | VK_IMAGE_USAGE_TRANSFER_DST_BIT, memoryProperties, mipLevels));
+
+    // 这里创建一个内存屏障，实际上这里并没有用这个来做多线程同步而是用来转换图片格式
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED; // 我们不需要关心源格式是什么
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL; // 首先指定图片的格式是“传输目的地”格式
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = mImage;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mMipLevels, 0, 1 };
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    // 将刚刚创建的图片通过上面定义的Barrier拷贝到刚刚创建的VkImage那里
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffer.GetVkBuffer(), mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(regions.size()), regions.data());
+
+    if (!blitMips)
+    {
+        // 所有Mip都是从文件拷贝过来的，直接转换为Shader可读格式
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        return VK_SUCCESS;
+    }
+
+    // 生成Mip：每一级从上一级线性过滤缩小一半，上一级先转换成“传输源”格式
+    int32_t mipWidth = static_cast<int32_t>(decoded.width);
+    int32_t mipHeight = static_cast<int32_t>(decoded.height);
+    for (uint32_t level = 1; level < mMipLevels; level++)
+    {
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 1, 0, 1 };
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        const int32_t nextWidth = std::max(mipWidth / 2, 1);
+        const int32_t nextHeight = std::max(mipHeight / 2, 1);
+        VkImageBlit blit = {};
+        blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1 };
+        blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
+        blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+        blit.dstOffsets[1] = { nextWidth, nextHeight, 1 };
+        vkCmdBlitImage(commandBuffer,
+            mImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1, &blit, VK_FILTER_LINEAR);
+
+        mipWidth = nextWidth;
+        mipHeight = nextHeight;
+    }
+
+    // 之后将图片转换为Shader可读格式：前面几级是“传输源”，最后一级还是“传输目的地”
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mMipLevels - 1, 0, 1 };
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, mMipLevels - 1, 1, 0, 1 };
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    // 开始转换
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    return VK_SUCCESS;
+}
+
+VkResult Image::RecordMipTailCopy(VkCommandBuffer commandBuffer, const Image& source, const uint32_t& firstMip)
+{
+    assert(firstMip < source.mMipLevels);
+    mFormat = source.mFormat;
+    const VkExtent3D extent = {
+        std::max(source.mExtent.width >> firstMip, 1u),
+        std::max(source.mExtent.height >> firstMip, 1u),
+        1
+    };
+    RETURN_IF_NOT_SUCCESS(Create(VK_IMAGE_TYPE_2D, extent, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, source.mMipLevels - firstMip));
+
+    // 源图片只有要拷贝的那几级转换成“传输源”，新图片整个转换成“传输目的地”
+    const VkImageSubresourceRange sourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, firstMip, mMipLevels, 0, 1 };
+    const VkImageSubresourceRange targetRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mMipLevels, 0, 1 };
+    ImageBarrier(commandBuffer, source.mImage, sourceRange,
+        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    ImageBarrier(commandBuffer, mImage, targetRange,
+        0, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    // 每一级原样拷贝，块压缩的格式也一样（最后几级不满一个块的时候正好到图片边缘）
+    std::vector<VkImageCopy> regions(mMipLevels);
+    for (uint32_t level = 0; level < mMipLevels; level++)
+    {
+        regions[level] = {};
+        regions[level].srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, firstMip + level, 0, 1 };
+        regions[level].dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+        regions[level].extent = { std::max(extent.width >> level, 1u), std::max(extent.height >> level, 1u), 1 };
+    }
+    vkCmdCopyImage(commandBuffer,
+        source.mImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(regions.size()), regions.data());
+
+    ImageBarrier(commandBuffer, source.mImage, sourceRange,
+        VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    ImageBarrier(commandBuffer, mImage, targetRange,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    return VK_SUCCESS;
+}
+
+bool Image::LoadImageFromFile(const char* path,
+	    const VkCommandPool& commandPool,
+	    const VkQueue& graphicsQueue,
+		const VkImageUsageFlags& usage, const VkMemoryPropertyFlags& memoryProperties,
+		const VkImageType& imageType,
+		const VkImageTiling& tiling,
+		const bool& generateMipmaps)
+{
+    DecodedImage decoded;
+    const bool allowCompressed = tiling == VK_IMAGE_TILING_OPTIMAL && imageType == VK_IMAGE_TYPE_2D;
+    if (!DecodeFile(path, true, allowCompressed, generateMipmaps, decoded))
+    {
+        return false;
+    }
+    return UploadDecoded(decoded, commandPool, graphicsQueue, usage, memoryProperties, imageType, tiling);
+}
+
+bool Image::LoadKtx2FromFile(const char* path,
+    const VkCommandPool& commandPool,
+    const VkQueue& graphicsQueue,
+    const VkImageUsageFlags& usage,
+    const VkMemoryPropertyFlags& memoryProperties)
+{
+    DecodedImage decoded;
+    if (!DecodeKtx2File(path, decoded))
+    {
+        return false;
+    }
+    return UploadDecoded(decoded, commandPool, graphicsQueue, usage, memoryProperties, VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_OPTIMAL);
+}
+
+bool Image::UploadDecoded(const DecodedImage& decoded,
+    const VkCommandPool& commandPool,
+    const VkQueue& graphicsQueue,
+    const VkImageUsageFlags& usage,
+    const VkMemoryPropertyFlags& memoryProperties,
+    const VkImageType& imageType,
+    const VkImageTiling& tiling)
+{
+    Buffer stagingBuffer(mAllocator);
+    const VkResult error = DoOneTimeCommand(mLogicalDevice, commandPool, graphicsQueue, [&](VkCommandBuffer& commandBuffer)
+    {
+        return RecordUpload(commandBuffer, decoded, stagingBuffer, usage, memoryProperties, imageType, tiling);
+    });
+    // 释放临时的Staging Buffer
+    stagingBuffer.Free();
+    return error == VK_SUCCESS;
+}
+
+VkResult Image::CreateTextureViewAndSampler(VkSamplerAddressMode addressMode)
+{
+    RETURN_IF_NOT_SUCCESS(CreateTextureView());
+    return CreateSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR, addressMode);
+}
+
+VkResult Image::CreateTextureView()
+{
+    return CreateImageView(VK_IMAGE_VIEW_TYPE_2D,
+        VkImageSubresourceRange
         {
-            // ͼƬϴBufferϣʱѾͷͼƬ
-            stagingBuffer.UploadData(imageData, imageSize);
-            stbi_image_free(imageData);
-
-            VkExtent3D imageExtent{
-                static_cast<uint32_t>(width),
-                static_cast<uint32_t>(height),
-                1
-            };
-            // øոдķVkImage
-            auto error = Create(imageType, imageExtent, tiling, usage, memoryProperties);
-            if (error != VK_SUCCESS)
-            {
-                return false;
-            }
-
-#pragma region CommandPoolһCommandBuffer
-            VkCommandBufferAllocateInfo allocInfo = {};
-            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-            allocInfo.commandPool = commandPool;
-            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-            allocInfo.commandBufferCount = 1;
-
-            VkCommandBuffer commandBuffer;
-            error = vkAllocateCommandBuffers(mLogicalDevice, &allocInfo, &commandBuffer);
-            if (VK_SUCCESS != error) {
-                return false;
-            }
-#pragma endregion
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = VK_REMAINING_MIP_LEVELS,
+            .baseArrayLayer = 0,
+            .layerCount = VK_REMAINING_ARRAY_LAYERS,
+        });
+}
 
-            VkCommandBufferBeginInfo beginInfo = {};
-            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-            error = vkBeginCommandBuffer(commandBuffer, &beginInfo);
-            if (VK_SUCCESS != error) {
-                vkFreeCommandBuffers(mLogicalDevice, commandPool, 1, &commandBuffer);
-                return false;
-            }
-
-            // ﴴһڴϣʵﲢû߳ͬתͼƬʽ
-            VkImageMemoryBarrier barrier = {};
-            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;;
-            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED; // ǲҪԴʽʲô
-            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL; // ָͼƬĸʽǡĿĵءʽ
-            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            barrier.image = mImage;
-            barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-
-            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-            VkBufferImageCopy region = {};
-            region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-            region.imageExtent = imageExtent;
-            // ոմͼƬͨ涨BarrierոմVkImage
-            vkCmdCopyBufferToImage(commandBuffer, stagingBuffer.GetVkBuffer(), mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-            // ֮ͼƬתΪShaderɶʽ
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            // ʼת
-            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-            error = vkEndCommandBuffer(commandBuffer);
-            if (VK_SUCCESS != error) {
-                vkFreeCommandBuffers(mLogicalDevice, commandPool, 1, &commandBuffer);
-                return false;
-            }
-
-            VkSubmitInfo submitInfo = {};
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &commandBuffer;
-            // CommandBuffer
-            error = vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-            if (VK_SUCCESS != error) {
-                vkFreeCommandBuffers(mLogicalDevice, commandPool, 1, &commandBuffer);
-                return false;
-            }
-            // ȴͼƬ
-            error = vkQueueWaitIdle(graphicsQueue);
-            if (VK_SUCCESS != error) {
-                vkFreeCommandBuffers(mLogicalDevice, commandPool, 1, &commandBuffer);
-                return false;
-            }
-            // ͷʱStaging Buffer
-            stagingBuffer.Free();
-            // ͷCommandBuffer
-            vkFreeCommandBuffers(mLogicalDevice, commandPool, 1, &commandBuffer);
-        }
-        else {
-            stbi_image_free(imageData);
-        }
+void Image::SetSampler(VkSampler sampler)
+{
+    // 共享的Sampler不归这张图片管，Dispose的时候不销毁
+    if (mSamplerCreated)
+    {
+        vkDestroySampler(mLogicalDevice, mSampler, VK_NULL_HANDLE);
+        mSamplerCreated = false;
     }
-    return true;
+    mSampler = sampler;
 }
 
 VkResult Image::CreateImageView(VkImageViewType viewType, VkImageSubresourceRange subresourceRange)
@@ -245,7 +495,8 @@ VkResult Image::CreateSampler(VkFilter magFilter, VkFilter minFilter, VkSamplerM
     samplerCreateInfo.compareEnable = VK_FALSE;
     samplerCreateInfo.compareOp = VK_COMPARE_OP_ALWAYS;
     samplerCreateInfo.minLod = 0;
-    samplerCreateInfo.maxLod = 0;
+    // 整条Mip链都可以用，具体用哪一级由Shader里面的光锥决定
+    samplerCreateInfo.maxLod = static_cast<float>(mMipLevels);
     samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
     samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
 
@@ -277,6 +528,17 @@ void Image::ImageBarrier(VkCommandBuffer commandBuffer, VkImage image, const VkI
         &imageMemoryBarrier);
 }
 
+VkDeviceSize Image::GetMemorySize() const
+{
+    if (mAllocation == VK_NULL_HANDLE)
+    {
+        return 0;
+    }
+    VmaAllocationInfo allocationInfo;
+    vmaGetAllocationInfo(mAllocator, mAllocation, &allocationInfo);
+    return allocationInfo.size;
+}
+
 void Image::Dispose()
 {
     if (mSamplerCreated)
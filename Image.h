@@ -1,9 +1,33 @@
 #pragma once
 
+#include <memory>
+
 #include "Common.h"
 
 #define DEFAULT_TEX_DIR "textures\\"
 
+// One mip level of a DecodedImage. The bytes may still be owned by the decoder (stb_image), so uploading them needs no extra copy.
+struct DecodedLevel
+{
+	std::shared_ptr<const uint8_t> data;
+	size_t size = 0;
+
+	static DecodedLevel FromVector(std::vector<uint8_t>&& bytes);
+};
+
+// CPU-side result of decoding an image file. Producing it does not touch the device queues,
+// so textures can be decoded on worker threads and uploaded later.
+struct DecodedImage
+{
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	// 烘焙过的KTX2带着整条Mip链，其它的只有第0级
+	std::vector<DecodedLevel> levels;
+	// 只有第0级的时候在GPU上用Blit生成剩下的Mip
+	bool generateMipmaps = true;
+};
+
 class Image
 {
 public:
@@ -11,7 +35,10 @@ public:
 		const VkExtent3D& extent,
 		const VkImageTiling& tiling,
 		const VkImageUsageFlags& usage,
-		const VkMemoryPropertyFlags& memoryProperties);
+		const VkMemoryPropertyFlags& memoryProperties,
+		const uint32_t& mipLevels = 1,
+		const uint32_t& arrayLayers = 1,
+		const VkImageCreateFlags& flags = 0);
 	Image(VmaAllocator& allocator,
 		VkDevice& logicalDevice,
 		const VkFormat& format = VK_FORMAT_B8G8R8A8_UNORM);
@@ -21,7 +48,53 @@ public:
 	VkResult MapMemory(void** data);
 	void UnmapMemory();
 	void UploadData(void* data, const VkDeviceSize& size);
+	// Loads a colour texture; the image takes the format DecodeFile picks for the file, not the one given to the constructor.
 	bool LoadImageFromFile(const char* path,
+		const VkCommandPool& commandPool,
+		const VkQueue& graphicsQueue,
+		const VkImageUsageFlags& usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		const VkMemoryPropertyFlags& memoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		const VkImageType& imageType = VK_IMAGE_TYPE_2D,
+		const VkImageTiling& tiling = VK_IMAGE_TILING_OPTIMAL,
+		const bool& generateMipmaps = true);
+	// Uploads the blocks and mips of a cooked KTX2 file as they are; the image takes the format of the file.
+	// Returns false when the file cannot be read or the device cannot sample its format.
+	bool LoadKtx2FromFile(const char* path,
+		const VkCommandPool& commandPool,
+		const VkQueue& graphicsQueue,
+		const VkImageUsageFlags& usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		const VkMemoryPropertyFlags& memoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	/*
+	 * Reads an image file into memory without touching the device queues; safe to call from several threads.
+	 * An up-to-date cooked KTX2 next to the file is used instead when allowCompressed is set and the device can sample it.
+	 * Images keep the channel order of the file: 8 bit files become R8G8B8A8_SRGB (R8G8B8A8_UNORM when srgb is false,
+	 * for data such as normal maps) and .hdr files R16G16B16A16_SFLOAT. A file that cannot be read decodes as the error texture.
+	 */
+	static bool DecodeFile(const char* path,
+		const bool& srgb,
+		const bool& allowCompressed,
+		const bool& generateMipmaps,
+		DecodedImage& decoded);
+	static bool DecodeKtx2File(const char* path, DecodedImage& decoded, const bool& srgb = true);
+
+	// Creates the image and records its upload (and mip generation) into commandBuffer.
+	// stagingBuffer is filled here and has to be kept until the commands have completed.
+	VkResult RecordUpload(VkCommandBuffer commandBuffer,
+		const DecodedImage& decoded,
+		Buffer& stagingBuffer,
+		const VkImageUsageFlags& usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		const VkMemoryPropertyFlags& memoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		const VkImageType& imageType = VK_IMAGE_TYPE_2D,
+		const VkImageTiling& tiling = VK_IMAGE_TILING_OPTIMAL);
+	/*
+	 * Creates this image from mips [firstMip, mip count) of source, so mip firstMip becomes mip 0, and records the copy.
+	 * source has to be a sampled texture created with TRANSFER_SRC usage; both images end up shader readable.
+	 * Used to give memory back under pressure without reading the file again.
+	 */
+	VkResult RecordMipTailCopy(VkCommandBuffer commandBuffer, const Image& source, const uint32_t& firstMip);
+	// RecordUpload in a one-time command buffer, waiting for it to complete
+	bool UploadDecoded(const DecodedImage& decoded,
 		const VkCommandPool& commandPool,
 		const VkQueue& graphicsQueue,
 		const VkImageUsageFlags& usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
@@ -32,6 +105,11 @@ public:
 	VkResult CreateImageView(VkImageViewType viewType, VkImageSubresourceRange subresourceRange);
 
 	VkResult CreateSampler(VkFilter magFilter, VkFilter minFilter, VkSamplerMipmapMode mipmapMode, VkSamplerAddressMode addressMode);
+	// 2D view of the whole mip chain and a trilinear sampler, what every material texture uses
+	VkResult CreateTextureViewAndSampler(VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT);
+	VkResult CreateTextureView();
+	// Uses a sampler owned by someone else (a SamplerCache); Dispose leaves it alone
+	void SetSampler(VkSampler sampler);
 
 	static void ImageBarrier(VkCommandBuffer commandBuffer,
 		VkImage image,
@@ -59,16 +137,40 @@ public:
 		return mSampler;
 	}
 
+	[[nodiscard]]
+	uint32_t GetMipLevels() const
+	{
+		return mMipLevels;
+	}
+
+	[[nodiscard]]
+	const VkExtent3D& GetExtent() const
+	{
+		return mExtent;
+	}
+
+	[[nodiscard]]
+	VkFormat GetFormat() const
+	{
+		return mFormat;
+	}
+
+	// Bytes of device memory bound to the image, 0 before Create
+	[[nodiscard]]
+	VkDeviceSize GetMemorySize() const;
+
 	void Dispose();
 private:
 	VkDevice& mLogicalDevice;
 	VmaAllocator& mAllocator;
 	VkFormat mFormat;
 
-	VkImage mImage;
-	VkImageView mImageView;
-	VkSampler mSampler;
-	VmaAllocation mAllocation;
+	VkImage mImage = VK_NULL_HANDLE;
+	VkImageView mImageView = VK_NULL_HANDLE;
+	VkSampler mSampler = VK_NULL_HANDLE;
+	VmaAllocation mAllocation = VK_NULL_HANDLE;
+	uint32_t mMipLevels = 1;
+	VkExtent3D mExtent = { 0, 0, 0 };
 
 	bool mSamplerCreated = false;
 };
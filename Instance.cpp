@@ -8,9 +8,9 @@ VkInstance& Instance::GetDefaultVkInstance()
 	{
 		return mDefaultInstance;
 	}
-	// ʼVOLK
+	// 初始化VOLK
 	volkInitialize();
-	// ʼӦйصĲעõVulkan汾1.2
+	// 初始化应用有关的参数，注意这里用到的Vulkan版本是1.2
 	VkApplicationInfo appInfo;
 	appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
 	appInfo.pNext = nullptr;
@@ -20,19 +20,19 @@ VkInstance& Instance::GetDefaultVkInstance()
 	appInfo.engineVersion = VK_API_VERSION_1_2;
 	appInfo.apiVersion = VK_API_VERSION_1_2;
 
-	// GLFWҪGLFWȾҪЩչ
+	// 向GLFW请求如果需要在GLFW上面渲染需要哪些扩展
 	uint32_t requiredExtensionsCount = 0;
 	const char** requiredExtensions = glfwGetRequiredInstanceExtensions(&requiredExtensionsCount);
 
 	std::vector<const char*> extensions;
 	std::vector<const char*> layers;
 
-	// VulkanУ
+	// 加载Vulkan的校验层
 	extensions.insert(extensions.begin(), requiredExtensions, requiredExtensions + requiredExtensionsCount);
 
 	extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 	layers.push_back("VK_LAYER_KHRONOS_validation");
-	// VkInstanceҪĲ
+	// 创建VkInstance需要的参数
 	VkInstanceCreateInfo instInfo;
 	instInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	instInfo.pNext = nullptr;
@@ -43,10 +43,10 @@ VkInstance& Instance::GetDefaultVkInstance()
 	instInfo.enabledLayerCount = static_cast<uint32_t>(layers.size());
 	instInfo.ppEnabledLayerNames = layers.data();
 
-	// instanceǷ񴴽ɹ
+	// 创建instance并检查是否创建成功
 	VkResult error = vkCreateInstance(&instInfo, nullptr, &mDefaultInstance);
 	assert(error == VK_SUCCESS);
-	// VOLKinstance
+	// VOLK加载相关instance
 	volkLoadInstance(mDefaultInstance);
 
 	return mDefaultInstance;
@@ -0,0 +1,203 @@
+﻿#include "Ktx2File.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+	constexpr uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	// Khronos Data Format的颜色模型
+	constexpr uint8_t KHR_DF_MODEL_BC1A = 128;
+	constexpr uint8_t KHR_DF_MODEL_BC7 = 135;
+	constexpr uint8_t KHR_DF_PRIMARIES_BT709 = 1;
+	constexpr uint8_t KHR_DF_TRANSFER_LINEAR = 1;
+	constexpr uint8_t KHR_DF_TRANSFER_SRGB = 2;
+
+	struct Ktx2Header
+	{
+		uint8_t identifier[12];
+		uint32_t vkFormat;
+		uint32_t typeSize;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t layerCount;
+		uint32_t faceCount;
+		uint32_t levelCount;
+		uint32_t supercompressionScheme;
+		uint32_t dfdByteOffset;
+		uint32_t dfdByteLength;
+		uint32_t kvdByteOffset;
+		uint32_t kvdByteLength;
+		uint64_t sgdByteOffset;
+		uint64_t sgdByteLength;
+	};
+	static_assert(sizeof(Ktx2Header) == 80, "KTX2 header has to be tightly packed");
+
+	struct Ktx2LevelIndex
+	{
+		uint64_t byteOffset;
+		uint64_t byteLength;
+		uint64_t uncompressedByteLength;
+	};
+
+	// 块压缩格式每块的字节数，其它格式返回0
+	uint32_t GetBlockBytes(const VkFormat& format)
+	{
+		switch (format)
+		{
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+			return 8;
+		case VK_FORMAT_BC7_UNORM_BLOCK:
+		case VK_FORMAT_BC7_SRGB_BLOCK:
+			return 16;
+		default:
+			return 0;
+		}
+	}
+
+	// 写入基本的数据格式描述符（一个描述块，一个样本覆盖整个压缩块）
+	std::vector<uint8_t> BuildDataFormatDescriptor(const VkFormat& format)
+	{
+		const uint32_t blockBytes = GetBlockBytes(format);
+		const bool isBC7 = blockBytes == 16;
+		const bool isSRGB = format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK || format == VK_FORMAT_BC7_SRGB_BLOCK;
+
+		std::vector<uint8_t> dfd(44, 0);
+		const uint32_t totalSize = static_cast<uint32_t>(dfd.size());
+		const uint16_t versionNumber = 2;
+		const uint16_t blockSize = 40;
+		std::memcpy(&dfd[0], &totalSize, 4);
+		// vendorId = 0，descriptorType = 0
+		std::memcpy(&dfd[8], &versionNumber, 2);
+		std::memcpy(&dfd[10], &blockSize, 2);
+		dfd[12] = isBC7 ? KHR_DF_MODEL_BC7 : KHR_DF_MODEL_BC1A;
+		dfd[13] = KHR_DF_PRIMARIES_BT709;
+		dfd[14] = isSRGB ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR;
+		dfd[15] = 0;
+		// 4x4的块，维度存的是“大小减一”
+		dfd[16] = 3;
+		dfd[17] = 3;
+		dfd[20] = static_cast<uint8_t>(blockBytes);
+		// 样本：从第0位开始，长度是整个块
+		dfd[30] = static_cast<uint8_t>(blockBytes * 8 - 1);
+		const uint32_t sampleUpper = UINT32_MAX;
+		std::memcpy(&dfd[40], &sampleUpper, 4);
+		return dfd;
+	}
+
+	uint64_t AlignUp64(const uint64_t value, const uint64_t align)
+	{
+		return (value + align - 1) / align * align;
+	}
+}
+
+bool Ktx2File::Read(const std::string& path, Ktx2Image& image)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+	{
+		return false;
+	}
+	const auto fileSize = static_cast<uint64_t>(file.tellg());
+	file.seekg(0);
+
+	Ktx2Header header;
+	if (fileSize < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+	{
+		return false;
+	}
+	if (std::memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0
+		|| header.supercompressionScheme != 0
+		|| header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth > 1
+		|| header.layerCount > 1 || header.faceCount != 1)
+	{
+		std::cerr << "Unsupported KTX2 file (only plain 2D textures are read): " << path << std::endl;
+		return false;
+	}
+
+	// levelCount为0表示让加载的程序自己生成Mip，这里只读文件里面有的那一级
+	const uint32_t levelCount = std::max(header.levelCount, 1u);
+	std::vector<Ktx2LevelIndex> levelIndex(levelCount);
+	if (!file.read(reinterpret_cast<char*>(levelIndex.data()), sizeof(Ktx2LevelIndex) * levelCount))
+	{
+		return false;
+	}
+
+	image.format = static_cast<VkFormat>(header.vkFormat);
+	image.width = header.pixelWidth;
+	image.height = header.pixelHeight;
+	image.levels.resize(levelCount);
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		const auto& index = levelIndex[level];
+		if (index.byteOffset + index.byteLength > fileSize)
+		{
+			std::cerr << "Truncated KTX2 file: " << path << std::endl;
+			return false;
+		}
+		image.levels[level].resize(index.byteLength);
+		file.seekg(static_cast<std::streamoff>(index.byteOffset));
+		if (!file.read(reinterpret_cast<char*>(image.levels[level].data()), static_cast<std::streamsize>(index.byteLength)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Ktx2File::Write(const std::string& path, const Ktx2Image& image)
+{
+	const uint32_t blockBytes = GetBlockBytes(image.format);
+	if (blockBytes == 0 || image.levels.empty())
+	{
+		return false;
+	}
+
+	const uint32_t levelCount = static_cast<uint32_t>(image.levels.size());
+	const std::vector<uint8_t> dfd = BuildDataFormatDescriptor(image.format);
+
+	Ktx2Header header = {};
+	std::memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+	header.vkFormat = static_cast<uint32_t>(image.format);
+	header.typeSize = 1;
+	header.pixelWidth = image.width;
+	header.pixelHeight = image.height;
+	header.faceCount = 1;
+	header.levelCount = levelCount;
+	header.dfdByteOffset = static_cast<uint32_t>(sizeof(Ktx2Header) + sizeof(Ktx2LevelIndex) * levelCount);
+	header.dfdByteLength = static_cast<uint32_t>(dfd.size());
+
+	// 规范要求Mip按从小到大的顺序存放，每一级按块大小对齐
+	std::vector<Ktx2LevelIndex> levelIndex(levelCount);
+	uint64_t offset = header.dfdByteOffset + header.dfdByteLength;
+	for (uint32_t level = levelCount; level-- > 0;)
+	{
+		offset = AlignUp64(offset, blockBytes);
+		levelIndex[level] = { offset, image.levels[level].size(), image.levels[level].size() };
+		offset += image.levels[level].size();
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		return false;
+	}
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(levelIndex.data()), sizeof(Ktx2LevelIndex) * levelCount);
+	file.write(reinterpret_cast<const char*>(dfd.data()), static_cast<std::streamsize>(dfd.size()));
+	uint64_t written = header.dfdByteOffset + header.dfdByteLength;
+	const char padding[16] = {};
+	for (uint32_t level = levelCount; level-- > 0;)
+	{
+		file.write(padding, static_cast<std::streamsize>(levelIndex[level].byteOffset - written));
+		file.write(reinterpret_cast<const char*>(image.levels[level].data()), static_cast<std::streamsize>(image.levels[level].size()));
+		written = levelIndex[level].byteOffset + levelIndex[level].byteLength;
+	}
+	return static_cast<bool>(file);
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Common.h"
+
+// Uncompressed (supercompressionScheme = 0) 2D KTX2 texture with its mip chain, level 0 first.
+struct Ktx2Image
+{
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<std::vector<uint8_t>> levels;
+};
+
+// Minimal reader / writer for the KTX2 container, only what the texture cooker produces:
+// a single 2D image (no array layers, no cube faces), no supercompression, no key/value data.
+class Ktx2File
+{
+public:
+	static bool Read(const std::string& path, Ktx2Image& image);
+	static bool Write(const std::string& path, const Ktx2Image& image);
+};
@@ -0,0 +1,103 @@
+﻿#include "MemoryBudgetManager.h"
+
+#include <algorithm>
+
+MemoryBudgetManager::MemoryBudgetManager(VmaAllocator& allocator, const VkDeviceSize& limitBytes) :
+	mAllocator(allocator),
+	mLimitBytes(limitBytes)
+{
+	PollHeapBudgets();
+}
+
+void MemoryBudgetManager::SetUsage(const MemoryClass& memoryClass, const VkDeviceSize& bytes)
+{
+	mUsage[memoryClass] = bytes;
+}
+
+MemoryBudgetManager::Step MemoryBudgetManager::Update()
+{
+	// VMA按帧号缓存预算，每帧告诉它一次才会重新向驱动查询
+	mFrame++;
+	vmaSetCurrentFrameIndex(mAllocator, mFrame);
+	PollHeapBudgets();
+
+	Step step;
+	if (mDeviceLocalBudget == 0 || mFrame - mLastStepFrame < COOLDOWN_FRAMES)
+	{
+		return step;
+	}
+
+	// 释放的显存到这时候已经反映在用量里了
+	if (mMeasureFreed)
+	{
+		mFreedByStep[mLevel] = mUsageBeforeStep > mDeviceLocalUsage ? mUsageBeforeStep - mDeviceLocalUsage : 0;
+		mMeasureFreed = false;
+	}
+
+	const double high = static_cast<double>(mDeviceLocalBudget) * HIGH_WATERMARK;
+	const double low = static_cast<double>(mDeviceLocalBudget) * LOW_WATERMARK;
+	if (mDeviceLocalUsage > high && mLevel + 1 < PRESSURE_RESPONSE_MAX)
+	{
+		mLevel++;
+		mUsageBeforeStep = mDeviceLocalUsage;
+		mMeasureFreed = true;
+		step.response = static_cast<PressureResponse>(mLevel);
+	}
+	else if (mLevel > 0 && static_cast<double>(mDeviceLocalUsage + mFreedByStep[mLevel]) < low)
+	{
+		// 撤销之后这一级省下的显存又会用回去，加上之后也要低于低水位才撤销，不然会来回切换
+		step.response = static_cast<PressureResponse>(mLevel);
+		step.undo = true;
+		mLevel--;
+	}
+	else
+	{
+		return step;
+	}
+
+	mLastStepFrame = mFrame;
+	std::cout << (step.undo ? "Memory pressure gone, undoing: " : "Memory pressure, ") << GetResponseName(step.response)
+		<< " (" << mDeviceLocalUsage / (1024 * 1024) << " / " << mDeviceLocalBudget / (1024 * 1024) << " MB)" << std::endl;
+	return step;
+}
+
+VkDeviceSize MemoryBudgetManager::GetBudget(const MemoryClass& memoryClass) const
+{
+	return static_cast<VkDeviceSize>(static_cast<double>(mDeviceLocalBudget) * CLASS_SHARES[memoryClass]);
+}
+
+const char* MemoryBudgetManager::GetMemoryClassName(const MemoryClass& memoryClass)
+{
+	static const char* names[MEMORY_CLASS_MAX] = { "Geometry", "Acceleration Structures", "Textures", "Render Targets" };
+	return names[memoryClass];
+}
+
+const char* MemoryBudgetManager::GetResponseName(const PressureResponse& response)
+{
+	static const char* names[PRESSURE_RESPONSE_MAX] = { "none", "drop top texture mips", "shrink geometry budget", "shrink render resolution" };
+	return names[response];
+}
+
+void MemoryBudgetManager::PollHeapBudgets()
+{
+	const VkPhysicalDeviceMemoryProperties* memoryProperties = nullptr;
+	vmaGetMemoryProperties(mAllocator, &memoryProperties);
+	std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets = {};
+	vmaGetHeapBudgets(mAllocator, budgets.data());
+
+	// 独立显卡只看显存堆；集成显卡只有一个同时是DEVICE_LOCAL的堆
+	mDeviceLocalUsage = 0;
+	mDeviceLocalBudget = 0;
+	for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; i++)
+	{
+		if (memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+		{
+			mDeviceLocalUsage += budgets[i].usage;
+			mDeviceLocalBudget += budgets[i].budget;
+		}
+	}
+	if (mLimitBytes > 0)
+	{
+		mDeviceLocalBudget = std::min(mDeviceLocalBudget, mLimitBytes);
+	}
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <array>
+
+#include "Common.h"
+
+// What a block of device memory is used for; every class gets a share of the budget.
+enum MemoryClass
+{
+	MEMORY_GEOMETRY = 0, MEMORY_ACCELERATION_STRUCTURES, MEMORY_TEXTURES, MEMORY_RENDER_TARGETS, MEMORY_CLASS_MAX
+};
+
+// Ways to give device memory back, from the least to the most visible one.
+enum PressureResponse
+{
+	NO_RESPONSE = 0, DROP_TEXTURE_MIPS, SHRINK_GEOMETRY_BUDGET, SHRINK_RENDER_RESOLUTION, PRESSURE_RESPONSE_MAX
+};
+
+/*
+ * Watches the device local heaps through vmaGetHeapBudgets (VK_EXT_memory_budget when the device has it,
+ * so memory taken by other processes on the same GPU counts against us) and answers pressure by
+ * lowering quality one step at a time instead of letting allocations fail.
+ * Above the high watermark the next PressureResponse is taken; once usage stays below the low watermark
+ * (even counting what the last step gave back), the last step is undone. Both wait COOLDOWN_FRAMES
+ * after the previous step, so freed memory shows up in the budget before the next decision.
+ */
+class MemoryBudgetManager
+{
+public:
+	// 占预算的比例
+	static constexpr float HIGH_WATERMARK = 0.9f;
+	static constexpr float LOW_WATERMARK = 0.7f;
+	static constexpr uint32_t COOLDOWN_FRAMES = 60;
+
+	struct Step
+	{
+		PressureResponse response = NO_RESPONSE;
+		// true: undo the response instead of taking it
+		bool undo = false;
+	};
+
+	// limitBytes caps the budget of this process (0: whatever the driver gives), for several instances sharing one GPU.
+	MemoryBudgetManager(VmaAllocator& allocator, const VkDeviceSize& limitBytes = 0);
+
+	// Bytes a class uses right now, as counted by the owners of the resources; only used for the budgets and statistics.
+	void SetUsage(const MemoryClass& memoryClass, const VkDeviceSize& bytes);
+
+	// Call once per frame while the device is idle. Returns the step the caller has to apply this frame, if any.
+	Step Update();
+
+	// Share of the device local budget a class should stay within
+	VkDeviceSize GetBudget(const MemoryClass& memoryClass) const;
+	VkDeviceSize GetUsage(const MemoryClass& memoryClass) const
+	{
+		return mUsage[memoryClass];
+	}
+
+	// Device local memory of this process and the budget it has, as of the last Update
+	VkDeviceSize GetDeviceLocalUsage() const
+	{
+		return mDeviceLocalUsage;
+	}
+	VkDeviceSize GetDeviceLocalBudget() const
+	{
+		return mDeviceLocalBudget;
+	}
+
+	// The responses [DROP_TEXTURE_MIPS, GetLevel()] are in effect
+	uint32_t GetLevel() const
+	{
+		return mLevel;
+	}
+
+	static const char* GetMemoryClassName(const MemoryClass& memoryClass);
+	static const char* GetResponseName(const PressureResponse& response);
+
+private:
+	// 每一类资源占总预算的比例，加起来是1
+	static constexpr std::array<float, MEMORY_CLASS_MAX> CLASS_SHARES = { 0.25f, 0.15f, 0.4f, 0.2f };
+
+	void PollHeapBudgets();
+
+	VmaAllocator& mAllocator;
+	VkDeviceSize mLimitBytes;
+
+	std::array<VkDeviceSize, MEMORY_CLASS_MAX> mUsage = {};
+	VkDeviceSize mDeviceLocalUsage = 0;
+	VkDeviceSize mDeviceLocalBudget = 0;
+
+	uint32_t mFrame = 0;
+	uint32_t mLastStepFrame = 0;
+	uint32_t mLevel = 0;
+	// 最近一次降级之前的显存用量；冷却时间过了之后和当时的用量相减，就是这一级实际省下的显存
+	VkDeviceSize mUsageBeforeStep = 0;
+	bool mMeasureFreed = false;
+	// 每一级省下的显存，用来判断撤销之后会不会马上又超
+	std::array<VkDeviceSize, PRESSURE_RESPONSE_MAX> mFreedByStep = {};
+};
@@ -5,125 +5,389 @@
 #include "Mesh.h"
 
 #include <assimp/postprocess.h>
+#include <assimp/DefaultIOSystem.h>
 #include <stdexcept>
-#include <queue>
+#include <stack>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
 #include <glm/gtx/transform.hpp>
 
 #include "VKRTApp.h"
+#include "VertexCompression.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "ObjLoader.h"
+#include "TextureCache.h"
+
+namespace
+{
+	// 记下Assimp打开过的文件（材质库、glTF的.bin等），ModelCache用它们判断缓存是否过期
+	class RecordingIOSystem : public Assimp::DefaultIOSystem
+	{
+	public:
+		explicit RecordingIOSystem(std::vector<std::string>& files) :
+			mFiles(files)
+		{
+		}
+
+		Assimp::IOStream* Open(const char* file, const char* mode) override
+		{
+			auto* stream = DefaultIOSystem::Open(file, mode);
+			if (stream != nullptr && std::find(mFiles.begin(), mFiles.end(), file) == mFiles.end())
+			{
+				mFiles.emplace_back(file);
+			}
+			return stream;
+		}
+
+	private:
+		std::vector<std::string>& mFiles;
+	};
+}
 
 Mesh::Mesh(VkDevice& logicalDevice,
 	VkCommandPool& pool,
 	VkQueue& graphicsQueue,
 	VmaAllocator& allocator,
-	const std::vector<vec3>& positions,
-	const std::vector<MyVertexAttribute>& vertexAttributes,
-	const std::vector<uint32_t>& indices,
+	std::vector<vec3> positions,
+	std::vector<VertexAttribute> vertexAttributes,
+	std::vector<std::vector<uint32_t>> lodIndices,
 	const std::string& matInfo,
 	const uint32_t& matID,
 	const aiColor4D& color,
-	const mat4& transform) :
+	const mat4& transform,
+	const MeshResidency& residency,
+	TextureCache* textureCache) :
 	mLogicalDevice(logicalDevice),
-	positions(positions),
-	vertAttributes(vertexAttributes),
-	indices(indices),
+	positions(std::move(positions)),
+	vertAttributes(std::move(vertexAttributes)),
 	positionBuffer(allocator),
 	vertAttriBuffer(allocator),
-	indexBuffer(allocator),
-	facesBuffer(allocator),
 	colorBuffer(allocator),
 	matInfo(matInfo),
 	matID(matID),
-	diffuseTex(allocator, logicalDevice),
 	transform(transform),
 	mCommandPool(pool),
 	mGraphicsQueue(graphicsQueue),
 	mAllocator(allocator),
 	mColor(color)
 {
-	CHECK_VK_ERROR(positionBuffer.CreateBuffer(sizeof(vec3) * positions.size(),
-		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
-		| VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
-		| VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-		VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT
-			| VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT), "Failed to create a vertex position buffer.");
+	// 参数已经被移动进成员了，下面只能使用成员
+	mPositionCount = this->positions.size();
+	mVertAttributeCount = this->vertAttributes.size();
+	mResidency = residency;
+	assert(!lodIndices.empty() && lodIndices.size() <= MAX_LOD_COUNT);
+
+	// 包围盒给流式加载判断距离和屏幕大小用
+	if (!this->positions.empty())
+	{
+		mBoundsMin = mBoundsMax = this->positions.front();
+		for (const auto& position : this->positions)
+		{
+			mBoundsMin = glm::min(mBoundsMin, position);
+			mBoundsMax = glm::max(mBoundsMax, position);
+		}
+	}
 
-	CHECK_VK_ERROR(vertAttriBuffer.CreateBuffer(sizeof(MyVertexAttribute) * vertexAttributes.size(),
+	// 同一个文件的贴图只加载一次，在别的线程上解码，之后由TextureCache::Update流式上传
+	// 颜色不小于0的材质用不到贴图，指向错误贴图就行
+	if (textureCache)
+	{
+		mTextureIndex = mColor.r < 0 ? textureCache->Acquire(this->matInfo) : TextureCache::ERROR_TEXTURE_INDEX;
+	}
+	else
+	{
+		diffuseTex = std::make_shared<Image>(allocator, logicalDevice);
+		LoadDiffuseTex(*diffuseTex);
+		mTextureIndex = matID;
+	}
+
+	// 远处的Mesh用更粗糙的LOD，少占显存也少遍历三角形；LOD在导入的时候就生成好了
+	mLods.reserve(lodIndices.size());
+	for (auto& indices : lodIndices)
+	{
+		auto& lod = mLods.emplace_back(allocator);
+		lod.indices = std::move(indices);
+		lod.indexCount = lod.indices.size();
+		lod.faces = BuildFaces(this->positions, this->vertAttributes, lod.indices);
+	}
+
+	// 流式加载的Mesh由MeshStreamer决定什么时候上传
+	if (mResidency != STREAMED)
+	{
+		UploadGeometry();
+		// GPU上已经有一份了，除非之后还要用（拾取、重建BLAS、导出），否则CPU端的数据直接释放
+		if (mResidency == RELEASE_AFTER_UPLOAD)
+		{
+			ReleaseCPUCopies();
+		}
+	}
+
+	colorBuffer.CreateBuffer(sizeof(MaterialData),
 		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-		| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+		| VK_BUFFER_USAGE_TRANSFER_DST_BIT
+		| VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 		VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT
-			| VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT), "Failed to create a vertex attribute buffer.");
+		| VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+	const MaterialData material = { vec4(mColor.r, mColor.g, mColor.b, mColor.a), mTextureIndex };
+	colorBuffer.UploadData(&material);
+}
 
-	CHECK_VK_ERROR(indexBuffer.CreateBuffer(sizeof(uint32_t) * indices.size(),
-		VK_BUFFER_USAGE_INDEX_BUFFER_BIT
-		| VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
-		| VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-		VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT
-			| VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT), "Failed to create an index buffer.");
+void Mesh::LoadDiffuseTex(Image& image)
+{
+	if (image.LoadImageFromFile(matInfo.c_str(), mCommandPool, mGraphicsQueue))
+	{
+		CHECK_VK_ERROR(image.CreateTextureViewAndSampler(), "Failed to create the view and sampler of a texture.");
+	}
+}
 
-	if (diffuseTex.LoadImageFromFile(matInfo.c_str(), mCommandPool, mGraphicsQueue))
+void Mesh::GenerateLods(MeshImportData& data)
+{
+	data.lodIndices.clear();
+	data.lodErrors.clear();
+	// 下面要引用上一级的索引，先留够位置
+	data.lodIndices.reserve(MAX_LOD_COUNT - 1);
+	const std::vector<uint32_t>* previous = &data.indices;
+	float previousError = 0.0f;
+	while (data.lodIndices.size() + 1 < MAX_LOD_COUNT)
 	{
-		CHECK_VK_ERROR(diffuseTex.CreateImageView(VK_IMAGE_VIEW_TYPE_2D,
-			VkImageSubresourceRange
-			{
-				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-				.baseMipLevel = 0,
-				.levelCount = VK_REMAINING_MIP_LEVELS,
-				.baseArrayLayer = 0,
-				.layerCount = VK_REMAINING_ARRAY_LAYERS,
-			}), "Failed to load image from file.");
-		CHECK_VK_ERROR(diffuseTex.CreateSampler(VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT),
-			"Failed to create a sampler of a texture.");
-	}
-
-	auto numFaces = indices.size() / 3;
-	faces.resize(numFaces * 4);
-	// faces.assign(faces.size(), FACE_NUM);
+		if (previous->size() / FACE_NUM < LOD_MIN_TRIANGLES)
+		{
+			break;
+		}
+
+		// 每一级都从上一级开始简化，误差累加起来
+		float error = 0.0f;
+		auto lodIndices = MeshSimplifier::Simplify(data.positions, *previous,
+			previous->size() / LOD_REDUCTION, LOD_MAX_ERROR, error);
+		// 只少了不到20%的三角形，这一级没有意义
+		if (lodIndices.size() * 5 > previous->size() * 4)
+		{
+			break;
+		}
+
+		// 和LOD 0一样按空间位置重排三角形；顶点是几级LOD共用的，不能重新编号
+		MeshOptimizer::SortTriangles(data.positions, lodIndices);
+		previousError += error;
+		data.lodErrors.push_back(previousError);
+		data.lodIndices.push_back(std::move(lodIndices));
+		previous = &data.lodIndices.back();
+	}
+}
+
+std::vector<uint32_t> Mesh::BuildFaces(const std::vector<vec3>& positions,
+	const std::vector<VertexAttribute>& vertAttributes,
+	const std::vector<uint32_t>& indices)
+{
+	const size_t numFaces = indices.size() / 3;
+	std::vector<uint32_t> faces(numFaces * 4);
+	// 材质ID跟着TLAS Instance走，faces.w只放纹理LOD的常数
 	for (size_t i = 0; i < numFaces; i ++)
 	{
 		faces[4 * i + 0] = indices[3 * i + 0];
 		faces[4 * i + 1] = indices[3 * i + 1];
 		faces[4 * i + 2] = indices[3 * i + 2];
+		faces[4 * i + 3] = PackFaceW(ComputeTexLodConstant(positions, vertAttributes, &indices[3 * i]));
+	}
+	return faces;
+}
+
+float Mesh::ComputeTexLodConstant(const std::vector<vec3>& positions,
+	const std::vector<VertexAttribute>& vertAttributes,
+	const uint32_t* triangle)
+{
+	// 光锥的纹理LOD：0.5 * log2(UV面积 / 三角形面积)，贴图的大小和Instance的缩放在Shader里面再加上
+	const vec3& p0 = positions[triangle[0]];
+	const float worldArea = glm::length(glm::cross(positions[triangle[1]] - p0, positions[triangle[2]] - p0));
+	const vec2 uv0 = glm::unpackHalf2x16(vertAttributes[triangle[0]].uvHalf);
+	const vec2 uv1 = glm::unpackHalf2x16(vertAttributes[triangle[1]].uvHalf);
+	const vec2 uv2 = glm::unpackHalf2x16(vertAttributes[triangle[2]].uvHalf);
+	const vec2 e1 = uv1 - uv0;
+	const vec2 e2 = uv2 - uv0;
+	const float uvArea = std::abs(e1.x * e2.y - e1.y * e2.x);
+	// 退化的三角形或者没有UV的话就用原始分辨率
+	if (worldArea <= 0.0f || uvArea <= 0.0f)
+	{
+		return 0.0f;
+	}
+	return std::clamp(0.5f * std::log2(uvArea / worldArea), -32.0f, 32.0f);
+}
+
+void Mesh::SetCPUGeometry(std::vector<vec3>&& newPositions,
+	std::vector<VertexAttribute>&& newVertAttributes,
+	std::vector<std::vector<uint32_t>>&& newLodIndices,
+	std::vector<std::vector<uint32_t>>&& newLodFaces)
+{
+	assert(newLodIndices.size() == mLods.size() && newLodFaces.size() == mLods.size());
+	positions = std::move(newPositions);
+	vertAttributes = std::move(newVertAttributes);
+	for (size_t i = 0; i < mLods.size(); i++)
+	{
+		assert(newLodFaces[i].size() / 4 == newLodIndices[i].size() / 3);
+		mLods[i].indices = std::move(newLodIndices[i]);
+		mLods[i].faces = std::move(newLodFaces[i]);
+		mLods[i].indexCount = mLods[i].indices.size();
 	}
 
-	CHECK_VK_ERROR(facesBuffer.CreateBuffer(sizeof(uint32_t) * faces.size(),
-		VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+	mPositionCount = positions.size();
+	mVertAttributeCount = vertAttributes.size();
+}
+
+void Mesh::UploadGeometry()
+{
+	assert(!mHasGPUGeometry);
+	assert(positions.size() == mPositionCount);
+
+	CHECK_VK_ERROR(positionBuffer.CreateBuffer(sizeof(vec3) * mPositionCount,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
 		| VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
-		| VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-		| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		| VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
 		VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT
-		| VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT), "Failed to create an faces buffer.");
+			| VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT), "Failed to create a vertex position buffer.");
 
-	matIDs.resize(numFaces);
-	matIDs.assign(matIDs.size(), matID);
+	CHECK_VK_ERROR(vertAttriBuffer.CreateBuffer(sizeof(VertexAttribute) * mVertAttributeCount,
+		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+		| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT
+			| VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT), "Failed to create a vertex attribute buffer.");
 
 	positionBuffer.UploadData(positions.data());
 	vertAttriBuffer.UploadData(vertAttributes.data());
-	indexBuffer.UploadData(indices.data());
-	facesBuffer.UploadData(faces.data());
 
-	colorBuffer.CreateBuffer(sizeof(aiColor4D),
-		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-		| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
-		| VK_BUFFER_USAGE_TRANSFER_DST_BIT
-		| VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-		VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT
-		| VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
-	colorBuffer.UploadData(&mColor);
+	// 所有LOD共用上面的顶点，每一级只有自己的索引和面
+	for (auto& lod : mLods)
+	{
+		assert(lod.indices.size() == lod.indexCount);
+		CHECK_VK_ERROR(lod.indexBuffer.CreateBuffer(sizeof(uint32_t) * lod.indexCount,
+			VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+			| VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
+			| VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+			VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT
+				| VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT), "Failed to create an index buffer.");
+
+		CHECK_VK_ERROR(lod.facesBuffer.CreateBuffer(sizeof(uint32_t) * lod.faces.size(),
+			VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+			| VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
+			| VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+			| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT
+			| VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT), "Failed to create an faces buffer.");
+
+		lod.indexBuffer.UploadData(lod.indices.data());
+		lod.facesBuffer.UploadData(lod.faces.data());
+	}
+
+	mHasGPUGeometry = true;
+}
+
+void Mesh::EvictGeometry()
+{
+	if (!mHasGPUGeometry)
+	{
+		return;
+	}
+
+	for (auto& lod : mLods)
+	{
+		lod.facesBuffer.Free();
+		lod.indexBuffer.Free();
+
+		// 底层加速结构引用了顶点和索引，一起释放
+		if (lod.accelerationStructure.accelerationStructure != VK_NULL_HANDLE)
+		{
+			vkDestroyAccelerationStructureKHR(mLogicalDevice, lod.accelerationStructure.accelerationStructure, VK_NULL_HANDLE);
+			lod.accelerationStructure.buffer->Free();
+		}
+		lod.accelerationStructure = {};
+	}
+	positionBuffer.Free();
+	vertAttriBuffer.Free();
+
+	mHasGPUGeometry = false;
+}
+
+size_t Mesh::GetGPUMemoryBytes() const
+{
+	if (!mHasGPUGeometry)
+	{
+		return 0;
+	}
+
+	size_t bytes = positionBuffer.GetSize() + vertAttriBuffer.GetSize();
+	for (const auto& lod : mLods)
+	{
+		bytes += lod.indexBuffer.GetSize() + lod.facesBuffer.GetSize();
+		if (lod.accelerationStructure.buffer)
+		{
+			bytes += lod.accelerationStructure.buffer->GetSize();
+		}
+	}
+	return bytes;
+}
+
+size_t Mesh::GetBLASMemoryBytes() const
+{
+	size_t bytes = 0;
+	for (const auto& lod : mLods)
+	{
+		if (mHasGPUGeometry && lod.accelerationStructure.buffer)
+		{
+			bytes += lod.accelerationStructure.buffer->GetSize();
+		}
+	}
+	return bytes;
 }
 
 size_t Mesh::GetPositionCount() const
 {
-	return positions.size();
+	return mPositionCount;
 }
 
 size_t Mesh::GetVertAttributeCount() const
 {
-	return vertAttributes.size();
+	return mVertAttributeCount;
+}
+
+size_t Mesh::GetIndexCount(const uint32_t& lod) const
+{
+	return mLods[lod].indexCount;
+}
+
+uint32_t Mesh::GetLodCount() const
+{
+	return static_cast<uint32_t>(mLods.size());
+}
+
+float Mesh::GetLodError(const uint32_t& lod) const
+{
+	return mLods[lod].error;
 }
 
-size_t Mesh::GetIndexCount() const
+size_t Mesh::GetCPUMemoryBytes() const
 {
-	return indices.size();
+	size_t bytes = positions.capacity() * sizeof(vec3)
+		+ vertAttributes.capacity() * sizeof(VertexAttribute);
+	for (const auto& lod : mLods)
+	{
+		bytes += (lod.indices.capacity() + lod.faces.capacity()) * sizeof(uint32_t);
+	}
+	return bytes;
+}
+
+void Mesh::ReleaseCPUCopies()
+{
+	// clear()不会归还内存，和空的vector交换才会真正释放
+	std::vector<vec3>().swap(positions);
+	std::vector<VertexAttribute>().swap(vertAttributes);
+	for (auto& lod : mLods)
+	{
+		std::vector<uint32_t>().swap(lod.indices);
+		std::vector<uint32_t>().swap(lod.faces);
+	}
 }
 
 Buffer& Mesh::GetPositionBuffer()
@@ -136,14 +400,14 @@ Buffer& Mesh::GetVertAttriBuffer()
 	return vertAttriBuffer;
 }
 
-Buffer& Mesh::GetIndexBuffer()
+Buffer& Mesh::GetIndexBuffer(const uint32_t& lod)
 {
-	return indexBuffer;
+	return mLods[lod].indexBuffer;
 }
 
-Buffer& Mesh::GetFacesBuffer()
+Buffer& Mesh::GetFacesBuffer(const uint32_t& lod)
 {
-	return facesBuffer;
+	return mLods[lod].facesBuffer;
 }
 
 Buffer& Mesh::GetColorBuffer()
@@ -156,107 +420,157 @@ Mesh::~Mesh() = default;
 std::shared_ptr<Mesh> Mesh::ImportMeshFromFileOfIndex(VkDevice& logicalDevice,
 	VkCommandPool& pool,
 	VkQueue& graphicsQueue,
-	VmaAllocator& allocator, const std::string& path, size_t index)
+	VmaAllocator& allocator, const std::string& path, size_t index,
+	const MeshResidency& residency)
 {
 	Assimp::Importer importer;
-	const auto* scene = importer.ReadFile(path, aiProcess_Triangulate
-		| aiProcess_JoinIdenticalVertices
-		| aiProcess_FlipUVs
-		| aiProcess_GenNormals);
+	const auto* scene = importer.ReadFile(path, IMPORT_FLAGS);
+	if (scene == nullptr || index >= scene->mNumMeshes)
+	{
+		return nullptr;
+	}
 
-	return ImportMeshFromAIScene(logicalDevice, pool, graphicsQueue, allocator, scene, index, path, 0);
+	return CreateMesh(logicalDevice, pool, graphicsQueue, allocator, ReadAIMesh(scene, index), 0, residency, nullptr);
 }
 
 std::vector<std::shared_ptr<Mesh>> Mesh::ImportAllMeshesFromFile(VkDevice& logicalDevice,
 	VkCommandPool& pool,
 	VkQueue& graphicsQueue,
-	VmaAllocator& allocator, const std::string& path)
+	VmaAllocator& allocator, const std::string& path,
+	std::vector<MeshInstance>& instances,
+	const MeshResidency& residency)
 {
-	// 因为导入结果可能有一组模型，所以需要是个Vector
-	auto result = std::vector<std::shared_ptr<Mesh>>();
-	Assimp::Importer importer;
-	// 读取文件，并且将所有顶点三角化、减少顶点数、反转UV的Y轴，最后如果没有Normals的话生成Normals
-	const auto* scene = importer.ReadFile(path, aiProcess_Triangulate |
-		aiProcess_JoinIdenticalVertices | aiProcess_FlipUVs | aiProcess_GenNormals);
+	ModelImportData model;
+	if (!ReadModelFile(path, model))
+	{
+		instances.clear();
+		return {};
+	}
+
+	instances = std::move(model.instances);
+	return CreateMeshes(logicalDevice, pool, graphicsQueue, allocator, model, 0, residency);
+}
 
+bool Mesh::ReadModelFile(const std::string& path, ModelImportData& model)
+{
+	// OBJ用自己的多线程解析器，比Assimp快很多；解析失败再交给Assimp试一次
+	std::string extension = std::filesystem::path(path).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](const unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	if (extension == ".obj")
+	{
+		if (ObjLoader::Read(path, model))
+		{
+			return true;
+		}
+		std::cerr << "Falling back to Assimp for " << path << std::endl;
+	}
+
+	// Importer不能在线程之间共用，每次读取都用自己的；IOSystem由Importer负责释放
+	Assimp::Importer importer;
+	model.dependencies.clear();
+	importer.SetIOHandler(new RecordingIOSystem(model.dependencies));
+	const auto* scene = importer.ReadFile(path, IMPORT_FLAGS);
 	if (scene == nullptr)
 	{
-		return result;
+		return false;
 	}
 
+	// 因为导入结果可能有一组模型，所以需要是个Vector
+	model.meshes.clear();
+	model.meshes.reserve(scene->mNumMeshes);
 	for (size_t i = 0; i < scene->mNumMeshes; i++)
 	{
-		auto curMesh = ImportMeshFromAIScene(logicalDevice, pool, graphicsQueue, allocator, scene, i, path, static_cast<uint32_t>(i));
-		if (curMesh != nullptr)
-		{
-			result.push_back(curMesh);
-		}
+		model.meshes.push_back(ReadAIMesh(scene, i));
 	}
 
-	// Set Transform
-	std::queue<aiNode*> nodeQueue;
-	nodeQueue.push(scene->mRootNode);
+	// 把节点树展开成Instance：每个节点引用的每个Mesh都是一个Instance，变换要乘上所有的父节点
+	// 同一个Mesh被多个节点引用的时候只有一份几何数据和底层加速结构
+	model.instances.clear();
+	std::vector<bool> placed(model.meshes.size(), false);
+	std::stack<std::pair<const aiNode*, aiMatrix4x4>> nodeStack;
+	nodeStack.emplace(scene->mRootNode, aiMatrix4x4());
 
-	while (!nodeQueue.empty())
+	while (!nodeStack.empty())
 	{
-		const auto* curNode = nodeQueue.front();
-		nodeQueue.pop();
+		const auto [curNode, parentTransform] = nodeStack.top();
+		nodeStack.pop();
+
+		// Assimp的矩阵是列向量的约定，父节点的矩阵乘在左边
+		const aiMatrix4x4 worldTransform = parentTransform * curNode->mTransformation;
+		// aiMatrix4x4是行主序的，glm是列主序的
+		mat4 world;
+		for (uint32_t row = 0; row < 4; row++)
+		{
+			for (uint32_t col = 0; col < 4; col++)
+			{
+				world[col][row] = worldTransform[row][col];
+			}
+		}
 
 		for (size_t i = 0; i < curNode->mNumMeshes; i++)
 		{
 			const auto& meshIndex = curNode->mMeshes[i];
-			if (meshIndex < result.size())
+			if (meshIndex >= model.meshes.size())
+			{
+				continue;
+			}
+			model.instances.push_back({ meshIndex, world, std::string(curNode->mName.C_Str()) });
+
+			if (!placed[meshIndex])
 			{
-				auto& curTransform = result[meshIndex]->transform;
-				auto curSourceTransform = curNode->mTransformation;
-				curTransform[0] = vec4(curSourceTransform[0][0], curSourceTransform[1][0], curSourceTransform[2][0], curSourceTransform[3][0]);
-				curTransform[1] = vec4(curSourceTransform[0][1], curSourceTransform[1][1], curSourceTransform[2][1], curSourceTransform[3][1]);
-				curTransform[2] = vec4(curSourceTransform[0][2], curSourceTransform[1][2], curSourceTransform[2][2], curSourceTransform[3][2]);
-				curTransform[3] = vec4(curSourceTransform[0][3], curSourceTransform[1][3], curSourceTransform[2][3], curSourceTransform[3][3]);
-				curTransform = glm::transpose(curTransform);
-				result[meshIndex]->aiMatrixTransform =
-					aiMatrix4x4(aiVector3t{ 1.f, 1.f, 1.f }, aiQuaternion(0, 0, 0), aiVector3t<float> {0, 0, 0})
-					* curSourceTransform;
+				model.meshes[meshIndex].transform = glm::transpose(world);
+				model.meshes[meshIndex].aiTransform = worldTransform;
+				placed[meshIndex] = true;
 			}
 		}
-		for (size_t i = 0; i < curNode->mNumChildren; i++)
+		// 倒着压栈，这样Instance的顺序和节点在文件里的顺序一致
+		for (size_t i = curNode->mNumChildren; i > 0; i--)
 		{
-			nodeQueue.push(curNode->mChildren[i]);
+			nodeStack.emplace(curNode->mChildren[i - 1], worldTransform);
 		}
 	}
 
+	return true;
+}
+
+std::vector<std::shared_ptr<Mesh>> Mesh::CreateMeshes(VkDevice& logicalDevice,
+	VkCommandPool& pool,
+	VkQueue& graphicsQueue,
+	VmaAllocator& allocator,
+	ModelImportData& model,
+	const uint32_t& firstMatID,
+	const MeshResidency& residency,
+	TextureCache* textureCache)
+{
+	std::vector<std::shared_ptr<Mesh>> result;
+	result.reserve(model.meshes.size());
+	for (size_t i = 0; i < model.meshes.size(); i++)
+	{
+		result.push_back(CreateMesh(logicalDevice, pool, graphicsQueue, allocator,
+			std::move(model.meshes[i]), firstMatID + static_cast<uint32_t>(i), residency, textureCache));
+	}
+	model.meshes.clear();
 	return result;
 }
 
 void Mesh::Dispose()
 {
 	colorBuffer.Free();
-	facesBuffer.Free();
-	indexBuffer.Free();
-	positionBuffer.Free();
-	vertAttriBuffer.Free();
+	EvictGeometry();
 
-	diffuseTex.Dispose();
-
-	vkDestroyAccelerationStructureKHR(mLogicalDevice, mAccelerationStructure.accelerationStructure, VK_NULL_HANDLE);
-	mAccelerationStructure.buffer->Free();
+	if (diffuseTex)
+	{
+		diffuseTex->Dispose();
+	}
 }
 
-std::shared_ptr<Mesh> Mesh::ImportMeshFromAIScene(VkDevice& logicalDevice,
-                                                  VkCommandPool& pool,
-                                                  VkQueue& graphicsQueue,
-                                                  VmaAllocator& allocator,
-                                                  const aiScene* scene, size_t index, const std::string& path, const uint32_t& matID)
+MeshImportData Mesh::ReadAIMesh(const aiScene* scene, size_t index)
 {
-	std::vector<vec3> positions;
-	std::vector<MyVertexAttribute> vertexAttributes;
-	std::vector<uint32_t> indices;
-	std::string matInfo;
-
-	if (scene->mNumMeshes < index)
-	{
-		return nullptr;
-	}
+	MeshImportData data;
+	auto& positions = data.positions;
+	auto& vertexAttributes = data.vertAttributes;
+	auto& indices = data.indices;
+	auto& matInfo = data.matInfo;
 
 	const auto* mesh = scene->mMeshes[index];
 
@@ -266,19 +580,19 @@ std::shared_ptr<Mesh> Mesh::ImportMeshFromAIScene(VkDevice& logicalDevice,
 	for (size_t i = 0; i < mesh->mNumVertices; i++)
 	{
 		const auto& curVert = mesh->mVertices[i];
-
-		aiVector3t<float> curTexCoord = { 0, 0, 0 };
-		auto* meshUVs = mesh->mTextureCoords[0];
-		if (meshUVs)
-		{
-			curTexCoord = mesh->mTextureCoords[0][i];
-		}
-		const auto& curNormal = mesh->mNormals[i];
-
 		positions.emplace_back(curVert.x, curVert.y, curVert.z);
-		vertexAttributes.emplace_back(
-			vec4{ curNormal.x, curNormal.y, curNormal.z, static_cast<float>(matID)},
-			vec4{ curTexCoord.x, curTexCoord.y, 1.0f, 1.0f });
+	}
+
+	// 法线压缩成八面体编码，UV压缩成半精度浮点，每个顶点只占8个字节
+	// aiVector3D是连续的三个float，所以步长是3
+	vertexAttributes.resize(mesh->mNumVertices);
+	if (mesh->mNormals)
+	{
+		const auto* meshUVs = mesh->mTextureCoords[0];
+		VertexCompression::EncodeVertexAttributes(&mesh->mNormals[0].x, 3,
+			meshUVs ? &meshUVs[0].x : nullptr, 3,
+			mesh->mNumVertices,
+			vertexAttributes.data());
 	}
 
 	for (size_t i = 0; i < mesh->mNumFaces; i++)
@@ -289,7 +603,7 @@ std::shared_ptr<Mesh> Mesh::ImportMeshFromAIScene(VkDevice& logicalDevice,
 			indices.emplace_back(curFace.mIndices[j]);
 		}
 	}
-	aiColor4D outColor{};
+	auto& outColor = data.color;
 	if (scene->HasMaterials())
 	{
 		auto matIndex = mesh->mMaterialIndex;
@@ -311,22 +625,74 @@ std::shared_ptr<Mesh> Mesh::ImportMeshFromAIScene(VkDevice& logicalDevice,
 		const std::string directory(DEFAULT_TEX_DIR);
 		matInfo = directory + matInfo;
 	}
-	// 用上面的数据构建Mesh
+	// 上传之前先重排三角形和顶点，提高命中着色器读取属性以及BLAS构建时的局部性
+	data.localityBefore = MeshOptimizer::AnalyzeLocality(indices, positions.size());
+	MeshOptimizer::Optimize(positions, vertexAttributes, indices);
+	data.localityAfter = MeshOptimizer::AnalyzeLocality(indices, positions.size());
+	GenerateLods(data);
+
+	// 记录当前Mesh的名称
+	data.name = std::string(mesh->mName.C_Str());
+	if (data.name.find("Window") != std::string::npos)
+	{
+		data.meshType = WINDOW;
+	}
+	return data;
+}
+
+std::shared_ptr<Mesh> Mesh::CreateMesh(VkDevice& logicalDevice,
+	VkCommandPool& pool,
+	VkQueue& graphicsQueue,
+	VmaAllocator& allocator,
+	MeshImportData&& data,
+	const uint32_t& matID,
+	const MeshResidency& residency,
+	TextureCache* textureCache)
+{
+	// 用读出来的数据构建Mesh；从ModelCache读出来的只有每一级LOD的索引数量，几何数据之后由MeshStreamer读进来
+	const bool cooked = data.positions.empty() && !data.lodIndexCounts.empty();
+	assert(!cooked || residency == STREAMED);
+	std::vector<std::vector<uint32_t>> lodIndices(cooked ? data.lodIndexCounts.size() : 0);
+	if (!cooked)
+	{
+		lodIndices.reserve(data.lodIndices.size() + 1);
+		lodIndices.push_back(std::move(data.indices));
+		for (auto& indices : data.lodIndices)
+		{
+			lodIndices.push_back(std::move(indices));
+		}
+	}
 	auto newMesh = std::make_shared<Mesh>(logicalDevice,
 		pool,
 		graphicsQueue,
 		allocator,
-		positions, vertexAttributes, indices, matInfo,
+		std::move(data.positions), std::move(data.vertAttributes), std::move(lodIndices), data.matInfo,
 		matID,
-		outColor);
-	// 记录当前Mesh的名称
-	auto meshName = std::string(mesh->mName.C_Str());
-	if (meshName.find("Window") != std::string::npos)
+		data.color,
+		data.transform,
+		residency,
+		textureCache);
+	newMesh->mMeshType = data.meshType;
+	newMesh->mName = data.name;
+	newMesh->aiMatrixTransform = data.aiTransform;
+	newMesh->mLocalityBefore = data.localityBefore;
+	newMesh->mLocalityAfter = data.localityAfter;
+	newMesh->mCookedPath = data.cookedPath;
+	if (cooked)
+	{
+		newMesh->mPositionCount = data.vertexCount;
+		newMesh->mVertAttributeCount = data.vertexCount;
+		newMesh->mBoundsMin = data.boundsMin;
+		newMesh->mBoundsMax = data.boundsMax;
+		for (size_t i = 0; i < data.lodIndexCounts.size(); i++)
+		{
+			newMesh->mLods[i].indexCount = data.lodIndexCounts[i];
+		}
+	}
+	for (size_t i = 0; i < data.lodErrors.size(); i++)
 	{
-		newMesh->mMeshType = WINDOW;
+		newMesh->mLods[i + 1].error = data.lodErrors[i];
 	}
-
-	newMesh->mName = meshName;
 	return newMesh;
 }
 
@@ -8,19 +8,18 @@
 
 #include <assimp/scene.h>
 #include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
 
 #include "glm/glm.hpp"
 #include "Buffer.h"
 #include "Image.h"
 #include "Constants.h"
+#include "shared_with_shaders.h"
+#include "MeshOptimizer.h"
 
 const unsigned char FACE_NUM = 3;
 
-struct MyVertexAttribute
-{
-	vec4 normal;
-	vec4 texCoord;
-};
+class TextureCache;
 
 struct MeshModelMat4
 {
@@ -34,34 +33,139 @@ struct AccelerationStructure
 	VkDeviceAddress handle;
 };
 
+// One level of detail of a Mesh. Every level indexes the same vertex buffers and has its own BLAS.
+struct MeshLod
+{
+	explicit MeshLod(VmaAllocator& allocator) :
+		indexBuffer(allocator),
+		facesBuffer(allocator)
+	{
+	}
+
+	std::vector<uint32_t> indices; // 索引
+	std::vector<uint32_t> faces; // 面，w分量是纹理LOD的常数
+	size_t indexCount = 0;
+
+	Buffer indexBuffer;
+	Buffer facesBuffer;
+	AccelerationStructure accelerationStructure{};
+
+	// 相对于模型最长边的几何误差，LOD 0是0
+	float error = 0.0f;
+};
+
+// One placement of a Mesh in the scene, flattened from the Assimp node hierarchy.
+// Several instances can share one Mesh, and with it the geometry buffers and BLASes.
+struct MeshInstance
+{
+	uint32_t meshIndex;
+	// 累乘了所有父节点之后的世界矩阵（没有转置）
+	mat4 transform;
+	// 引用这个Mesh的节点名称
+	std::string name;
+};
+
 enum MeshType
 {
 	OPAQUE = 0, WINDOW, MESH_TYPE_MAX
 };
 
+// CPU-side result of reading one mesh of a model file. Producing it does not touch the GPU,
+// so several model files can be read on different threads.
+struct MeshImportData
+{
+	std::string name;
+	std::vector<vec3> positions;
+	std::vector<VertexAttribute> vertAttributes;
+	std::vector<uint32_t> indices;
+	// LOD 1开始的索引，导入的时候就简化并重排好了，和LOD 0共用顶点
+	std::vector<std::vector<uint32_t>> lodIndices;
+	std::vector<float> lodErrors;
+	std::string matInfo;
+	aiColor4D color{};
+	MeshType meshType = OPAQUE;
+	// 第一个引用这个Mesh的节点的变换，和Mesh::GetTransform一样是转置过的
+	mat4 transform = mat4(1.0f);
+	aiMatrix4x4 aiTransform;
+	MeshLocalityStats localityBefore;
+	MeshLocalityStats localityAfter;
+
+	// ModelCache烘焙好的几何文件，MeshStreamer从这里读
+	std::string cookedPath;
+	// 从ModelCache读出来的Mesh没有几何数据，只有这些数量和包围盒（lodIndexCounts包括LOD 0）
+	size_t vertexCount = 0;
+	std::vector<size_t> lodIndexCounts;
+	vec3 boundsMin = vec3(0.0f);
+	vec3 boundsMax = vec3(0.0f);
+};
+
+// Everything read from one model file: its meshes and the flattened node hierarchy.
+// MeshInstance::meshIndex is relative to meshes.
+struct ModelImportData
+{
+	std::vector<MeshImportData> meshes;
+	std::vector<MeshInstance> instances;
+	// 除了模型文件本身，导入时还读过的文件（OBJ的材质库），ModelCache用它们判断缓存是否过期
+	std::vector<std::string> dependencies;
+};
+
+// Whether a Mesh keeps its CPU-side geometry after the GPU buffers have been filled.
+// Only picking, BLAS rebuilds or export need KEEP_CPU_COPY.
+// STREAMED meshes are not uploaded at all; the MeshStreamer owns their geometry.
+enum MeshResidency
+{
+	RELEASE_AFTER_UPLOAD = 0, KEEP_CPU_COPY, STREAMED
+};
+
 class Mesh
 {
 public:
+	// 包括原始的LOD 0在内最多几级
+	static constexpr uint32_t MAX_LOD_COUNT = 3;
+
 	Mesh(VkDevice& logicalDevice,
 		VkCommandPool& pool,
 		VkQueue& graphicsQueue,
 		VmaAllocator& allocator,
-		const std::vector<vec3>& positions,
-		const std::vector<MyVertexAttribute>& texCoords,
-		const std::vector<uint32_t>& indices,
+		std::vector<vec3> positions,
+		std::vector<VertexAttribute> texCoords,
+		std::vector<std::vector<uint32_t>> lodIndices,
 		const std::string& matInfo,
 		const uint32_t& matID,
 		const aiColor4D& color = { 1.0f, 1.0f, 1.0f, 1.0f },
-		const mat4& transform = mat4(1.0f));
+		const mat4& transform = mat4(1.0f),
+		const MeshResidency& residency = RELEASE_AFTER_UPLOAD,
+		TextureCache* textureCache = nullptr);
 
 	size_t GetPositionCount() const;
 	size_t GetVertAttributeCount() const;
-	size_t GetIndexCount() const;
+	size_t GetIndexCount(const uint32_t& lod = 0) const;
+	uint32_t GetLodCount() const;
+	float GetLodError(const uint32_t& lod) const;
+
+	// 当前仍然留在内存里的CPU端几何数据大小（字节）
+	size_t GetCPUMemoryBytes() const;
+	// 释放CPU端的几何数据，GPU上的Buffer不受影响
+	void ReleaseCPUCopies();
+
+	// 替换CPU端的几何数据（例如从磁盘重新读回来），每一级LOD一组索引和面，faces需要已经带上w分量
+	void SetCPUGeometry(std::vector<vec3>&& newPositions,
+		std::vector<VertexAttribute>&& newVertAttributes,
+		std::vector<std::vector<uint32_t>>&& newLodIndices,
+		std::vector<std::vector<uint32_t>>&& newLodFaces);
+	// 用CPU端的几何数据创建并填充GPU上的Buffer
+	void UploadGeometry();
+	// 释放GPU上的几何Buffer和所有LOD的底层加速结构，贴图和颜色保留
+	void EvictGeometry();
+	// 几何Buffer与底层加速结构占用的显存（字节）
+	size_t GetGPUMemoryBytes() const;
+	// 其中底层加速结构占用的部分
+	size_t GetBLASMemoryBytes() const;
 
 	Buffer& GetPositionBuffer();
 	Buffer& GetVertAttriBuffer();
-	Buffer& GetIndexBuffer();
-	Buffer& GetFacesBuffer();
+	Buffer& GetIndexBuffer(const uint32_t& lod = 0);
+	Buffer& GetFacesBuffer(const uint32_t& lod = 0);
 	Buffer& GetColorBuffer();
 
 	void SetModel(const mat4& newModel);
@@ -75,35 +179,57 @@ public:
 	static std::shared_ptr<Mesh> ImportMeshFromFileOfIndex(VkDevice& logicalDevice,
 		VkCommandPool& pool,
 		VkQueue& graphicsQueue,
-		VmaAllocator& allocator, const std::string& path, size_t index);
+		VmaAllocator& allocator, const std::string& path, size_t index,
+		const MeshResidency& residency = RELEASE_AFTER_UPLOAD);
+	// instances receives one record per (node, mesh) pair with the accumulated world transform
 	static std::vector<std::shared_ptr<Mesh>> ImportAllMeshesFromFile(VkDevice& logicalDevice,
 		VkCommandPool& pool,
 		VkQueue& graphicsQueue,
-		VmaAllocator& allocator, const std::string& path);
+		VmaAllocator& allocator, const std::string& path,
+		std::vector<MeshInstance>& instances,
+		const MeshResidency& residency = RELEASE_AFTER_UPLOAD);
+
+	// Reads and optimizes a model file without touching the GPU; safe to call from several threads.
+	static bool ReadModelFile(const std::string& path, ModelImportData& model);
+	// Simplifies the LOD 0 indices of data into data.lodIndices and data.lodErrors.
+	static void GenerateLods(MeshImportData& data);
+	// The faces (three indices and the packed faces.w) of one LOD
+	static std::vector<uint32_t> BuildFaces(const std::vector<vec3>& positions,
+		const std::vector<VertexAttribute>& vertAttributes,
+		const std::vector<uint32_t>& indices);
+	// Creates the meshes of a model on the calling thread. Material IDs are numbered from firstMatID,
+	// so meshes of several models can share the texture and color arrays.
+	// With a textureCache the diffuse textures are shared by path and stream in through its Update;
+	// without one every mesh loads its own texture right away.
+	static std::vector<std::shared_ptr<Mesh>> CreateMeshes(VkDevice& logicalDevice,
+		VkCommandPool& pool,
+		VkQueue& graphicsQueue,
+		VmaAllocator& allocator,
+		ModelImportData& model,
+		const uint32_t& firstMatID,
+		const MeshResidency& residency = RELEASE_AFTER_UPLOAD,
+		TextureCache* textureCache = nullptr);
+
+	// 下面几个CPU端数据只有KEEP_CPU_COPY的Mesh才有内容，否则上传之后就是空的
 
 	[[nodiscard]] const std::vector<vec3>& GetPositions() const
 	{
 		return positions;
 	}
 
-	[[nodiscard]] const std::vector<MyVertexAttribute>& GetVertAttributes() const
+	[[nodiscard]] const std::vector<VertexAttribute>& GetVertAttributes() const
 	{
 		return vertAttributes;
 	}
 
-	[[nodiscard]] const std::vector<uint32_t>& GetIndicies() const
+	[[nodiscard]] const std::vector<uint32_t>& GetIndicies(const uint32_t& lod = 0) const
 	{
-		return indices;
+		return mLods[lod].indices;
 	}
 
-	[[nodiscard]] const std::vector<uint32_t>& GetFaces() const
+	[[nodiscard]] const std::vector<uint32_t>& GetFaces(const uint32_t& lod = 0) const
 	{
-		return faces;
-	}
-
-	[[nodiscard]] const std::vector<uint32_t>& GetMatIDs() const
-	{
-		return matIDs;
+		return mLods[lod].faces;
 	}
 
 	[[nodiscard]] const uint32_t& GetMatID() const
@@ -111,9 +237,17 @@ public:
 		return matID;
 	}
 
+	// 只有没用TextureCache创建的Mesh才有自己的贴图
 	[[nodiscard]] const Image& GetDiffuseTex() const
 	{
-		return diffuseTex;
+		assert(diffuseTex);
+		return *diffuseTex;
+	}
+
+	// 贴图在贴图数组里的位置，写在颜色Buffer里给Shader用
+	[[nodiscard]] uint32_t GetTextureIndex() const
+	{
+		return mTextureIndex;
 	}
 
 	[[nodiscard]] const std::string& GetMatInfo() const
@@ -121,6 +255,13 @@ public:
 		return matInfo;
 	}
 
+	// ModelCache里的几何文件，没有烘焙成功的话是空的
+	[[nodiscard]] const std::string& GetCookedPath() const
+	{
+		return mCookedPath;
+	}
+
+	// 第一个引用这个Mesh的节点的变换（转置过的），场景里的摆放以MeshInstance为准
 	[[nodiscard]] const mat4& GetTransform() const
 	{
 		return transform;
@@ -131,9 +272,9 @@ public:
 		return aiMatrixTransform;
 	}
 
-	[[nodiscard]] AccelerationStructure& GetAccelerationStructure()
+	[[nodiscard]] AccelerationStructure& GetAccelerationStructure(const uint32_t& lod = 0)
 	{
-		return mAccelerationStructure;
+		return mLods[lod].accelerationStructure;
 	}
 
 	[[nodiscard]] const MeshType& GetMeshType() const
@@ -146,26 +287,70 @@ public:
 		return mName;
 	}
 
+	[[nodiscard]] const MeshResidency& GetResidency() const
+	{
+		return mResidency;
+	}
+
+	[[nodiscard]] bool HasGPUGeometry() const
+	{
+		return mHasGPUGeometry;
+	}
+
+	// 模型空间下的包围盒
+	[[nodiscard]] const vec3& GetBoundsMin() const
+	{
+		return mBoundsMin;
+	}
+
+	[[nodiscard]] const vec3& GetBoundsMax() const
+	{
+		return mBoundsMax;
+	}
+
+	// 导入时MeshOptimizer重排前后LOD 0索引的局部性，显示在ImGUI上
+	[[nodiscard]] const MeshLocalityStats& GetLocalityBefore() const
+	{
+		return mLocalityBefore;
+	}
+
+	[[nodiscard]] const MeshLocalityStats& GetLocalityAfter() const
+	{
+		return mLocalityAfter;
+	}
+
 protected:
 	VkDevice& mLogicalDevice;
 	MeshModelMat4 modelObj;
 
 	std::vector<vec3> positions; // 顶点坐标
-	std::vector<MyVertexAttribute> vertAttributes; // 顶点描述
-	std::vector<uint32_t> indices; // 索引
-	std::vector<uint32_t> faces; // 面
-	std::vector<uint32_t> matIDs; // 材质ID
+	std::vector<VertexAttribute> vertAttributes; // 顶点描述（压缩后的法线与UV）
+	// LOD 0是导入的原始网格，后面每一级越来越粗糙
+	std::vector<MeshLod> mLods;
+
+	// CPU端数据可能已经释放，数量单独记录一份给BLAS等使用
+	size_t mPositionCount = 0;
+	size_t mVertAttributeCount = 0;
+	MeshResidency mResidency = RELEASE_AFTER_UPLOAD;
+	bool mHasGPUGeometry = false;
+
+	vec3 mBoundsMin = vec3(0.0f);
+	vec3 mBoundsMax = vec3(0.0f);
+
+	MeshLocalityStats mLocalityBefore;
+	MeshLocalityStats mLocalityAfter;
+	std::string mCookedPath;
 
 	Buffer positionBuffer;
 	Buffer vertAttriBuffer;
-	Buffer indexBuffer;
-	Buffer facesBuffer;
 	Buffer colorBuffer;
 
 	std::string matInfo;
 	uint32_t matID;
 
-	Image diffuseTex;
+	// 热重载的时候整个换掉，旧的还要留到GPU用完；贴图由TextureCache共享的时候是空的
+	std::shared_ptr<Image> diffuseTex;
+	uint32_t mTextureIndex = 0;
 
 	mat4 transform;
 	aiMatrix4x4 aiMatrixTransform;
@@ -174,18 +359,40 @@ protected:
 	VkQueue& mGraphicsQueue;
 	VmaAllocator& mAllocator;
 
-	AccelerationStructure mAccelerationStructure;
-
 	aiColor4D mColor;
 
 	MeshType mMeshType = OPAQUE;
 
 	std::string mName;
 private:
-	static std::shared_ptr<Mesh> ImportMeshFromAIScene(VkDevice& logicalDevice,
+	// 每一级的目标三角形数量是上一级的多少分之一
+	static constexpr size_t LOD_REDUCTION = 4;
+	// 简化误差超过模型最长边的这个比例就停下来
+	static constexpr float LOD_MAX_ERROR = 0.05f;
+	// 三角形太少的Mesh不值得再生成LOD
+	static constexpr size_t LOD_MIN_TRIANGLES = 256;
+
+	// 从matInfo读取贴图并创建ImageView和Sampler
+	void LoadDiffuseTex(Image& image);
+	// 三角形的纹理LOD常数，放进faces.w
+	static float ComputeTexLodConstant(const std::vector<vec3>& positions,
+		const std::vector<VertexAttribute>& vertAttributes,
+		const uint32_t* triangle);
+
+	// Assimp导入时的后处理：三角化、合并相同的顶点、反转UV的Y轴、没有法线的话生成法线
+	static constexpr unsigned int IMPORT_FLAGS = aiProcess_Triangulate
+		| aiProcess_JoinIdenticalVertices
+		| aiProcess_FlipUVs
+		| aiProcess_GenNormals;
+
+	static MeshImportData ReadAIMesh(const aiScene* scene, size_t index);
+	static std::shared_ptr<Mesh> CreateMesh(VkDevice& logicalDevice,
 		VkCommandPool& pool,
 		VkQueue& graphicsQueue,
 		VmaAllocator& allocator,
-		const aiScene* scene, size_t index, const std::string& path, const uint32_t& matID);
+		MeshImportData&& data,
+		const uint32_t& matID,
+		const MeshResidency& residency,
+		TextureCache* textureCache);
 };
 
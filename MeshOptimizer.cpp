@@ -0,0 +1,149 @@
+﻿#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <numeric>
+
+uint32_t MeshOptimizer::MortonCode(const vec3& normalizedPosition)
+{
+	// 每个轴量化到10位，再把三个轴的位交错排列成30位的Morton码
+	const auto expandBits = [](uint32_t v)
+	{
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	};
+	const auto quantized = glm::clamp(normalizedPosition * 1024.0f, vec3(0.0f), vec3(1023.0f));
+	return expandBits(static_cast<uint32_t>(quantized.x)) * 4
+		+ expandBits(static_cast<uint32_t>(quantized.y)) * 2
+		+ expandBits(static_cast<uint32_t>(quantized.z));
+}
+
+void MeshOptimizer::SortTriangles(const std::vector<vec3>& positions, std::vector<uint32_t>& indices)
+{
+	const size_t numFaces = indices.size() / 3;
+	if (numFaces == 0)
+	{
+		return;
+	}
+
+	// 三角形按照重心的Morton码排序，空间上相邻的三角形在内存里也相邻
+	vec3 boundsMin(std::numeric_limits<float>::max());
+	vec3 boundsMax(std::numeric_limits<float>::lowest());
+	for (const auto& index : indices)
+	{
+		boundsMin = glm::min(boundsMin, positions[index]);
+		boundsMax = glm::max(boundsMax, positions[index]);
+	}
+	const vec3 extent = boundsMax - boundsMin;
+	// 包围盒某个轴是扁平的时候避免除0
+	const vec3 invExtent(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+		extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+		extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+	std::vector<uint32_t> faceCodes(numFaces);
+	for (size_t i = 0; i < numFaces; i++)
+	{
+		const vec3 centroid = (positions[indices[3 * i + 0]]
+			+ positions[indices[3 * i + 1]]
+			+ positions[indices[3 * i + 2]]) / 3.0f;
+		faceCodes[i] = MortonCode((centroid - boundsMin) * invExtent);
+	}
+
+	std::vector<uint32_t> faceOrder(numFaces);
+	std::iota(faceOrder.begin(), faceOrder.end(), 0u);
+	// stable_sort保证Morton码相同的三角形保持原来的相对顺序
+	std::stable_sort(faceOrder.begin(), faceOrder.end(),
+		[&](const uint32_t& a, const uint32_t& b) { return faceCodes[a] < faceCodes[b]; });
+
+	std::vector<uint32_t> sortedIndices(indices.size());
+	for (size_t i = 0; i < numFaces; i++)
+	{
+		const auto& face = faceOrder[i];
+		sortedIndices[3 * i + 0] = indices[3 * face + 0];
+		sortedIndices[3 * i + 1] = indices[3 * face + 1];
+		sortedIndices[3 * i + 2] = indices[3 * face + 2];
+	}
+
+	indices = std::move(sortedIndices);
+}
+
+void MeshOptimizer::Optimize(std::vector<vec3>& positions,
+	std::vector<VertexAttribute>& vertexAttributes,
+	std::vector<uint32_t>& indices)
+{
+	assert(positions.size() == vertexAttributes.size());
+
+	if (indices.size() < 3)
+	{
+		return;
+	}
+
+	// 1. 空间上相邻的三角形在内存里也相邻
+	SortTriangles(positions, indices);
+
+	// 2. 顶点按照第一次被引用的顺序重新编号，没有被引用的顶点直接丢弃
+	constexpr uint32_t UNUSED = std::numeric_limits<uint32_t>::max();
+	std::vector<uint32_t> remap(positions.size(), UNUSED);
+	uint32_t nextVertex = 0;
+	for (auto& index : indices)
+	{
+		if (remap[index] == UNUSED)
+		{
+			remap[index] = nextVertex++;
+		}
+		index = remap[index];
+	}
+
+	std::vector<vec3> newPositions(nextVertex);
+	std::vector<VertexAttribute> newAttributes(nextVertex);
+	for (size_t i = 0; i < positions.size(); i++)
+	{
+		if (remap[i] != UNUSED)
+		{
+			newPositions[remap[i]] = positions[i];
+			newAttributes[remap[i]] = vertexAttributes[i];
+		}
+	}
+
+	positions = std::move(newPositions);
+	vertexAttributes = std::move(newAttributes);
+}
+
+MeshLocalityStats MeshOptimizer::AnalyzeLocality(const std::vector<uint32_t>& indices, const size_t& vertexCount)
+{
+	MeshLocalityStats stats;
+	const size_t numFaces = indices.size() / 3;
+	if (numFaces == 0 || vertexCount == 0)
+	{
+		return stats;
+	}
+
+	// 模拟一个FIFO的顶点缓存：记录每个顶点进入缓存之后（算上它自己）的未命中计数
+	// 之后又未命中的次数小于缓存大小，说明它还没有被挤出去
+	std::vector<size_t> cacheTimestamps(vertexCount, 0);
+	std::vector<bool> referenced(vertexCount, false);
+	size_t misses = 0;
+	size_t referencedCount = 0;
+	for (const auto& index : indices)
+	{
+		if (!referenced[index])
+		{
+			referenced[index] = true;
+			referencedCount++;
+		}
+		else if (misses - cacheTimestamps[index] < CACHE_SIZE)
+		{
+			continue;
+		}
+		misses++;
+		cacheTimestamps[index] = misses;
+	}
+
+	stats.acmr = static_cast<float>(misses) / static_cast<float>(numFaces);
+	stats.atvr = static_cast<float>(misses) / static_cast<float>(referencedCount);
+	return stats;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+#include "shared_with_shaders.h"
+
+// Locality statistics of an index buffer, simulated with a FIFO post-transform cache.
+struct MeshLocalityStats
+{
+	float acmr = 0.0f; // average cache miss ratio: misses per triangle (0.5 ~ 3.0, lower is better)
+	float atvr = 0.0f; // average transformed vertex ratio: misses per referenced vertex (>= 1.0, lower is better)
+};
+
+// Reorders the geometry of a mesh before it is uploaded so that neighbouring
+// triangles and the vertices they fetch sit close to each other in memory.
+class MeshOptimizer
+{
+public:
+	static constexpr size_t CACHE_SIZE = 16;
+
+	/*
+	 * Sorts triangles by the Morton code of their centroids, then renumbers the vertices
+	 * in order of first use and drops the ones no triangle references.
+	 */
+	static void Optimize(std::vector<vec3>& positions,
+		std::vector<VertexAttribute>& vertexAttributes,
+		std::vector<uint32_t>& indices);
+
+	// Only the triangle sort of Optimize, for index lists that share their vertices with others (LODs).
+	static void SortTriangles(const std::vector<vec3>& positions, std::vector<uint32_t>& indices);
+
+	static MeshLocalityStats AnalyzeLocality(const std::vector<uint32_t>& indices, const size_t& vertexCount);
+
+private:
+	static uint32_t MortonCode(const vec3& normalizedPosition);
+};
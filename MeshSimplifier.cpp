@@ -0,0 +1,357 @@
+﻿#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+namespace
+{
+	// 边界边的约束平面权重，越大开口的边缘越不容易被简化掉
+	constexpr double BOUNDARY_WEIGHT = 10.0;
+
+	// 对称的4x4矩阵只需要存10个数，w是累加的面积权重
+	struct Quadric
+	{
+		double a2 = 0, b2 = 0, c2 = 0, d2 = 0;
+		double ab = 0, ac = 0, ad = 0, bc = 0, bd = 0, cd = 0;
+		double w = 0;
+	};
+
+	void AddPlane(Quadric& q, const glm::dvec3& n, const double& d, const double& weight)
+	{
+		q.a2 += n.x * n.x * weight;
+		q.b2 += n.y * n.y * weight;
+		q.c2 += n.z * n.z * weight;
+		q.d2 += d * d * weight;
+		q.ab += n.x * n.y * weight;
+		q.ac += n.x * n.z * weight;
+		q.ad += n.x * d * weight;
+		q.bc += n.y * n.z * weight;
+		q.bd += n.y * d * weight;
+		q.cd += n.z * d * weight;
+		q.w += weight;
+	}
+
+	Quadric Add(const Quadric& q, const Quadric& r)
+	{
+		return {
+			q.a2 + r.a2, q.b2 + r.b2, q.c2 + r.c2, q.d2 + r.d2,
+			q.ab + r.ab, q.ac + r.ac, q.ad + r.ad, q.bc + r.bc, q.bd + r.bd, q.cd + r.cd,
+			q.w + r.w };
+	}
+
+	// 点到所有平面距离平方的加权平均
+	double Error(const Quadric& q, const glm::dvec3& p)
+	{
+		if (q.w <= 0.0)
+		{
+			return 0.0;
+		}
+		const double r = q.a2 * p.x * p.x + q.b2 * p.y * p.y + q.c2 * p.z * p.z + q.d2
+			+ 2.0 * (q.ab * p.x * p.y + q.ac * p.x * p.z + q.ad * p.x + q.bc * p.y * p.z + q.bd * p.y + q.cd * p.z);
+		return std::abs(r) / q.w;
+	}
+
+	struct PositionHash
+	{
+		size_t operator()(const vec3& p) const
+		{
+			uint32_t bits[3];
+			std::memcpy(bits, &p, sizeof(bits));
+			return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+		}
+	};
+
+	uint64_t EdgeKey(const uint32_t& a, const uint32_t& b)
+	{
+		return a < b ? (static_cast<uint64_t>(a) << 32) | b : (static_cast<uint64_t>(b) << 32) | a;
+	}
+}
+
+std::vector<uint32_t> MeshSimplifier::Simplify(const std::vector<vec3>& positions,
+	const std::vector<uint32_t>& indices,
+	const size_t& targetIndexCount,
+	const float& maxError,
+	float& resultError)
+{
+	resultError = 0.0f;
+	std::vector<uint32_t> result = indices;
+	size_t triangleCount = result.size() / 3;
+
+	const size_t vertexCount = positions.size();
+	if (result.size() <= targetIndexCount || vertexCount == 0)
+	{
+		return result;
+	}
+
+	// 归一化到包围盒最长边为1，这样误差就是相对于模型大小的
+	vec3 boundsMin = positions.front();
+	vec3 boundsMax = positions.front();
+	for (const auto& position : positions)
+	{
+		boundsMin = glm::min(boundsMin, position);
+		boundsMax = glm::max(boundsMax, position);
+	}
+	const vec3 extent = boundsMax - boundsMin;
+	const float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+	const double scale = maxExtent > 0.0f ? 1.0 / maxExtent : 1.0;
+	std::vector<glm::dvec3> points(vertexCount);
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		points[i] = glm::dvec3(positions[i] - boundsMin) * scale;
+	}
+
+	// 位置相同的顶点（UV或法线的接缝）焊在一起，拓扑关系只看焊接之后的顶点
+	std::vector<uint32_t> welded(vertexCount);
+	{
+		std::unordered_map<vec3, uint32_t, PositionHash> firstVertex;
+		firstVertex.reserve(vertexCount);
+		for (uint32_t i = 0; i < vertexCount; i++)
+		{
+			welded[i] = firstVertex.emplace(positions[i], i).first->second;
+		}
+	}
+
+	// 初始的Quadric：每个三角形所在的平面，按面积加权
+	std::vector<Quadric> quadrics(vertexCount);
+	struct EdgeInfo
+	{
+		uint32_t count;
+		uint32_t from;
+		uint32_t to;
+		glm::dvec3 normal;
+	};
+	std::unordered_map<uint64_t, EdgeInfo> edgeInfos;
+	edgeInfos.reserve(result.size());
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const uint32_t w[3] = { welded[result[3 * t + 0]], welded[result[3 * t + 1]], welded[result[3 * t + 2]] };
+		const glm::dvec3 cross = glm::cross(points[w[1]] - points[w[0]], points[w[2]] - points[w[0]]);
+		const double length = glm::length(cross);
+		if (length <= 0.0)
+		{
+			continue;
+		}
+		const glm::dvec3 normal = cross / length;
+		const double d = -glm::dot(normal, points[w[0]]);
+		for (const auto& vertex : w)
+		{
+			AddPlane(quadrics[vertex], normal, d, length * 0.5);
+		}
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			auto& info = edgeInfos.try_emplace(EdgeKey(w[k], w[(k + 1) % 3]), EdgeInfo{ 0, w[k], w[(k + 1) % 3], normal }).first->second;
+			info.count++;
+		}
+	}
+
+	// 边界边（焊接后只有一个三角形使用）加一个垂直于三角形的约束平面，防止开口的边缘往里缩
+	for (const auto& [key, info] : edgeInfos)
+	{
+		if (info.count != 1)
+		{
+			continue;
+		}
+		const glm::dvec3 edge = points[info.to] - points[info.from];
+		const double length = glm::length(edge);
+		if (length <= 0.0)
+		{
+			continue;
+		}
+		const glm::dvec3 normal = glm::normalize(glm::cross(edge, info.normal));
+		const double d = -glm::dot(normal, points[info.from]);
+		AddPlane(quadrics[info.from], normal, d, length * length * BOUNDARY_WEIGHT);
+		AddPlane(quadrics[info.to], normal, d, length * length * BOUNDARY_WEIGHT);
+	}
+
+	const double maxCost = static_cast<double>(maxError) * maxError;
+	const size_t targetTriangles = targetIndexCount / 3;
+	std::vector<uint8_t> touched(vertexCount);
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<uint32_t> offsets(vertexCount + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<std::pair<uint32_t, uint32_t>> copies;
+
+	// 每一轮先按代价排序所有的边，然后贪心地合并互不相邻的边，直到三角形数量达标
+	while (triangleCount > targetTriangles)
+	{
+		// 每个焊接顶点周围的三角形
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (size_t i = 0; i < triangleCount * 3; i++)
+		{
+			offsets[welded[result[i]] + 1]++;
+		}
+		std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+		adjacency.resize(triangleCount * 3);
+		{
+			std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < triangleCount * 3; i++)
+			{
+				adjacency[cursor[welded[result[i]]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+
+		std::vector<uint64_t> edges;
+		edges.reserve(triangleCount * 3);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				const uint32_t a = welded[result[3 * t + k]];
+				const uint32_t b = welded[result[3 * t + (k + 1) % 3]];
+				if (a != b)
+				{
+					edges.push_back(EdgeKey(a, b));
+				}
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+		// 保留原来的顶点，所以一条边只有两个方向可以选，取代价小的那个
+		struct Candidate
+		{
+			uint32_t from;
+			uint32_t to;
+			double cost;
+		};
+		std::vector<Candidate> candidates;
+		candidates.reserve(edges.size());
+		for (const auto& edge : edges)
+		{
+			const auto a = static_cast<uint32_t>(edge >> 32);
+			const auto b = static_cast<uint32_t>(edge & 0xFFFFFFFFu);
+			const Quadric q = Add(quadrics[a], quadrics[b]);
+			const double costToB = Error(q, points[b]);
+			const double costToA = Error(q, points[a]);
+			candidates.push_back(costToB <= costToA ? Candidate{ a, b, costToB } : Candidate{ b, a, costToA });
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const Candidate& x, const Candidate& y) { return x.cost < y.cost; });
+
+		std::fill(touched.begin(), touched.end(), 0);
+		std::iota(remap.begin(), remap.end(), 0u);
+		const size_t needed = triangleCount - targetTriangles;
+		size_t removed = 0;
+		size_t collapses = 0;
+		for (const auto& candidate : candidates)
+		{
+			if (candidate.cost > maxCost || removed >= needed)
+			{
+				break;
+			}
+			if (touched[candidate.from] || touched[candidate.to])
+			{
+				continue;
+			}
+
+			// 检查：合并之后周围的三角形不能翻面；from的每一个接缝副本都要能找到对应的to的副本
+			bool valid = true;
+			size_t collapsedTriangles = 0;
+			copies.clear();
+			for (uint32_t a = offsets[candidate.from]; a < offsets[candidate.from + 1] && valid; a++)
+			{
+				const uint32_t t = adjacency[a];
+				const uint32_t* tri = &result[3 * t];
+				uint32_t fromCopy = 0;
+				uint32_t toCopy = UINT32_MAX;
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					if (welded[tri[k]] == candidate.from)
+					{
+						fromCopy = tri[k];
+					}
+					else if (welded[tri[k]] == candidate.to)
+					{
+						toCopy = tri[k];
+					}
+				}
+
+				if (toCopy != UINT32_MAX)
+				{
+					// 这个三角形会退化掉，顺便记下from的这个副本要合并到to的哪个副本上
+					collapsedTriangles++;
+					if (std::none_of(copies.begin(), copies.end(), [&](const auto& copy) { return copy.first == fromCopy; }))
+					{
+						copies.emplace_back(fromCopy, toCopy);
+					}
+					continue;
+				}
+
+				glm::dvec3 p[3];
+				glm::dvec3 moved[3];
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					p[k] = points[welded[tri[k]]];
+					moved[k] = welded[tri[k]] == candidate.from ? points[candidate.to] : p[k];
+				}
+				const glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				const glm::dvec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+				if (glm::dot(before, after) <= 0.0)
+				{
+					valid = false;
+				}
+			}
+			for (uint32_t a = offsets[candidate.from]; a < offsets[candidate.from + 1] && valid; a++)
+			{
+				const uint32_t* tri = &result[3 * adjacency[a]];
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					if (welded[tri[k]] == candidate.from
+						&& std::none_of(copies.begin(), copies.end(), [&](const auto& copy) { return copy.first == tri[k]; }))
+					{
+						// 这个副本和to不在同一侧的接缝上，合并会把UV扯坏
+						valid = false;
+					}
+				}
+			}
+			if (!valid)
+			{
+				continue;
+			}
+
+			for (const auto& [fromCopy, toCopy] : copies)
+			{
+				remap[fromCopy] = toCopy;
+			}
+			quadrics[candidate.to] = Add(quadrics[candidate.to], quadrics[candidate.from]);
+			resultError = std::max(resultError, static_cast<float>(std::sqrt(candidate.cost)));
+
+			// from周围一圈的顶点这一轮都不再动，保证上面的翻面检查仍然成立
+			for (uint32_t a = offsets[candidate.from]; a < offsets[candidate.from + 1]; a++)
+			{
+				const uint32_t* tri = &result[3 * adjacency[a]];
+				touched[welded[tri[0]]] = touched[welded[tri[1]]] = touched[welded[tri[2]]] = 1;
+			}
+			removed += collapsedTriangles;
+			collapses++;
+		}
+
+		if (collapses == 0)
+		{
+			break;
+		}
+
+		// 应用这一轮的合并，去掉退化的三角形
+		size_t write = 0;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			const uint32_t a = remap[result[3 * t + 0]];
+			const uint32_t b = remap[result[3 * t + 1]];
+			const uint32_t c = remap[result[3 * t + 2]];
+			if (welded[a] == welded[b] || welded[b] == welded[c] || welded[a] == welded[c])
+			{
+				continue;
+			}
+			result[3 * write + 0] = a;
+			result[3 * write + 1] = b;
+			result[3 * write + 2] = c;
+			write++;
+		}
+		triangleCount = write;
+		result.resize(triangleCount * 3);
+	}
+
+	return result;
+}
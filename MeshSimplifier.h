@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+#include "shared_with_shaders.h"
+
+// Quadric error metric edge collapse used to build the LOD chain of a Mesh at import time.
+// Collapses always move one vertex onto a neighbour, so every LOD keeps indexing the original vertex buffers.
+class MeshSimplifier
+{
+public:
+	/*
+	 * Collapses edges until the index count drops to targetIndexCount or the next collapse
+	 * would exceed maxError (relative to the largest extent of the mesh).
+	 * resultError receives the largest error of the collapses that were applied.
+	 * Vertices sharing a position (UV / normal seams) are collapsed together, so seams stay closed.
+	 */
+	static std::vector<uint32_t> Simplify(const std::vector<vec3>& positions,
+		const std::vector<uint32_t>& indices,
+		const size_t& targetIndexCount,
+		const float& maxError,
+		float& resultError);
+};
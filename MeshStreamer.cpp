@@ -0,0 +1,728 @@
+﻿#include "MeshStreamer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <numeric>
+#include <stdexcept>
+
+#include "Device.h"
+#include "VertexCompression.h"
+
+MeshStreamer::MeshStreamer(VmaAllocator& allocator,
+	VkCommandPool& graphicsPool,
+	const VkDeviceSize& budgetBytes) :
+	mAllocator(allocator),
+	mGraphicsPool(graphicsPool),
+	mBudgetBytes(budgetBytes),
+	mBlasBuilder(allocator),
+	mBuildScratchBuffer(allocator)
+{
+	// 底层加速结构在Compute Queue上构建，需要一个单独的命令池
+	VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+	commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	commandPoolCreateInfo.queueFamilyIndex = Device::GetQueue().ComputeQueueFamilyIndex;
+	auto error = vkCreateCommandPool(Device::GetLogicalDevice(), &commandPoolCreateInfo, nullptr, &mComputePool);
+	assert(error == VK_SUCCESS);
+
+	// 用Fence轮询构建是否完成，渲染线程不需要等它
+	VkFenceCreateInfo fenceCreateInfo = {};
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	error = vkCreateFence(Device::GetLogicalDevice(), &fenceCreateInfo, nullptr, &mBuildFence);
+	assert(error == VK_SUCCESS);
+}
+
+void MeshStreamer::Register(const std::vector<std::shared_ptr<Mesh>>& meshes, const std::vector<MeshInstance>& instances)
+{
+	// 几何体槽位和材质序号都要放得进Instance Custom Index的12位，超出的话会被截断，Shader读到别的Mesh
+	size_t slotCount = 1; // 最后一个是替身
+	for (const auto& mesh : meshes)
+	{
+		slotCount += mesh->GetLodCount();
+		if (mesh->GetMatID() > SWS_INSTANCE_MATERIAL_MASK)
+		{
+			throw std::runtime_error("The scene has more materials than an instance custom index can address (at most "
+				+ std::to_string(SWS_INSTANCE_MATERIAL_MASK + 1) + ")");
+		}
+	}
+	if (slotCount > SWS_INSTANCE_GEOMETRY_MASK + 1)
+	{
+		throw std::runtime_error("The scene needs " + std::to_string(slotCount) + " geometry slots (one per mesh LOD), an instance custom index can address at most "
+			+ std::to_string(SWS_INSTANCE_GEOMETRY_MASK + 1));
+	}
+
+	CreateStandIn();
+
+	std::vector<std::shared_ptr<Mesh>> pinnedMeshes;
+	mEntries.resize(meshes.size());
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		auto& entry = mEntries[i];
+		auto& mesh = meshes[i];
+		assert(mesh->GetResidency() == STREAMED);
+		entry.mesh = mesh;
+		entry.slotBase = static_cast<uint32_t>(mSlots.size());
+		entry.slotCount = mesh->GetLodCount();
+		for (uint32_t lod = 0; lod < mesh->GetLodCount(); lod++)
+		{
+			mSlots.emplace_back(i, lod);
+		}
+
+		// 读盘线程还没启动，不用加锁
+		entry.cachePath = mesh->GetCookedPath();
+		PrepareEntry(i, pinnedMeshes);
+	}
+
+	// 每个Instance的世界空间包围球，用来估算它在屏幕上的大小
+	mInstances.clear();
+	mInstances.reserve(instances.size());
+	for (const auto& instance : instances)
+	{
+		assert(instance.meshIndex < mEntries.size());
+		StreamInstance& streamInstance = mInstances.emplace_back();
+		streamInstance.entry = instance.meshIndex;
+		streamInstance.transform = instance.transform;
+		UpdateInstanceBounds(streamInstance);
+	}
+
+	mBlasBuilder.Build(Device::GetLogicalDevice(), mGraphicsPool, Device::GetGraphicsQueue(), pinnedMeshes);
+	for (auto& entry : mEntries)
+	{
+		if (entry.pinned)
+		{
+			entry.gpuBytes = entry.mesh->GetGPUMemoryBytes();
+		}
+	}
+
+	mLoaderThread = std::thread(&MeshStreamer::LoaderLoop, this);
+}
+
+void MeshStreamer::ReplaceMesh(const size_t& index, const std::shared_ptr<Mesh>& mesh)
+{
+	assert(index < mEntries.size());
+	assert(mesh->GetResidency() == STREAMED);
+
+	// 正在构建的批次里有旧的Mesh的话先等它构建完，不然构建完成的状态会算到新的Mesh头上
+	if (std::find(mBuildingEntries.begin(), mBuildingEntries.end(), index) != mBuildingEntries.end())
+	{
+		vkWaitForFences(Device::GetLogicalDevice(), 1, &mBuildFence, VK_TRUE, UINT64_MAX);
+		FinishBuild();
+	}
+
+	auto& entry = mEntries[index];
+	{
+		// 读盘线程取请求的时候会读cachePath
+		std::lock_guard<std::mutex> lock(mLoaderMutex);
+		entry.cachePath = mesh->GetCookedPath();
+		if (entry.state == LOADING)
+		{
+			// 还在排队的请求直接撤掉，已经在读的（或者读完还没取走的）结果到时候丢掉
+			const auto request = std::find(mLoadRequests.begin(), mLoadRequests.end(), index);
+			if (request != mLoadRequests.end())
+			{
+				mLoadRequests.erase(request);
+			}
+			else
+			{
+				entry.discardLoad = true;
+			}
+		}
+	}
+
+	// 原来需要常驻的话，新的几何数据直接进入下一批构建，不用再从盘上读回来
+	const bool wanted = entry.state != EVICTED;
+	CookedGeometry geometry;
+	if (wanted)
+	{
+		geometry.positions = mesh->GetPositions();
+		geometry.vertAttributes = mesh->GetVertAttributes();
+		for (uint32_t lod = 0; lod < mesh->GetLodCount(); lod++)
+		{
+			geometry.lodIndices.push_back(mesh->GetIndicies(lod));
+			geometry.lodFaces.push_back(mesh->GetFaces(lod));
+		}
+	}
+
+	// 旧的Mesh由调用的一方等GPU用完之后释放，这里只是不再引用它
+	entry.mesh = mesh;
+	entry.loaded = {};
+	entry.loadFailed = false;
+	entry.pinned = false;
+	entry.state = EVICTED;
+
+	std::vector<std::shared_ptr<Mesh>> pinnedMeshes;
+	PrepareEntry(index, pinnedMeshes);
+	if (!pinnedMeshes.empty())
+	{
+		mBlasBuilder.Build(Device::GetLogicalDevice(), mGraphicsPool, Device::GetGraphicsQueue(), pinnedMeshes);
+		entry.gpuBytes = mesh->GetGPUMemoryBytes();
+	}
+	else if (wanted)
+	{
+		entry.loaded = std::move(geometry);
+		entry.state = LOADED;
+	}
+
+	const uint32_t lodCount = std::min(mesh->GetLodCount(), entry.slotCount);
+	for (auto& instance : mInstances)
+	{
+		if (instance.entry == index)
+		{
+			UpdateInstanceBounds(instance);
+			instance.lod = std::min(instance.lod, lodCount - 1);
+		}
+	}
+	mReplaced = true;
+}
+
+void MeshStreamer::UpdateInstance(const size_t& index, const MeshInstance& instance)
+{
+	assert(index < mInstances.size() && instance.meshIndex < mEntries.size());
+	auto& streamInstance = mInstances[index];
+	const auto& entry = mEntries[instance.meshIndex];
+	streamInstance.entry = instance.meshIndex;
+	streamInstance.transform = instance.transform;
+	// 换了Mesh的话原来的LOD不一定还有
+	streamInstance.lod = std::min(streamInstance.lod, std::min(entry.mesh->GetLodCount(), entry.slotCount) - 1);
+	UpdateInstanceBounds(streamInstance);
+	mReplaced = true;
+}
+
+bool MeshStreamer::Update(const Camera& camera)
+{
+	bool changed = FinishBuild();
+	changed |= mReplaced;
+	mReplaced = false;
+	CollectLoadResults();
+
+	// 用包围球估算每个Instance投影到屏幕上的大小，Mesh的大小取它最大的那个Instance
+	const vec3& cameraPos = camera.GetPosition();
+	const float tanHalfFov = std::tan(Deg2Rad(camera.GetFovY()) * 0.5f);
+	std::vector<float> instanceSizes(mInstances.size());
+	std::vector<float> screenSizes(mEntries.size(), 0.0f);
+	for (size_t i = 0; i < mInstances.size(); i++)
+	{
+		const auto& instance = mInstances[i];
+		const float distance = std::max(glm::length(instance.worldCenter - cameraPos) - instance.worldRadius, camera.GetNearPlane());
+		instanceSizes[i] = instance.worldRadius / (distance * tanHalfFov);
+		screenSizes[instance.entry] = std::max(screenSizes[instance.entry], instanceSizes[i]);
+	}
+
+	std::vector<size_t> order(mEntries.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](const size_t& a, const size_t& b) { return screenSizes[a] > screenSizes[b]; });
+
+	// 从最重要的开始分配预算，超出预算或者太小的Mesh卸载掉
+	VkDeviceSize usedBytes = 0;
+	bool requested = false;
+	{
+		std::lock_guard<std::mutex> lock(mLoaderMutex);
+		for (const auto& index : order)
+		{
+			auto& entry = mEntries[index];
+			if (entry.pinned)
+			{
+				usedBytes += entry.gpuBytes;
+				continue;
+			}
+
+			const float threshold = entry.state == EVICTED ? LOAD_SCREEN_SIZE : EVICT_SCREEN_SIZE;
+			const bool wanted = !entry.loadFailed
+				&& screenSizes[index] >= threshold
+				&& usedBytes + entry.gpuBytes <= mBudgetBytes;
+			if (wanted)
+			{
+				usedBytes += entry.gpuBytes;
+				if (entry.state == EVICTED)
+				{
+					entry.state = LOADING;
+					mLoadRequests.push_back(index);
+					requested = true;
+				}
+				continue;
+			}
+
+			if (entry.state == RESIDENT)
+			{
+				// 这时候设备是空闲的，可以直接释放
+				entry.mesh->EvictGeometry();
+				entry.state = EVICTED;
+				changed = true;
+			}
+			else if (entry.state == LOADED)
+			{
+				entry.loaded = {};
+				entry.state = EVICTED;
+			}
+			// LOADING和BUILDING的等它们完成，下一帧再决定去留
+		}
+	}
+
+	// 常驻的Mesh换LOD只需要改TLAS Instance引用的底层加速结构
+	for (size_t i = 0; i < mInstances.size(); i++)
+	{
+		auto& instance = mInstances[i];
+		const auto& entry = mEntries[instance.entry];
+		const uint32_t lod = SelectLod(std::min(entry.mesh->GetLodCount(), entry.slotCount), instance.lod, instanceSizes[i]);
+		if (lod != instance.lod && entry.state == RESIDENT)
+		{
+			changed = true;
+		}
+		instance.lod = lod;
+	}
+	if (requested)
+	{
+		mLoaderCondition.notify_one();
+	}
+
+	StartBuild(order);
+	return changed;
+}
+
+uint32_t MeshStreamer::GetGeometrySlotCount() const
+{
+	return static_cast<uint32_t>(mSlots.size()) + 1;
+}
+
+uint32_t MeshStreamer::GetStandInSlot() const
+{
+	return static_cast<uint32_t>(mSlots.size());
+}
+
+Mesh& MeshStreamer::GetSlotMesh(const uint32_t& slot)
+{
+	// 热重载之后LOD可能变少了，多出来的槽位也指向替身
+	if (slot < mSlots.size() && mEntries[mSlots[slot].first].state == RESIDENT
+		&& mSlots[slot].second < mEntries[mSlots[slot].first].mesh->GetLodCount())
+	{
+		return *mEntries[mSlots[slot].first].mesh;
+	}
+	// 没有常驻的Mesh，描述符指向替身的Buffer，保证每个描述符都是有效的
+	return *mStandIn;
+}
+
+uint32_t MeshStreamer::GetSlotLod(const uint32_t& slot) const
+{
+	if (slot < mSlots.size() && mEntries[mSlots[slot].first].state == RESIDENT
+		&& mSlots[slot].second < mEntries[mSlots[slot].first].mesh->GetLodCount())
+	{
+		return mSlots[slot].second;
+	}
+	return 0;
+}
+
+std::vector<VkAccelerationStructureInstanceKHR> MeshStreamer::GetInstances()
+{
+	std::vector<VkAccelerationStructureInstanceKHR> instances(mInstances.size());
+	for (size_t i = 0; i < mInstances.size(); i++)
+	{
+		const auto& streamInstance = mInstances[i];
+		auto& entry = mEntries[streamInstance.entry];
+		if (entry.state == RESIDENT)
+		{
+			instances[i] = TopLevelAccelerationStructure::MakeInstance(*entry.mesh,
+				streamInstance.transform,
+				entry.slotBase + streamInstance.lod,
+				streamInstance.lod);
+			continue;
+		}
+
+		// 替身：Mask和材质跟着原来的Mesh，几何体换成包围盒
+		auto& instance = instances[i];
+		instance = TopLevelAccelerationStructure::MakeInstance(*entry.mesh,
+			streamInstance.transform * entry.standInTransform,
+			GetStandInSlot());
+		instance.instanceCustomIndex = PackInstanceCustomIndex(GetStandInSlot(), entry.mesh->GetMatID());
+		instance.accelerationStructureReference = mStandIn->GetAccelerationStructure().handle;
+	}
+	return instances;
+}
+
+size_t MeshStreamer::GetResidentCount() const
+{
+	return std::count_if(mEntries.begin(), mEntries.end(), [](const StreamEntry& entry) { return entry.state == RESIDENT; });
+}
+
+VkDeviceSize MeshStreamer::GetResidentBytes() const
+{
+	VkDeviceSize bytes = 0;
+	for (const auto& entry : mEntries)
+	{
+		bytes += entry.mesh->GetGPUMemoryBytes();
+	}
+	return bytes;
+}
+
+VkDeviceSize MeshStreamer::GetResidentBLASBytes() const
+{
+	VkDeviceSize bytes = 0;
+	for (const auto& entry : mEntries)
+	{
+		bytes += entry.mesh->GetBLASMemoryBytes();
+	}
+	return bytes;
+}
+
+void MeshStreamer::Dispose()
+{
+	{
+		std::lock_guard<std::mutex> lock(mLoaderMutex);
+		mStopLoader = true;
+	}
+	mLoaderCondition.notify_one();
+	if (mLoaderThread.joinable())
+	{
+		mLoaderThread.join();
+	}
+
+	if (mBuildCommandBuffer != VK_NULL_HANDLE)
+	{
+		vkWaitForFences(Device::GetLogicalDevice(), 1, &mBuildFence, VK_TRUE, UINT64_MAX);
+		vkFreeCommandBuffers(Device::GetLogicalDevice(), mComputePool, 1, &mBuildCommandBuffer);
+		mBuildScratchBuffer.Free();
+		mBuildCommandBuffer = VK_NULL_HANDLE;
+	}
+
+	// 场景里的Mesh由VKRTApp释放，这里只释放替身
+	mStandIn->Dispose();
+
+	vkDestroyFence(Device::GetLogicalDevice(), mBuildFence, VK_NULL_HANDLE);
+	vkDestroyCommandPool(Device::GetLogicalDevice(), mComputePool, VK_NULL_HANDLE);
+}
+
+void MeshStreamer::PrepareEntry(const size_t& index, std::vector<std::shared_ptr<Mesh>>& pinnedMeshes)
+{
+	auto& entry = mEntries[index];
+	auto& mesh = entry.mesh;
+
+	// 扁平的Mesh（例如地板）也给替身留一点厚度
+	const vec3 localCenter = (mesh->GetBoundsMin() + mesh->GetBoundsMax()) * 0.5f;
+	const vec3 halfExtent = glm::max((mesh->GetBoundsMax() - mesh->GetBoundsMin()) * 0.5f, vec3(1e-3f));
+	entry.standInTransform = glm::translate(mat4(1.0f), localCenter) * glm::scale(mat4(1.0f), halfExtent);
+	entry.gpuBytes = EstimateGPUBytes(*mesh);
+
+	if (!entry.cachePath.empty())
+	{
+		// 几何数据在ModelCache的文件里，需要的时候再读回来
+		mesh->ReleaseCPUCopies();
+	}
+	else
+	{
+		// 烘焙失败的话就没办法再读回来，只能一直常驻
+		std::cerr << "Mesh " << mesh->GetName() << " has no cooked geometry, keeping it resident." << std::endl;
+		mesh->UploadGeometry();
+		mesh->ReleaseCPUCopies();
+		entry.pinned = true;
+		entry.state = RESIDENT;
+		pinnedMeshes.push_back(mesh);
+	}
+}
+
+void MeshStreamer::UpdateInstanceBounds(StreamInstance& instance) const
+{
+	const auto& mesh = *mEntries[instance.entry].mesh;
+	const vec3& localMin = mesh.GetBoundsMin();
+	const vec3& localMax = mesh.GetBoundsMax();
+	vec3 worldMin(FLT_MAX);
+	vec3 worldMax(-FLT_MAX);
+	for (uint32_t corner = 0; corner < 8; corner++)
+	{
+		const vec3 localCorner((corner & 1) ? localMax.x : localMin.x,
+			(corner & 2) ? localMax.y : localMin.y,
+			(corner & 4) ? localMax.z : localMin.z);
+		const vec3 worldCorner = vec3(instance.transform * vec4(localCorner, 1.0f));
+		worldMin = glm::min(worldMin, worldCorner);
+		worldMax = glm::max(worldMax, worldCorner);
+	}
+	instance.worldCenter = (worldMin + worldMax) * 0.5f;
+	instance.worldRadius = glm::length(worldMax - worldMin) * 0.5f;
+}
+
+void MeshStreamer::CreateStandIn()
+{
+	// 替身是一个[-1, 1]的立方体，每个面4个顶点，这样法线和UV都是对的
+	std::vector<vec3> positions;
+	std::vector<VertexAttribute> vertAttributes;
+	std::vector<uint32_t> indices;
+	const vec3 normals[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	const vec2 uvs[4] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+	for (const auto& normal : normals)
+	{
+		const vec3 u(normal.y, normal.z, normal.x);
+		const vec3 v = glm::cross(normal, u);
+		const auto base = static_cast<uint32_t>(positions.size());
+		const vec3 corners[4] = { normal - u - v, normal + u - v, normal + u + v, normal - u + v };
+		for (uint32_t i = 0; i < 4; i++)
+		{
+			positions.push_back(corners[i]);
+			vertAttributes.push_back({ VertexCompression::EncodeOctNormal(normal), VertexCompression::EncodeHalfUV(uvs[i]) });
+		}
+		indices.insert(indices.end(), { base, base + 1, base + 2, base, base + 2, base + 3 });
+	}
+
+	// 替身不需要贴图，实例上用的是原来那个Mesh的材质
+	mStandIn = std::make_shared<Mesh>(Device::GetLogicalDevice(),
+		mGraphicsPool,
+		Device::GetGraphicsQueue(),
+		mAllocator,
+		std::move(positions), std::move(vertAttributes), std::vector<std::vector<uint32_t>>{ std::move(indices) },
+		DEFAULT_TEX_DIR,
+		0);
+
+	std::vector<std::shared_ptr<Mesh>> standIns = { mStandIn };
+	mBlasBuilder.Build(Device::GetLogicalDevice(), mGraphicsPool, Device::GetGraphicsQueue(), standIns);
+}
+
+VkDeviceSize MeshStreamer::EstimateGPUBytes(const Mesh& mesh) const
+{
+	// 只查询大小的时候不需要真正的Buffer地址
+	VkAccelerationStructureGeometryKHR geometry = {};
+	geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+	geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+	geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+	geometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
+	geometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+	geometry.geometry.triangles.vertexStride = sizeof(vec3);
+	geometry.geometry.triangles.maxVertex = static_cast<uint32_t>(mesh.GetPositionCount());
+	geometry.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
+
+	VkAccelerationStructureBuildGeometryInfoKHR buildInfo = {};
+	buildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+	buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+	buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+	buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+	buildInfo.geometryCount = 1;
+	buildInfo.pGeometries = &geometry;
+
+	// 所有LOD共用顶点，各自有索引、面和底层加速结构
+	VkDeviceSize bytes = mesh.GetPositionCount() * sizeof(vec3)
+		+ mesh.GetVertAttributeCount() * sizeof(VertexAttribute);
+	for (uint32_t lod = 0; lod < mesh.GetLodCount(); lod++)
+	{
+		const auto numFaces = static_cast<uint32_t>(mesh.GetIndexCount(lod) / FACE_NUM);
+		VkAccelerationStructureBuildSizesInfoKHR sizeInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+		vkGetAccelerationStructureBuildSizesKHR(Device::GetLogicalDevice(),
+			VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+			&buildInfo,
+			&numFaces,
+			&sizeInfo);
+
+		bytes += mesh.GetIndexCount(lod) * sizeof(uint32_t)
+			+ numFaces * 4 * sizeof(uint32_t)
+			+ sizeInfo.accelerationStructureSize;
+	}
+	return bytes;
+}
+
+uint32_t MeshStreamer::SelectLod(const uint32_t& lodCount, const uint32_t& currentLod, const float& screenSize)
+{
+	const uint32_t maxLod = std::min(lodCount, Mesh::MAX_LOD_COUNT) - 1;
+	uint32_t lod = std::min(currentLod, maxLod);
+	// 变大了马上换成更精细的LOD
+	while (lod > 0 && screenSize >= LOD_SCREEN_SIZES[lod - 1])
+	{
+		lod--;
+	}
+	// 变小了要再小一截才换成更粗糙的LOD
+	while (lod < maxLod && screenSize < LOD_SCREEN_SIZES[lod] * LOD_HYSTERESIS)
+	{
+		lod++;
+	}
+	return lod;
+}
+
+void MeshStreamer::LoaderLoop()
+{
+	while (true)
+	{
+		size_t index;
+		std::string path;
+		{
+			std::unique_lock<std::mutex> lock(mLoaderMutex);
+			mLoaderCondition.wait(lock, [this]() { return mStopLoader || !mLoadRequests.empty(); });
+			if (mStopLoader)
+			{
+				return;
+			}
+			index = mLoadRequests.front();
+			mLoadRequests.pop_front();
+			path = mEntries[index].cachePath;
+		}
+
+		// 读盘不持有锁，渲染线程可以继续提交新的请求
+		LoadResult result{ index, false, {} };
+		result.succeeded = ModelCache::ReadGeometry(path, result.geometry);
+
+		std::lock_guard<std::mutex> lock(mLoaderMutex);
+		mLoadResults.push_back(std::move(result));
+	}
+}
+
+void MeshStreamer::CollectLoadResults()
+{
+	std::vector<LoadResult> results;
+	{
+		std::lock_guard<std::mutex> lock(mLoaderMutex);
+		results.swap(mLoadResults);
+	}
+
+	for (auto& result : results)
+	{
+		auto& entry = mEntries[result.index];
+		if (entry.discardLoad)
+		{
+			entry.discardLoad = false;
+			continue;
+		}
+		assert(entry.state == LOADING);
+		if (!result.succeeded || result.geometry.lodIndices.size() != entry.mesh->GetLodCount())
+		{
+			// 缓存文件坏了，以后就一直用替身
+			std::cerr << "Failed to stream mesh " << entry.mesh->GetName() << " from " << entry.cachePath << std::endl;
+			entry.loadFailed = true;
+			entry.state = EVICTED;
+			continue;
+		}
+		entry.loaded = std::move(result.geometry);
+		entry.state = LOADED;
+	}
+}
+
+bool MeshStreamer::FinishBuild()
+{
+	if (mBuildCommandBuffer == VK_NULL_HANDLE
+		|| vkGetFenceStatus(Device::GetLogicalDevice(), mBuildFence) != VK_SUCCESS)
+	{
+		return false;
+	}
+
+	vkResetFences(Device::GetLogicalDevice(), 1, &mBuildFence);
+	vkFreeCommandBuffers(Device::GetLogicalDevice(), mComputePool, 1, &mBuildCommandBuffer);
+	mBuildCommandBuffer = VK_NULL_HANDLE;
+	mBuildScratchBuffer.Free();
+
+	// Compute和Graphics不是同一个Queue Family的话，加速结构的Buffer需要在Graphics这边接收所有权
+	if (Device::GetQueue().ComputeQueueFamilyIndex != Device::GetQueue().GraphicsQueueFamilyIndex)
+	{
+		VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
+		commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		commandBufferAllocateInfo.commandPool = mGraphicsPool;
+		commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		commandBufferAllocateInfo.commandBufferCount = 1;
+
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		auto error = vkAllocateCommandBuffers(Device::GetLogicalDevice(), &commandBufferAllocateInfo, &commandBuffer);
+		assert(error == VK_SUCCESS);
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		TransferOwnership(commandBuffer, true);
+		vkEndCommandBuffer(commandBuffer);
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		vkQueueSubmit(Device::GetGraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
+		error = vkQueueWaitIdle(Device::GetGraphicsQueue());
+		assert(error == VK_SUCCESS);
+		vkFreeCommandBuffers(Device::GetLogicalDevice(), mGraphicsPool, 1, &commandBuffer);
+	}
+
+	for (const auto& index : mBuildingEntries)
+	{
+		auto& entry = mEntries[index];
+		entry.state = RESIDENT;
+		entry.gpuBytes = entry.mesh->GetGPUMemoryBytes();
+	}
+	mBuildingEntries.clear();
+	return true;
+}
+
+void MeshStreamer::StartBuild(const std::vector<size_t>& order)
+{
+	// 同一时间只有一批在构建
+	if (mBuildCommandBuffer != VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	std::vector<std::shared_ptr<Mesh>> batch;
+	for (const auto& index : order)
+	{
+		auto& entry = mEntries[index];
+		if (entry.state != LOADED)
+		{
+			continue;
+		}
+
+		entry.mesh->SetCPUGeometry(std::move(entry.loaded.positions),
+			std::move(entry.loaded.vertAttributes),
+			std::move(entry.loaded.lodIndices),
+			std::move(entry.loaded.lodFaces));
+		entry.mesh->UploadGeometry();
+		entry.mesh->ReleaseCPUCopies();
+		entry.loaded = {};
+		entry.state = BUILDING;
+
+		mBuildingEntries.push_back(index);
+		batch.push_back(entry.mesh);
+		if (batch.size() >= MAX_BUILDS_PER_BATCH)
+		{
+			break;
+		}
+	}
+
+	if (batch.empty())
+	{
+		return;
+	}
+
+	mBuildCommandBuffer = mBlasBuilder.RecordBuild(Device::GetLogicalDevice(), mComputePool, batch, mBuildScratchBuffer);
+	TransferOwnership(mBuildCommandBuffer, false);
+	vkEndCommandBuffer(mBuildCommandBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &mBuildCommandBuffer;
+	const auto error = vkQueueSubmit(Device::GetComputeQueue(), 1, &submitInfo, mBuildFence);
+	assert(error == VK_SUCCESS);
+}
+
+void MeshStreamer::TransferOwnership(VkCommandBuffer commandBuffer, const bool& acquire)
+{
+	const auto& queue = Device::GetQueue();
+	if (queue.ComputeQueueFamilyIndex == queue.GraphicsQueueFamilyIndex)
+	{
+		return;
+	}
+
+	// Release和Acquire两边的Barrier除了AccessMask以外必须一模一样
+	std::vector<VkBufferMemoryBarrier> barriers;
+	for (const auto& index : mBuildingEntries)
+	{
+		auto& mesh = *mEntries[index].mesh;
+		for (uint32_t lod = 0; lod < mesh.GetLodCount(); lod++)
+		{
+			VkBufferMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.srcAccessMask = acquire ? 0 : VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+			barrier.dstAccessMask = acquire ? VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR : 0;
+			barrier.srcQueueFamilyIndex = queue.ComputeQueueFamilyIndex;
+			barrier.dstQueueFamilyIndex = queue.GraphicsQueueFamilyIndex;
+			barrier.buffer = mesh.GetAccelerationStructure(lod).buffer->GetVkBuffer();
+			barrier.offset = 0;
+			barrier.size = VK_WHOLE_SIZE;
+			barriers.push_back(barrier);
+		}
+	}
+
+	vkCmdPipelineBarrier(commandBuffer,
+		acquire ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+		acquire ? VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR
+			: VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+}
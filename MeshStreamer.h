@@ -0,0 +1,173 @@
+﻿#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Mesh.h"
+#include "ModelCache.h"
+#include "Camera.h"
+#include "BottomLevelAccelerationStructureBuilder.h"
+#include "TopLevelAccelerationStructure.h"
+
+/*
+ * Keeps a budgeted subset of the scene meshes and their BLASes on the GPU.
+ * The geometry of every mesh stays in the file ModelCache cooked it into. Meshes that become
+ * important (close to the camera, large on screen) are read back on a loader thread and get
+ * their BLAS built on the compute queue; unimportant ones are evicted when the budget runs out.
+ * A mesh without GPU geometry is traced as a shared box stand-in scaled to its bounds.
+ * All LODs of a mesh are streamed together; each instance references the LOD picked from its own screen size.
+ * A mesh is as important as its largest instance on screen.
+ */
+class MeshStreamer
+{
+public:
+	static constexpr VkDeviceSize DEFAULT_BUDGET_BYTES = 512ull * 1024 * 1024;
+
+	MeshStreamer(VmaAllocator& allocator,
+		VkCommandPool& graphicsPool,
+		const VkDeviceSize& budgetBytes = DEFAULT_BUDGET_BYTES);
+
+	// Drops the CPU copies of the meshes; they are read back from Mesh::GetCookedPath when needed.
+	// A mesh without a cooked file stays resident. The meshes have to be imported with the STREAMED residency.
+	// Throws when the geometry slots or the materials do not fit into the 12-bit fields of the instance custom index.
+	void Register(const std::vector<std::shared_ptr<Mesh>>& meshes, const std::vector<MeshInstance>& instances);
+
+	/*
+	 * Swaps in a re-imported and re-cooked mesh (hot reload) while the device is idle. If the old one was resident,
+	 * the new one is rebuilt in the next batch; only its own BLAS is rebuilt.
+	 * The old mesh is no longer referenced afterwards, but its buffers may still be in use by the last frame.
+	 * The LOD slots were sized by the old mesh, so extra LODs of the new one are not used.
+	 */
+	void ReplaceMesh(const size_t& index, const std::shared_ptr<Mesh>& mesh);
+	// Moves a registered instance to another transform or mesh (hot reload edited its node) while the device is idle.
+	// The TLAS has to be refreshed after the next Update, like after ReplaceMesh.
+	void UpdateInstance(const size_t& index, const MeshInstance& instance);
+
+	// Call once per frame while the device is idle.
+	// Returns true when the resident set or a selected LOD changed, so the geometry descriptors and the TLAS have to be refreshed.
+	bool Update(const Camera& camera);
+
+	// One geometry slot per LOD of every mesh, and the stand-in box in the last one
+	uint32_t GetGeometrySlotCount() const;
+	uint32_t GetStandInSlot() const;
+	// The mesh and LOD whose buffers back a geometry slot right now
+	Mesh& GetSlotMesh(const uint32_t& slot);
+	uint32_t GetSlotLod(const uint32_t& slot) const;
+
+	// TLAS instances in the order of the registered MeshInstances, so gl_InstanceID indexes the object attributes
+	std::vector<VkAccelerationStructureInstanceKHR> GetInstances();
+	size_t GetInstanceCount() const
+	{
+		return mInstances.size();
+	}
+
+	size_t GetResidentCount() const;
+	VkDeviceSize GetResidentBytes() const;
+	// The BLAS part of GetResidentBytes
+	VkDeviceSize GetResidentBLASBytes() const;
+	VkDeviceSize GetBudgetBytes() const
+	{
+		return mBudgetBytes;
+	}
+	// The least important meshes are evicted by the next Update when the resident ones no longer fit
+	void SetBudgetBytes(const VkDeviceSize& budgetBytes)
+	{
+		mBudgetBytes = budgetBytes;
+	}
+
+	void Dispose();
+
+private:
+	// 屏幕上投影的大小（占视口高度的比例）超过LOAD才加载，低于EVICT才卸载，中间留一段防止来回抖动
+	static constexpr float LOAD_SCREEN_SIZE = 0.02f;
+	static constexpr float EVICT_SCREEN_SIZE = 0.01f;
+	// 每次提交给Compute Queue构建的底层加速结构数量上限，避免一帧里面卡太久
+	static constexpr size_t MAX_BUILDS_PER_BATCH = 8;
+	// 屏幕大小低于第i个值就从LOD i换到LOD i+1；换回精细的LOD不需要再乘LOD_HYSTERESIS，这样不会在阈值附近来回切换
+	static constexpr float LOD_SCREEN_SIZES[Mesh::MAX_LOD_COUNT - 1] = { 0.3f, 0.1f };
+	static constexpr float LOD_HYSTERESIS = 0.8f;
+
+	enum StreamState
+	{
+		EVICTED = 0, LOADING, LOADED, BUILDING, RESIDENT
+	};
+
+	struct StreamEntry
+	{
+		std::shared_ptr<Mesh> mesh;
+		std::string cachePath;
+		StreamState state = EVICTED;
+		// 常驻时需要的显存，第一次构建完之后会换成准确的值
+		VkDeviceSize gpuBytes = 0;
+		// 第一级LOD占用的几何体槽位，后面几级紧跟着
+		uint32_t slotBase = 0;
+		uint32_t slotCount = 0;
+		// 把单位立方体变换到这个Mesh模型空间包围盒上的矩阵
+		mat4 standInTransform = mat4(1.0f);
+		CookedGeometry loaded;
+		// 没有烘焙文件的Mesh只能一直常驻
+		bool pinned = false;
+		// 缓存读失败的Mesh以后只用替身
+		bool loadFailed = false;
+		// 读盘线程正在读的是热重载之前的缓存，结果要丢掉
+		bool discardLoad = false;
+	};
+
+	struct StreamInstance
+	{
+		size_t entry;
+		mat4 transform;
+		vec3 worldCenter = vec3(0.0f);
+		float worldRadius = 0.0f;
+		// 当前引用的LOD
+		uint32_t lod = 0;
+	};
+
+	struct LoadResult
+	{
+		size_t index;
+		bool succeeded;
+		CookedGeometry geometry;
+	};
+
+	void CreateStandIn();
+	VkDeviceSize EstimateGPUBytes(const Mesh& mesh) const;
+	static uint32_t SelectLod(const uint32_t& lodCount, const uint32_t& currentLod, const float& screenSize);
+	void PrepareEntry(const size_t& index, std::vector<std::shared_ptr<Mesh>>& pinnedMeshes);
+	void UpdateInstanceBounds(StreamInstance& instance) const;
+	void LoaderLoop();
+	void CollectLoadResults();
+	bool FinishBuild();
+	void StartBuild(const std::vector<size_t>& order);
+	void TransferOwnership(VkCommandBuffer commandBuffer, const bool& acquire);
+
+	VmaAllocator& mAllocator;
+	VkCommandPool& mGraphicsPool;
+	VkDeviceSize mBudgetBytes;
+
+	std::vector<StreamEntry> mEntries;
+	// 每个几何体槽位对应的Mesh序号和LOD
+	std::vector<std::pair<size_t, uint32_t>> mSlots;
+	std::vector<StreamInstance> mInstances;
+	std::shared_ptr<Mesh> mStandIn;
+	// 热重载换掉了Mesh或者移动了Instance，下一次Update要让描述符和TLAS刷新
+	bool mReplaced = false;
+
+	BottomLevelAccelerationStructureBuilder mBlasBuilder;
+	VkCommandPool mComputePool = VK_NULL_HANDLE;
+	VkFence mBuildFence = VK_NULL_HANDLE;
+	VkCommandBuffer mBuildCommandBuffer = VK_NULL_HANDLE;
+	Buffer mBuildScratchBuffer;
+	std::vector<size_t> mBuildingEntries;
+
+	// 读盘线程
+	std::thread mLoaderThread;
+	std::mutex mLoaderMutex;
+	std::condition_variable mLoaderCondition;
+	std::deque<size_t> mLoadRequests;
+	std::vector<LoadResult> mLoadResults;
+	bool mStopLoader = false;
+};
@@ -0,0 +1,397 @@
+﻿#include "ModelCache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+
+#include "FileWatcher.h"
+
+namespace
+{
+	// 几何文件的文件头，数量后面紧跟着各个数组的原始数据
+	struct CookedMeshHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t positionCount;
+		uint64_t vertAttributeCount;
+		uint64_t lodCount;
+	};
+
+	// 顶点数据后面每一级LOD一个，后面紧跟着这一级的索引和面
+	struct CookedLodHeader
+	{
+		uint64_t indexCount;
+		uint64_t faceCount;
+	};
+
+	constexpr uint32_t COOKED_MESH_MAGIC = 0x4D524B56; // "VKRM"
+	constexpr uint32_t COOKED_MODEL_MAGIC = 0x444D4B56; // "VKMD"
+	// 描述文件损坏的时候不要按照读出来的数量去分配内存
+	constexpr uint64_t MAX_RECORD_COUNT = 1ull << 24;
+
+	template<typename T>
+	void WriteValue(std::ofstream& file, const T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	void WriteString(std::ofstream& file, const std::string& value)
+	{
+		WriteValue(file, static_cast<uint64_t>(value.size()));
+		file.write(value.data(), value.size());
+	}
+
+	template<typename T>
+	bool ReadValue(std::ifstream& file, T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		file.read(reinterpret_cast<char*>(&value), sizeof(T));
+		return file.good();
+	}
+
+	bool ReadCount(std::ifstream& file, uint64_t& count)
+	{
+		return ReadValue(file, count) && count <= MAX_RECORD_COUNT;
+	}
+
+	bool ReadString(std::ifstream& file, std::string& value)
+	{
+		uint64_t size = 0;
+		if (!ReadCount(file, size))
+		{
+			return false;
+		}
+		value.resize(size);
+		file.read(value.data(), size);
+		return file.good();
+	}
+}
+
+ModelCache::ModelCache(std::filesystem::path directory) :
+	mDirectory(std::move(directory))
+{
+}
+
+bool ModelCache::Load(const std::string& sourcePath, ModelImportData& model) const
+{
+	std::ifstream file(GetModelPath(sourcePath), std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	// 格式版本、模型文件本身和它引用的文件都没变才能用
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	std::string cookedSource;
+	FileStamp stamp{};
+	if (!ReadValue(file, magic) || !ReadValue(file, version) || magic != COOKED_MODEL_MAGIC || version != FORMAT_VERSION
+		|| !ReadString(file, cookedSource) || !ReadValue(file, stamp)
+		|| cookedSource != FileWatcher::NormalizePath(sourcePath) || stamp.size == MISSING_SIZE || !(stamp == GetStamp(sourcePath)))
+	{
+		return false;
+	}
+
+	uint64_t dependencyCount = 0;
+	if (!ReadCount(file, dependencyCount))
+	{
+		return false;
+	}
+	model.dependencies.resize(dependencyCount);
+	for (auto& dependency : model.dependencies)
+	{
+		if (!ReadString(file, dependency) || !ReadValue(file, stamp) || !(stamp == GetStamp(dependency)))
+		{
+			return false;
+		}
+	}
+
+	const auto geometryDirectory = GetModelPath(sourcePath).replace_extension();
+	uint64_t meshCount = 0;
+	if (!ReadCount(file, meshCount))
+	{
+		return false;
+	}
+	model.meshes.clear();
+	model.meshes.resize(meshCount);
+	for (auto& mesh : model.meshes)
+	{
+		uint32_t meshType = 0;
+		uint64_t vertexCount = 0;
+		uint64_t lodCount = 0;
+		std::string geometryFile;
+		if (!ReadString(file, mesh.name) || !ReadString(file, mesh.matInfo)
+			|| !ReadValue(file, mesh.color) || !ReadValue(file, meshType)
+			|| !ReadValue(file, mesh.transform) || !ReadValue(file, mesh.aiTransform)
+			|| !ReadValue(file, mesh.localityBefore) || !ReadValue(file, mesh.localityAfter)
+			|| !ReadValue(file, mesh.boundsMin) || !ReadValue(file, mesh.boundsMax)
+			|| !ReadValue(file, vertexCount) || !ReadCount(file, lodCount)
+			|| meshType >= MESH_TYPE_MAX || lodCount == 0 || lodCount > Mesh::MAX_LOD_COUNT)
+		{
+			return false;
+		}
+		mesh.meshType = static_cast<MeshType>(meshType);
+		mesh.vertexCount = vertexCount;
+		mesh.lodIndexCounts.resize(lodCount);
+		mesh.lodErrors.resize(lodCount - 1);
+		for (uint64_t lod = 0; lod < lodCount; lod++)
+		{
+			uint64_t indexCount = 0;
+			float error = 0.0f;
+			if (!ReadValue(file, indexCount) || !ReadValue(file, error))
+			{
+				return false;
+			}
+			mesh.lodIndexCounts[lod] = indexCount;
+			if (lod > 0)
+			{
+				mesh.lodErrors[lod - 1] = error;
+			}
+		}
+
+		// 几何文件被删掉的话整个模型重新导入
+		if (!ReadString(file, geometryFile) || !std::filesystem::exists(geometryDirectory / geometryFile))
+		{
+			return false;
+		}
+		mesh.cookedPath = (geometryDirectory / geometryFile).string();
+	}
+
+	uint64_t instanceCount = 0;
+	if (!ReadCount(file, instanceCount))
+	{
+		return false;
+	}
+	model.instances.resize(instanceCount);
+	for (auto& instance : model.instances)
+	{
+		if (!ReadValue(file, instance.meshIndex) || !ReadValue(file, instance.transform) || !ReadString(file, instance.name)
+			|| instance.meshIndex >= model.meshes.size())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ModelCache::Store(const std::string& sourcePath, ModelImportData& model) const
+{
+	const auto modelPath = GetModelPath(sourcePath);
+	const auto geometryDirectory = std::filesystem::path(modelPath).replace_extension();
+	const FileStamp sourceStamp = GetStamp(sourcePath);
+	std::error_code error;
+	std::filesystem::create_directories(geometryDirectory, error);
+	if (error || sourceStamp.size == MISSING_SIZE)
+	{
+		std::cerr << "Failed to create the model cache directory " << geometryDirectory.string() << std::endl;
+		return false;
+	}
+
+	// 几何文件名带上模型文件的修改时间，热重载的时候不会覆盖读盘线程可能正在读的旧文件
+	bool succeeded = true;
+	std::vector<std::filesystem::path> geometryFiles(model.meshes.size());
+	for (size_t i = 0; i < model.meshes.size(); i++)
+	{
+		auto& mesh = model.meshes[i];
+		geometryFiles[i] = std::to_string(sourceStamp.writeTime) + "_" + std::to_string(i) + ".vkrmesh";
+		if (WriteGeometry(geometryDirectory / geometryFiles[i], mesh))
+		{
+			mesh.cookedPath = (geometryDirectory / geometryFiles[i]).string();
+		}
+		else
+		{
+			std::cerr << "Failed to cook mesh " << mesh.name << " into " << (geometryDirectory / geometryFiles[i]).string() << std::endl;
+			succeeded = false;
+		}
+	}
+	if (!succeeded)
+	{
+		return false;
+	}
+
+	// 描述文件最后写，先写到临时文件再换过去，中途失败也不会留下指向不完整几何文件的描述
+	auto temporaryPath = modelPath;
+	temporaryPath += ".tmp";
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		WriteValue(file, COOKED_MODEL_MAGIC);
+		WriteValue(file, FORMAT_VERSION);
+		WriteString(file, FileWatcher::NormalizePath(sourcePath));
+		WriteValue(file, sourceStamp);
+		WriteValue(file, static_cast<uint64_t>(model.dependencies.size()));
+		for (const auto& dependency : model.dependencies)
+		{
+			WriteString(file, dependency);
+			WriteValue(file, GetStamp(dependency));
+		}
+
+		WriteValue(file, static_cast<uint64_t>(model.meshes.size()));
+		for (size_t i = 0; i < model.meshes.size(); i++)
+		{
+			const auto& mesh = model.meshes[i];
+			vec3 boundsMin(0.0f);
+			vec3 boundsMax(0.0f);
+			if (!mesh.positions.empty())
+			{
+				boundsMin = boundsMax = mesh.positions.front();
+				for (const auto& position : mesh.positions)
+				{
+					boundsMin = glm::min(boundsMin, position);
+					boundsMax = glm::max(boundsMax, position);
+				}
+			}
+
+			WriteString(file, mesh.name);
+			WriteString(file, mesh.matInfo);
+			WriteValue(file, mesh.color);
+			WriteValue(file, static_cast<uint32_t>(mesh.meshType));
+			WriteValue(file, mesh.transform);
+			WriteValue(file, mesh.aiTransform);
+			WriteValue(file, mesh.localityBefore);
+			WriteValue(file, mesh.localityAfter);
+			WriteValue(file, boundsMin);
+			WriteValue(file, boundsMax);
+			WriteValue(file, static_cast<uint64_t>(mesh.positions.size()));
+			WriteValue(file, static_cast<uint64_t>(mesh.lodIndices.size() + 1));
+			WriteValue(file, static_cast<uint64_t>(mesh.indices.size()));
+			WriteValue(file, 0.0f);
+			for (size_t lod = 0; lod < mesh.lodIndices.size(); lod++)
+			{
+				WriteValue(file, static_cast<uint64_t>(mesh.lodIndices[lod].size()));
+				WriteValue(file, mesh.lodErrors[lod]);
+			}
+			WriteString(file, geometryFiles[i].string());
+		}
+
+		WriteValue(file, static_cast<uint64_t>(model.instances.size()));
+		for (const auto& instance : model.instances)
+		{
+			WriteValue(file, instance.meshIndex);
+			WriteValue(file, instance.transform);
+			WriteString(file, instance.name);
+		}
+		if (!file.good())
+		{
+			return false;
+		}
+	}
+	std::filesystem::rename(temporaryPath, modelPath, error);
+	if (error)
+	{
+		std::cerr << "Failed to write the model cache file " << modelPath.string() << std::endl;
+		return false;
+	}
+
+	// 上一次烘焙的几何文件已经没有描述文件引用了；还在被读的删不掉也没关系，下次烘焙再删
+	for (const auto& entry : std::filesystem::directory_iterator(geometryDirectory, error))
+	{
+		if (std::find(geometryFiles.begin(), geometryFiles.end(), entry.path().filename()) == geometryFiles.end())
+		{
+			std::error_code removeError;
+			std::filesystem::remove(entry.path(), removeError);
+		}
+	}
+	return true;
+}
+
+bool ModelCache::ReadGeometry(const std::string& path, CookedGeometry& geometry)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	CookedMeshHeader header = {};
+	if (!ReadValue(file, header) || header.magic != COOKED_MESH_MAGIC || header.version != FORMAT_VERSION
+		|| header.lodCount > Mesh::MAX_LOD_COUNT)
+	{
+		return false;
+	}
+
+	geometry.positions.resize(header.positionCount);
+	geometry.vertAttributes.resize(header.vertAttributeCount);
+	file.read(reinterpret_cast<char*>(geometry.positions.data()), geometry.positions.size() * sizeof(vec3));
+	file.read(reinterpret_cast<char*>(geometry.vertAttributes.data()), geometry.vertAttributes.size() * sizeof(VertexAttribute));
+
+	geometry.lodIndices.resize(header.lodCount);
+	geometry.lodFaces.resize(header.lodCount);
+	for (uint64_t lod = 0; lod < header.lodCount && file.good(); lod++)
+	{
+		CookedLodHeader lodHeader = {};
+		if (!ReadValue(file, lodHeader))
+		{
+			return false;
+		}
+		geometry.lodIndices[lod].resize(lodHeader.indexCount);
+		geometry.lodFaces[lod].resize(lodHeader.faceCount);
+		file.read(reinterpret_cast<char*>(geometry.lodIndices[lod].data()), geometry.lodIndices[lod].size() * sizeof(uint32_t));
+		file.read(reinterpret_cast<char*>(geometry.lodFaces[lod].data()), geometry.lodFaces[lod].size() * sizeof(uint32_t));
+	}
+	return file.good();
+}
+
+ModelCache::FileStamp ModelCache::GetStamp(const std::string& path)
+{
+	std::error_code error;
+	const auto size = std::filesystem::file_size(path, error);
+	if (error)
+	{
+		return { MISSING_SIZE, 0 };
+	}
+	const auto writeTime = std::filesystem::last_write_time(path, error);
+	if (error)
+	{
+		return { MISSING_SIZE, 0 };
+	}
+	return { static_cast<uint64_t>(size), static_cast<int64_t>(writeTime.time_since_epoch().count()) };
+}
+
+bool ModelCache::WriteGeometry(const std::filesystem::path& path, const MeshImportData& mesh)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	const CookedMeshHeader header
+	{
+		COOKED_MESH_MAGIC,
+		FORMAT_VERSION,
+		mesh.positions.size(),
+		mesh.vertAttributes.size(),
+		mesh.lodIndices.size() + 1,
+	};
+	WriteValue(file, header);
+	file.write(reinterpret_cast<const char*>(mesh.positions.data()), mesh.positions.size() * sizeof(vec3));
+	file.write(reinterpret_cast<const char*>(mesh.vertAttributes.data()), mesh.vertAttributes.size() * sizeof(VertexAttribute));
+	// 面和Mesh构造的时候算出来的一样，读回来可以直接上传
+	for (size_t lod = 0; lod <= mesh.lodIndices.size(); lod++)
+	{
+		const auto& indices = lod == 0 ? mesh.indices : mesh.lodIndices[lod - 1];
+		const auto faces = Mesh::BuildFaces(mesh.positions, mesh.vertAttributes, indices);
+		const CookedLodHeader lodHeader{ indices.size(), faces.size() };
+		WriteValue(file, lodHeader);
+		file.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+		file.write(reinterpret_cast<const char*>(faces.data()), faces.size() * sizeof(uint32_t));
+	}
+	return file.good();
+}
+
+std::filesystem::path ModelCache::GetModelPath(const std::string& sourcePath) const
+{
+	// 相对路径里的分隔符和点都换成下划线，不同目录下的同名模型不会撞在一起
+	std::string name = std::filesystem::path(sourcePath).lexically_normal().string();
+	std::replace_if(name.begin(), name.end(), [](const char& c) { return !std::isalnum(static_cast<unsigned char>(c)); }, '_');
+	return mDirectory / (name + ".vkrmodel");
+}
@@ -0,0 +1,62 @@
+﻿#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "Mesh.h"
+
+// Geometry of one cooked mesh as it is read back: the shared vertices and the indices and faces of every LOD
+struct CookedGeometry
+{
+	std::vector<vec3> positions;
+	std::vector<VertexAttribute> vertAttributes;
+	std::vector<std::vector<uint32_t>> lodIndices;
+	std::vector<std::vector<uint32_t>> lodFaces;
+};
+
+/*
+ * Imported models cooked to disk, so that only model files that changed since the last launch go through
+ * the importer, MeshOptimizer and the LOD generation again.
+ * Every model has a description file (meshes without their geometry, and the nodes), which is current while the
+ * format version and the size and modification time of the model file and of the files it references
+ * (OBJ material libraries) match, and one geometry file per mesh that MeshStreamer reads when the mesh is needed.
+ */
+class ModelCache
+{
+public:
+	// Bump when the importers, MeshOptimizer, the LOD generation or one of the file layouts change
+	static constexpr uint32_t FORMAT_VERSION = 1;
+
+	explicit ModelCache(std::filesystem::path directory);
+
+	// Fills model from the cooked copy of sourcePath if it is current. The meshes come without geometry;
+	// MeshImportData::cookedPath says where it is.
+	bool Load(const std::string& sourcePath, ModelImportData& model) const;
+	// Cooks model, which was just imported from sourcePath, and sets cookedPath of every mesh whose geometry was written.
+	// Returns false when something could not be written; the model is then imported again next time.
+	bool Store(const std::string& sourcePath, ModelImportData& model) const;
+
+	static bool ReadGeometry(const std::string& path, CookedGeometry& geometry);
+
+private:
+	// 文件不存在的时候size是MISSING_SIZE
+	struct FileStamp
+	{
+		uint64_t size;
+		int64_t writeTime;
+
+		bool operator==(const FileStamp& other) const
+		{
+			return size == other.size && writeTime == other.writeTime;
+		}
+	};
+	static constexpr uint64_t MISSING_SIZE = ~0ull;
+
+	static FileStamp GetStamp(const std::string& path);
+	static bool WriteGeometry(const std::filesystem::path& path, const MeshImportData& mesh);
+	// 每个模型一个描述文件，几何文件放在同名的目录里
+	std::filesystem::path GetModelPath(const std::string& sourcePath) const;
+
+	std::filesystem::path mDirectory;
+};
@@ -0,0 +1,710 @@
+﻿#include "ObjLoader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <unordered_map>
+
+#include "VertexCompression.h"
+
+namespace
+{
+	// 负数索引是相对于当前已经读到的顶点数量的，分块解析的时候还不知道前面的块有多少顶点
+	// 先在块内解析成“块内的序号 + RELATIVE_INDEX”，合并的时候再加上前面的块的数量
+	constexpr int64_t RELATIVE_INDEX = int64_t(1) << 40;
+	constexpr int64_t MISSING_INDEX = INT64_MIN;
+	constexpr uint32_t MISSING = UINT32_MAX;
+	// 焊接顶点的哈希表分成多少片，每一片由一个线程独占
+	constexpr uint32_t WELD_SHARD_BITS = 6;
+	constexpr uint32_t WELD_SHARDS = 1u << WELD_SHARD_BITS;
+	// 小于这个数量的工作不值得再开线程
+	constexpr size_t MIN_ITEMS_PER_THREAD = 16384;
+
+	struct RawCorner
+	{
+		int64_t v;
+		int64_t vt;
+		int64_t vn;
+	};
+
+	struct Corner
+	{
+		uint32_t v;
+		uint32_t vt;
+		uint32_t vn;
+
+		bool operator==(const Corner& other) const
+		{
+			return v == other.v && vt == other.vt && vn == other.vn;
+		}
+	};
+
+	struct CornerHash
+	{
+		uint64_t operator()(const Corner& corner) const
+		{
+			uint64_t h = (static_cast<uint64_t>(corner.v) << 32 | corner.vt) * 0x9E3779B97F4A7C15ull;
+			h ^= (static_cast<uint64_t>(corner.vn) + (h >> 29)) * 0xBF58476D1CE4E5B9ull;
+			return h ^ (h >> 31);
+		}
+	};
+
+	// o、g、usemtl出现的位置（块内的三角形序号）
+	struct StateChange
+	{
+		size_t triangle;
+		bool isMaterial;
+		std::string name;
+	};
+
+	struct ChunkResult
+	{
+		std::vector<float> positions;
+		std::vector<float> normals;
+		std::vector<float> uvs;
+		// 每个三角形三个角
+		std::vector<RawCorner> corners;
+		std::vector<StateChange> changes;
+		std::vector<std::string> materialLibraries;
+		std::string error;
+	};
+
+	struct ObjMaterial
+	{
+		std::string texture;
+		aiColor4D diffuse = { 0.6f, 0.6f, 0.6f, 1.0f };
+	};
+
+	// 把[0, count)分给若干个线程，每个线程处理连续的一段，至少minItemsPerThread个
+	template <typename Func>
+	void ParallelFor(const size_t& count, const size_t& minItemsPerThread, Func func)
+	{
+		const size_t hardwareThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+		const size_t numThreads = std::clamp<size_t>(count / minItemsPerThread, 1, hardwareThreads);
+		if (numThreads == 1)
+		{
+			func(0, count, 0);
+			return;
+		}
+
+		std::vector<std::thread> threads;
+		threads.reserve(numThreads);
+		for (size_t t = 0; t < numThreads; t++)
+		{
+			threads.emplace_back([&, t]() { func(count * t / numThreads, count * (t + 1) / numThreads, t); });
+		}
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+	}
+
+	bool IsSpace(const char& c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	const char* SkipSpaces(const char* p, const char* end)
+	{
+		while (p < end && IsSpace(*p))
+		{
+			p++;
+		}
+		return p;
+	}
+
+	std::string RestOfLine(const char* p, const char* end)
+	{
+		p = SkipSpaces(p, end);
+		while (end > p && IsSpace(end[-1]))
+		{
+			end--;
+		}
+		return std::string(p, end);
+	}
+
+	// 读若干个浮点数，from_chars不依赖locale，比strtod快得多
+	bool ParseFloats(const char* p, const char* end, float* out, const size_t& count, const size_t& required)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			p = SkipSpaces(p, end);
+			if (p < end && *p == '+')
+			{
+				p++;
+			}
+			const auto [next, ec] = std::from_chars(p, end, out[i]);
+			if (ec != std::errc())
+			{
+				if (i < required)
+				{
+					return false;
+				}
+				out[i] = 0.0f;
+				continue;
+			}
+			p = next;
+		}
+		return true;
+	}
+
+	// v、v/vt、v//vn、v/vt/vn
+	bool ParseCorner(const char*& p, const char* end, const size_t& positionCount, const size_t& uvCount, const size_t& normalCount,
+		RawCorner& corner)
+	{
+		const size_t counts[3] = { positionCount, uvCount, normalCount };
+		int64_t values[3] = { MISSING_INDEX, MISSING_INDEX, MISSING_INDEX };
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			if (k > 0)
+			{
+				if (p >= end || *p != '/')
+				{
+					break;
+				}
+				p++;
+				if (p < end && *p == '/')
+				{
+					continue;
+				}
+			}
+
+			int64_t index = 0;
+			const auto [next, ec] = std::from_chars(p, end, index);
+			if (ec != std::errc())
+			{
+				if (k == 0)
+				{
+					return false;
+				}
+				continue;
+			}
+			p = next;
+			if (index > 0)
+			{
+				values[k] = index - 1;
+			}
+			else if (index < 0)
+			{
+				values[k] = RELATIVE_INDEX + static_cast<int64_t>(counts[k]) + index;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		corner = { values[0], values[1], values[2] };
+		return true;
+	}
+
+	void ParseChunk(const char* begin, const char* end, ChunkResult& result)
+	{
+		std::vector<RawCorner> polygon;
+		const char* line = begin;
+		while (line < end)
+		{
+			// memchr一般是向量化的，找换行比逐个字符判断快
+			const char* lineEnd = static_cast<const char*>(std::memchr(line, '\n', end - line));
+			if (lineEnd == nullptr)
+			{
+				lineEnd = end;
+			}
+
+			const char* p = SkipSpaces(line, lineEnd);
+			const size_t length = lineEnd - p;
+			if (length >= 2 && p[0] == 'v' && IsSpace(p[1]))
+			{
+				float xyz[3];
+				if (!ParseFloats(p + 2, lineEnd, xyz, 3, 3))
+				{
+					result.error = "invalid vertex: " + std::string(p, lineEnd);
+					return;
+				}
+				result.positions.insert(result.positions.end(), xyz, xyz + 3);
+			}
+			else if (length >= 3 && p[0] == 'v' && p[1] == 'n' && IsSpace(p[2]))
+			{
+				float xyz[3];
+				if (!ParseFloats(p + 3, lineEnd, xyz, 3, 3))
+				{
+					result.error = "invalid normal: " + std::string(p, lineEnd);
+					return;
+				}
+				result.normals.insert(result.normals.end(), xyz, xyz + 3);
+			}
+			else if (length >= 3 && p[0] == 'v' && p[1] == 't' && IsSpace(p[2]))
+			{
+				float uv[2];
+				if (!ParseFloats(p + 3, lineEnd, uv, 2, 1))
+				{
+					result.error = "invalid texture coordinate: " + std::string(p, lineEnd);
+					return;
+				}
+				result.uvs.insert(result.uvs.end(), uv, uv + 2);
+			}
+			else if (length >= 2 && p[0] == 'f' && IsSpace(p[1]))
+			{
+				polygon.clear();
+				const char* q = SkipSpaces(p + 2, lineEnd);
+				while (q < lineEnd)
+				{
+					RawCorner corner;
+					if (!ParseCorner(q, lineEnd, result.positions.size() / 3, result.uvs.size() / 2, result.normals.size() / 3, corner))
+					{
+						result.error = "invalid face: " + std::string(p, lineEnd);
+						return;
+					}
+					polygon.push_back(corner);
+					q = SkipSpaces(q, lineEnd);
+				}
+				// 多边形按扇形三角化
+				for (size_t i = 2; i < polygon.size(); i++)
+				{
+					result.corners.push_back(polygon[0]);
+					result.corners.push_back(polygon[i - 1]);
+					result.corners.push_back(polygon[i]);
+				}
+			}
+			else if (length >= 2 && (p[0] == 'o' || p[0] == 'g') && IsSpace(p[1]))
+			{
+				result.changes.push_back({ result.corners.size() / 3, false, RestOfLine(p + 2, lineEnd) });
+			}
+			else if (length >= 7 && std::strncmp(p, "usemtl", 6) == 0 && IsSpace(p[6]))
+			{
+				result.changes.push_back({ result.corners.size() / 3, true, RestOfLine(p + 7, lineEnd) });
+			}
+			else if (length >= 7 && std::strncmp(p, "mtllib", 6) == 0 && IsSpace(p[6]))
+			{
+				result.materialLibraries.push_back(RestOfLine(p + 7, lineEnd));
+			}
+			// 注释、平滑组、线和点都不需要
+
+			line = lineEnd + 1;
+		}
+	}
+
+	void ReadMaterialLibrary(const std::filesystem::path& path, std::map<std::string, ObjMaterial>& materials)
+	{
+		std::ifstream file(path);
+		if (!file.is_open())
+		{
+			std::cerr << "Failed to open material library " << path.string() << std::endl;
+			return;
+		}
+
+		ObjMaterial* current = nullptr;
+		std::string line;
+		while (std::getline(file, line))
+		{
+			const char* p = SkipSpaces(line.data(), line.data() + line.size());
+			const char* end = line.data() + line.size();
+			const auto startsWith = [&](const char* keyword)
+			{
+				const size_t length = std::strlen(keyword);
+				return static_cast<size_t>(end - p) > length && std::strncmp(p, keyword, length) == 0 && IsSpace(p[length]);
+			};
+
+			if (startsWith("newmtl"))
+			{
+				current = &materials[RestOfLine(p + 6, end)];
+			}
+			else if (current != nullptr && startsWith("Kd"))
+			{
+				float rgb[3];
+				if (ParseFloats(p + 2, end, rgb, 3, 3))
+				{
+					current->diffuse = { rgb[0], rgb[1], rgb[2], 1.0f };
+				}
+			}
+			else if (current != nullptr && startsWith("map_Kd"))
+			{
+				// 贴图的选项（-bm、-s之类的）都在文件名前面，只取最后一段
+				const std::string value = RestOfLine(p + 6, end);
+				const size_t lastSpace = value.find_last_of(" \t");
+				current->texture = lastSpace == std::string::npos ? value : value.substr(lastSpace + 1);
+			}
+		}
+	}
+
+	/*
+	 * 分片哈希表焊接顶点：
+	 * 1. 每个线程把自己那一段的角按哈希分到各个分片里
+	 * 2. 每个分片由一个线程按顺序插入自己的哈希表，分片之间没有共享的数据，不需要加锁
+	 * 3. 分片的顶点按分片顺序拼起来，再把每个角的序号换成全局的序号
+	 */
+	void WeldCorners(const std::vector<Corner>& corners, std::vector<Corner>& uniqueCorners, std::vector<uint32_t>& indices)
+	{
+		const size_t count = corners.size();
+		std::vector<uint8_t> cornerShards(count);
+		std::vector<uint32_t> cornerLocals(count);
+
+		const size_t hardwareThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+		const size_t numThreads = std::clamp<size_t>(count / MIN_ITEMS_PER_THREAD, 1, hardwareThreads);
+		std::vector<std::vector<std::vector<uint32_t>>> buckets(numThreads, std::vector<std::vector<uint32_t>>(WELD_SHARDS));
+		ParallelFor(numThreads, 1, [&](const size_t& first, const size_t& last, const size_t&)
+		{
+			for (size_t t = first; t < last; t++)
+			{
+				const size_t begin = count * t / numThreads;
+				const size_t end = count * (t + 1) / numThreads;
+				for (size_t i = begin; i < end; i++)
+				{
+					const auto shard = static_cast<uint8_t>(CornerHash()(corners[i]) >> (64 - WELD_SHARD_BITS));
+					cornerShards[i] = shard;
+					buckets[t][shard].push_back(static_cast<uint32_t>(i));
+				}
+			}
+		});
+
+		std::vector<std::vector<Corner>> shardCorners(WELD_SHARDS);
+		const auto weldShards = [&](const size_t& first, const size_t& last, const size_t&)
+		{
+			for (size_t shard = first; shard < last; shard++)
+			{
+				std::unordered_map<Corner, uint32_t, CornerHash> lookup;
+				for (size_t t = 0; t < numThreads; t++)
+				{
+					for (const auto& i : buckets[t][shard])
+					{
+						const auto [it, inserted] = lookup.try_emplace(corners[i], static_cast<uint32_t>(shardCorners[shard].size()));
+						if (inserted)
+						{
+							shardCorners[shard].push_back(corners[i]);
+						}
+						cornerLocals[i] = it->second;
+					}
+				}
+			}
+		};
+		// 分片数量固定，只有角足够多的时候才值得每个分片一个线程
+		if (numThreads > 1)
+		{
+			std::vector<std::thread> threads;
+			const size_t numShardThreads = std::min<size_t>(numThreads, WELD_SHARDS);
+			for (size_t t = 0; t < numShardThreads; t++)
+			{
+				threads.emplace_back(weldShards, WELD_SHARDS * t / numShardThreads, WELD_SHARDS * (t + 1) / numShardThreads, t);
+			}
+			for (auto& thread : threads)
+			{
+				thread.join();
+			}
+		}
+		else
+		{
+			weldShards(0, WELD_SHARDS, 0);
+		}
+
+		std::vector<uint32_t> shardBases(WELD_SHARDS + 1, 0);
+		for (uint32_t shard = 0; shard < WELD_SHARDS; shard++)
+		{
+			shardBases[shard + 1] = shardBases[shard] + static_cast<uint32_t>(shardCorners[shard].size());
+		}
+		uniqueCorners.resize(shardBases[WELD_SHARDS]);
+		for (uint32_t shard = 0; shard < WELD_SHARDS; shard++)
+		{
+			std::copy(shardCorners[shard].begin(), shardCorners[shard].end(), uniqueCorners.begin() + shardBases[shard]);
+		}
+
+		indices.resize(count);
+		ParallelFor(count, MIN_ITEMS_PER_THREAD, [&](const size_t& begin, const size_t& end, const size_t&)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				indices[i] = shardBases[cornerShards[i]] + cornerLocals[i];
+			}
+		});
+	}
+}
+
+bool ObjLoader::Read(const std::string& path, ModelImportData& model)
+{
+	// 整个文件一次读进内存，之后按行边界切块
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+	{
+		std::cerr << "Failed to open " << path << std::endl;
+		return false;
+	}
+	const auto fileSize = static_cast<size_t>(file.tellg());
+	std::vector<char> text(fileSize);
+	file.seekg(0);
+	file.read(text.data(), static_cast<std::streamsize>(fileSize));
+	if (!file)
+	{
+		std::cerr << "Failed to read " << path << std::endl;
+		return false;
+	}
+
+	const char* data = text.data();
+	const char* dataEnd = data + text.size();
+	const size_t hardwareThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+	// 每块至少1MB
+	const size_t numChunks = std::clamp<size_t>(fileSize >> 20, 1, hardwareThreads * 4);
+	std::vector<const char*> chunkStarts(numChunks + 1, dataEnd);
+	chunkStarts[0] = data;
+	for (size_t c = 1; c < numChunks; c++)
+	{
+		const char* guess = std::max(data + fileSize * c / numChunks, chunkStarts[c - 1]);
+		const char* newline = static_cast<const char*>(std::memchr(guess, '\n', dataEnd - guess));
+		chunkStarts[c] = newline ? newline + 1 : dataEnd;
+	}
+
+	std::vector<ChunkResult> chunks(numChunks);
+	ParallelFor(numChunks, 1, [&](const size_t& begin, const size_t& end, const size_t&)
+	{
+		for (size_t c = begin; c < end; c++)
+		{
+			ParseChunk(chunkStarts[c], chunkStarts[c + 1], chunks[c]);
+		}
+	});
+
+	// 每一块在全局数组里的起始位置
+	std::vector<size_t> positionBases(numChunks + 1, 0);
+	std::vector<size_t> uvBases(numChunks + 1, 0);
+	std::vector<size_t> normalBases(numChunks + 1, 0);
+	std::vector<size_t> triangleBases(numChunks + 1, 0);
+	for (size_t c = 0; c < numChunks; c++)
+	{
+		if (!chunks[c].error.empty())
+		{
+			std::cerr << "Failed to parse " << path << ": " << chunks[c].error << std::endl;
+			return false;
+		}
+		positionBases[c + 1] = positionBases[c] + chunks[c].positions.size() / 3;
+		uvBases[c + 1] = uvBases[c] + chunks[c].uvs.size() / 2;
+		normalBases[c + 1] = normalBases[c] + chunks[c].normals.size() / 3;
+		triangleBases[c + 1] = triangleBases[c] + chunks[c].corners.size() / 3;
+	}
+	const size_t positionCount = positionBases[numChunks];
+	const size_t uvCount = uvBases[numChunks];
+	const size_t normalCount = normalBases[numChunks];
+	const size_t triangleCount = triangleBases[numChunks];
+	if (positionCount >= MISSING || uvCount >= MISSING || normalCount >= MISSING)
+	{
+		std::cerr << "Too many vertices in " << path << std::endl;
+		return false;
+	}
+
+	// 合并各个块，同时把相对索引换成绝对索引
+	std::vector<float> positions(positionCount * 3);
+	std::vector<float> uvs(uvCount * 2);
+	std::vector<float> normals(normalCount * 3);
+	std::vector<Corner> corners(triangleCount * 3);
+	std::atomic<bool> indicesValid = true;
+	ParallelFor(numChunks, 1, [&](const size_t& begin, const size_t& end, const size_t&)
+	{
+		for (size_t c = begin; c < end; c++)
+		{
+			auto& chunk = chunks[c];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + positionBases[c] * 3);
+			std::copy(chunk.uvs.begin(), chunk.uvs.end(), uvs.begin() + uvBases[c] * 2);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + normalBases[c] * 3);
+
+			const auto resolve = [&](const int64_t& raw, const size_t& base, const size_t& total) -> uint32_t
+			{
+				if (raw == MISSING_INDEX)
+				{
+					return MISSING;
+				}
+				const int64_t index = raw >= RELATIVE_INDEX / 2 ? raw - RELATIVE_INDEX + static_cast<int64_t>(base) : raw;
+				if (index < 0 || index >= static_cast<int64_t>(total))
+				{
+					indicesValid = false;
+					return 0;
+				}
+				return static_cast<uint32_t>(index);
+			};
+			for (size_t i = 0; i < chunk.corners.size(); i++)
+			{
+				const auto& raw = chunk.corners[i];
+				corners[triangleBases[c] * 3 + i] =
+				{
+					resolve(raw.v, positionBases[c], positionCount),
+					resolve(raw.vt, uvBases[c], uvCount),
+					resolve(raw.vn, normalBases[c], normalCount),
+				};
+			}
+			std::vector<RawCorner>().swap(chunk.corners);
+		}
+	});
+	if (!indicesValid)
+	{
+		std::cerr << "Face index out of range in " << path << std::endl;
+		return false;
+	}
+
+	// 材质库的路径是相对于OBJ文件的
+	const std::filesystem::path directory = std::filesystem::path(path).parent_path();
+	std::map<std::string, ObjMaterial> materials;
+	model.dependencies.clear();
+	for (const auto& chunk : chunks)
+	{
+		for (const auto& library : chunk.materialLibraries)
+		{
+			ReadMaterialLibrary(directory / library, materials);
+			model.dependencies.push_back((directory / library).string());
+		}
+	}
+
+	// 按顺序走一遍对象和材质的切换，同一个(对象, 材质)的三角形归到同一个Mesh里
+	std::map<std::pair<std::string, std::string>, size_t> meshLookup;
+	std::vector<std::pair<std::string, std::string>> meshKeys;
+	std::vector<std::vector<std::pair<size_t, size_t>>> meshRanges;
+	std::string currentObject = std::filesystem::path(path).stem().string();
+	std::string currentMaterial;
+	size_t rangeBegin = 0;
+	const auto closeRange = [&](const size_t& rangeEnd)
+	{
+		if (rangeEnd <= rangeBegin)
+		{
+			return;
+		}
+		const auto key = std::make_pair(currentObject, currentMaterial);
+		auto [it, inserted] = meshLookup.try_emplace(key, meshKeys.size());
+		if (inserted)
+		{
+			meshKeys.push_back(key);
+			meshRanges.emplace_back();
+		}
+		meshRanges[it->second].emplace_back(rangeBegin, rangeEnd);
+		rangeBegin = rangeEnd;
+	};
+	for (size_t c = 0; c < numChunks; c++)
+	{
+		for (const auto& change : chunks[c].changes)
+		{
+			closeRange(triangleBases[c] + change.triangle);
+			rangeBegin = triangleBases[c] + change.triangle;
+			(change.isMaterial ? currentMaterial : currentObject) = change.name;
+		}
+	}
+	closeRange(triangleCount);
+	chunks.clear();
+
+	model.meshes.clear();
+	model.meshes.resize(meshKeys.size());
+	model.instances.clear();
+	for (size_t m = 0; m < meshKeys.size(); m++)
+	{
+		auto& data = model.meshes[m];
+		const auto& [objectName, materialName] = meshKeys[m];
+		data.name = objectName;
+		if (data.name.find("Window") != std::string::npos)
+		{
+			data.meshType = WINDOW;
+		}
+
+		// 和Assimp的结果保持一致：有贴图的话颜色标记为-1，Shader里面用贴图
+		const auto material = materials.find(materialName);
+		const ObjMaterial objMaterial = material != materials.end() ? material->second : ObjMaterial{};
+		data.matInfo = std::string(DEFAULT_TEX_DIR) + objMaterial.texture;
+		data.color = objMaterial.texture.empty() ? objMaterial.diffuse : aiColor4D{ -1.0f, -1.0f, -1.0f, -1.0f };
+
+		// OBJ没有节点层级，每个Mesh摆放一次
+		model.instances.push_back({ static_cast<uint32_t>(m), mat4(1.0f), objectName });
+
+		// 把这个Mesh的角收集起来然后焊接
+		std::vector<Corner> meshCorners;
+		size_t meshTriangles = 0;
+		for (const auto& [first, last] : meshRanges[m])
+		{
+			meshTriangles += last - first;
+		}
+		meshCorners.reserve(meshTriangles * 3);
+		for (const auto& [first, last] : meshRanges[m])
+		{
+			meshCorners.insert(meshCorners.end(), corners.begin() + first * 3, corners.begin() + last * 3);
+		}
+
+		std::vector<Corner> uniqueCorners;
+		WeldCorners(meshCorners, uniqueCorners, data.indices);
+
+		const size_t vertexCount = uniqueCorners.size();
+		data.positions.resize(vertexCount);
+		std::vector<float> vertexNormals(vertexCount * 3);
+		std::vector<float> vertexUVs(vertexCount * 2);
+		bool hasUVs = false;
+		bool missingNormals = false;
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			const auto& corner = uniqueCorners[i];
+			data.positions[i] = vec3(positions[corner.v * 3 + 0], positions[corner.v * 3 + 1], positions[corner.v * 3 + 2]);
+			if (corner.vt != MISSING)
+			{
+				// 和aiProcess_FlipUVs一样反转V
+				vertexUVs[i * 2 + 0] = uvs[corner.vt * 2 + 0];
+				vertexUVs[i * 2 + 1] = 1.0f - uvs[corner.vt * 2 + 1];
+				hasUVs = true;
+			}
+			if (corner.vn != MISSING)
+			{
+				std::copy_n(&normals[corner.vn * 3], 3, &vertexNormals[i * 3]);
+			}
+			else
+			{
+				missingNormals = true;
+			}
+		}
+
+		// 没有法线的顶点用相邻三角形的面积加权法线，位置相同的顶点共用
+		if (missingNormals)
+		{
+			std::unordered_map<uint32_t, vec3> accumulated;
+			for (size_t t = 0; t < data.indices.size() / 3; t++)
+			{
+				const auto& c0 = uniqueCorners[data.indices[t * 3 + 0]];
+				const auto& c1 = uniqueCorners[data.indices[t * 3 + 1]];
+				const auto& c2 = uniqueCorners[data.indices[t * 3 + 2]];
+				const vec3& p0 = data.positions[data.indices[t * 3 + 0]];
+				const vec3 faceNormal = glm::cross(data.positions[data.indices[t * 3 + 1]] - p0, data.positions[data.indices[t * 3 + 2]] - p0);
+				for (const auto* corner : { &c0, &c1, &c2 })
+				{
+					if (corner->vn == MISSING)
+					{
+						accumulated[corner->v] += faceNormal;
+					}
+				}
+			}
+			for (size_t i = 0; i < vertexCount; i++)
+			{
+				if (uniqueCorners[i].vn == MISSING)
+				{
+					const vec3& sum = accumulated[uniqueCorners[i].v];
+					const vec3 normal = glm::length(sum) > 0.0f ? glm::normalize(sum) : vec3(0.0f, 1.0f, 0.0f);
+					vertexNormals[i * 3 + 0] = normal.x;
+					vertexNormals[i * 3 + 1] = normal.y;
+					vertexNormals[i * 3 + 2] = normal.z;
+				}
+			}
+		}
+
+		data.vertAttributes.resize(vertexCount);
+		VertexCompression::EncodeVertexAttributes(vertexNormals.data(), 3,
+			hasUVs ? vertexUVs.data() : nullptr, 2,
+			vertexCount,
+			data.vertAttributes.data());
+	}
+
+	// 每个Mesh的重排和LOD生成互不影响，可以一起做
+	ParallelFor(model.meshes.size(), 1, [&](const size_t& begin, const size_t& end, const size_t&)
+	{
+		for (size_t m = begin; m < end; m++)
+		{
+			auto& data = model.meshes[m];
+			data.localityBefore = MeshOptimizer::AnalyzeLocality(data.indices, data.positions.size());
+			MeshOptimizer::Optimize(data.positions, data.vertAttributes, data.indices);
+			data.localityAfter = MeshOptimizer::AnalyzeLocality(data.indices, data.positions.size());
+			Mesh::GenerateLods(data);
+		}
+	});
+
+	return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+
+#include "Mesh.h"
+
+/*
+ * Native reader for Wavefront OBJ / MTL files; Mesh::ReadModelFile uses it instead of Assimp for .obj.
+ * The file is split into chunks at line boundaries that are parsed in parallel, and identical
+ * (position, uv, normal) corners are welded with a sharded hash table, again in parallel.
+ * The result matches the Assimp path: triangulated, UVs flipped, normals generated when missing,
+ * one mesh per (object, material) pair with an identity instance each.
+ */
+class ObjLoader
+{
+public:
+	// Returns false (with a message on std::cerr) when the file cannot be read or is malformed.
+	static bool Read(const std::string& path, ModelImportData& model);
+};
@@ -0,0 +1,139 @@
+﻿#include "PipelineCache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+	constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x43505256; // "VRPC"
+	constexpr uint32_t PIPELINE_CACHE_VERSION = 1;
+}
+
+PipelineCache::PipelineCache(VkDevice logicalDevice, VkPhysicalDevice physicalDevice, const std::string& path) :
+	mLogicalDevice(logicalDevice),
+	mPhysicalDevice(physicalDevice),
+	mPath(path)
+{
+	VkPhysicalDeviceProperties properties = {};
+	vkGetPhysicalDeviceProperties(mPhysicalDevice, &properties);
+	std::memcpy(mPipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+	// 换了显卡或者驱动之后旧的数据没有用，驱动也可能不认，直接从空的缓存开始
+	std::vector<char> data;
+	mLoadedFromDisk = ReadFile(data);
+
+	VkPipelineCacheCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	createInfo.initialDataSize = mLoadedFromDisk ? data.size() : 0;
+	createInfo.pInitialData = mLoadedFromDisk ? data.data() : nullptr;
+	auto error = vkCreatePipelineCache(mLogicalDevice, &createInfo, VK_NULL_HANDLE, &mPipelineCache);
+	if (error != VK_SUCCESS && mLoadedFromDisk)
+	{
+		std::cerr << "Pipeline cache " << mPath << " was rejected by the driver, starting empty." << std::endl;
+		mLoadedFromDisk = false;
+		createInfo.initialDataSize = 0;
+		createInfo.pInitialData = nullptr;
+		error = vkCreatePipelineCache(mLogicalDevice, &createInfo, VK_NULL_HANDLE, &mPipelineCache);
+	}
+	CHECK_VK_ERROR(error, "Failed to create the pipeline cache.");
+}
+
+PipelineCache::FileHeader PipelineCache::MakeFileHeader(const uint64_t& dataSize) const
+{
+	VkPhysicalDeviceIDProperties idProperties = {};
+	idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+	VkPhysicalDeviceProperties2 properties = {};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties.pNext = &idProperties;
+	vkGetPhysicalDeviceProperties2(mPhysicalDevice, &properties);
+
+	FileHeader header = {};
+	header.magic = PIPELINE_CACHE_MAGIC;
+	header.version = PIPELINE_CACHE_VERSION;
+	header.vendorID = properties.properties.vendorID;
+	header.deviceID = properties.properties.deviceID;
+	header.driverVersion = properties.properties.driverVersion;
+	std::memcpy(header.driverUUID, idProperties.driverUUID, VK_UUID_SIZE);
+	header.dataSize = dataSize;
+	return header;
+}
+
+bool PipelineCache::ReadFile(std::vector<char>& data) const
+{
+	std::ifstream file(mPath, std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	FileHeader header = {};
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	const FileHeader expected = MakeFileHeader(header.dataSize);
+	if (!file || std::memcmp(&header, &expected, sizeof(FileHeader)) != 0)
+	{
+		return false;
+	}
+	data.resize(header.dataSize);
+	file.read(data.data(), data.size());
+	if (!file)
+	{
+		return false;
+	}
+
+	// 再核对一遍驱动自己的头（VkPipelineCacheHeaderVersionOne）
+	VkPipelineCacheHeaderVersionOne driverHeader = {};
+	if (data.size() < sizeof(driverHeader))
+	{
+		return false;
+	}
+	std::memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+	return driverHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		&& driverHeader.vendorID == expected.vendorID
+		&& driverHeader.deviceID == expected.deviceID
+		&& std::memcmp(driverHeader.pipelineCacheUUID, mPipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+bool PipelineCache::Save() const
+{
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(mLogicalDevice, mPipelineCache, &dataSize, nullptr) != VK_SUCCESS)
+	{
+		return false;
+	}
+	std::vector<char> data(dataSize);
+	if (vkGetPipelineCacheData(mLogicalDevice, mPipelineCache, &dataSize, data.data()) != VK_SUCCESS)
+	{
+		return false;
+	}
+
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(mPath).parent_path(), error);
+	// 先写临时文件再改名，写到一半退出的话下次启动不会读到坏的缓存
+	const std::string temporaryPath = mPath + ".tmp";
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+		const FileHeader header = MakeFileHeader(dataSize);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(data.data(), dataSize);
+		if (!file.good())
+		{
+			return false;
+		}
+	}
+	std::filesystem::rename(temporaryPath, mPath, error);
+	return !error;
+}
+
+void PipelineCache::Dispose()
+{
+	if (mPipelineCache != VK_NULL_HANDLE)
+	{
+		vkDestroyPipelineCache(mLogicalDevice, mPipelineCache, VK_NULL_HANDLE);
+		mPipelineCache = VK_NULL_HANDLE;
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "Common.h"
+
+/*
+ * A VkPipelineCache persisted between runs, so the driver does not compile the ray tracing pipeline from scratch on every launch.
+ * The file is only used when it was written by the same device and driver (vendor / device ID, driver version, driver UUID
+ * and the pipeline cache UUID); otherwise the cache starts empty and the file is replaced by Save.
+ */
+class PipelineCache
+{
+public:
+	PipelineCache(VkDevice logicalDevice, VkPhysicalDevice physicalDevice, const std::string& path);
+
+	// Writes the current contents of the cache to the file; call before destroying the device
+	bool Save() const;
+	void Dispose();
+
+	VkPipelineCache GetVkPipelineCache() const
+	{
+		return mPipelineCache;
+	}
+
+	// The file existed and matched this device and driver
+	bool IsLoadedFromDisk() const
+	{
+		return mLoadedFromDisk;
+	}
+
+private:
+	// 文件开头自己加的头，驱动的数据跟在后面
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint8_t driverUUID[VK_UUID_SIZE];
+		uint64_t dataSize;
+	};
+
+	FileHeader MakeFileHeader(const uint64_t& dataSize) const;
+	bool ReadFile(std::vector<char>& data) const;
+
+	VkDevice mLogicalDevice;
+	VkPhysicalDevice mPhysicalDevice;
+	std::string mPath;
+	VkPipelineCache mPipelineCache = VK_NULL_HANDLE;
+	bool mLoadedFromDisk = false;
+	// 驱动自己的缓存头里要核对的pipelineCacheUUID
+	uint8_t mPipelineCacheUUID[VK_UUID_SIZE] = {};
+};
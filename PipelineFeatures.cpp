@@ -0,0 +1,28 @@
+﻿#include "PipelineFeatures.h"
+
+#include <cstddef>
+
+uint32_t PipelineFeatures::GetKey() const
+{
+	// 反弹次数不超过MAX_BOUNCES_LIMIT，占低8位就够了
+	return maxBounces | (refraction ? 1u << 8 : 0u) | (shadows ? 1u << 9 : 0u) | (textureLodMode << 10);
+}
+
+PipelineSpecialization::PipelineSpecialization(const PipelineFeatures& features)
+{
+	mData.maxBounces = features.maxBounces;
+	mData.refraction = features.refraction ? VK_TRUE : VK_FALSE;
+	mData.shadows = features.shadows ? VK_TRUE : VK_FALSE;
+	mData.textureLodMode = features.textureLodMode;
+
+	// 所有Stage共用同一份，某个Stage里没有用到的ID会被忽略
+	mEntries[0] = { SWS_SPEC_MAX_BOUNCES, offsetof(SpecializationData, maxBounces), sizeof(uint32_t) };
+	mEntries[1] = { SWS_SPEC_REFRACTION, offsetof(SpecializationData, refraction), sizeof(VkBool32) };
+	mEntries[2] = { SWS_SPEC_SHADOWS, offsetof(SpecializationData, shadows), sizeof(VkBool32) };
+	mEntries[3] = { SWS_SPEC_TEXTURE_LOD_MODE, offsetof(SpecializationData, textureLodMode), sizeof(uint32_t) };
+
+	mInfo.mapEntryCount = static_cast<uint32_t>(mEntries.size());
+	mInfo.pMapEntries = mEntries.data();
+	mInfo.dataSize = sizeof(mData);
+	mInfo.pData = &mData;
+}
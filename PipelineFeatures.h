@@ -0,0 +1,63 @@
+#pragma once
+#include <array>
+
+#include "Common.h"
+#include "shared_with_shaders.h"
+
+/*
+ * Feature switches of the ray tracing pipeline. They reach the shaders as specialization constants (SWS_SPEC_*),
+ * so the SPIR-V is shared by every variant and the driver folds the values into the pipeline:
+ * a disabled feature is compiled out of the ray generation loop instead of being branched over per pixel.
+ */
+struct PipelineFeatures
+{
+	static constexpr uint32_t MAX_BOUNCES_LIMIT = 8;
+
+	uint32_t maxBounces = SWS_MAX_RECURSION;
+	bool refraction = true;
+	bool shadows = true;
+	uint32_t textureLodMode = SWS_TEXTURE_LOD_RAY_CONE;
+
+	bool operator==(const PipelineFeatures& other) const
+	{
+		return maxBounces == other.maxBounces && refraction == other.refraction
+			&& shadows == other.shadows && textureLodMode == other.textureLodMode;
+	}
+
+	bool operator!=(const PipelineFeatures& other) const
+	{
+		return !(*this == other);
+	}
+
+	// Distinct for every distinct set of features, to key cached pipeline variants
+	uint32_t GetKey() const;
+};
+
+// The VkSpecializationInfo of one PipelineFeatures; it has to stay alive until the pipeline is created.
+class PipelineSpecialization
+{
+public:
+	explicit PipelineSpecialization(const PipelineFeatures& features);
+
+	PipelineSpecialization(const PipelineSpecialization&) = delete;
+	PipelineSpecialization& operator=(const PipelineSpecialization&) = delete;
+
+	const VkSpecializationInfo* GetInfo() const
+	{
+		return &mInfo;
+	}
+
+private:
+	// 和Shader里constant_id的类型一一对应，bool在SPIR-V里是32位的
+	struct SpecializationData
+	{
+		uint32_t maxBounces;
+		VkBool32 refraction;
+		VkBool32 shadows;
+		uint32_t textureLodMode;
+	};
+
+	SpecializationData mData;
+	std::array<VkSpecializationMapEntry, 4> mEntries;
+	VkSpecializationInfo mInfo;
+};
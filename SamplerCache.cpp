@@ -0,0 +1,48 @@
+﻿#include "SamplerCache.h"
+
+SamplerCache::SamplerCache(VkDevice& logicalDevice) :
+	mLogicalDevice(logicalDevice)
+{
+}
+
+VkSampler SamplerCache::Get(const SamplerKey& key)
+{
+	const auto found = mSamplers.find(key);
+	if (found != mSamplers.end())
+	{
+		return found->second;
+	}
+
+	VkSamplerCreateInfo samplerCreateInfo = {};
+	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerCreateInfo.magFilter = key.magFilter;
+	samplerCreateInfo.minFilter = key.minFilter;
+	samplerCreateInfo.mipmapMode = key.mipmapMode;
+	samplerCreateInfo.addressModeU = key.addressMode;
+	samplerCreateInfo.addressModeV = key.addressMode;
+	samplerCreateInfo.addressModeW = key.addressMode;
+	samplerCreateInfo.mipLodBias = 0;
+	samplerCreateInfo.anisotropyEnable = VK_FALSE;
+	samplerCreateInfo.maxAnisotropy = 1;
+	samplerCreateInfo.compareEnable = VK_FALSE;
+	samplerCreateInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	samplerCreateInfo.minLod = 0;
+	// 不同的图片Mip数量不一样，由ImageView限制，Sampler本身不截断
+	samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+	samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+	samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
+
+	VkSampler sampler = VK_NULL_HANDLE;
+	CHECK_VK_ERROR(vkCreateSampler(mLogicalDevice, &samplerCreateInfo, nullptr, &sampler), "Failed to create a sampler.");
+	mSamplers.emplace(key, sampler);
+	return sampler;
+}
+
+void SamplerCache::Dispose()
+{
+	for (auto& [key, sampler] : mSamplers)
+	{
+		vkDestroySampler(mLogicalDevice, sampler, VK_NULL_HANDLE);
+	}
+	mSamplers.clear();
+}
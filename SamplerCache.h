@@ -0,0 +1,51 @@
+#pragma once
+#include <unordered_map>
+
+#include "Common.h"
+
+// Filter and address state of a sampler; samplers from the cache never clamp the LOD, the image view does.
+struct SamplerKey
+{
+	VkFilter magFilter = VK_FILTER_LINEAR;
+	VkFilter minFilter = VK_FILTER_LINEAR;
+	VkSamplerMipmapMode mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+
+	bool operator==(const SamplerKey& other) const
+	{
+		return magFilter == other.magFilter && minFilter == other.minFilter
+			&& mipmapMode == other.mipmapMode && addressMode == other.addressMode;
+	}
+};
+
+// One VkSampler per distinct SamplerKey, shared by every image that samples with that state.
+class SamplerCache
+{
+public:
+	explicit SamplerCache(VkDevice& logicalDevice);
+
+	// Creates the sampler on first use; the cache keeps ownership.
+	VkSampler Get(const SamplerKey& key);
+
+	size_t GetSamplerCount() const
+	{
+		return mSamplers.size();
+	}
+
+	void Dispose();
+
+private:
+	struct SamplerKeyHash
+	{
+		size_t operator()(const SamplerKey& key) const
+		{
+			return static_cast<size_t>(key.magFilter)
+				| static_cast<size_t>(key.minFilter) << 8
+				| static_cast<size_t>(key.mipmapMode) << 16
+				| static_cast<size_t>(key.addressMode) << 24;
+		}
+	};
+
+	VkDevice& mLogicalDevice;
+	std::unordered_map<SamplerKey, VkSampler, SamplerKeyHash> mSamplers;
+};
@@ -0,0 +1,720 @@
+﻿#include "Scene.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <sstream>
+#include <stdexcept>
+
+#include "FileWatcher.h"
+#include "ModelCache.h"
+
+namespace
+{
+	// 场景文件只用到JSON的一小部分，这里写一个最简单的解析器，不额外引入依赖
+	struct JsonValue
+	{
+		enum Type
+		{
+			NUL = 0, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT
+		};
+
+		Type type = NUL;
+		bool boolean = false;
+		double number = 0.0;
+		std::string string;
+		std::vector<JsonValue> array;
+		// 保留文件里的顺序
+		std::vector<std::pair<std::string, JsonValue>> object;
+
+		const JsonValue* Find(const std::string& key) const
+		{
+			for (const auto& [name, value] : object)
+			{
+				if (name == key)
+				{
+					return &value;
+				}
+			}
+			return nullptr;
+		}
+	};
+
+	class JsonParser
+	{
+	public:
+		explicit JsonParser(const std::string& text) :
+			mText(text)
+		{
+		}
+
+		JsonValue Parse()
+		{
+			JsonValue value = ParseValue();
+			SkipWhitespace();
+			if (mPos != mText.size())
+			{
+				Fail("unexpected trailing characters");
+			}
+			return value;
+		}
+
+	private:
+		[[noreturn]] void Fail(const std::string& message) const
+		{
+			throw std::runtime_error("Invalid JSON at offset " + std::to_string(mPos) + ": " + message);
+		}
+
+		void SkipWhitespace()
+		{
+			while (mPos < mText.size() && std::isspace(static_cast<unsigned char>(mText[mPos])))
+			{
+				mPos++;
+			}
+		}
+
+		char Peek()
+		{
+			SkipWhitespace();
+			if (mPos >= mText.size())
+			{
+				Fail("unexpected end of file");
+			}
+			return mText[mPos];
+		}
+
+		void Expect(const char& c)
+		{
+			if (Peek() != c)
+			{
+				Fail(std::string("expected '") + c + "'");
+			}
+			mPos++;
+		}
+
+		bool ConsumeLiteral(const char* literal)
+		{
+			const size_t length = std::char_traits<char>::length(literal);
+			if (mText.compare(mPos, length, literal) != 0)
+			{
+				return false;
+			}
+			mPos += length;
+			return true;
+		}
+
+		JsonValue ParseValue()
+		{
+			JsonValue value;
+			const char c = Peek();
+			if (c == '{')
+			{
+				value.type = JsonValue::OBJECT;
+				mPos++;
+				if (Peek() == '}')
+				{
+					mPos++;
+					return value;
+				}
+				while (true)
+				{
+					if (Peek() != '"')
+					{
+						Fail("expected a key");
+					}
+					std::string key = ParseString();
+					Expect(':');
+					value.object.emplace_back(std::move(key), ParseValue());
+					if (Peek() == ',')
+					{
+						mPos++;
+						continue;
+					}
+					Expect('}');
+					return value;
+				}
+			}
+			if (c == '[')
+			{
+				value.type = JsonValue::ARRAY;
+				mPos++;
+				if (Peek() == ']')
+				{
+					mPos++;
+					return value;
+				}
+				while (true)
+				{
+					value.array.push_back(ParseValue());
+					if (Peek() == ',')
+					{
+						mPos++;
+						continue;
+					}
+					Expect(']');
+					return value;
+				}
+			}
+			if (c == '"')
+			{
+				value.type = JsonValue::STRING;
+				value.string = ParseString();
+				return value;
+			}
+			if (ConsumeLiteral("true"))
+			{
+				value.type = JsonValue::BOOLEAN;
+				value.boolean = true;
+				return value;
+			}
+			if (ConsumeLiteral("false"))
+			{
+				value.type = JsonValue::BOOLEAN;
+				value.boolean = false;
+				return value;
+			}
+			if (ConsumeLiteral("null"))
+			{
+				return value;
+			}
+
+			// 剩下的只可能是数字
+			value.type = JsonValue::NUMBER;
+			value.number = ParseNumber();
+			return value;
+		}
+
+		bool IsDigit(const size_t& pos) const
+		{
+			return pos < mText.size() && std::isdigit(static_cast<unsigned char>(mText[pos]));
+		}
+
+		// 先按JSON的语法找到数字的结尾，strtod还会接受inf、nan、十六进制和开头的'+'，这些都不是合法的JSON
+		double ParseNumber()
+		{
+			size_t end = mPos;
+			if (end < mText.size() && mText[end] == '-')
+			{
+				end++;
+			}
+			if (!IsDigit(end))
+			{
+				Fail("unexpected character");
+			}
+			// 整数部分不能有前导0
+			if (mText[end] == '0')
+			{
+				end++;
+			}
+			else
+			{
+				while (IsDigit(end))
+				{
+					end++;
+				}
+			}
+			if (end < mText.size() && mText[end] == '.')
+			{
+				end++;
+				if (!IsDigit(end))
+				{
+					Fail("expected a digit after the decimal point");
+				}
+				while (IsDigit(end))
+				{
+					end++;
+				}
+			}
+			if (end < mText.size() && (mText[end] == 'e' || mText[end] == 'E'))
+			{
+				end++;
+				if (end < mText.size() && (mText[end] == '+' || mText[end] == '-'))
+				{
+					end++;
+				}
+				if (!IsDigit(end))
+				{
+					Fail("expected a digit in the exponent");
+				}
+				while (IsDigit(end))
+				{
+					end++;
+				}
+			}
+
+			const double number = std::strtod(mText.substr(mPos, end - mPos).c_str(), nullptr);
+			if (!std::isfinite(number))
+			{
+				Fail("number out of range");
+			}
+			mPos = end;
+			return number;
+		}
+
+		uint32_t ParseHex4()
+		{
+			if (mPos + 4 > mText.size())
+			{
+				Fail("invalid unicode escape");
+			}
+			uint32_t code = 0;
+			for (size_t i = 0; i < 4; i++)
+			{
+				const char c = mText[mPos++];
+				if (!std::isxdigit(static_cast<unsigned char>(c)))
+				{
+					Fail("invalid unicode escape");
+				}
+				code = code * 16 + static_cast<uint32_t>(std::isdigit(static_cast<unsigned char>(c)) ? c - '0' : std::tolower(c) - 'a' + 10);
+			}
+			return code;
+		}
+
+		std::string ParseString()
+		{
+			Expect('"');
+			std::string result;
+			while (true)
+			{
+				if (mPos >= mText.size())
+				{
+					Fail("unterminated string");
+				}
+				const char c = mText[mPos++];
+				if (c == '"')
+				{
+					return result;
+				}
+				if (c != '\\')
+				{
+					result += c;
+					continue;
+				}
+
+				if (mPos >= mText.size())
+				{
+					Fail("unterminated string");
+				}
+				const char escaped = mText[mPos++];
+				switch (escaped)
+				{
+				case '"': result += '"'; break;
+				case '\\': result += '\\'; break;
+				case '/': result += '/'; break;
+				case 'b': result += '\b'; break;
+				case 'f': result += '\f'; break;
+				case 'n': result += '\n'; break;
+				case 'r': result += '\r'; break;
+				case 't': result += '\t'; break;
+				case 'u':
+				{
+					// 转换成UTF-8；基本多文种平面之外的字符是一对UTF-16代理项
+					uint32_t code = ParseHex4();
+					if (code >= 0xDC00 && code <= 0xDFFF)
+					{
+						Fail("unpaired low surrogate in unicode escape");
+					}
+					if (code >= 0xD800 && code <= 0xDBFF)
+					{
+						if (!ConsumeLiteral("\\u"))
+						{
+							Fail("unpaired high surrogate in unicode escape");
+						}
+						const uint32_t low = ParseHex4();
+						if (low < 0xDC00 || low > 0xDFFF)
+						{
+							Fail("unpaired high surrogate in unicode escape");
+						}
+						code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+					}
+
+					if (code < 0x80)
+					{
+						result += static_cast<char>(code);
+					}
+					else if (code < 0x800)
+					{
+						result += static_cast<char>(0xC0 | (code >> 6));
+						result += static_cast<char>(0x80 | (code & 0x3F));
+					}
+					else if (code < 0x10000)
+					{
+						result += static_cast<char>(0xE0 | (code >> 12));
+						result += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+						result += static_cast<char>(0x80 | (code & 0x3F));
+					}
+					else
+					{
+						result += static_cast<char>(0xF0 | (code >> 18));
+						result += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+						result += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+						result += static_cast<char>(0x80 | (code & 0x3F));
+					}
+					break;
+				}
+				default:
+					Fail("invalid escape sequence");
+				}
+			}
+		}
+
+		const std::string& mText;
+		size_t mPos = 0;
+	};
+
+	float ReadFloat(const JsonValue& parent, const char* key, const float& defaultValue)
+	{
+		const auto* value = parent.Find(key);
+		if (value == nullptr)
+		{
+			return defaultValue;
+		}
+		if (value->type != JsonValue::NUMBER)
+		{
+			throw std::runtime_error(std::string("\"") + key + "\" has to be a number");
+		}
+		return static_cast<float>(value->number);
+	}
+
+	bool ReadBool(const JsonValue& parent, const char* key, const bool& defaultValue)
+	{
+		const auto* value = parent.Find(key);
+		if (value == nullptr)
+		{
+			return defaultValue;
+		}
+		if (value->type != JsonValue::BOOLEAN)
+		{
+			throw std::runtime_error(std::string("\"") + key + "\" has to be true or false");
+		}
+		return value->boolean;
+	}
+
+	std::string ReadString(const JsonValue& parent, const char* key, const std::string& defaultValue)
+	{
+		const auto* value = parent.Find(key);
+		if (value == nullptr)
+		{
+			return defaultValue;
+		}
+		if (value->type != JsonValue::STRING)
+		{
+			throw std::runtime_error(std::string("\"") + key + "\" has to be a string");
+		}
+		return value->string;
+	}
+
+	vec3 ReadVec3(const JsonValue& parent, const char* key, const vec3& defaultValue)
+	{
+		const auto* value = parent.Find(key);
+		if (value == nullptr)
+		{
+			return defaultValue;
+		}
+		if (value->type != JsonValue::ARRAY || value->array.size() != 3
+			|| std::any_of(value->array.begin(), value->array.end(), [](const JsonValue& v) { return v.type != JsonValue::NUMBER; }))
+		{
+			throw std::runtime_error(std::string("\"") + key + "\" has to be an array of 3 numbers");
+		}
+		return vec3(value->array[0].number, value->array[1].number, value->array[2].number);
+	}
+
+	ObjAttri ReadObjAttri(const JsonValue& parent, const ObjAttri& defaultValue)
+	{
+		ObjAttri result{};
+		result.reflection = ReadBool(parent, "reflection", defaultValue.reflection);
+		result.refraction = ReadBool(parent, "refraction", defaultValue.refraction);
+		return result;
+	}
+}
+
+Scene Scene::LoadFromFile(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open scene file " + path);
+	}
+	std::stringstream text;
+	text << file.rdbuf();
+	const std::string content = text.str();
+
+	Scene scene;
+
+	try
+	{
+		const JsonValue root = JsonParser(content).Parse();
+		if (root.type != JsonValue::OBJECT)
+		{
+			throw std::runtime_error("the root has to be an object");
+		}
+
+		// 资源用名字引用，重复引用的资源只读取一次
+		const auto* assets = root.Find("assets");
+		if (assets == nullptr || assets->type != JsonValue::OBJECT)
+		{
+			throw std::runtime_error("\"assets\" has to be an object of name: path");
+		}
+		std::vector<std::string> assetNames;
+		for (const auto& [name, value] : assets->object)
+		{
+			if (value.type != JsonValue::STRING)
+			{
+				throw std::runtime_error("asset \"" + name + "\" has to be a path");
+			}
+			assetNames.push_back(name);
+			scene.mAssets.push_back(value.string);
+		}
+
+		const auto* instances = root.Find("instances");
+		if (instances == nullptr || instances->type != JsonValue::ARRAY)
+		{
+			throw std::runtime_error("\"instances\" has to be an array");
+		}
+		for (const auto& instance : instances->array)
+		{
+			if (instance.type != JsonValue::OBJECT)
+			{
+				throw std::runtime_error("every instance has to be an object");
+			}
+
+			SceneInstanceDesc desc;
+			const std::string asset = ReadString(instance, "asset", "");
+			const auto found = std::find(assetNames.begin(), assetNames.end(), asset);
+			if (found == assetNames.end())
+			{
+				throw std::runtime_error("unknown asset \"" + asset + "\"");
+			}
+			desc.asset = static_cast<uint32_t>(found - assetNames.begin());
+			desc.name = ReadString(instance, "name", asset);
+
+			// 先缩放，再按X、Y、Z的顺序旋转，最后平移
+			const vec3 position = ReadVec3(instance, "position", vec3(0.0f));
+			const vec3 rotation = ReadVec3(instance, "rotation", vec3(0.0f));
+			const vec3 scale = ReadVec3(instance, "scale", vec3(1.0f));
+			desc.transform = glm::translate(mat4(1.0f), position)
+				* glm::rotate(mat4(1.0f), Deg2Rad(rotation.z), vec3(0.0f, 0.0f, 1.0f))
+				* glm::rotate(mat4(1.0f), Deg2Rad(rotation.y), vec3(0.0f, 1.0f, 0.0f))
+				* glm::rotate(mat4(1.0f), Deg2Rad(rotation.x), vec3(1.0f, 0.0f, 0.0f))
+				* glm::scale(mat4(1.0f), scale);
+
+			desc.attributes = ReadObjAttri(instance, ObjAttri{});
+			if (const auto* objects = instance.Find("objects"))
+			{
+				if (objects->type != JsonValue::OBJECT)
+				{
+					throw std::runtime_error("\"objects\" has to be an object of name: attributes");
+				}
+				for (const auto& [name, value] : objects->object)
+				{
+					desc.objectOverrides.emplace_back(name, ReadObjAttri(value, desc.attributes));
+				}
+			}
+			scene.mInstances.push_back(std::move(desc));
+		}
+
+		scene.mEnvironmentMap = ReadString(root, "environment", scene.mEnvironmentMap);
+		scene.mVirtualTextures = ReadBool(root, "virtualTextures", scene.mVirtualTextures);
+		scene.mGPUMemoryBudgetMB = static_cast<uint32_t>(std::max(ReadFloat(root, "gpuMemoryBudgetMB", 0.0f), 0.0f));
+
+		if (const auto* camera = root.Find("camera"))
+		{
+			scene.mCameraPosition = ReadVec3(*camera, "position", scene.mCameraPosition);
+			scene.mCameraDirection = ReadVec3(*camera, "direction", scene.mCameraDirection);
+			scene.mCameraFovY = ReadFloat(*camera, "fov", scene.mCameraFovY);
+			scene.mCameraNear = ReadFloat(*camera, "near", scene.mCameraNear);
+			scene.mCameraFar = ReadFloat(*camera, "far", scene.mCameraFar);
+		}
+
+		if (const auto* light = root.Find("light"))
+		{
+			const vec3 direction = ReadVec3(*light, "direction", vec3(scene.mSunPosAndAmbient));
+			scene.mSunPosAndAmbient = vec4(direction, ReadFloat(*light, "ambient", scene.mSunPosAndAmbient.w));
+		}
+	}
+	catch (const std::exception& e)
+	{
+		throw std::runtime_error("Failed to load scene " + path + ": " + e.what());
+	}
+
+	return scene;
+}
+
+void Scene::LoadAssets(VkDevice& logicalDevice,
+	VkCommandPool& pool,
+	VkQueue& graphicsQueue,
+	VmaAllocator& allocator,
+	TextureCache& textureCache,
+	const ModelCache* modelCache,
+	const MeshResidency& residency,
+	std::vector<std::shared_ptr<Mesh>>& meshes,
+	std::vector<MeshInstance>& instances,
+	std::vector<ObjAttri>& objAttris)
+{
+	// 烘焙缓存里的Mesh没有几何数据，只能交给MeshStreamer
+	assert(modelCache == nullptr || residency == STREAMED);
+
+	// 每个资源一个线程：读文件、解析、重排顶点、生成LOD、烘焙都只用CPU，互相之间没有影响
+	std::vector<ModelImportData> models(mAssets.size());
+	std::vector<std::future<bool>> reads;
+	reads.reserve(mAssets.size());
+	for (size_t i = 0; i < mAssets.size(); i++)
+	{
+		reads.push_back(std::async(std::launch::async, [this, &models, &textureCache, modelCache, i]()
+		{
+			// 上次烘焙之后模型文件没有变过的话，导入和优化都可以跳过
+			const bool cached = modelCache != nullptr && modelCache->Load(mAssets[i], models[i]);
+			if (!cached && !Mesh::ReadModelFile(mAssets[i], models[i]))
+			{
+				return false;
+			}
+			// 贴图的解码比读模型还慢，读完一个模型知道了它的贴图路径就马上开始解码
+			for (const auto& mesh : models[i].meshes)
+			{
+				if (mesh.color.r < 0)
+				{
+					textureCache.Prefetch(mesh.matInfo);
+				}
+			}
+			// 烘焙失败的Mesh由MeshStreamer一直留在显存里，下次启动再重新导入
+			if (!cached && modelCache != nullptr)
+			{
+				modelCache->Store(mAssets[i], models[i]);
+			}
+			return true;
+		}));
+	}
+	for (size_t i = 0; i < reads.size(); i++)
+	{
+		if (!reads[i].get())
+		{
+			throw std::runtime_error("Failed to load asset " + mAssets[i]);
+		}
+	}
+
+	// 创建Vulkan资源要用同一个命令池和队列，只能在这个线程上按顺序来
+	meshes.clear();
+	instances.clear();
+	objAttris.clear();
+	mAssetRanges.assign(models.size(), {});
+	std::vector<std::vector<MeshInstance>> modelInstances(models.size());
+	for (size_t i = 0; i < models.size(); i++)
+	{
+		auto& range = mAssetRanges[i];
+		range.firstMesh = static_cast<uint32_t>(meshes.size());
+		range.meshCount = static_cast<uint32_t>(models[i].meshes.size());
+		range.nodeCount = models[i].instances.size();
+		modelInstances[i] = std::move(models[i].instances);
+		auto created = Mesh::CreateMeshes(logicalDevice, pool, graphicsQueue, allocator, models[i], range.firstMesh, residency, &textureCache);
+		meshes.insert(meshes.end(), created.begin(), created.end());
+	}
+	// 贴图不在这里等，材质先指向占位图，之后每帧由TextureCache::Update流式传上去
+
+	// 场景里的每个Instance展开成资源里每个节点的Instance，变换乘在节点的世界矩阵外面
+	for (const auto& sceneInstance : mInstances)
+	{
+		const uint32_t firstMesh = mAssetRanges[sceneInstance.asset].firstMesh;
+		for (const auto& node : modelInstances[sceneInstance.asset])
+		{
+			ObjAttri attributes;
+			instances.push_back(PlaceNode(sceneInstance, node, firstMesh, meshes[firstMesh + node.meshIndex]->GetName(), attributes));
+			objAttris.push_back(attributes);
+		}
+	}
+}
+
+MeshInstance Scene::PlaceNode(const SceneInstanceDesc& sceneInstance,
+	const MeshInstance& node,
+	const uint32_t& firstMesh,
+	const std::string& meshName,
+	ObjAttri& attributes)
+{
+	attributes = sceneInstance.attributes;
+	for (const auto& [name, overrideAttributes] : sceneInstance.objectOverrides)
+	{
+		if (node.name.find(name) != std::string::npos || meshName.find(name) != std::string::npos)
+		{
+			attributes = overrideAttributes;
+		}
+	}
+	return { firstMesh + node.meshIndex, sceneInstance.transform * node.transform, sceneInstance.name + "/" + node.name };
+}
+
+int Scene::FindAsset(const std::string& path) const
+{
+	for (size_t i = 0; i < mAssets.size(); i++)
+	{
+		if (FileWatcher::NormalizePath(mAssets[i]) == path)
+		{
+			return static_cast<int>(i);
+		}
+	}
+	return -1;
+}
+
+bool Scene::ReloadAsset(VkDevice& logicalDevice,
+	VkCommandPool& pool,
+	VkQueue& graphicsQueue,
+	VmaAllocator& allocator,
+	TextureCache& textureCache,
+	const ModelCache* modelCache,
+	const MeshResidency& residency,
+	const uint32_t& asset,
+	std::vector<std::shared_ptr<Mesh>>& newMeshes,
+	uint32_t& firstMesh,
+	std::vector<MeshInstance>& instances,
+	std::vector<ObjAttri>& objAttris,
+	std::vector<size_t>& updatedInstances) const
+{
+	assert(asset < mAssetRanges.size());
+	const auto& range = mAssetRanges[asset];
+
+	ModelImportData model;
+	if (!Mesh::ReadModelFile(mAssets[asset], model))
+	{
+		std::cerr << "Failed to reload asset " << mAssets[asset] << std::endl;
+		return false;
+	}
+
+	// Mesh数量或者节点数量变了的话，描述符数组和TLAS Instance的数量都对不上，只能重启
+	if (model.meshes.size() != range.meshCount || model.instances.size() != range.nodeCount)
+	{
+		std::cerr << "The layout of " << mAssets[asset] << " changed (" << model.meshes.size() << " meshes, "
+			<< model.instances.size() << " nodes), restart to pick it up." << std::endl;
+		return false;
+	}
+
+	// 模型文件的修改时间变了，缓存只能重新烘焙；新的几何文件不会覆盖旧的Mesh还在用的文件
+	if (modelCache != nullptr)
+	{
+		modelCache->Store(mAssets[asset], model);
+	}
+
+	firstMesh = range.firstMesh;
+	// 已经加载过的贴图直接共用，新出现的贴图和启动时一样流式加载
+	newMeshes = Mesh::CreateMeshes(logicalDevice, pool, graphicsQueue, allocator, model, range.firstMesh, residency, &textureCache);
+
+	// 节点的变换、名字和引用的Mesh都可能改了，这个资源展开出来的Instance全部重新摆放一遍
+	// 节点数量没变，所以每个场景Instance展开出来的位置和LoadAssets的时候一样
+	updatedInstances.clear();
+	size_t next = 0;
+	for (const auto& sceneInstance : mInstances)
+	{
+		const size_t nodeCount = mAssetRanges[sceneInstance.asset].nodeCount;
+		if (sceneInstance.asset == asset)
+		{
+			for (size_t i = 0; i < nodeCount; i++)
+			{
+				const auto& node = model.instances[i];
+				instances[next + i] = PlaceNode(sceneInstance, node, range.firstMesh, newMeshes[node.meshIndex]->GetName(), objAttris[next + i]);
+				updatedInstances.push_back(next + i);
+			}
+		}
+		next += nodeCount;
+	}
+	assert(next == instances.size());
+	return true;
+}
@@ -0,0 +1,164 @@
+#pragma once
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Mesh.h"
+#include "TextureCache.h"
+
+class ModelCache;
+
+// One placement of a model asset in a scene file.
+struct SceneInstanceDesc
+{
+	uint32_t asset = 0;
+	std::string name;
+	mat4 transform = mat4(1.0f);
+	ObjAttri attributes{};
+	// Attributes for the nodes / meshes of the asset whose name contains the key
+	std::vector<std::pair<std::string, ObjAttri>> objectOverrides;
+};
+
+/*
+ * Declarative scene description read from a JSON file:
+ * {
+ *   "assets":      { "loft": "models\\Loft.obj" },
+ *   "instances":   [ { "asset": "loft", "name": "Loft",
+ *                      "position": [0, 0, 0], "rotation": [0, 0, 0], "scale": [1, 1, 1],
+ *                      "reflection": false, "refraction": false,
+ *                      "objects": { "Window": { "reflection": true } } } ],
+ *   "environment": "textures\\Sky.png",
+ *   "virtualTextures": false,
+ *   "gpuMemoryBudgetMB": 0,
+ *   "camera":      { "position": [x, y, z], "direction": [x, y, z], "fov": 60, "near": 0.2, "far": 5000 },
+ *   "light":       { "direction": [x, y, z], "ambient": 0.5 }
+ * }
+ * Rotation is XYZ Euler angles in degrees. Everything except "assets" and "instances" is optional.
+ */
+class Scene
+{
+public:
+	// Throws std::runtime_error when the file cannot be read or is not a valid scene.
+	static Scene LoadFromFile(const std::string& path);
+
+	/*
+	 * Reads every asset on its own thread; an asset placed by several instances is read only once.
+	 * With a modelCache (STREAMED residency only), assets cooked from the current file are taken from the cache
+	 * without their geometry, the others are imported and cooked.
+	 * The meshes are then created on the calling thread, and every scene instance is expanded into
+	 * one MeshInstance (with its ObjAttri) per node of its asset. Textures go through textureCache.
+	 */
+	void LoadAssets(VkDevice& logicalDevice,
+		VkCommandPool& pool,
+		VkQueue& graphicsQueue,
+		VmaAllocator& allocator,
+		TextureCache& textureCache,
+		const ModelCache* modelCache,
+		const MeshResidency& residency,
+		std::vector<std::shared_ptr<Mesh>>& meshes,
+		std::vector<MeshInstance>& instances,
+		std::vector<ObjAttri>& objAttris);
+
+	// The asset read from path (compared with FileWatcher::NormalizePath), or -1
+	[[nodiscard]] int FindAsset(const std::string& path) const;
+
+	/*
+	 * Re-reads one asset after its file changed. The new meshes take the place of
+	 * meshes [firstMesh, firstMesh + newMeshes.size()) created by LoadAssets, with the same material IDs.
+	 * The new meshes are cooked into modelCache if there is one.
+	 * Edited nodes (transform, name, mesh) are written into the entries of instances and objAttris that came
+	 * from this asset; their indices are returned in updatedInstances.
+	 * Returns false when the file cannot be read or its mesh / node count changed, which needs a restart.
+	 */
+	bool ReloadAsset(VkDevice& logicalDevice,
+		VkCommandPool& pool,
+		VkQueue& graphicsQueue,
+		VmaAllocator& allocator,
+		TextureCache& textureCache,
+		const ModelCache* modelCache,
+		const MeshResidency& residency,
+		const uint32_t& asset,
+		std::vector<std::shared_ptr<Mesh>>& newMeshes,
+		uint32_t& firstMesh,
+		std::vector<MeshInstance>& instances,
+		std::vector<ObjAttri>& objAttris,
+		std::vector<size_t>& updatedInstances) const;
+
+	[[nodiscard]] const std::string& GetEnvironmentMap() const
+	{
+		return mEnvironmentMap;
+	}
+
+	// 材质贴图按页流式加载（VirtualTextureStreamer），而不是整张常驻
+	[[nodiscard]] bool UsesVirtualTextures() const
+	{
+		return mVirtualTextures;
+	}
+
+	// 这个进程最多用多少显存（MB），同一张显卡上跑好几个实例的时候用来分；0表示驱动给多少用多少
+	[[nodiscard]] uint32_t GetGPUMemoryBudgetMB() const
+	{
+		return mGPUMemoryBudgetMB;
+	}
+
+	[[nodiscard]] const vec3& GetCameraPosition() const
+	{
+		return mCameraPosition;
+	}
+
+	[[nodiscard]] const vec3& GetCameraDirection() const
+	{
+		return mCameraDirection;
+	}
+
+	[[nodiscard]] float GetCameraFovY() const
+	{
+		return mCameraFovY;
+	}
+
+	[[nodiscard]] float GetCameraNear() const
+	{
+		return mCameraNear;
+	}
+
+	[[nodiscard]] float GetCameraFar() const
+	{
+		return mCameraFar;
+	}
+
+	// xyz是平行光的方向，w是环境光
+	[[nodiscard]] const vec4& GetSunPosAndAmbient() const
+	{
+		return mSunPosAndAmbient;
+	}
+
+private:
+	// LoadAssets之后每个资源在Mesh数组里的位置，热重载的时候按这个替换
+	struct AssetRange
+	{
+		uint32_t firstMesh = 0;
+		uint32_t meshCount = 0;
+		size_t nodeCount = 0;
+	};
+
+	// 场景里的一个Instance摆放资源里的一个节点：变换乘在节点的世界矩阵外面，名字匹配的objects覆盖属性
+	static MeshInstance PlaceNode(const SceneInstanceDesc& sceneInstance,
+		const MeshInstance& node,
+		const uint32_t& firstMesh,
+		const std::string& meshName,
+		ObjAttri& attributes);
+
+	std::vector<std::string> mAssets;
+	std::vector<AssetRange> mAssetRanges;
+	std::vector<SceneInstanceDesc> mInstances;
+
+	std::string mEnvironmentMap = DEFAULT_TEXTURE_DIR"Sky_LowPoly_01_Day_a.png";
+	bool mVirtualTextures = false;
+	uint32_t mGPUMemoryBudgetMB = 0;
+	vec3 mCameraPosition = vec3(0.0f, 0.0f, 0.0f);
+	vec3 mCameraDirection = vec3(0.0f, 0.0f, 1.0f);
+	float mCameraFovY = 60.0f;
+	float mCameraNear = 0.2f;
+	float mCameraFar = 5000.0f;
+	vec4 mSunPosAndAmbient = vec4(0.7f, 0.45f, 0.55f, 0.5f);
+};
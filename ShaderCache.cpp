@@ -0,0 +1,258 @@
+﻿#include "ShaderCache.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <glslang/SPIRV/GlslangToSpv.h>
+#include <spirv-tools/libspirv.h>
+
+#include "FileUtility.h"
+#include "ShaderModule.h"
+
+namespace
+{
+	// 缓存文件格式或者编译方式变了（不在下面的哈希里的那些）就改一下这个版本号
+	constexpr uint32_t SHADER_CACHE_MAGIC = 0x43565053; // "SPVC"
+	constexpr uint32_t SHADER_CACHE_VERSION = 1;
+	constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+
+	struct ShaderCacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key;
+		uint64_t wordCount;
+	};
+
+	struct EmbeddedShader
+	{
+		uint64_t key;
+		const uint32_t* code;
+		size_t wordCount;
+	};
+
+	// FNV-1a，只用来区分内容，不需要抗碰撞
+	class Fnv1a
+	{
+	public:
+		void Add(const void* data, const size_t& size)
+		{
+			const auto* bytes = static_cast<const uint8_t*>(data);
+			for (size_t i = 0; i < size; i++)
+			{
+				mHash = (mHash ^ bytes[i]) * 0x100000001b3ull;
+			}
+		}
+
+		void Add(const std::string& text)
+		{
+			// 连同结尾的'\0'一起，这样"ab"+"c"和"a"+"bc"不一样
+			Add(text.c_str(), text.size() + 1);
+		}
+
+		template<typename T>
+		void AddValue(const T& value)
+		{
+			Add(&value, sizeof(T));
+		}
+
+		uint64_t Get() const
+		{
+			return mHash;
+		}
+
+	private:
+		uint64_t mHash = 0xcbf29ce484222325ull;
+	};
+}
+
+#ifdef VKRT_EMBEDDED_SHADERS
+#include "EmbeddedShaders.inl"
+#endif
+
+uint64_t ShaderCache::ComputeKey(const EShLanguage& stage, const char* source, std::map<std::string, std::string>& headers)
+{
+	headers.clear();
+	ReadIncludes(source, headers);
+
+	Fnv1a hash;
+	hash.AddValue(SHADER_CACHE_VERSION);
+	// 编译选项
+	hash.AddValue(static_cast<int32_t>(stage));
+	hash.AddValue(static_cast<int32_t>(ShaderModule::CLIENT_VERSION));
+	hash.AddValue(static_cast<int32_t>(ShaderModule::TARGET_SPIRV_VERSION));
+	hash.AddValue(ShaderModule::DEFAULT_GLSL_VERSION);
+	hash.AddValue(ShaderModule::OPTIMIZE_SPIRV);
+	hash.AddValue(ShaderModule::STRIP_DEBUG_INFO);
+	// 编译器版本
+	const auto version = glslang::GetVersion();
+	hash.AddValue(version.major);
+	hash.AddValue(version.minor);
+	hash.AddValue(version.patch);
+	hash.AddValue(glslang::GetSpirvGeneratorVersion());
+	hash.Add(spvSoftwareVersionDetailsString());
+	// 源代码和所有的头文件，map按名字排好了序
+	hash.Add(source);
+	for (const auto& [name, text] : headers)
+	{
+		hash.Add(name);
+		hash.Add(text);
+	}
+	return hash.Get();
+}
+
+void ShaderCache::ReadIncludes(const std::string& source, std::map<std::string, std::string>& headers)
+{
+	std::istringstream lines(source);
+	std::string line;
+	while (std::getline(lines, line))
+	{
+		// 只认#include "xxx"，和ShaderIncluder一样都相对于Shader目录
+		const size_t directive = line.find_first_not_of(" \t");
+		if (directive == std::string::npos || line.compare(directive, 1, "#") != 0)
+		{
+			continue;
+		}
+		const size_t keyword = line.find_first_not_of(" \t", directive + 1);
+		if (keyword == std::string::npos || line.compare(keyword, 7, "include") != 0)
+		{
+			continue;
+		}
+		const size_t open = line.find('"', keyword + 7);
+		const size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+		if (close == std::string::npos)
+		{
+			continue;
+		}
+
+		const std::string name = line.substr(open + 1, close - open - 1);
+		if (headers.count(name) != 0)
+		{
+			continue;
+		}
+		// 读不到的头文件记成空的，编译的时候会报错
+		const auto data = FileUtility::readFile(std::string(DEFAULT_SHADER_DIR) + name);
+		headers[name] = std::string(data.data());
+		ReadIncludes(headers[name], headers);
+	}
+}
+
+std::string ShaderCache::GetCachePath(const uint64_t& key)
+{
+	std::ostringstream path;
+	path << CACHE_DIRECTORY << std::hex << std::setw(16) << std::setfill('0') << key << ".spv";
+	return path.str();
+}
+
+bool ShaderCache::Load(const uint64_t& key, std::vector<uint32_t>& spirv)
+{
+#ifdef VKRT_EMBEDDED_SHADERS
+	for (const auto& embedded : EMBEDDED_SHADERS)
+	{
+		if (embedded.key == key)
+		{
+			spirv.assign(embedded.code, embedded.code + embedded.wordCount);
+			return true;
+		}
+	}
+#endif
+
+	std::ifstream file(GetCachePath(key), std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	ShaderCacheHeader header{};
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!file || header.magic != SHADER_CACHE_MAGIC || header.version != SHADER_CACHE_VERSION || header.key != key || header.wordCount == 0)
+	{
+		return false;
+	}
+	spirv.resize(header.wordCount);
+	file.read(reinterpret_cast<char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+	// 写到一半的文件或者被改坏的文件当作没有缓存
+	if (!file || spirv[0] != SPIRV_MAGIC)
+	{
+		spirv.clear();
+		return false;
+	}
+	return true;
+}
+
+bool ShaderCache::Store(const uint64_t& key, const std::vector<uint32_t>& spirv)
+{
+	std::error_code error;
+	std::filesystem::create_directories(CACHE_DIRECTORY, error);
+
+	// 先写临时文件再改名，另一个进程或线程不会读到写了一半的缓存
+	const std::string path = GetCachePath(key);
+	std::ostringstream temporaryPath;
+	temporaryPath << path << "." << std::hex << std::hash<std::thread::id>()(std::this_thread::get_id()) << ".tmp";
+	{
+		std::ofstream file(temporaryPath.str(), std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+		const ShaderCacheHeader header{ SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION, key, spirv.size() };
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+		if (!file.good())
+		{
+			file.close();
+			std::filesystem::remove(temporaryPath.str(), error);
+			return false;
+		}
+	}
+	std::filesystem::rename(temporaryPath.str(), path, error);
+	if (error)
+	{
+		std::filesystem::remove(temporaryPath.str(), error);
+		return false;
+	}
+	return true;
+}
+
+bool ShaderCache::WriteEmbeddedShaders(const std::vector<std::pair<std::string, EShLanguage>>& shaderFiles, const std::string& outputPath)
+{
+	std::ostringstream arrays;
+	std::ostringstream table;
+	for (size_t i = 0; i < shaderFiles.size(); i++)
+	{
+		const auto& [path, stage] = shaderFiles[i];
+		const auto source = FileUtility::readFile(path);
+		std::map<std::string, std::string> headers;
+		const uint64_t key = ComputeKey(stage, source.data(), headers);
+		std::vector<uint32_t> spirv;
+		std::string errorLog;
+		ShaderModule::CompileStats stats;
+		if (!ShaderModule::Compile(stage, source.data(), headers, spirv, errorLog, stats))
+		{
+			std::cerr << errorLog << "Failed to compile " << path << ", nothing was written." << std::endl;
+			return false;
+		}
+
+		arrays << "// " << path << "\nstatic const uint32_t EMBEDDED_SHADER_" << i << "[] = {";
+		for (size_t word = 0; word < spirv.size(); word++)
+		{
+			arrays << (word % 8 == 0 ? "\n\t" : " ") << "0x" << std::hex << std::setw(8) << std::setfill('0') << spirv[word] << "u," << std::dec;
+		}
+		arrays << "\n};\n\n";
+		table << "\t{ 0x" << std::hex << std::setw(16) << std::setfill('0') << key << "ull, EMBEDDED_SHADER_" << std::dec << i
+			<< ", " << spirv.size() << " },\n";
+	}
+
+	std::ofstream file(outputPath, std::ios::trunc);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	file << "// Generated by VKRTRenderer --embed-shaders, do not edit.\n"
+		<< "// Only entries whose key still matches the shader sources are used.\n\n"
+		<< arrays.str()
+		<< "static const EmbeddedShader EMBEDDED_SHADERS[] = {\n" << table.str() << "};\n";
+	return file.good();
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glslang/Public/ShaderLang.h>
+
+#include "Constants.h"
+
+/*
+ * Content addressed cache of compiled SPIR-V, so shaders are only compiled by glslang when something they depend on changed.
+ * The key hashes the source, every header it includes (transitively), the compile and optimization options
+ * and the glslang and SPIRV-Tools versions;
+ * entries live in shaders/cache/<key>.spv and are never invalidated, a change simply produces a new key.
+ * Building with VKRT_EMBEDDED_SHADERS defined also links in EmbeddedShaders.inl (written by --embed-shaders),
+ * which is looked up before the disk.
+ */
+class ShaderCache
+{
+public:
+	static constexpr const char* CACHE_DIRECTORY = DEFAULT_SHADER_DIR"cache\\";
+	static constexpr const char* EMBEDDED_SHADERS_FILE = "EmbeddedShaders.inl";
+
+	/*
+	 * headers receives the contents of every header reachable through #include "..." from source, keyed by the name
+	 * in the directive, so the compile does not have to read them again. The scan ignores the preprocessor,
+	 * so a header behind an #if counts as a dependency even when it is not used.
+	 */
+	static uint64_t ComputeKey(const EShLanguage& stage, const char* source, std::map<std::string, std::string>& headers);
+
+	// Safe to call from several threads
+	static bool Load(const uint64_t& key, std::vector<uint32_t>& spirv);
+	static bool Store(const uint64_t& key, const std::vector<uint32_t>& spirv);
+
+	// Compiles the given shader files and writes them out as C++ arrays for a VKRT_EMBEDDED_SHADERS build
+	static bool WriteEmbeddedShaders(const std::vector<std::pair<std::string, EShLanguage>>& shaderFiles, const std::string& outputPath);
+
+private:
+	static std::string GetCachePath(const uint64_t& key);
+	static void ReadIncludes(const std::string& source, std::map<std::string, std::string>& headers);
+};
@@ -1,6 +1,11 @@
+#include <algorithm>
+#include <atomic>
 #include <filesystem>
+#include <thread>
+#include <spirv-tools/optimizer.hpp>
 
 #include "ShaderModule.h"
+#include "ShaderCache.h"
 
 #include "FileUtility.h"
 #include "Constants.h"
@@ -122,14 +127,26 @@ const TBuiltInResource DefaultTBuiltInResource = {
 		/* .generalConstantMatrixVectorIndexing = */ 1,
 	} };
 
+ShaderIncluder::ShaderIncluder(const std::map<std::string, std::string>* headers) :
+	mHeaders(headers)
+{
+}
+
 Includer::IncludeResult* ShaderIncluder::includeLocal(const char* headerName, const char* includerName, size_t inclusionDepth)
 {
 	std::filesystem::path relativePath = (std::string(DEFAULT_SHADER_DIR) + std::string(headerName)).c_str();
 	auto absolutePath = absolute(relativePath).generic_string();
-	auto fileData = FileUtility::readFile(std::string(DEFAULT_SHADER_DIR) + std::string(headerName));
 
-	auto curFileData = fileData.data();
-	mHeaderData.emplace_back(curFileData);
+	// 计算缓存键的时候已经读过的头文件不再读一遍
+	if (mHeaders && mHeaders->count(headerName) != 0)
+	{
+		mHeaderData.emplace_back(mHeaders->at(headerName));
+	}
+	else
+	{
+		auto fileData = FileUtility::readFile(std::string(DEFAULT_SHADER_DIR) + std::string(headerName));
+		mHeaderData.emplace_back(fileData.data());
+	}
 
 	mIncludeResult.emplace_back(absolutePath,
 		mHeaderData.back().c_str(),
@@ -145,33 +162,26 @@ void ShaderIncluder::releaseInclude(IncludeResult* result)
 ShaderModule::ShaderModule(VkDevice logicalDevice, EShLanguage stage, const char* shaderSource) :
 	mLogicalDevice(logicalDevice)
 {
-	// ShaderStageԴһЩ
-	glslang::TShader shader(stage);
-	shader.setStrings(&shaderSource, 1);
-	shader.setEnvInput(glslang::EShSourceGlsl, stage, glslang::EShClientVulkan, 120);
-	shader.setEnvClient(glslang::EShClientVulkan, glslang::EShTargetVulkan_1_2);
-	shader.setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_4);
-	// ʹincluderеİ#includeݵԴس
-	ShaderIncluder includer;
-	if (!shader.parse(&DefaultTBuiltInResource, 120, ENoProfile, false, false, EShMsgDefault, includer))
-	{
-		std::cerr << shader.getInfoLog();
-		return;
+	// 源代码、包含的头文件和编译选项都没有变的话，直接用上次编译出来的SPIR-V
+	std::map<std::string, std::string> headers;
+	const uint64_t cacheKey = ShaderCache::ComputeKey(stage, shaderSource, headers);
+	// 缓存里存的是优化之后的结果，优化的开销只有第一次编译的时候才有
+	if (ShaderCache::Load(cacheKey, mSPIRVCode))
+	{
+		mCompileStats.instructions = CountInstructions(mSPIRVCode);
+		mCompileStats.bytes = mSPIRVCode.size() * sizeof(uint32_t);
 	}
-
-	// ʼ
-	glslang::TProgram program;
-	program.addShader(&shader);
-	if (!program.link(EShMsgDefault))
+	else
 	{
-		std::cerr << program.getInfoLog();
-		return;
+		if (!Compile(stage, shaderSource, headers, mSPIRVCode, mErrorLog, mCompileStats))
+		{
+			std::cerr << mErrorLog;
+			return;
+		}
+		ShaderCache::Store(cacheKey, mSPIRVCode);
 	}
-	const auto intermediate = program.getIntermediate(stage);
 
-	glslang::GlslangToSpv(*intermediate, mSPIRVCode);
-
-	// VulkanShaderModule
+	// 创建Vulkan的ShaderModule
 	VkShaderModuleCreateInfo shaderModuleCreateInfo = {};
 	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 	shaderModuleCreateInfo.codeSize = mSPIRVCode.size() * sizeof(unsigned int);
@@ -198,7 +208,148 @@ ShaderModule::ShaderModule(VkDevice logicalDevice, EShLanguage stage, const std:
 
 }
 
-VkPipelineShaderStageCreateInfo ShaderModule::GetShaderStage(VkShaderStageFlagBits stage)
+std::vector<std::shared_ptr<ShaderModule>> ShaderModule::CreateModules(VkDevice logicalDevice,
+	const std::vector<std::pair<std::string, EShLanguage>>& shaderFiles)
+{
+	std::vector<std::shared_ptr<ShaderModule>> modules(shaderFiles.size());
+	// 每个Shader的解析、链接、生成SPIR-V都是独立的，glslang在InitializeProcess之后每个TShader用自己线程的内存池
+	// 线程按顺序领取下一个Shader，变体多的时候编译时间按核数摊开
+	std::atomic<size_t> nextShader = 0;
+	const auto compileJob = [&]()
+	{
+		for (size_t i = nextShader++; i < shaderFiles.size(); i = nextShader++)
+		{
+			const auto& [path, stage] = shaderFiles[i];
+			modules[i] = std::make_shared<ShaderModule>(logicalDevice, stage, FileUtility::readFile(path));
+		}
+	};
+
+	const size_t threadCount = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, shaderFiles.size());
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount);
+	for (size_t t = 1; t < threadCount; t++)
+	{
+		threads.emplace_back(compileJob);
+	}
+	// 当前线程也领任务
+	compileJob();
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	// 从缓存读出来的没有优化之前的数据
+	for (size_t i = 0; i < modules.size(); i++)
+	{
+		const auto& stats = modules[i]->GetCompileStats();
+		if (stats.glslangInstructions != 0)
+		{
+			std::cout << shaderFiles[i].first << ": " << stats.glslangInstructions << " -> " << stats.instructions << " instructions, "
+				<< stats.glslangBytes << " -> " << stats.bytes << " bytes" << std::endl;
+		}
+	}
+	return modules;
+}
+
+bool ShaderModule::Compile(const EShLanguage& stage,
+	const char* shaderSource,
+	const std::map<std::string, std::string>& headers,
+	std::vector<uint32_t>& spirv,
+	std::string& errorLog,
+	CompileStats& stats)
+{
+	// 声明Shader的Stage、源代码和一些参数
+	glslang::TShader shader(stage);
+	shader.setStrings(&shaderSource, 1);
+	shader.setEnvInput(glslang::EShSourceGlsl, stage, glslang::EShClientVulkan, DEFAULT_GLSL_VERSION);
+	shader.setEnvClient(glslang::EShClientVulkan, CLIENT_VERSION);
+	shader.setEnvTarget(glslang::EShTargetSpv, TARGET_SPIRV_VERSION);
+	// 使用includer把所有的包含#include内容的源代码加载出来
+	ShaderIncluder includer(&headers);
+	if (!shader.parse(&DefaultTBuiltInResource, DEFAULT_GLSL_VERSION, ENoProfile, false, false, EShMsgDefault, includer))
+	{
+		errorLog = shader.getInfoLog();
+		return false;
+	}
+
+	// 开始编译
+	glslang::TProgram program;
+	program.addShader(&shader);
+	if (!program.link(EShMsgDefault))
+	{
+		errorLog = program.getInfoLog();
+		return false;
+	}
+	const auto intermediate = program.getIntermediate(stage);
+
+	// Debug版本带上源代码和行号，方便RenderDoc之类的工具调试Shader
+	glslang::SpvOptions spvOptions;
+	spvOptions.generateDebugInfo = !STRIP_DEBUG_INFO;
+	spirv.clear();
+	glslang::GlslangToSpv(*intermediate, spirv, &spvOptions);
+	stats.glslangInstructions = CountInstructions(spirv);
+	stats.glslangBytes = spirv.size() * sizeof(uint32_t);
+
+	Optimize(spirv);
+	stats.instructions = CountInstructions(spirv);
+	stats.bytes = spirv.size() * sizeof(uint32_t);
+	return true;
+}
+
+void ShaderModule::Optimize(std::vector<uint32_t>& spirv)
+{
+	if (!OPTIMIZE_SPIRV && !STRIP_DEBUG_INFO)
+	{
+		return;
+	}
+
+	// 目标环境和CLIENT_VERSION一致；特化常量不会被折叠掉，创建管线的时候还能特化
+	spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_2);
+	std::string messages;
+	optimizer.SetMessageConsumer([&messages](spv_message_level_t level, const char*, const spv_position_t& position, const char* message)
+	{
+		if (level <= SPV_MSG_ERROR)
+		{
+			messages += std::to_string(position.index) + ": " + message + "\n";
+		}
+	});
+	if (OPTIMIZE_SPIRV)
+	{
+		// 内联、标量替换、死代码消除、常量折叠等等，和spirv-opt -O一样
+		optimizer.RegisterPerformancePasses();
+	}
+	if (STRIP_DEBUG_INFO)
+	{
+		optimizer.RegisterPass(spvtools::CreateStripDebugInfoPass());
+	}
+
+	std::vector<uint32_t> optimized;
+	if (!optimizer.Run(spirv.data(), spirv.size(), &optimized))
+	{
+		std::cerr << "spirv-opt failed, using the unoptimized SPIR-V:\n" << messages;
+		return;
+	}
+	spirv = std::move(optimized);
+}
+
+size_t ShaderModule::CountInstructions(const std::vector<uint32_t>& spirv)
+{
+	// 前5个字是文件头，之后每条指令第一个字的高16位是这条指令的字数
+	constexpr size_t HEADER_WORDS = 5;
+	size_t count = 0;
+	for (size_t word = HEADER_WORDS; word < spirv.size(); count++)
+	{
+		const size_t wordCount = spirv[word] >> 16;
+		if (wordCount == 0)
+		{
+			break;
+		}
+		word += wordCount;
+	}
+	return count;
+}
+
+VkPipelineShaderStageCreateInfo ShaderModule::GetShaderStage(VkShaderStageFlagBits stage, const VkSpecializationInfo* specialization)
 {
 	return VkPipelineShaderStageCreateInfo{
 		/*sType*/ VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
@@ -207,7 +358,7 @@ VkPipelineShaderStageCreateInfo ShaderModule::GetShaderStage(VkShaderStageFlagBi
 		/*stage*/ stage,
 		/*module*/ mShaderModule,
 		/*pName*/ "main",
-		/*pSpecializationInfo*/ nullptr
+		/*pSpecializationInfo*/ specialization
 	};
 }
 
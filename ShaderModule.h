@@ -1,5 +1,10 @@
 #pragma once
+#include <deque>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 #include <Volk/volk.h>
 #include <glslang/Public/ShaderLang.h>
@@ -10,31 +15,109 @@
 
 class ShaderIncluder: public glslang::TShader::Includer
 {
-	std::vector<IncludeResult> mIncludeResult;
-	std::vector<std::string> mHeaderData;
+public:
+	// Headers found in headers (keyed by the name in the #include) are served from memory instead of the disk
+	explicit ShaderIncluder(const std::map<std::string, std::string>* headers = nullptr);
+
+private:
+	// glslang持有返回的指针直到编译结束，所以不能用vector（扩容会让之前的指针失效）
+	std::deque<IncludeResult> mIncludeResult;
+	std::deque<std::string> mHeaderData;
+	const std::map<std::string, std::string>* mHeaders;
 
 	IncludeResult* includeLocal(const char* headerName, const char* includerName, size_t inclusionDepth) override;
 
 	void releaseInclude(IncludeResult*) override;
 };
 
+/*
+ * A shader stage compiled from GLSL. The SPIR-V comes from the ShaderCache when neither the source,
+ * the headers it includes nor the compile options changed since it was last compiled.
+ */
 class ShaderModule: public IDisposable
 {
 public:
+	static constexpr glslang::EShTargetClientVersion CLIENT_VERSION = glslang::EShTargetVulkan_1_2;
+	static constexpr glslang::EShTargetLanguageVersion TARGET_SPIRV_VERSION = glslang::EShTargetSpv_1_4;
+	static constexpr int DEFAULT_GLSL_VERSION = 120;
+	// spirv-opt performance passes on the glslang output, unless VKRT_NO_SHADER_OPTIMIZATION is defined
+#ifdef VKRT_NO_SHADER_OPTIMIZATION
+	static constexpr bool OPTIMIZE_SPIRV = false;
+#else
+	static constexpr bool OPTIMIZE_SPIRV = true;
+#endif
+	// Debug builds keep the source and line info for shader debuggers, release builds strip all debug info
+#ifdef NDEBUG
+	static constexpr bool STRIP_DEBUG_INFO = true;
+#else
+	static constexpr bool STRIP_DEBUG_INFO = false;
+#endif
+
+	// Size of the SPIR-V glslang produced and of what is handed to vkCreateShaderModule.
+	// The glslang numbers stay 0 when the SPIR-V came from the cache.
+	struct CompileStats
+	{
+		size_t glslangInstructions = 0;
+		size_t glslangBytes = 0;
+		size_t instructions = 0;
+		size_t bytes = 0;
+	};
+
 	ShaderModule(VkDevice logicalDevice, EShLanguage stage, const char* shaderSource);
 	ShaderModule(VkDevice logicalDevice, EShLanguage stage, const std::string& shaderSource);
 	ShaderModule(VkDevice logicalDevice, EShLanguage stage, const std::vector<char>& shaderSource);
 
-	VkPipelineShaderStageCreateInfo GetShaderStage(VkShaderStageFlagBits stage);
+	// specialization has to stay valid until the pipeline has been created
+	VkPipelineShaderStageCreateInfo GetShaderStage(VkShaderStageFlagBits stage, const VkSpecializationInfo* specialization = nullptr);
 
 	virtual ~ShaderModule();
 	void Dispose() override;
 
 	VkShaderModule& GetShaderModule();
+
+	bool IsValid() const
+	{
+		return mIsValid;
+	}
+
+	// glslang's messages when the shader failed to compile
+	const std::string& GetErrorLog() const
+	{
+		return mErrorLog;
+	}
+
+	const CompileStats& GetCompileStats() const
+	{
+		return mCompileStats;
+	}
+
+	/*
+	 * Creates a module for every (file, stage), running the glslang compiles (or cache reads) as independent jobs
+	 * on up to one thread per core. Returns once all of them are done, in the order of shaderFiles.
+	 * The size before and after optimization is printed for every stage that was compiled.
+	 * glslang::InitializeProcess has to have been called; it stays the only process-wide setup.
+	 */
+	static std::vector<std::shared_ptr<ShaderModule>> CreateModules(VkDevice logicalDevice,
+		const std::vector<std::pair<std::string, EShLanguage>>& shaderFiles);
+
+	// glslang and spirv-opt only, no device needed; headers as collected by ShaderCache::ComputeKey
+	static bool Compile(const EShLanguage& stage,
+		const char* shaderSource,
+		const std::map<std::string, std::string>& headers,
+		std::vector<uint32_t>& spirv,
+		std::string& errorLog,
+		CompileStats& stats);
+
+	static size_t CountInstructions(const std::vector<uint32_t>& spirv);
 private:
+	// 优化失败的话保留glslang的输出，不算编译失败
+	static void Optimize(std::vector<uint32_t>& spirv);
+
 	std::vector<uint32_t> mSPIRVCode;
 	VkShaderModule mShaderModule;
 	const VkDevice mLogicalDevice;
 	bool mIsValid = false;
+	std::string mErrorLog;
+	CompileStats mCompileStats;
 };
 
@@ -3,17 +3,17 @@
 Surface::Surface(VkInstance& instance, GLFWwindow* window,
     VkPhysicalDevice physicalDevice, uint32_t graphicsQueueFamilyIndex)
 {
-    // ڴϴһSurface
+    // 在窗口上创建一个Surface
     auto error = glfwCreateWindowSurface(instance, window, nullptr, &mSurface);
     assert(error == VK_SUCCESS);
 
-    // 鿴ǰSurfaceǷʾͼΡ
-    // ǸϻΪVulkanƵĽȷʵҪʾЩ豸Ͳʾ
+    // 查看当前创建的Surface是否允许显示图形……
+    // 这个看起来是个废话，不过因为Vulkan绘制的结果确实不需要真的显示出来，有些设备就不允许显示
     VkBool32 supportPresent = VK_FALSE;
     error = vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, graphicsQueueFamilyIndex, mSurface, &supportPresent);
     assert(error == VK_SUCCESS && supportPresent);
 
-    // ȡǰSurfaceֵ֧ɫͣҼ¼
+    // 获取当前Surface支持的颜色类型，并且记录下来
     uint32_t formatCount;
     vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, mSurface, &formatCount, nullptr);
     std::vector<VkSurfaceFormatKHR> surfaceFormats(formatCount);
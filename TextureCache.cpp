@@ -0,0 +1,320 @@
+﻿#include "TextureCache.h"
+
+#include <algorithm>
+
+#include "Constants.h"
+#include "FileWatcher.h"
+
+TextureCache::TextureCache(VmaAllocator& allocator,
+	VkDevice& logicalDevice,
+	VkCommandPool& commandPool,
+	VkQueue& graphicsQueue) :
+	mAllocator(allocator),
+	mLogicalDevice(logicalDevice),
+	mCommandPool(commandPool),
+	mGraphicsQueue(graphicsQueue),
+	mSamplers(logicalDevice),
+	mLoader(allocator, logicalDevice, commandPool, graphicsQueue)
+{
+	// 占位图只有一个像素，马上就能传完，之后所有新贴图先指向它
+	DecodedImage placeholder;
+	placeholder.format = VK_FORMAT_R8G8B8A8_SRGB;
+	placeholder.width = placeholder.height = 1;
+	placeholder.levels.push_back(DecodedLevel::FromVector({ 128, 128, 128, 255 }));
+	placeholder.generateMipmaps = false;
+	mPlaceholder = CreateImage({});
+	const bool uploaded = mPlaceholder->UploadDecoded(placeholder, commandPool, graphicsQueue);
+	assert(uploaded);
+	CHECK_VK_ERROR(mPlaceholder->CreateTextureView(), "Failed to create the view of the placeholder texture.");
+
+	// 第0张是错误贴图，没有贴图的材质也指向它
+	Acquire(DEFAULT_TEXTURE_DIR"error.png");
+}
+
+void TextureCache::Prefetch(const std::string& path)
+{
+	// 虚拟贴图按页在用到的时候才解码
+	if (!mVirtualTextures)
+	{
+		mLoader.Prefetch(FileWatcher::NormalizePath(path));
+	}
+}
+
+uint32_t TextureCache::Acquire(const std::string& path, const SamplerKey& sampler)
+{
+	const std::string normalizedPath = FileWatcher::NormalizePath(path);
+	const auto found = mIndices.find(normalizedPath);
+	if (found != mIndices.end())
+	{
+		return found->second;
+	}
+
+	if (mVirtualTextures)
+	{
+		const uint32_t id = mVirtualTextures->Register(normalizedPath);
+		if (id != UINT32_MAX)
+		{
+			mIndices.emplace(normalizedPath, id | SWS_VIRTUAL_TEXTURE_BIT);
+			return id | SWS_VIRTUAL_TEXTURE_BIT;
+		}
+		// 虚拟贴图数量到上限了，剩下的还是整张加载
+	}
+
+	if (mEntries.size() >= mCapacity)
+	{
+		std::cerr << "No room for texture " << path << " in the texture array, restart to pick it up." << std::endl;
+		mLoader.Release(normalizedPath);
+		return ERROR_TEXTURE_INDEX;
+	}
+
+	// 先用占位图，解码和上传都在之后的Update里
+	const auto index = static_cast<uint32_t>(mEntries.size());
+	mEntries.push_back(Entry{ normalizedPath, sampler, mPlaceholder });
+	mIndices.emplace(normalizedPath, index);
+	mLoader.Prefetch(normalizedPath);
+	mStreamQueue.push_back(index);
+	return index;
+}
+
+bool TextureCache::Update(DeletionQueue& deletionQueue, std::vector<uint32_t>& changedTextures)
+{
+	// 解码好的贴图先传Mip尾巴（很小，不限量），整张的按顺序传到这一帧的预算用完为止
+	std::vector<std::pair<uint32_t, TextureState>> targets;
+	std::vector<std::pair<std::shared_ptr<Image>, const DecodedImage*>> uploads;
+	VkDeviceSize fullBytes = 0;
+	for (auto it = mStreamQueue.begin(); it != mStreamQueue.end();)
+	{
+		auto& entry = mEntries[*it];
+		const auto* result = mLoader.Poll(entry.path);
+		if (!result)
+		{
+			++it;
+			continue;
+		}
+		if (!result->succeeded)
+		{
+			std::cerr << "Failed to load texture " << entry.path << std::endl;
+			mLoader.Release(entry.path);
+			it = mStreamQueue.erase(it);
+			continue;
+		}
+
+		if (entry.state == PLACEHOLDER && !result->preview.levels.empty())
+		{
+			targets.emplace_back(*it, PREVIEW);
+			uploads.emplace_back(CreateImage(entry.sampler), &result->preview);
+			++it;
+			continue;
+		}
+
+		VkDeviceSize bytes = 0;
+		for (const auto& level : result->image.levels)
+		{
+			bytes += level.size;
+		}
+		if (fullBytes > 0 && fullBytes + bytes > MAX_STREAMED_BYTES_PER_UPDATE)
+		{
+			++it;
+			continue;
+		}
+		fullBytes += bytes;
+		targets.emplace_back(*it, FULL);
+		uploads.emplace_back(CreateImage(entry.sampler), &result->image);
+		it = mStreamQueue.erase(it);
+	}
+	if (uploads.empty())
+	{
+		return false;
+	}
+
+	// 一个CommandBuffer传完；传失败的贴图没有ImageView，继续用原来的
+	mLoader.Upload(uploads);
+	for (size_t i = 0; i < uploads.size(); i++)
+	{
+		auto& [index, state] = targets[i];
+		auto& entry = mEntries[index];
+		if (state == FULL)
+		{
+			mLoader.Release(entry.path);
+		}
+		if (uploads[i].first->GetImageView() == VK_NULL_HANDLE)
+		{
+			uploads[i].first->Dispose();
+			continue;
+		}
+		ReplaceImage(entry, std::move(uploads[i].first), deletionQueue);
+		entry.state = state;
+		changedTextures.push_back(index);
+	}
+	return true;
+}
+
+void TextureCache::SetCapacity(const uint32_t& capacity)
+{
+	mCapacity = std::max(capacity, GetTextureCount());
+}
+
+bool TextureCache::Reload(const std::string& normalizedPath, DeletionQueue& deletionQueue)
+{
+	const auto found = mIndices.find(normalizedPath);
+	if (found == mIndices.end())
+	{
+		return false;
+	}
+
+	if (found->second & SWS_VIRTUAL_TEXTURE_BIT)
+	{
+		mVirtualTextures->Reload(found->second & ~SWS_VIRTUAL_TEXTURE_BIT);
+		return true;
+	}
+
+	// 之前的解码结果可能是改动之前的文件
+	auto& entry = mEntries[found->second];
+	mLoader.Release(entry.path);
+	// 先读到一张新的贴图里：文件可能只写了一半，读不出来的话继续用旧的贴图，状态也不变
+	auto image = CreateImage(entry.sampler);
+	mLoader.Enqueue(entry.path, image);
+	mLoader.Flush();
+	if (image->GetImageView() == VK_NULL_HANDLE)
+	{
+		image->Dispose();
+		return false;
+	}
+
+	// 还在流式加载的贴图不用再等，已经整张读好了
+	std::erase(mStreamQueue, found->second);
+	// 旧的贴图可能还在正在执行的命令里面被采样，不能马上释放
+	ReplaceImage(entry, std::move(image), deletionQueue);
+	entry.state = FULL;
+	entry.droppedMips = 0;
+	return true;
+}
+
+bool TextureCache::DropTopMips(DeletionQueue& deletionQueue)
+{
+	std::vector<std::pair<size_t, std::shared_ptr<Image>>> shrunk;
+	const VkResult error = DoOneTimeCommand(mLogicalDevice, mCommandPool, mGraphicsQueue, [&](VkCommandBuffer& commandBuffer)
+	{
+		for (size_t i = 0; i < mEntries.size(); i++)
+		{
+			const auto& image = *mEntries[i].image;
+			const VkExtent3D& extent = image.GetExtent();
+			// 错误贴图、还没传完的和已经很小的贴图不动，只剩一级Mip的也没有可以拷的
+			if (i == ERROR_TEXTURE_INDEX || mEntries[i].state != FULL || image.GetMipLevels() < 2
+				|| std::max(extent.width, extent.height) / 2 < MIN_DROPPED_SIZE)
+			{
+				continue;
+			}
+
+			auto smaller = CreateImage(mEntries[i].sampler);
+			if (smaller->RecordMipTailCopy(commandBuffer, image, 1) == VK_SUCCESS)
+			{
+				shrunk.emplace_back(i, std::move(smaller));
+			}
+		}
+		return VK_SUCCESS;
+	});
+	if (error != VK_SUCCESS)
+	{
+		for (auto& [index, image] : shrunk)
+		{
+			image->Dispose();
+		}
+		return false;
+	}
+
+	for (auto& [index, image] : shrunk)
+	{
+		CHECK_VK_ERROR(image->CreateTextureView(), "Failed to create the view of a texture.");
+		auto& entry = mEntries[index];
+		ReplaceImage(entry, std::move(image), deletionQueue);
+		entry.droppedMips++;
+	}
+	return !shrunk.empty();
+}
+
+bool TextureCache::RestoreTopMips(DeletionQueue& deletionQueue)
+{
+	std::vector<std::pair<size_t, std::shared_ptr<Image>>> restored;
+	for (size_t i = 0; i < mEntries.size(); i++)
+	{
+		if (mEntries[i].droppedMips == 0)
+		{
+			continue;
+		}
+		auto image = CreateImage(mEntries[i].sampler);
+		mLoader.Enqueue(mEntries[i].path, image);
+		restored.emplace_back(i, std::move(image));
+	}
+	if (restored.empty())
+	{
+		return false;
+	}
+	mLoader.Flush();
+
+	// 读不出来的贴图继续用缩小的那张
+	bool replaced = false;
+	for (auto& [index, image] : restored)
+	{
+		if (image->GetImageView() == VK_NULL_HANDLE)
+		{
+			image->Dispose();
+			continue;
+		}
+		auto& entry = mEntries[index];
+		ReplaceImage(entry, std::move(image), deletionQueue);
+		entry.droppedMips = 0;
+		replaced = true;
+	}
+	return replaced;
+}
+
+bool TextureCache::HasDroppedMips() const
+{
+	return std::any_of(mEntries.begin(), mEntries.end(), [](const Entry& entry) { return entry.droppedMips > 0; });
+}
+
+VkDeviceSize TextureCache::GetMemoryBytes() const
+{
+	VkDeviceSize bytes = 0;
+	for (const auto& entry : mEntries)
+	{
+		if (entry.image != mPlaceholder)
+		{
+			bytes += entry.image->GetMemorySize();
+		}
+	}
+	return bytes;
+}
+
+std::shared_ptr<Image> TextureCache::CreateImage(const SamplerKey& sampler)
+{
+	auto image = std::make_shared<Image>(mAllocator, mLogicalDevice);
+	image->SetSampler(mSamplers.Get(sampler));
+	return image;
+}
+
+void TextureCache::ReplaceImage(Entry& entry, std::shared_ptr<Image>&& image, DeletionQueue& deletionQueue)
+{
+	if (entry.image != mPlaceholder)
+	{
+		deletionQueue.Push([oldImage = std::move(entry.image)]() { oldImage->Dispose(); });
+	}
+	entry.image = std::move(image);
+}
+
+void TextureCache::Dispose()
+{
+	for (auto& entry : mEntries)
+	{
+		if (entry.image != mPlaceholder)
+		{
+			entry.image->Dispose();
+		}
+	}
+	mPlaceholder->Dispose();
+	mEntries.clear();
+	mStreamQueue.clear();
+	mIndices.clear();
+	mSamplers.Dispose();
+}
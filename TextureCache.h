@@ -0,0 +1,139 @@
+#pragma once
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DeletionQueue.h"
+#include "Image.h"
+#include "SamplerCache.h"
+#include "TextureLoader.h"
+#include "VirtualTextureStreamer.h"
+
+/*
+ * Material textures shared by path: every file is loaded once no matter how many meshes use it,
+ * and its index in the texture descriptor array stays the same for the lifetime of the cache.
+ * Index 0 is the error texture, which meshes without a texture point at as well.
+ * All textures sample through the SamplerCache, so identical sampler state means one VkSampler.
+ * Textures stream in without blocking: a new texture is bound to a shared 1x1 placeholder, then to a small
+ * copy of its mip tail as soon as its file is decoded, and finally to the full image, a few per frame.
+ * With virtual textures attached, textures acquired from then on are registered there instead of being loaded,
+ * and their index is the virtual texture ID with SWS_VIRTUAL_TEXTURE_BIT set.
+ */
+class TextureCache
+{
+public:
+	static constexpr uint32_t ERROR_TEXTURE_INDEX = 0;
+
+	// Textures are not shrunk below this size when their top mips are dropped
+	static constexpr uint32_t MIN_DROPPED_SIZE = 256;
+	// Full resolution bytes uploaded per Update at most (at least one texture); mip tails do not count
+	static constexpr VkDeviceSize MAX_STREAMED_BYTES_PER_UPDATE = 32ull * 1024 * 1024;
+
+	TextureCache(VmaAllocator& allocator,
+		VkDevice& logicalDevice,
+		VkCommandPool& commandPool,
+		VkQueue& graphicsQueue);
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// Starts decoding the file on a worker thread; safe to call from several threads.
+	void Prefetch(const std::string& path);
+	// Index of the texture read from path, keyed by FileWatcher::NormalizePath. A new texture shows the placeholder until Update streams it in.
+	uint32_t Acquire(const std::string& path, const SamplerKey& sampler = {});
+
+	/*
+	 * Call once per frame while the device is idle. Uploads the mip tails of the textures decoded since the last call,
+	 * then full resolution textures in Acquire order within MAX_STREAMED_BYTES_PER_UPDATE.
+	 * The indices whose image changed are appended to changedTextures; replaced images go through deletionQueue.
+	 */
+	bool Update(DeletionQueue& deletionQueue, std::vector<uint32_t>& changedTextures);
+	// Textures still waiting for their full resolution image
+	uint32_t GetStreamingCount() const
+	{
+		return static_cast<uint32_t>(mStreamQueue.size());
+	}
+
+	// Textures acquired beyond this many get the error texture (the descriptor array cannot grow at run time)
+	void SetCapacity(const uint32_t& capacity);
+	// Set before the materials are created; the streamer has to outlive the cache
+	void SetVirtualTextures(VirtualTextureStreamer* virtualTextures)
+	{
+		mVirtualTextures = virtualTextures;
+	}
+
+	// Reloads the texture read from path (in FileWatcher::NormalizePath form) in place; the old image
+	// is released through deletionQueue. Returns false when no texture was read from that file, or when
+	// the file could not be loaded; the old image is kept then.
+	bool Reload(const std::string& normalizedPath, DeletionQueue& deletionQueue);
+
+	/*
+	 * Replaces every texture larger than MIN_DROPPED_SIZE with a copy that starts at its second mip,
+	 * a quarter of the memory, without reading the files again. The old images go through deletionQueue.
+	 * Returns false when no texture could be shrunk.
+	 */
+	bool DropTopMips(DeletionQueue& deletionQueue);
+	// Reloads the textures DropTopMips shrank at full resolution
+	bool RestoreTopMips(DeletionQueue& deletionQueue);
+	bool HasDroppedMips() const;
+
+	// Device memory of all loaded textures
+	VkDeviceSize GetMemoryBytes() const;
+
+	uint32_t GetTextureCount() const
+	{
+		return static_cast<uint32_t>(mEntries.size());
+	}
+
+	// Shared with every material that uses it
+	std::shared_ptr<Image> GetTexture(const uint32_t& index) const
+	{
+		return mEntries[index].image;
+	}
+
+	SamplerCache& GetSamplerCache()
+	{
+		return mSamplers;
+	}
+
+	void Dispose();
+
+private:
+	enum TextureState
+	{
+		PLACEHOLDER = 0, PREVIEW, FULL
+	};
+
+	struct Entry
+	{
+		std::string path;
+		SamplerKey sampler;
+		std::shared_ptr<Image> image;
+		TextureState state = PLACEHOLDER;
+		// 显存紧张时去掉了几级最大的Mip
+		uint32_t droppedMips = 0;
+	};
+
+	std::shared_ptr<Image> CreateImage(const SamplerKey& sampler);
+	// 换掉一张贴图的Image，旧的等用到它的帧执行完再释放（占位图是共用的，不释放）
+	void ReplaceImage(Entry& entry, std::shared_ptr<Image>&& image, DeletionQueue& deletionQueue);
+
+	VmaAllocator& mAllocator;
+	VkDevice& mLogicalDevice;
+	VkCommandPool& mCommandPool;
+	VkQueue& mGraphicsQueue;
+
+	std::vector<Entry> mEntries;
+	// 规范化之后的路径 -> 下标
+	std::unordered_map<std::string, uint32_t> mIndices;
+	SamplerCache mSamplers;
+	TextureLoader mLoader;
+	// 还没有解码完的贴图都先指向这张1x1的灰色图片
+	std::shared_ptr<Image> mPlaceholder;
+	// 还没传完整张贴图的下标，按Acquire的顺序
+	std::deque<uint32_t> mStreamQueue;
+	uint32_t mCapacity = UINT32_MAX;
+	VirtualTextureStreamer* mVirtualTextures = nullptr;
+};
@@ -0,0 +1,515 @@
+﻿#include "TextureCooker.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+	// sRGB编码的8位值对应的线性值
+	struct SrgbToLinearTable
+	{
+		float values[256];
+
+		SrgbToLinearTable()
+		{
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				const float c = i / 255.0f;
+				values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+		}
+	};
+
+	uint8_t LinearToSrgb(const float& linear)
+	{
+		const float c = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+		return static_cast<uint8_t>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+
+	// BC7的4位索引对应的插值权重（总和64）
+	constexpr uint32_t BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// 按位从低到高写入一个压缩块
+	struct BlockBitWriter
+	{
+		uint8_t* block;
+		uint32_t position = 0;
+
+		void Write(const uint32_t& value, const uint32_t& bits)
+		{
+			for (uint32_t i = 0; i < bits; i++, position++)
+			{
+				block[position >> 3] |= static_cast<uint8_t>(((value >> i) & 1u) << (position & 7));
+			}
+		}
+	};
+
+	// 用协方差矩阵的幂迭代求一个块里颜色分布的主轴，channels是3（RGB）或者4（RGBA）
+	void PrincipalAxis(const uint8_t* rgba, const uint32_t& channels, float* mean, float* axis)
+	{
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			mean[c] = 0.0f;
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				mean[c] += rgba[i * 4 + c];
+			}
+			mean[c] /= 16.0f;
+		}
+
+		float covariance[4][4] = {};
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			for (uint32_t a = 0; a < channels; a++)
+			{
+				for (uint32_t b = 0; b < channels; b++)
+				{
+					covariance[a][b] += (rgba[i * 4 + a] - mean[a]) * (rgba[i * 4 + b] - mean[b]);
+				}
+			}
+		}
+
+		// 从包围盒的对角线开始迭代，收敛得比较快
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			uint8_t minValue = 255;
+			uint8_t maxValue = 0;
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				minValue = std::min(minValue, rgba[i * 4 + c]);
+				maxValue = std::max(maxValue, rgba[i * 4 + c]);
+			}
+			axis[c] = static_cast<float>(maxValue - minValue) + 1e-3f;
+		}
+		for (uint32_t iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = {};
+			float length = 0.0f;
+			for (uint32_t a = 0; a < channels; a++)
+			{
+				for (uint32_t b = 0; b < channels; b++)
+				{
+					next[a] += covariance[a][b] * axis[b];
+				}
+				length = std::max(length, std::abs(next[a]));
+			}
+			// 所有颜色都一样
+			if (length <= 0.0f)
+			{
+				break;
+			}
+			for (uint32_t c = 0; c < channels; c++)
+			{
+				axis[c] = next[c] / length;
+			}
+		}
+	}
+
+	// 沿主轴把块里的颜色投影到两端，得到两个端点
+	void FitEndpoints(const uint8_t* rgba, const uint32_t& channels, float* endpoint0, float* endpoint1)
+	{
+		float mean[4];
+		float axis[4];
+		PrincipalAxis(rgba, channels, mean, axis);
+
+		float minT = FLT_MAX;
+		float maxT = -FLT_MAX;
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			float t = 0.0f;
+			for (uint32_t c = 0; c < channels; c++)
+			{
+				t += (rgba[i * 4 + c] - mean[c]) * axis[c];
+			}
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+		float axisLengthSq = 0.0f;
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			axisLengthSq += axis[c] * axis[c];
+		}
+		const float scale = axisLengthSq > 0.0f ? 1.0f / axisLengthSq : 0.0f;
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			endpoint0[c] = std::clamp(mean[c] + axis[c] * minT * scale, 0.0f, 255.0f);
+			endpoint1[c] = std::clamp(mean[c] + axis[c] * maxT * scale, 0.0f, 255.0f);
+		}
+	}
+
+	uint32_t ColorDistanceSq(const uint8_t* a, const uint32_t* b, const uint32_t& channels)
+	{
+		uint32_t distance = 0;
+		for (uint32_t c = 0; c < channels; c++)
+		{
+			const int32_t d = static_cast<int32_t>(a[c]) - static_cast<int32_t>(b[c]);
+			distance += static_cast<uint32_t>(d * d);
+		}
+		return distance;
+	}
+
+	uint16_t PackRGB565(const float* color)
+	{
+		const uint32_t r = static_cast<uint32_t>(std::lround(color[0] * 31.0f / 255.0f));
+		const uint32_t g = static_cast<uint32_t>(std::lround(color[1] * 63.0f / 255.0f));
+		const uint32_t b = static_cast<uint32_t>(std::lround(color[2] * 31.0f / 255.0f));
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	void UnpackRGB565(const uint16_t& packed, uint32_t* color)
+	{
+		const uint32_t r = (packed >> 11) & 31;
+		const uint32_t g = (packed >> 5) & 63;
+		const uint32_t b = packed & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	// BC7模式6的端点：每个通道7位，再加一个所有通道共用的P位
+	void QuantizeBC7Endpoint(const float* endpoint, uint32_t* quantized, uint32_t& pBit)
+	{
+		float bestError = FLT_MAX;
+		for (uint32_t p = 0; p < 2; p++)
+		{
+			uint32_t candidate[4];
+			float error = 0.0f;
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				candidate[c] = static_cast<uint32_t>(std::clamp(std::lround((endpoint[c] - p) * 0.5f), 0l, 127l));
+				const float d = static_cast<float>((candidate[c] << 1) | p) - endpoint[c];
+				error += d * d;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				pBit = p;
+				std::memcpy(quantized, candidate, sizeof(candidate));
+			}
+		}
+	}
+
+	bool IsSourceImage(const std::filesystem::path& path)
+	{
+		std::string extension = path.extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](const unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		// HDR是浮点数据，BC1/BC7放不下
+		return extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".tga" || extension == ".bmp";
+	}
+}
+
+std::string TextureCooker::GetCookedPath(const std::string& sourcePath)
+{
+	return std::filesystem::path(sourcePath).replace_extension(".ktx2").string();
+}
+
+bool TextureCooker::IsCookedUpToDate(const std::string& sourcePath)
+{
+	std::error_code error;
+	const auto cookedTime = std::filesystem::last_write_time(GetCookedPath(sourcePath), error);
+	if (error)
+	{
+		return false;
+	}
+	const auto sourceTime = std::filesystem::last_write_time(sourcePath, error);
+	return !error && cookedTime >= sourceTime;
+}
+
+void TextureCooker::EncodeBC1Block(const uint8_t* rgba, uint8_t* block)
+{
+	float endpoint0[3];
+	float endpoint1[3];
+	FitEndpoints(rgba, 3, endpoint0, endpoint1);
+
+	// 四色模式要求color0 > color1
+	uint16_t color0 = PackRGB565(endpoint1);
+	uint16_t color1 = PackRGB565(endpoint0);
+	if (color0 < color1)
+	{
+		std::swap(color0, color1);
+	}
+
+	uint32_t palette[4][3];
+	UnpackRGB565(color0, palette[0]);
+	UnpackRGB565(color1, palette[1]);
+	for (uint32_t c = 0; c < 3; c++)
+	{
+		palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+	}
+
+	uint32_t indices = 0;
+	// 两个端点相同的时候是三色模式，全部用第0个
+	if (color0 != color1)
+	{
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			uint32_t bestIndex = 0;
+			uint32_t bestDistance = UINT32_MAX;
+			for (uint32_t p = 0; p < 4; p++)
+			{
+				const uint32_t distance = ColorDistanceSq(&rgba[i * 4], palette[p], 3);
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					bestIndex = p;
+				}
+			}
+			indices |= bestIndex << (i * 2);
+		}
+	}
+
+	std::memcpy(block + 0, &color0, 2);
+	std::memcpy(block + 2, &color1, 2);
+	std::memcpy(block + 4, &indices, 4);
+}
+
+void TextureCooker::EncodeBC7Block(const uint8_t* rgba, uint8_t* block)
+{
+	// 只用模式6：一个分区，RGBA端点，4位索引，对一般的贴图质量足够而且编码很快
+	float endpoint0[4];
+	float endpoint1[4];
+	FitEndpoints(rgba, 4, endpoint0, endpoint1);
+
+	uint32_t quantized[2][4];
+	uint32_t pBits[2];
+	QuantizeBC7Endpoint(endpoint0, quantized[0], pBits[0]);
+	QuantizeBC7Endpoint(endpoint1, quantized[1], pBits[1]);
+
+	uint32_t ends[2][4];
+	for (uint32_t e = 0; e < 2; e++)
+	{
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			ends[e][c] = (quantized[e][c] << 1) | pBits[e];
+		}
+	}
+	uint32_t palette[16][4];
+	for (uint32_t w = 0; w < 16; w++)
+	{
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			palette[w][c] = ((64 - BC7_WEIGHTS4[w]) * ends[0][c] + BC7_WEIGHTS4[w] * ends[1][c] + 32) >> 6;
+		}
+	}
+
+	uint32_t indices[16];
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		uint32_t bestDistance = UINT32_MAX;
+		for (uint32_t w = 0; w < 16; w++)
+		{
+			const uint32_t distance = ColorDistanceSq(&rgba[i * 4], palette[w], 4);
+			if (distance < bestDistance)
+			{
+				bestDistance = distance;
+				indices[i] = w;
+			}
+		}
+	}
+
+	// 第一个像素的索引最高位是隐含的0，不满足的话交换两个端点
+	if (indices[0] >= 8)
+	{
+		std::swap(quantized[0], quantized[1]);
+		std::swap(pBits[0], pBits[1]);
+		for (auto& index : indices)
+		{
+			index = 15 - index;
+		}
+	}
+
+	std::memset(block, 0, 16);
+	BlockBitWriter writer{ block };
+	writer.Write(1u << 6, 7);
+	for (uint32_t c = 0; c < 4; c++)
+	{
+		writer.Write(quantized[0][c], 7);
+		writer.Write(quantized[1][c], 7);
+	}
+	writer.Write(pBits[0], 1);
+	writer.Write(pBits[1], 1);
+	writer.Write(indices[0], 3);
+	for (uint32_t i = 1; i < 16; i++)
+	{
+		writer.Write(indices[i], 4);
+	}
+}
+
+std::vector<uint8_t> TextureCooker::DownsampleRGBA(const uint8_t* rgba, const uint32_t& width, const uint32_t& height)
+{
+	// 2x2的盒式滤波，奇数尺寸的最后一行/列重复边上的像素
+	// 颜色是sRGB编码的，要在线性空间里平均，不然缩小之后会变暗；Alpha本来就是线性的
+	static const SrgbToLinearTable toLinear;
+	const uint32_t nextWidth = std::max(width / 2, 1u);
+	const uint32_t nextHeight = std::max(height / 2, 1u);
+	std::vector<uint8_t> result(static_cast<size_t>(nextWidth) * nextHeight * 4);
+	for (uint32_t y = 0; y < nextHeight; y++)
+	{
+		const uint32_t y0 = std::min(y * 2, height - 1);
+		const uint32_t y1 = std::min(y * 2 + 1, height - 1);
+		for (uint32_t x = 0; x < nextWidth; x++)
+		{
+			const uint32_t x0 = std::min(x * 2, width - 1);
+			const uint32_t x1 = std::min(x * 2 + 1, width - 1);
+			const uint8_t* texels[4] = {
+				&rgba[(static_cast<size_t>(y0) * width + x0) * 4],
+				&rgba[(static_cast<size_t>(y0) * width + x1) * 4],
+				&rgba[(static_cast<size_t>(y1) * width + x0) * 4],
+				&rgba[(static_cast<size_t>(y1) * width + x1) * 4]
+			};
+			uint8_t* target = &result[(static_cast<size_t>(y) * nextWidth + x) * 4];
+			for (uint32_t c = 0; c < 3; c++)
+			{
+				const float sum = toLinear.values[texels[0][c]] + toLinear.values[texels[1][c]]
+					+ toLinear.values[texels[2][c]] + toLinear.values[texels[3][c]];
+				target[c] = LinearToSrgb(sum * 0.25f);
+			}
+			const uint32_t alphaSum = texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3];
+			target[3] = static_cast<uint8_t>((alphaSum + 2) / 4);
+		}
+	}
+	return result;
+}
+
+std::vector<uint8_t> TextureCooker::EncodeLevel(const std::vector<uint8_t>& rgba, const uint32_t& width, const uint32_t& height, const bool& useBC7)
+{
+	const uint32_t blocksX = (width + 3) / 4;
+	const uint32_t blocksY = (height + 3) / 4;
+	const uint32_t blockBytes = useBC7 ? 16 : 8;
+	std::vector<uint8_t> result(static_cast<size_t>(blocksX) * blocksY * blockBytes);
+
+	// 每个线程负责若干行块，块之间互不依赖
+	const auto encodeRows = [&](const uint32_t beginRow, const uint32_t endRow)
+	{
+		uint8_t texels[16 * 4];
+		for (uint32_t by = beginRow; by < endRow; by++)
+		{
+			for (uint32_t bx = 0; bx < blocksX; bx++)
+			{
+				// 边缘不足4x4的块重复边上的像素
+				for (uint32_t i = 0; i < 16; i++)
+				{
+					const uint32_t x = std::min(bx * 4 + i % 4, width - 1);
+					const uint32_t y = std::min(by * 4 + i / 4, height - 1);
+					std::memcpy(&texels[i * 4], &rgba[(static_cast<size_t>(y) * width + x) * 4], 4);
+				}
+				uint8_t* block = &result[(static_cast<size_t>(by) * blocksX + bx) * blockBytes];
+				if (useBC7)
+				{
+					EncodeBC7Block(texels, block);
+				}
+				else
+				{
+					EncodeBC1Block(texels, block);
+				}
+			}
+		}
+	};
+
+	const uint32_t threadCount = std::clamp(std::thread::hardware_concurrency(), 1u, std::max(blocksY / 16, 1u));
+	std::vector<std::thread> threads;
+	const uint32_t rowsPerThread = (blocksY + threadCount - 1) / threadCount;
+	for (uint32_t t = 1; t < threadCount; t++)
+	{
+		threads.emplace_back(encodeRows, std::min(t * rowsPerThread, blocksY), std::min((t + 1) * rowsPerThread, blocksY));
+	}
+	encodeRows(0, std::min(rowsPerThread, blocksY));
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+	return result;
+}
+
+bool TextureCooker::CookFile(const std::string& sourcePath, const std::string& cookedPath)
+{
+	int width, height, channels;
+	stbi_uc* pixels = stbi_load(sourcePath.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+	if (!pixels)
+	{
+		std::cerr << "Failed to read texture " << sourcePath << ": " << stbi_failure_reason() << std::endl;
+		return false;
+	}
+	std::vector<uint8_t> level(pixels, pixels + static_cast<size_t>(width) * height * 4);
+	stbi_image_free(pixels);
+
+	// 有透明像素的用BC7，不透明的用BC1
+	bool hasAlpha = false;
+	for (size_t i = 3; i < level.size() && !hasAlpha; i += 4)
+	{
+		hasAlpha = level[i] != 255;
+	}
+
+	Ktx2Image image;
+	image.format = hasAlpha ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+	image.width = static_cast<uint32_t>(width);
+	image.height = static_cast<uint32_t>(height);
+	uint32_t levelWidth = image.width;
+	uint32_t levelHeight = image.height;
+	while (true)
+	{
+		image.levels.push_back(EncodeLevel(level, levelWidth, levelHeight, hasAlpha));
+		if (levelWidth == 1 && levelHeight == 1)
+		{
+			break;
+		}
+		level = DownsampleRGBA(level.data(), levelWidth, levelHeight);
+		levelWidth = std::max(levelWidth / 2, 1u);
+		levelHeight = std::max(levelHeight / 2, 1u);
+	}
+
+	// 先写到临时文件再改名，中途失败不会留下一个看起来比源文件新的坏文件
+	const std::string temporaryPath = cookedPath + ".tmp";
+	if (!Ktx2File::Write(temporaryPath, image))
+	{
+		std::cerr << "Failed to write cooked texture " << cookedPath << std::endl;
+		return false;
+	}
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, cookedPath, error);
+	if (error)
+	{
+		std::cerr << "Failed to write cooked texture " << cookedPath << ": " << error.message() << std::endl;
+		std::filesystem::remove(temporaryPath, error);
+		return false;
+	}
+	return true;
+}
+
+size_t TextureCooker::CookDirectory(const std::string& directory)
+{
+	std::string root = directory;
+	std::replace(root.begin(), root.end(), '\\', '/');
+
+	size_t cookedCount = 0;
+	std::error_code error;
+	for (const auto& entry : std::filesystem::recursive_directory_iterator(root, error))
+	{
+		if (!entry.is_regular_file() || !IsSourceImage(entry.path()))
+		{
+			continue;
+		}
+		const std::string sourcePath = entry.path().string();
+		if (IsCookedUpToDate(sourcePath))
+		{
+			continue;
+		}
+		std::cout << "Cooking " << sourcePath << std::endl;
+		if (CookFile(sourcePath, GetCookedPath(sourcePath)))
+		{
+			cookedCount++;
+		}
+	}
+	if (error)
+	{
+		std::cerr << "Failed to list textures in " << directory << ": " << error.message() << std::endl;
+	}
+	return cookedCount;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Ktx2File.h"
+
+/*
+ * Offline texture cooker (run with --cook-textures): encodes source images into block compressed
+ * KTX2 files with a full mip chain. Opaque images become BC1 (8:1), images with alpha BC7 (4:1).
+ * Sources are treated as sRGB colour: the blocks are tagged _SRGB and the mips are filtered in linear space.
+ * Image::LoadImageFromFile picks up the cooked file next to the source while it is newer than the source.
+ */
+class TextureCooker
+{
+public:
+	// textures/Floor_c.png -> textures/Floor_c.ktx2
+	static std::string GetCookedPath(const std::string& sourcePath);
+	// The cooked file exists and was written after the source was last modified
+	static bool IsCookedUpToDate(const std::string& sourcePath);
+
+	static bool CookFile(const std::string& sourcePath, const std::string& cookedPath);
+	// Cooks every image under the directory whose cooked file is missing or stale, returns how many were written
+	static size_t CookDirectory(const std::string& directory);
+
+	// Block encoders, rgba: 16 texels of a 4x4 block in row order, 4 bytes each
+	static void EncodeBC1Block(const uint8_t* rgba, uint8_t* block);
+	static void EncodeBC7Block(const uint8_t* rgba, uint8_t* block);
+
+	// Next mip of an sRGB RGBA8 image: 2x2 box filter in linear space, odd edges repeat the last row / column
+	static std::vector<uint8_t> DownsampleRGBA(const uint8_t* rgba, const uint32_t& width, const uint32_t& height);
+
+private:
+	static std::vector<uint8_t> EncodeLevel(const std::vector<uint8_t>& rgba, const uint32_t& width, const uint32_t& height, const bool& useBC7);
+};
@@ -0,0 +1,280 @@
+﻿#include "TextureLoader.h"
+
+#include <algorithm>
+
+#include "Buffer.h"
+#include "TextureCooker.h"
+
+TextureLoader::TextureLoader(VmaAllocator& allocator,
+	VkDevice& logicalDevice,
+	VkCommandPool& commandPool,
+	VkQueue& graphicsQueue,
+	const uint32_t& threadCount) :
+	mAllocator(allocator),
+	mLogicalDevice(logicalDevice),
+	mCommandPool(commandPool),
+	mGraphicsQueue(graphicsQueue)
+{
+	const uint32_t workerCount = std::max(threadCount, 1u);
+	mWorkers.reserve(workerCount);
+	for (uint32_t i = 0; i < workerCount; i++)
+	{
+		mWorkers.emplace_back(&TextureLoader::WorkerLoop, this);
+	}
+}
+
+TextureLoader::~TextureLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mWorkCondition.notify_all();
+	for (auto& worker : mWorkers)
+	{
+		worker.join();
+	}
+}
+
+void TextureLoader::Prefetch(const std::string& path)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!mEntries.try_emplace(path).second)
+		{
+			return;
+		}
+		mRequests.push_back(path);
+	}
+	mWorkCondition.notify_one();
+}
+
+void TextureLoader::Enqueue(const std::string& path, const std::shared_ptr<Image>& image)
+{
+	Prefetch(path);
+	mPendingUploads.emplace_back(path, image);
+}
+
+void TextureLoader::WorkerLoop()
+{
+	while (true)
+	{
+		std::string path;
+		DecodeEntry* entry;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWorkCondition.wait(lock, [this]() { return mStop || !mRequests.empty(); });
+			if (mStop)
+			{
+				return;
+			}
+			path = std::move(mRequests.front());
+			mRequests.pop_front();
+			entry = &mEntries[path];
+		}
+
+		// 解码不需要锁，Flush和Poll只会在done之后读这个Entry
+		DecodeResult result = Decode(path);
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			entry->result = std::move(result);
+			entry->done = true;
+		}
+		mDoneCondition.notify_all();
+	}
+}
+
+TextureLoader::DecodeResult TextureLoader::Decode(const std::string& path)
+{
+	DecodeResult result;
+	result.succeeded = Image::DecodeFile(path.c_str(), true, true, true, result.image);
+	if (result.succeeded)
+	{
+		result.preview = MakePreview(result.image);
+	}
+	return result;
+}
+
+TextureLoader::DecodeEntry& TextureLoader::WaitForDecode(const std::string& path)
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	const auto [found, inserted] = mEntries.try_emplace(path);
+	auto& entry = found->second;
+	// 没有Prefetch过（或者已经Release掉）的，以及还在排队没有线程接手的，直接在这个线程上解码
+	const auto request = std::find(mRequests.begin(), mRequests.end(), path);
+	if (!inserted && request == mRequests.end())
+	{
+		// 正在别的线程上解码，或者已经解码完了
+		mDoneCondition.wait(lock, [&entry]() { return entry.done; });
+		return entry;
+	}
+	if (request != mRequests.end())
+	{
+		mRequests.erase(request);
+	}
+
+	// Entry还没有done，Release不会删掉它
+	lock.unlock();
+	DecodeResult result = Decode(path);
+	lock.lock();
+	entry.result = std::move(result);
+	entry.done = true;
+	lock.unlock();
+	mDoneCondition.notify_all();
+	return entry;
+}
+
+bool TextureLoader::Flush()
+{
+	bool succeeded = true;
+	size_t next = 0;
+	while (next < mPendingUploads.size())
+	{
+		// 按Staging Buffer的预算把上传分成几批，每批一个CommandBuffer，提交之后等一次
+		std::vector<std::pair<std::shared_ptr<Image>, const DecodedImage*>> batch;
+		VkDeviceSize stagingBytes = 0;
+		for (; next < mPendingUploads.size(); next++)
+		{
+			auto& [path, image] = mPendingUploads[next];
+			const DecodeEntry& entry = WaitForDecode(path);
+			if (!entry.result.succeeded)
+			{
+				std::cerr << "Failed to load texture " << path << std::endl;
+				succeeded = false;
+				continue;
+			}
+
+			VkDeviceSize bytes = 0;
+			for (const auto& level : entry.result.image.levels)
+			{
+				bytes += level.size;
+			}
+			// 至少放一张进去，超大的贴图自己一批
+			if (!batch.empty() && stagingBytes + bytes > MAX_STAGING_BYTES_PER_BATCH)
+			{
+				break;
+			}
+			stagingBytes += bytes;
+			batch.emplace_back(image, &entry.result.image);
+		}
+		succeeded &= Upload(batch);
+	}
+
+	// 解码的结果只用一次，上传完就释放；流式加载还没轮到的那些不动
+	for (const auto& [path, image] : mPendingUploads)
+	{
+		Release(path);
+	}
+	mPendingUploads.clear();
+	return succeeded;
+}
+
+const TextureLoader::DecodeResult* TextureLoader::Poll(const std::string& path)
+{
+	Prefetch(path);
+	std::lock_guard<std::mutex> lock(mMutex);
+	const auto& entry = mEntries[path];
+	return entry.done ? &entry.result : nullptr;
+}
+
+void TextureLoader::Release(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	const auto found = mEntries.find(path);
+	if (found != mEntries.end() && found->second.done)
+	{
+		mEntries.erase(found);
+	}
+}
+
+bool TextureLoader::Upload(const std::vector<std::pair<std::shared_ptr<Image>, const DecodedImage*>>& uploads)
+{
+	if (uploads.empty())
+	{
+		return true;
+	}
+
+	bool succeeded = true;
+	std::vector<std::unique_ptr<Buffer>> stagingBuffers;
+	std::vector<size_t> uploaded;
+	const VkResult error = DoOneTimeCommand(mLogicalDevice, mCommandPool, mGraphicsQueue, [&](VkCommandBuffer& commandBuffer)
+	{
+		for (size_t i = 0; i < uploads.size(); i++)
+		{
+			auto& stagingBuffer = stagingBuffers.emplace_back(std::make_unique<Buffer>(mAllocator));
+			// 显存紧张的时候TextureCache要从贴图里拷出低几级Mip，所以都要能当传输源
+			if (uploads[i].first->RecordUpload(commandBuffer, *uploads[i].second, *stagingBuffer,
+				VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT) != VK_SUCCESS)
+			{
+				std::cerr << "Failed to upload a texture." << std::endl;
+				succeeded = false;
+				continue;
+			}
+			uploaded.push_back(i);
+		}
+		return VK_SUCCESS;
+	});
+
+	for (auto& stagingBuffer : stagingBuffers)
+	{
+		stagingBuffer->Free();
+	}
+	if (error != VK_SUCCESS)
+	{
+		std::cerr << "Failed to submit the texture uploads." << std::endl;
+		return false;
+	}
+	for (const size_t index : uploaded)
+	{
+		CHECK_VK_ERROR(uploads[index].first->CreateTextureView(), "Failed to create the view of a texture.");
+	}
+	return succeeded;
+}
+
+DecodedImage TextureLoader::MakePreview(const DecodedImage& decoded)
+{
+	DecodedImage preview;
+	if (std::max(decoded.width, decoded.height) <= PREVIEW_SIZE)
+	{
+		return preview;
+	}
+
+	preview.format = decoded.format;
+	uint32_t level = 0;
+	while (std::max(decoded.width >> level, decoded.height >> level) > PREVIEW_SIZE)
+	{
+		level++;
+	}
+	preview.width = std::max(decoded.width >> level, 1u);
+	preview.height = std::max(decoded.height >> level, 1u);
+
+	if (decoded.levels.size() > 1)
+	{
+		// 带着Mip链的KTX2，直接共用后面几级的数据
+		if (level < decoded.levels.size())
+		{
+			preview.levels.assign(decoded.levels.begin() + level, decoded.levels.end());
+			preview.generateMipmaps = false;
+		}
+		return preview;
+	}
+
+	// 只有第0级的8位贴图在CPU上一级一级缩小，剩下的Mip上传的时候再生成；半精度的HDR贴图不做预览
+	if (decoded.format != VK_FORMAT_R8G8B8A8_SRGB || decoded.levels.empty())
+	{
+		return {};
+	}
+	std::vector<uint8_t> pixels = TextureCooker::DownsampleRGBA(decoded.levels[0].data.get(), decoded.width, decoded.height);
+	uint32_t width = std::max(decoded.width / 2, 1u);
+	uint32_t height = std::max(decoded.height / 2, 1u);
+	while (std::max(width, height) > PREVIEW_SIZE)
+	{
+		pixels = TextureCooker::DownsampleRGBA(pixels.data(), width, height);
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+	preview.width = width;
+	preview.height = height;
+	preview.levels.push_back(DecodedLevel::FromVector(std::move(pixels)));
+	return preview;
+}
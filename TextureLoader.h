@@ -0,0 +1,92 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Image.h"
+
+/*
+ * Decodes textures on a pool of worker threads and uploads them in a few batched submissions.
+ * Used through the TextureCache, which assigns the shared samplers.
+ * Paths are handed to Prefetch as soon as they are known (right after a model file is read).
+ * Streamed textures are picked up with Poll once their decode has finished and uploaded with Upload;
+ * images that are needed right away are queued with Enqueue, and Flush waits for their decodes and
+ * records the uploads into as few command buffers as the staging budget allows.
+ */
+class TextureLoader
+{
+public:
+	// 一次提交里Staging Buffer的总大小上限
+	static constexpr VkDeviceSize MAX_STAGING_BYTES_PER_BATCH = 256ull * 1024 * 1024;
+	// 比这个大的贴图会另外准备一份从这个尺寸开始的Mip尾巴，流式加载的时候先传它
+	static constexpr uint32_t PREVIEW_SIZE = 64;
+
+	// The decoded file and, for images larger than PREVIEW_SIZE, its mip tail starting at PREVIEW_SIZE (no levels otherwise)
+	struct DecodeResult
+	{
+		bool succeeded = false;
+		DecodedImage image;
+		DecodedImage preview;
+	};
+
+	TextureLoader(VmaAllocator& allocator,
+		VkDevice& logicalDevice,
+		VkCommandPool& commandPool,
+		VkQueue& graphicsQueue,
+		const uint32_t& threadCount = std::thread::hardware_concurrency());
+	~TextureLoader();
+
+	TextureLoader(const TextureLoader&) = delete;
+	TextureLoader& operator=(const TextureLoader&) = delete;
+
+	// Starts decoding the file on a worker thread; safe to call from several threads, a path is decoded once.
+	void Prefetch(const std::string& path);
+	// image is created, uploaded and given its view by the next Flush; the sampler is up to the caller.
+	void Enqueue(const std::string& path, const std::shared_ptr<Image>& image);
+	// Returns false when an upload failed; the images that could not be uploaded stay empty.
+	bool Flush();
+
+	// The decode of path once it has finished, nullptr before; starts decoding the file if nobody asked for it yet.
+	// The result stays valid until Release.
+	const DecodeResult* Poll(const std::string& path);
+	// Frees the decoded data of path once it has been uploaded; a decode still running is left alone.
+	void Release(const std::string& path);
+	// Creates and uploads the images in one command buffer, waits for it and creates their views.
+	// Returns false when an upload failed; those images are left without a view.
+	bool Upload(const std::vector<std::pair<std::shared_ptr<Image>, const DecodedImage*>>& uploads);
+
+private:
+	struct DecodeEntry
+	{
+		bool done = false;
+		DecodeResult result;
+	};
+
+	// 在CPU上缩小到PREVIEW_SIZE，烘焙过的贴图直接取它自己的Mip
+	static DecodedImage MakePreview(const DecodedImage& decoded);
+	static DecodeResult Decode(const std::string& path);
+	void WorkerLoop();
+	// 等某个路径解码完；没有Prefetch过或者还没轮到的话在这个线程上直接解码
+	DecodeEntry& WaitForDecode(const std::string& path);
+
+	VmaAllocator& mAllocator;
+	VkDevice& mLogicalDevice;
+	VkCommandPool& mCommandPool;
+	VkQueue& mGraphicsQueue;
+
+	std::vector<std::thread> mWorkers;
+	std::mutex mMutex;
+	std::condition_variable mWorkCondition;
+	std::condition_variable mDoneCondition;
+	std::deque<std::string> mRequests;
+	// unordered_map的节点地址不会变，解码线程可以一直写同一个Entry
+	std::unordered_map<std::string, DecodeEntry> mEntries;
+	bool mStop = false;
+
+	std::vector<std::pair<std::string, std::shared_ptr<Image>>> mPendingUploads;
+};
@@ -2,64 +2,66 @@
 #include <vector>
 
 TopLevelAccelerationStructure::TopLevelAccelerationStructure(VmaAllocator& allocator):
-	mAllocator(allocator)
+	mAllocator(allocator),
+    mInstancesBuffer(allocator),
+    mScratchBuffer(allocator)
 {
     mAccelerationStructure.buffer = std::make_shared<Buffer>(mAllocator);
 }
 
+VkAccelerationStructureInstanceKHR TopLevelAccelerationStructure::MakeInstance(Mesh& mesh,
+    const mat4& transform,
+    const uint32_t& geometryIndex,
+    const uint32_t& lod)
+{
+    VkAccelerationStructureInstanceKHR instance = {};
+    // 这里需要指定每个Instance的Transform信息
+    // VkTransformMatrixKHR是行主序的3x4矩阵，glm是列主序的
+    for (size_t row = 0; row < 3; row++)
+    {
+        for (size_t col = 0; col < 4; col++)
+        {
+            instance.transform.matrix[row][col] = transform[col][row];
+        }
+    }
+    // 这里需要给每个Instance指定一个独立的ID，用于在Shader里面区分当前我们操作的是那个对象
+    // 低位是几何体的序号（用来索引顶点属性和面），高位是材质序号，这样Shader里面不需要再额外读一次材质ID
+    instance.instanceCustomIndex = PackInstanceCustomIndex(geometryIndex, mesh.GetMatID());
+    // 这里指定Instance的Mask，用于在Shader中发射射线的时候忽略碰撞部分对象
+    // 不过目前的Demo并没有做区分
+    instance.mask = 0x01;
+    if (mesh.GetMeshType() == WINDOW)
+    {
+        instance.mask = 0x02;
+    }
+    instance.instanceShaderBindingTableRecordOffset = 0;
+    instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+    instance.accelerationStructureReference = mesh.GetAccelerationStructure(lod).handle;
+    return instance;
+}
+
 void TopLevelAccelerationStructure::Build(
     VkDevice& logicalDevice,
     VkCommandPool& cmdPool,
     VkQueue& queue,
-	std::vector<std::shared_ptr<Mesh>> meshes)
+    const std::vector<VkAccelerationStructureInstanceKHR>& instances)
 {
     mLogicalDevice = logicalDevice;
-    const size_t numMeshes = meshes.size();
-
-    // ĿǰһMeshӦһInstance 
-    std::vector<VkAccelerationStructureInstanceKHR> instances(numMeshes, VkAccelerationStructureInstanceKHR{});
-    for (size_t i = 0; i < numMeshes; ++i)
-    {
-        auto& mesh = meshes[i];
+    mNumInstances = static_cast<uint32_t>(instances.size());
 
-        VkAccelerationStructureInstanceKHR& instance = instances[i];
-        // ҪָÿInstanceTransformϢ
-        auto& meshTransform = mesh->GetTransform();
-
-        for (size_t row = 0; row < 3; row++)
-        {
-            for (size_t col = 0; col < 4; col++)
-            {
-                instance.transform.matrix[row][col] = meshTransform[row][col];
-            }
-        }
-        // ҪÿInstanceָһIDShaderֵǰǲǸ
-        instance.instanceCustomIndex = static_cast<uint32_t>(i);
-        // ָInstanceMaskShaderзߵʱײֶ
-        // ĿǰDemoû
-        instance.mask = 0x01;
-        if (mesh->GetMeshType() == WINDOW)
-        {
-            instance.mask = 0x02;
-        }
-        instance.instanceShaderBindingTableRecordOffset = 0;
-        instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-        instance.accelerationStructureReference = mesh->GetAccelerationStructure().handle;
-    }
-    // InstanceBuffer
-    Buffer instancesBuffer(mAllocator);
-    VkResult error = instancesBuffer.CreateBuffer(instances.size() * sizeof(VkAccelerationStructureInstanceKHR),
+    // 创建Instance的Buffer
+    VkResult error = mInstancesBuffer.CreateBuffer(instances.size() * sizeof(VkAccelerationStructureInstanceKHR),
         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
         VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
     
     assert(error == VK_SUCCESS);
-    // ϴInstance
-    instancesBuffer.UploadData(instances.data(), instancesBuffer.GetSize());
+    // 上传Instance数据
+    mInstancesBuffer.UploadData(instances.data(), mInstancesBuffer.GetSize());
 
-    // ʼٽṹʵ̺͵ײٽṹ
+    // 开始创建顶层加速结构，其实创建的流程和底层加速结构很类似
     VkAccelerationStructureGeometryInstancesDataKHR tlasInstancesInfo = {};
     tlasInstancesInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
-    tlasInstancesInfo.data = GetBufferDeviceAddressConst(logicalDevice, instancesBuffer);
+    tlasInstancesInfo.data = GetBufferDeviceAddressConst(logicalDevice, mInstancesBuffer);
 
     VkAccelerationStructureGeometryKHR  tlasGeoInfo = {};
     tlasGeoInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
@@ -70,14 +72,15 @@ void TopLevelAccelerationStructure::Build(
     buildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
     buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
     buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-    buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+    // 流式加载会不停地替换Instance引用的底层加速结构，所以需要允许原地更新
+    buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+        | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
     buildInfo.geometryCount = 1;
     buildInfo.pGeometries = &tlasGeoInfo;
 
-    const uint32_t numInstances = static_cast<uint32_t>(instances.size());
-    // ٽṹʱ䴴СҪѯһֵֻҪVulkanǾ
+    // 创建顶层加速结构的时候，其创建大小不需要我们轮询一遍整个集合来找最大值，只需要让Vulkan告诉我们就行了
     VkAccelerationStructureBuildSizesInfoKHR sizeInfo = { VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
-    vkGetAccelerationStructureBuildSizesKHR(logicalDevice, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo, &numInstances, &sizeInfo);
+    vkGetAccelerationStructureBuildSizesKHR(logicalDevice, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo, &mNumInstances, &sizeInfo);
 
 	mAccelerationStructure.buffer->CreateBuffer(sizeInfo.accelerationStructureSize,
         VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
@@ -88,18 +91,73 @@ void TopLevelAccelerationStructure::Build(
     createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
     createInfo.size = sizeInfo.accelerationStructureSize;
     createInfo.buffer = mAccelerationStructure.buffer->GetVkBuffer();
-    // ٽṹʱûʵʴ
+    // 创建加速结构，此时还没有往里面实际传入数据
     error = vkCreateAccelerationStructureKHR(logicalDevice, &createInfo, nullptr, &mAccelerationStructure.accelerationStructure);
     assert(error == VK_SUCCESS);
-    // ȻҪһʱBuffer
-    Buffer scratchBuffer(mAllocator);
-    error = scratchBuffer.CreateBuffer(sizeInfo.buildScratchSize,
+    // 依然需要一个临时的Buffer，重新构建和更新都会用到它，所以按两者中较大的那个来分配
+    error = mScratchBuffer.CreateBuffer(std::max(sizeInfo.buildScratchSize, sizeInfo.updateScratchSize),
         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
         VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT);
     assert(error == VK_SUCCESS);
 
-    buildInfo.scratchData = GetBufferDeviceAddress(logicalDevice, scratchBuffer);
-    buildInfo.srcAccelerationStructure = VK_NULL_HANDLE;
+    Submit(logicalDevice, cmdPool, queue, VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
+
+    VkAccelerationStructureDeviceAddressInfoKHR addressInfo = {};
+    addressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+    addressInfo.accelerationStructure = mAccelerationStructure.accelerationStructure;
+    mAccelerationStructure.handle = vkGetAccelerationStructureDeviceAddressKHR(logicalDevice, &addressInfo);
+}
+
+void TopLevelAccelerationStructure::Update(
+    VkDevice& logicalDevice,
+    VkCommandPool& cmdPool,
+    VkQueue& queue,
+    const std::vector<VkAccelerationStructureInstanceKHR>& instances)
+{
+    // Instance的数量变了的话只能重新创建
+    assert(instances.size() == mNumInstances);
+    mInstancesBuffer.UploadData(instances.data(), mInstancesBuffer.GetSize());
+
+    // 连续更新太多次之后BVH的质量会越来越差，这时候在原来的内存上完整地重新构建一次
+    if (mUpdatesSinceBuild >= MAX_UPDATES_BEFORE_REBUILD)
+    {
+        Submit(logicalDevice, cmdPool, queue, VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
+    }
+    else
+    {
+        Submit(logicalDevice, cmdPool, queue, VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR);
+    }
+}
+
+void TopLevelAccelerationStructure::Submit(
+    VkDevice& logicalDevice,
+    VkCommandPool& cmdPool,
+    VkQueue& queue,
+    const VkBuildAccelerationStructureModeKHR& mode)
+{
+    VkAccelerationStructureGeometryInstancesDataKHR tlasInstancesInfo = {};
+    tlasInstancesInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+    tlasInstancesInfo.data = GetBufferDeviceAddressConst(logicalDevice, mInstancesBuffer);
+
+    VkAccelerationStructureGeometryKHR  tlasGeoInfo = {};
+    tlasGeoInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    tlasGeoInfo.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+    tlasGeoInfo.geometry.instances = tlasInstancesInfo;
+
+    // 更新时的参数必须和构建时保持一致
+    VkAccelerationStructureBuildGeometryInfoKHR buildInfo = {};
+    buildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+    buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    buildInfo.mode = mode;
+    buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+        | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+    buildInfo.geometryCount = 1;
+    buildInfo.pGeometries = &tlasGeoInfo;
+    buildInfo.scratchData = GetBufferDeviceAddress(logicalDevice, mScratchBuffer);
+    // 更新模式下，源和目标是同一个加速结构
+    buildInfo.srcAccelerationStructure = mode == VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR
+        ? mAccelerationStructure.accelerationStructure
+        : VK_NULL_HANDLE;
     buildInfo.dstAccelerationStructure = mAccelerationStructure.accelerationStructure;
 
     VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
@@ -109,7 +167,7 @@ void TopLevelAccelerationStructure::Build(
     commandBufferAllocateInfo.commandBufferCount = 1;
 
     VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
-    error = vkAllocateCommandBuffers(logicalDevice, &commandBufferAllocateInfo, &commandBuffer);
+    VkResult error = vkAllocateCommandBuffers(logicalDevice, &commandBufferAllocateInfo, &commandBuffer);
     assert(error == VK_SUCCESS);
 
     VkCommandBufferBeginInfo beginInfo = {};
@@ -118,7 +176,7 @@ void TopLevelAccelerationStructure::Build(
     vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
     VkAccelerationStructureBuildRangeInfoKHR range = {};
-    range.primitiveCount = numInstances;
+    range.primitiveCount = mNumInstances;
 
     const VkAccelerationStructureBuildRangeInfoKHR* ranges[1] = { &range };
 
@@ -130,23 +188,20 @@ void TopLevelAccelerationStructure::Build(
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
-    // ʼٽṹ
+    // 开始构建顶层加速结构
     vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
     error = vkQueueWaitIdle(queue);
     ASSERT_VK(error);
     vkFreeCommandBuffers(logicalDevice, cmdPool, 1, &commandBuffer);
 
-    VkAccelerationStructureDeviceAddressInfoKHR addressInfo = {};
-    addressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
-    addressInfo.accelerationStructure = mAccelerationStructure.accelerationStructure;
-    mAccelerationStructure.handle = vkGetAccelerationStructureDeviceAddressKHR(logicalDevice, &addressInfo);
-    // ͷʱ
-    scratchBuffer.Free();
-    instancesBuffer.Free();
+    mUpdatesSinceBuild = mode == VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR ? mUpdatesSinceBuild + 1 : 0;
 }
 
 void TopLevelAccelerationStructure::Dispose()
 {
     mAccelerationStructure.buffer->Free();
     vkDestroyAccelerationStructureKHR(mLogicalDevice, mAccelerationStructure.accelerationStructure, VK_NULL_HANDLE);
+    // 释放临时缓存
+    mScratchBuffer.Free();
+    mInstancesBuffer.Free();
 }
@@ -5,10 +5,26 @@ class TopLevelAccelerationStructure
 {
 public:
 	TopLevelAccelerationStructure(VmaAllocator&);
+
+	// Fills one TLAS instance that places the BLAS of the given LOD of the mesh with a world transform.
+	// geometryIndex is the slot of the attribute / faces descriptor arrays the hit shader reads from.
+	static VkAccelerationStructureInstanceKHR MakeInstance(Mesh& mesh,
+		const mat4& transform,
+		const uint32_t& geometryIndex,
+		const uint32_t& lod = 0);
+
 	void Build(VkDevice& logicalDevice,
 		VkCommandPool& cmdPool,
 		VkQueue& queue,
-		std::vector<std::shared_ptr<Mesh>> meshes);
+		const std::vector<VkAccelerationStructureInstanceKHR>& instances);
+
+	// Refits the TLAS in place after instances changed (transform or BLAS reference).
+	// The instance count must stay the same as in Build. Every few updates it is rebuilt
+	// from scratch, because refitting slowly degrades the trace performance.
+	void Update(VkDevice& logicalDevice,
+		VkCommandPool& cmdPool,
+		VkQueue& queue,
+		const std::vector<VkAccelerationStructureInstanceKHR>& instances);
 
 	[[nodiscard]]
 	const AccelerationStructure& GetAccelerationStructure() const
@@ -18,9 +34,21 @@ public:
 
 	void Dispose();
 private:
+	static constexpr uint32_t MAX_UPDATES_BEFORE_REBUILD = 16;
+
+	void Submit(VkDevice& logicalDevice,
+		VkCommandPool& cmdPool,
+		VkQueue& queue,
+		const VkBuildAccelerationStructureModeKHR& mode);
+
 	VmaAllocator& mAllocator;
 	AccelerationStructure mAccelerationStructure;
 
+	// 更新的时候还要用到，所以和加速结构一起保留
+	Buffer mInstancesBuffer;
+	Buffer mScratchBuffer;
+	uint32_t mNumInstances = 0;
+	uint32_t mUpdatesSinceBuild = 0;
+
 	VkDevice mLogicalDevice;
 };
-
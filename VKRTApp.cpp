@@ -1,64 +1,111 @@
 #include "VKRTApp.h"
+
+#include <chrono>
+#include <filesystem>
+#include <stdexcept>
+
 #include "Device.h"
 #include "FileUtility.h"
 
 #include "Instance.h"
 #include "shared_with_shaders.h"
 #include "DescriptorSet.h"
+#include "Scene.h"
+#include "FileWatcher.h"
+#include "EnvironmentMap.h"
+#include "ShaderCache.h"
 
-VKRTApp::VKRTApp(GLFWwindow* window, const uint32_t& width, const uint32_t& height) :
+VKRTApp::VKRTApp(GLFWwindow* window, const uint32_t& width, const uint32_t& height, const std::string& scenePath) :
 	mWindow(window),
 	mWidth(width),
-	mHeight(height)
+	mHeight(height),
+	mRenderWidth(width),
+	mRenderHeight(height)
 {
-	// ÿVulkanҪһVKInstance
+	// 每个Vulkan程序都需要一个VKInstance
 	InitInstance();
 
-	// ʼVulkanȾ豸
+	// 初始化用于Vulkan渲染的设备
 	InitDevice();
 
-	// SurfaceչʾVulkanջƵĽĵط
+	// Surface就是展示Vulkan最终绘制的结果的地方
 	mSurface = std::make_unique<Surface>(mInstance,
 		window,
 		Device::GetPhysicalDevice(),
 		Device::GetQueue().GraphicsQueueFamilyIndex);
 
-	// ʹAMDVMAһЧĹԴBufferAPI
+	// 程序使用了AMD的VMA，一个更高效的管理显存与分配Buffer的API
 	CHECK_VK_ERROR(InitVma(), "Failed to init VMA.");
 
-	// 
+	// 交换链
 	mSwapchain = std::make_unique<Swapchain>(Device::GetPhysicalDevice(),
 		Device::GetLogicalDevice(),
 		mSurface->GetSurface(),
 		mSurface->GetSurfaceFormat(),
 		mWidth, mHeight);
 
-	// أCommandBuffer
+	// 命令池，用来分配CommandBuffer
 	CHECK_VK_ERROR(InitCommandPool(), "Failed to init command pool.");
 
+	// 上次运行存下来的管线缓存，驱动不用每次启动都从头编译光线追踪管线
+	mPipelineCache = std::make_unique<PipelineCache>(Device::GetLogicalDevice(), Device::GetPhysicalDevice(),
+		std::string(ShaderCache::CACHE_DIRECTORY) + "pipelines.bin");
+
 	/*
-	 * ׷ٹդͬҪԤȴһͼƬΪ׷ٹߵĻ
-	 * ֮ÿRay TraceĽͼƬ
+	 * 光线追踪管线与光栅化不同，需要预先传入一个图片，作为光线追踪管线的画布
+	 * 之后每个像素Ray Trace后的结果都会存入这张图片里面
 	 */
 	CHECK_VK_ERROR(InitializeOffscreenImage(), "Failed to init offscreen image.");
-	// ʼCommandBuffer
+	// 初始化CommandBuffer
 	CHECK_VK_ERROR(InitializeCommandBuffers(), "Failed to init command buffers.");
 
-	// ģ
-	mMeshes = Mesh::ImportAllMeshesFromFile(Device::GetLogicalDevice(),
+	// 场景文件里描述了用到的模型、每个Instance的摆放和属性、天空盒、相机和光源
+	mScene = Scene::LoadFromFile(scenePath);
+	// 显存不够的时候逐步降低画质，而不是等分配失败
+	mMemoryBudget = std::make_unique<MemoryBudgetManager>(mVmaAllocator, static_cast<VkDeviceSize>(mScene.GetGPUMemoryBudgetMB()) * 1024 * 1024);
+
+	// 导入模型，几何数据不直接上传，交给MeshStreamer按需加载；同一个文件的贴图只加载一次
+	mTextureCache = std::make_unique<TextureCache>(mVmaAllocator, Device::GetLogicalDevice(), mCommandPool, Device::GetGraphicsQueue());
+	// 开启虚拟贴图的场景，材质贴图只有光线打到的页才会加载进显存
+	mVirtualTextures = std::make_unique<VirtualTextureStreamer>(mVmaAllocator, Device::GetLogicalDevice(), mCommandPool, Device::GetGraphicsQueue(),
+		mTextureCache->GetSamplerCache(),
+		mScene.UsesVirtualTextures() ? VirtualTextureStreamer::DEFAULT_CACHE_ROWS : 1);
+	if (mScene.UsesVirtualTextures())
+	{
+		mTextureCache->SetVirtualTextures(mVirtualTextures.get());
+	}
+	// 导入过的模型烘焙在工作目录下的cache里，不放在被FileWatcher监视的models下面
+	mModelCache = std::make_unique<ModelCache>(std::filesystem::path("cache") / "models");
+	mScene.LoadAssets(Device::GetLogicalDevice(),
 		mCommandPool,
 		Device::GetGraphicsQueue(),
 		mVmaAllocator,
-		DEFAULT_MODEL_DIR"Loft.obj");
+		*mTextureCache,
+		mModelCache.get(),
+		STREAMED,
+		mMeshes,
+		mMeshInstances,
+		mObjAttris);
+	mTextureArraySize = mTextureCache->GetTextureCount() + TEXTURE_ARRAY_HEADROOM;
+	mTextureCache->SetCapacity(mTextureArraySize);
+	std::cout << mMeshes.size() << " materials share " << mTextureCache->GetTextureCount() << " textures and "
+		<< mTextureCache->GetSamplerCache().GetSamplerCount() << " samplers." << std::endl;
 
-	// ʼVulkanͬʵ
+	/*
+	 * 流式加载：模型的几何数据留在ModelCache烘焙的文件里，根据相机的距离和在屏幕上的大小决定哪些读进显存
+	 * 不在显存里的模型用一个包围盒大小的替身代替
+	 */
+	mMeshStreamer = std::make_unique<MeshStreamer>(mVmaAllocator, mCommandPool);
+	mMeshStreamer->Register(mMeshes, mMeshInstances);
+
+	// 初始化Vulkan绘制同步的相关实例
 	CHECK_VK_ERROR(InitializeSynchronization(), "Failed to init synchronization.");
 
 	/*
-	 * Buffer
-	 * ģÿݣ磺λáUVͷ
+	 * 创建顶点属性Buffer
+	 * 用来传入模型中每个顶点的数据，例如：位置、UV和法线
 	 */
-	mObjAttris.resize(mMeshes.size());
+	// 反射、折射这些属性跟着每个Instance走，Shader里面用gl_InstanceID索引
 	mObjectAttrisBuffer.resize(mObjAttris.size(), { mVmaAllocator });
 	for (size_t i = 0; i < mObjectAttrisBuffer.size(); i ++)
 	{
@@ -73,91 +120,43 @@ VKRTApp::VKRTApp(GLFWwindow* window, const uint32_t& width, const uint32_t& heig
 	}
 
 	/*
-	 * ÿһģͶһMatID
-	 * ǵǰģͣڹ׷ٹУӦѡĸͼ
+	 * 每一个模型的MatID不再单独用一个Buffer传入Shader
+	 * 而是在构建顶层加速结构的时候写进每个Instance的Custom Index里面（见TopLevelAccelerationStructure）
 	 */
-	mMatIDsBuffers.resize(mMeshes.size());
-	for (size_t i = 0; i < mMeshes.size(); i++)
-	{
-		auto& matIDsBuffer = mMatIDsBuffers[i];
 
-		const auto matIDsBufferSize = mMeshes[i]->GetMatIDs().size() * sizeof(uint32_t);
-		matIDsBuffer = std::make_shared<Buffer>(mVmaAllocator);
-		matIDsBuffer->CreateBuffer(matIDsBufferSize,
-			VK_BUFFER_USAGE_TRANSFER_DST_BIT
-			| VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
-			| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
-			| VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-			VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
-		matIDsBuffer->UploadData(mMeshes[i]->GetMatIDs().data(), matIDsBufferSize);
-	}
-
-	// պСûдκ壬ȾպеĲ
-	mSkyBoxImage = std::make_unique<Image>(mVmaAllocator, Device::GetLogicalDevice());
-	mSkyBoxImage->LoadImageFromFile(DEFAULT_TEXTURE_DIR"Sky_LowPoly_01_Day_a.png",
-		mCommandPool,
-		Device::GetGraphicsQueue());
-	mSkyBoxImage->CreateImageView(
-		VK_IMAGE_VIEW_TYPE_2D,
-		VkImageSubresourceRange
-		{
-			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.baseMipLevel = 0,
-			.levelCount = VK_REMAINING_MIP_LEVELS,
-			.baseArrayLayer = 0,
-			.layerCount = VK_REMAINING_ARRAY_LAYERS,
-		});
-	mSkyBoxImage->CreateSampler(
-		VK_FILTER_LINEAR,
-		VK_FILTER_LINEAR,
-		VK_SAMPLER_MIPMAP_MODE_LINEAR,
-		VK_SAMPLER_ADDRESS_MODE_REPEAT);
-
-	// ÿģ͹ײٽṹ
-	mBtmLvlAccStructBuilder = std::make_unique<BottomLevelAccelerationStructureBuilder>(mVmaAllocator);
-	mBtmLvlAccStructBuilder->Build(Device::GetLogicalDevice(), mCommandPool, Device::GetGraphicsQueue(), mMeshes);
+	// 天空盒。如果射线没有打中任何物体，就渲染天空盒的材质
+	mSkyBoxImage = CreateSkyBoxImage();
 
 	/*
-	 * ٽṹ
-	 * ٽṹջᴫShaderĳ
+	 * 用来构建顶层加速结构
+	 * 顶层加速结构是最终会传给Shader的场景
+	 * 每个模型的底层加速结构由MeshStreamer在加载之后构建，一开始全部都是替身
 	 */
 	mTopLvlAccStruct = std::make_unique<TopLevelAccelerationStructure>(mVmaAllocator);
-	mTopLvlAccStruct->Build(Device::GetLogicalDevice(), mCommandPool, Device::GetGraphicsQueue(), mMeshes);
+	mTopLvlAccStruct->Build(Device::GetLogicalDevice(), mCommandPool, Device::GetGraphicsQueue(), mMeshStreamer->GetInstances());
 
 	/*
-	 * ˵ǰ׷ٹҪShader
-	 * RayGen: ׷ٵڣ
-	 * RayHitǰеһĿ
-	 * RayMissǰûκĿ
-	 * RayShadowHit󣬻ᳯŹԴٴηһߡκ壬˵ǰ屻ţҪиӰ
-	 * RayShadowMissûκڵǰ壬ȾӰ
+	 * 包含了当前光线追踪管线所需要的所有Shader
+	 * RayGen: 光线追踪的入口，用来发射射线
+	 * RayHit：当前射线命中的最近的一个目标
+	 * RayMiss：当前射线没有命中任何目标
+	 * RayShadowHit：当命中物体后，会朝着光源方向再次发射一条射线。如果这个过程中命中任何其它物体，就说明当前的物体被挡着，需要有个阴影
+	 * RayShadowMiss：没有任何其它物体遮挡当前物体，不渲染阴影
 	 */
-	auto shaderCodeRayGen = FileUtility::readFile(DEFAULT_SHADER_DIR"ray_gen.glsl");
-	mRayGen = std::make_shared<ShaderModule>(Device::GetLogicalDevice(), EShLangRayGen, shaderCodeRayGen);
-
-	auto shaderCodeRayHit = FileUtility::readFile(DEFAULT_SHADER_DIR"ray_chit.glsl");
-	mRayHit = std::make_shared<ShaderModule>(Device::GetLogicalDevice(), EShLangClosestHit, shaderCodeRayHit);
-
-	auto shaderCodeMiss = FileUtility::readFile(DEFAULT_SHADER_DIR"ray_miss.glsl");
-	mRayMiss = std::make_shared<ShaderModule>(Device::GetLogicalDevice(), EShLangMiss, shaderCodeMiss);
-
-	auto shaderShadowHit = FileUtility::readFile(DEFAULT_SHADER_DIR"shadow_ray_chit.glsl");
-	mShadowRayHit = std::make_shared<ShaderModule>(Device::GetLogicalDevice(), EShLangClosestHit, shaderShadowHit);
-
-	auto shaderShadowMiss = FileUtility::readFile(DEFAULT_SHADER_DIR"shadow_ray_miss.glsl");
-	mShadowRayMiss = std::make_shared<ShaderModule>(Device::GetLogicalDevice(), EShLangMiss, shaderShadowMiss);
+	// 几个Shader互相独立，分到多个线程上同时编译（或者从缓存读），全部完成之后才会创建管线
+	const auto shaderModules = ShaderModule::CreateModules(Device::GetLogicalDevice(), GetShaderFiles());
 
 	mLayoutRaygen = std::make_unique<DescriptorSetLayout>(Device::GetLogicalDevice(), SWS_RAYGEN_SET);
 
-#pragma region ʼShaderõ
+#pragma region 初始化Shader会用到的描述集
 
-	// ٽṹ
+	// 加速结构
 	AddASBinding();
-	// 
+	// 相机
 	AddCameraBinding();
-	// ׷ٹߵĻ
+	// 光线追踪管线的画布
 	AddOffscreenImageBinding();
-	// Setǹ׷ٹõĺĵݣٽṹͻ
+	// 这个Set是光线追踪光线用到的核心的数据：加速结构、相机和画布
 	mLayoutRaygen->CreateDescriptorSet();
 
 	const VkDescriptorBindingFlags flag = VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
@@ -167,37 +166,36 @@ VKRTApp::VKRTApp(GLFWwindow* window, const uint32_t& width, const uint32_t& heig
 	bindingFlags.pBindingFlags = &flag;
 	bindingFlags.bindingCount = 1;
 
-	// SSBO: Shader Storage Buffer ObjectClosest Hit Shader棬ҪȾϢ
+	// SSBO: Shader Storage Buffer Object，用来传入Closest Hit Shader里面，需要用来渲染的信息
 	VkDescriptorSetLayoutBinding ssboBinding;
 	ssboBinding.binding = 0;
 	ssboBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	ssboBinding.descriptorCount = mMeshes.size();
+	// 每个模型一个几何体槽位，最后再加一个替身的槽位
+	ssboBinding.descriptorCount = mMeshStreamer->GetGeometrySlotCount();
 	ssboBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
 	ssboBinding.pImmutableSamplers = nullptr;
-	// ÿĲID
-	mLayoutMaterialIDs = std::make_unique<DescriptorSetLayout>(Device::GetLogicalDevice(), SWS_MATIDS_SET);
-	mLayoutMaterialIDs->AddBinding(ssboBinding);
-	mLayoutMaterialIDs->CreateDescriptorSet();
-	// ÿԣ磺UVߵ
+	// 每个顶点的属性，例如：UV、法线等
 	mLayoutVertices = std::make_unique<DescriptorSetLayout>(Device::GetLogicalDevice(), SWS_ATTRIBS_SET);
 	mLayoutVertices->AddBinding(ssboBinding);
 	mLayoutVertices->CreateDescriptorSet();
-	// FacesIndexBufferÿһ飨ΪΣһvec4vec3ԭΪڴ롣ʵvec4һûõ
+	// Faces是IndexBuffer，每三个一组（因为是三角形），组成了一个vec4。不用vec3的原因是为了内存对齐。实际上vec4最后一个分量是没有用到的
 	mLayoutFaces = std::make_unique<DescriptorSetLayout>(Device::GetLogicalDevice(), SWS_FACES_SET);
 	mLayoutFaces->AddBinding(ssboBinding);
 	mLayoutFaces->CreateDescriptorSet();
-	// 
+	// 传材质
 	VkDescriptorSetLayoutBinding textureBinding;
 	textureBinding.binding = 0;
 	textureBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	textureBinding.descriptorCount = mMeshes.size();
+	textureBinding.descriptorCount = mTextureArraySize;
 	textureBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
 	textureBinding.pImmutableSamplers = nullptr;
 
 	mLayoutTexs = std::make_unique<DescriptorSetLayout>(Device::GetLogicalDevice(), SWS_TEXTURES_SET);
-	mLayoutTexs->AddBinding(textureBinding);
+	// 贴图流式加载进来之后只改数组里对应的那一项，支持的话允许在绑定之后更新
+	mLayoutTexs->AddBinding(textureBinding,
+		Device::GetSampledImageUpdateAfterBindSupported() ? VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT : 0);
 	mLayoutTexs->CreateDescriptorSet();
-	// պ
+	// 天空盒
 	VkDescriptorSetLayoutBinding skyBoxBinding;
 	skyBoxBinding.binding = 0;
 	skyBoxBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -208,7 +206,7 @@ VKRTApp::VKRTApp(GLFWwindow* window, const uint32_t& width, const uint32_t& heig
 	mLayoutSkyBox = std::make_unique<DescriptorSetLayout>(Device::GetLogicalDevice(), SWS_ENVS_SET);
 	mLayoutSkyBox->AddBinding(skyBoxBinding);
 	mLayoutSkyBox->CreateDescriptorSet();
-	// ÿģ͵Դɫ
+	// 每个模型的自带的颜色。
 	VkDescriptorSetLayoutBinding colorBinding;
 	colorBinding.binding = 0;
 	colorBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
@@ -219,49 +217,66 @@ VKRTApp::VKRTApp(GLFWwindow* window, const uint32_t& width, const uint32_t& heig
 	mLayoutColor = std::make_unique<DescriptorSetLayout>(Device::GetLogicalDevice(), SWS_COLORS_SET);
 	mLayoutColor->AddBinding(colorBinding);
 	mLayoutColor->CreateDescriptorSet();
-	// ÿģ͵ԣ統ǰģǷ仹
+	// 每个模型的属性，例如当前模型是否反射还是折射
 	VkDescriptorSetLayoutBinding objAttriBinding;
 	objAttriBinding.binding = 0;
 	objAttriBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	objAttriBinding.descriptorCount = mMeshes.size();
+	objAttriBinding.descriptorCount = mMeshInstances.size();
 	objAttriBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
 	objAttriBinding.pImmutableSamplers = nullptr;
 
 	mLayoutObjAttris = std::make_unique<DescriptorSetLayout>(Device::GetLogicalDevice(), SWS_OBJ_ATTR_SET);
 	mLayoutObjAttris->AddBinding(objAttriBinding);
 	mLayoutObjAttris->CreateDescriptorSet();
-	// أ
+	// 虚拟贴图：物理页缓存、页表、每张贴图的信息和Shader写回的请求
+	mLayoutVirtualTextures = std::make_unique<DescriptorSetLayout>(Device::GetLogicalDevice(), SWS_VIRTUAL_TEXTURE_SET);
+	VkDescriptorSetLayoutBinding virtualTextureBinding = {};
+	virtualTextureBinding.descriptorCount = 1;
+	virtualTextureBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
+	virtualTextureBinding.binding = SWS_VT_PAGE_CACHE_BINDING;
+	virtualTextureBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	mLayoutVirtualTextures->AddBinding(virtualTextureBinding);
+	virtualTextureBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	for (const uint32_t binding : { SWS_VT_PAGE_TABLE_BINDING, SWS_VT_INFO_BINDING, SWS_VT_FEEDBACK_BINDING })
+	{
+		virtualTextureBinding.binding = binding;
+		mLayoutVirtualTextures->AddBinding(virtualTextureBinding);
+	}
+	mLayoutVirtualTextures->CreateDescriptorSet();
+	// 描述池，用来分配描述集合
 	std::vector<VkDescriptorPoolSize> poolSizes({
 		{ VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1 },       // top-level AS
 		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },                    // output image
 		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },                   // Camera data
 		//
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, static_cast<uint32_t>(mMeshes.size()) * 3 },       // per-face material IDs for each mesh
-		// vertex attribs for each mesh
-		// faces buffer for each mesh
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, mMeshStreamer->GetGeometrySlotCount() * 2 },       // vertex attribs for each geometry slot
+		// faces buffer for each geometry slot
 		//
-		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, static_cast<uint32_t>(mMeshes.size()) },// textures for each material
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, mTextureArraySize },// textures shared by the materials
 
 		//
 		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 },            // environment texture
 		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },            // object color
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },            // object attribute
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, static_cast<uint32_t>(mMeshInstances.size()) },            // object attribute for each instance
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 },            // virtual texture page cache
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 },            // virtual texture page table, infos and feedback
 		});
 
 	auto layouts = std::vector<DescriptorSetLayout*>{
 		mLayoutRaygen.get(),
-		mLayoutMaterialIDs.get(),
 		mLayoutVertices.get(),
 		mLayoutFaces.get(),
 		mLayoutTexs.get(),
 		mLayoutSkyBox.get(),
 		mLayoutColor.get(),
 		mLayoutObjAttris.get(),
+		mLayoutVirtualTextures.get(),
 	};
 	mDescriptorSet = std::make_unique<DescriptorSet>(Device::GetLogicalDevice());
-	// ĿǰDemoûκŻжMeshжٲʡûвʵ壬ҲһԴʴShader
+	// 有多少Mesh就有多少材质（颜色），贴图按文件去重之后由材质里的textureIndex引用
 	const auto numMeshes = static_cast<uint32_t>(mMeshes.size());
 	const auto numMaterials = static_cast<uint32_t>(mMeshes.size());
+	const auto numGeometrySlots = mMeshStreamer->GetGeometrySlotCount();
 
 	mDescriptorSet->InitPool(
 		layouts,
@@ -270,32 +285,30 @@ VKRTApp::VKRTApp(GLFWwindow* window, const uint32_t& width, const uint32_t& heig
 		numMaterials,
 		{
 			1,
-			numMeshes,      // per-face material IDs for each mesh
-			numMeshes,      // vertex attribs for each mesh
-			numMeshes,      // faces buffer for each mesh
-			numMaterials,   // textures for each material
+			numGeometrySlots,      // vertex attribs for each geometry slot
+			numGeometrySlots,      // faces buffer for each geometry slot
+			mTextureArraySize,   // textures shared by the materials
 			1,              // environment texture
 			numMaterials, // Colors for each material
-			numMaterials,
+			static_cast<uint32_t>(mMeshInstances.size()), // object attributes for each instance
+			1,              // virtual textures
 		});
 #pragma endregion
-	//׷ٹ
+	//创建光线追踪光线
 	CreatePipelineLayout();
 
-	CreateRayTracingPipeline();
+	CreateRayTracingPipeline(shaderModules);
 
 	const auto& swapchainExtent = mSwapchain->GetSwapchainExtent();
-	//Ϣ
+	//设置相机信息
 	mCamera.SetViewport({ 0, 0, static_cast<int>(mWidth), static_cast<int>(mHeight) });
-	mCamera.SetViewPlanes(0.2f, 5000.0f);
-	mCamera.SetFovY(60.f);
-	// mCamera.LookAt(vec3(0.25f, 3.20f, 6.15f), vec3(0.25f, 2.75f, 5.25f));
-	// mCamera.LookAt(vec3(0.25f, 7, 6.15f), vec3(0.0f, 0.0f, 0.0f));
+	mCamera.SetViewPlanes(mScene.GetCameraNear(), mScene.GetCameraFar());
+	mCamera.SetFovY(mScene.GetCameraFovY());
 
-	mCamera.SetPosition({ 1.6f, 1.58f, 3.5f });
-	mCamera.SetDirection({ -0.48, -0.1f, 0.87f });
+	mCamera.SetPosition(mScene.GetCameraPosition());
+	mCamera.SetDirection(mScene.GetCameraDirection());
 
-	mParams.sunPosAndAmbient = vec4(0.7f, 0.45f, 0.55f, 0.5f);
+	mParams.sunPosAndAmbient = mScene.GetSunPosAndAmbient();
 	mParams.camPos = vec4(mCamera.GetPosition(), 0.0f);
 	mParams.camDir = vec4(mCamera.GetDirection(), 0.0f);
 	mParams.camUp = vec4(mCamera.GetUp(), 0.0f);
@@ -307,22 +320,37 @@ VKRTApp::VKRTApp(GLFWwindow* window, const uint32_t& width, const uint32_t& heig
 		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 		VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
 	mCameraBuffer->UploadData(&mParams, sizeof(UniformParams));
-	// Shader
+	// 更新Shader里面的描述集合
 	UpdateDescriptorSets();
-	// ʼImGUI
+	// 初始化ImGUI
 	InitImGUI();
 	/*
-	 * ׷ٹ߲ҪFrameBufferΪиOffscreen Picture
-	 * ҲûRenderPass
-	 * ImGUIǹդߣҪImGUIһFrameBufferRenderPass
+	 * 光线追踪管线不需要FrameBuffer（因为有个Offscreen Picture）。
+	 * 也没有RenderPass……
+	 * 但是ImGUI是光栅化管线，所以需要给ImGUI创建一个FrameBuffer和RenderPass
 	 */
 	CreateFrameBuffers();
+
+	// 监视模型和贴图的目录，文件改动之后只重新导入改动的那个资源
+	mFileWatcher = std::make_unique<FileWatcher>(std::vector<std::string>{ DEFAULT_MODEL_DIR, DEFAULT_TEXTURE_DIR, DEFAULT_SHADER_DIR });
 }
 
 VKRTApp::~VKRTApp()
 {
-	// Դ
+	// 清理资源
 	vkDeviceWaitIdle(Device::GetLogicalDevice());
+	mFileWatcher.reset();
+	// 等后台的管线建完，没来得及换上的直接销毁
+	if (mPipelineBuild.valid())
+	{
+		auto pipeline = mPipelineBuild.get();
+		if (pipeline.pipeline != VK_NULL_HANDLE)
+		{
+			vkDestroyPipeline(Device::GetLogicalDevice(), pipeline.pipeline, VK_NULL_HANDLE);
+			pipeline.shaderBindingTable->Dispose();
+		}
+	}
+	mDeletionQueue.Flush();
 
 	mOffscreenImage->Dispose();
 	mSkyBoxImage->Dispose();
@@ -340,7 +368,13 @@ VKRTApp::~VKRTApp()
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
 
-	vkDestroyPipeline(Device::GetLogicalDevice(), mRTPipeline, VK_NULL_HANDLE);
+	vkDestroyPipeline(Device::GetLogicalDevice(), mRTPipeline.pipeline, VK_NULL_HANDLE);
+	for (auto& [key, variant] : mPipelineVariants)
+	{
+		vkDestroyPipeline(Device::GetLogicalDevice(), variant.pipeline, VK_NULL_HANDLE);
+		variant.shaderBindingTable->Dispose();
+	}
+	mPipelineVariants.clear();
 	vkDestroyPipelineLayout(Device::GetLogicalDevice(), mRTPipelineLayout, VK_NULL_HANDLE);
 
 	mCameraBuffer->Free();
@@ -350,36 +384,41 @@ VKRTApp::~VKRTApp()
 		attri.Free();
 	}
 
+	mMeshStreamer->Dispose();
+
 	for (auto& mesh : mMeshes)
 	{
 		mesh->Dispose();
 	}
-
-	for (auto& mat : mMatIDsBuffers)
-	{
-		mat->Free();
-	}
+	mVirtualTextures->Dispose();
+	mTextureCache->Dispose();
 
 	mTopLvlAccStruct->Dispose();
 
-	mShaderBindingTable->Dispose();
+	mRTPipeline.shaderBindingTable->Dispose();
 
 	mLayoutRaygen->Dispose();
-	mLayoutMaterialIDs->Dispose();
 	mLayoutVertices->Dispose();
 	mLayoutFaces->Dispose();
 	mLayoutTexs->Dispose();
 	mLayoutSkyBox->Dispose();
 	mLayoutColor->Dispose();
 	mLayoutObjAttris->Dispose();
+	mLayoutVirtualTextures->Dispose();
 
 	mDescriptorSet->Dispose();
 
-	mRayGen->Dispose();
-	mRayHit->Dispose();
-	mRayMiss->Dispose();
-	mShadowRayHit->Dispose();
-	mShadowRayMiss->Dispose();
+	// 管线都已经建好了，缓存里是这次运行编译过的全部内容
+	if (!mPipelineCache->Save())
+	{
+		std::cerr << "Failed to save the pipeline cache." << std::endl;
+	}
+	mPipelineCache->Dispose();
+
+	for (auto& shader : mRTPipeline.shaders)
+	{
+		shader->Dispose();
+	}
 
 	vkFreeCommandBuffers(Device::GetLogicalDevice(), mCommandPool, mCommandBuffers.size(), mCommandBuffers.data());
 	vkDestroyCommandPool(Device::GetLogicalDevice(), mCommandPool, nullptr);
@@ -406,20 +445,25 @@ void VKRTApp::InitDevice()
 
 VkResult VKRTApp::InitVma()
 {
-	// ҪһЩVulkanľ庯ָ봫ȥ﾿ʲôμVOLKһС
+	// 需要把一些Vulkan的具体函数指针传进去，如果不清楚这里究竟发生了什么，请参见：VOLK那一小节
 	VmaVulkanFunctions vulkanFunctions = {};
 	vulkanFunctions.vkGetInstanceProcAddr = vkGetInstanceProcAddr;
 	vulkanFunctions.vkGetDeviceProcAddr = vkGetDeviceProcAddr;
 	vulkanFunctions.vkDestroyBuffer = vkDestroyBuffer;
-	// ָǰVulkanİ汾豸Ϣ
+	// 指定当前Vulkan的版本与设备信息
 	VmaAllocatorCreateInfo allocatorCreateInfo = {};
 	allocatorCreateInfo.vulkanApiVersion = VK_API_VERSION_1_2;
 	allocatorCreateInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+	// 让vmaGetHeapBudgets读驱动给的预算，而不是只统计自己分配了多少
+	if (Device::GetMemoryBudgetSupported())
+	{
+		allocatorCreateInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+	}
 	allocatorCreateInfo.physicalDevice = Device::GetPhysicalDevice();
 	allocatorCreateInfo.device = Device::GetLogicalDevice();
 	allocatorCreateInfo.instance = Instance::GetDefaultVkInstance();
 	allocatorCreateInfo.pVulkanFunctions = &vulkanFunctions;
-	// Allocator
+	// 创建Allocator
 	return vmaCreateAllocator(&allocatorCreateInfo, &mVmaAllocator);
 }
 
@@ -440,8 +484,8 @@ VkResult VKRTApp::InitCommandPool()
 
 VkResult VKRTApp::InitializeOffscreenImage()
 {
-	// һ뵱ǰͼС൱ͼƬ
-	const VkExtent3D extent = { mWidth, mHeight, 1 };
+	// 创建一个与光线追踪分辨率相当的图片，平时和绘图区域一样大
+	const VkExtent3D extent = { mRenderWidth, mRenderHeight, 1 };
 	mOffscreenImage = std::make_unique<Image>(mVmaAllocator, Device::GetLogicalDevice());
 	VkResult error = mOffscreenImage->Create(VK_IMAGE_TYPE_2D,
 		extent,
@@ -461,17 +505,17 @@ VkResult VKRTApp::InitializeOffscreenImage()
 
 VkResult VKRTApp::InitializeCommandBuffers()
 {
-	// עCommandBufferVector
-	// һʼҪݽͼƬԤȸÿCommandBufferÿռ
+	// 注意这里是CommandBuffer的Vector数组
+	// 一开始要依据交换链图片的数量预先给每个CommandBuffer分配好空间
 	mCommandBuffers.resize(mSwapchain->GetImageCount());
 
 	VkCommandBufferAllocateInfo commandBufferAllocateInfo;
 	commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	commandBufferAllocateInfo.pNext = nullptr;
-	// Command BufferҪCommandPool
+	// Command Buffer需要从CommandPool里面分配
 	commandBufferAllocateInfo.commandPool = mCommandPool;
 	commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	// ָҪ
+	// 指定需要创建的数量
 	commandBufferAllocateInfo.commandBufferCount = static_cast<uint32_t>(mCommandBuffers.size());
 
 	return vkAllocateCommandBuffers(Device::GetLogicalDevice(), &commandBufferAllocateInfo, mCommandBuffers.data());
@@ -495,7 +539,7 @@ VkResult VKRTApp::InitializeSynchronization()
 
 void VKRTApp::AddASBinding()
 {
-	// ٽṹİ
+	// 加速结构的绑定
 	VkDescriptorSetLayoutBinding accelerationStructureBinding = {};
 	accelerationStructureBinding.binding = SWS_SCENE_AS_BINDING;
 	accelerationStructureBinding.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
@@ -508,7 +552,7 @@ void VKRTApp::AddASBinding()
 
 void VKRTApp::AddOffscreenImageBinding()
 {
-	// İ
+	// 画布的绑定
 	VkDescriptorSetLayoutBinding offscreenImageBinding = {};
 	offscreenImageBinding.binding = SWS_RESULT_IMAGE_BINDING;
 	offscreenImageBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
@@ -533,17 +577,17 @@ void VKRTApp::AddCameraBinding()
 
 void VKRTApp::CreatePipelineLayout()
 {
-	// ߲
+	// 创建管线布局
 	const auto setLayouts = std::vector<VkDescriptorSetLayout>
 	{
 		mLayoutRaygen->GetSetLayout(),
-		mLayoutMaterialIDs->GetSetLayout(),
 		mLayoutVertices->GetSetLayout(),
 		mLayoutFaces->GetSetLayout(),
 		mLayoutTexs->GetSetLayout(),
 		mLayoutSkyBox->GetSetLayout(),
 		mLayoutColor->GetSetLayout(),
 		mLayoutObjAttris->GetSetLayout(),
+		mLayoutVirtualTextures->GetSetLayout(),
 	};
 
 	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
@@ -556,138 +600,237 @@ void VKRTApp::CreatePipelineLayout()
 	assert(error == VK_SUCCESS);
 }
 
-void VKRTApp::CreateRayTracingPipeline()
+void VKRTApp::CreateRayTracingPipeline(const std::vector<std::shared_ptr<ShaderModule>>& shaders)
 {
-	// ׷ٹ
+	auto pipeline = BuildRayTracingPipeline(shaders, mRequestedFeatures);
+	if (!pipeline.errors.empty())
+	{
+		std::cerr << pipeline.errors;
+		throw std::runtime_error("Failed to create the ray tracing pipeline, see the shader errors above.");
+	}
+	SetRayTracingPipeline(std::move(pipeline));
+}
+
+VKRTApp::RayTracingPipeline VKRTApp::BuildRayTracingPipeline(const std::vector<std::shared_ptr<ShaderModule>>& shaders, const PipelineFeatures& features)
+{
+	RayTracingPipeline result;
+	result.shaders = shaders;
+	result.features = features;
+	for (size_t i = 0; i < shaders.size(); i++)
+	{
+		if (!shaders[i]->IsValid())
+		{
+			result.errors += GetShaderFiles()[i].first + ":\n" + shaders[i]->GetErrorLog();
+		}
+	}
+	if (!result.errors.empty())
+	{
+		return result;
+	}
+
+	// 创建光线追踪管线，Shader的顺序和GetShaderFiles一致
 	const auto& rtProps = Device::GetRTProps();
-	mShaderBindingTable = std::make_unique<ShaderBindingTable>(mVmaAllocator);
-	mShaderBindingTable->Initialize(2, 2,
+	auto shaderBindingTable = std::make_unique<ShaderBindingTable>(mVmaAllocator);
+	shaderBindingTable->Initialize(2, 2,
 		rtProps.shaderGroupHandleSize,
 		rtProps.shaderGroupBaseAlignment);
 
-	mShaderBindingTable->SetRaygenStage(mRayGen->GetShaderStage(VK_SHADER_STAGE_RAYGEN_BIT_KHR));
+	// 功能开关作为特化常量传给所有Stage
+	const PipelineSpecialization specialization(features);
+	const auto* specializationInfo = specialization.GetInfo();
+	shaderBindingTable->SetRaygenStage(shaders[0]->GetShaderStage(VK_SHADER_STAGE_RAYGEN_BIT_KHR, specializationInfo));
 
-	mShaderBindingTable->AddStageToHitGroup({ mRayHit->GetShaderStage(VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR) }, SWS_PRIMARY_HIT_SHADERS_IDX);
-	mShaderBindingTable->AddStageToHitGroup({ mShadowRayHit->GetShaderStage(VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR) }, SWS_SHADOW_HIT_SHADERS_IDX);
+	shaderBindingTable->AddStageToHitGroup({ shaders[1]->GetShaderStage(VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, specializationInfo) }, SWS_PRIMARY_HIT_SHADERS_IDX);
+	shaderBindingTable->AddStageToHitGroup({ shaders[3]->GetShaderStage(VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, specializationInfo) }, SWS_SHADOW_HIT_SHADERS_IDX);
 
-	mShaderBindingTable->AddStageToMissGroup({ mRayMiss->GetShaderStage(VK_SHADER_STAGE_MISS_BIT_KHR) }, SWS_PRIMARY_MISS_SHADERS_IDX);
-	mShaderBindingTable->AddStageToMissGroup({ mShadowRayMiss->GetShaderStage(VK_SHADER_STAGE_MISS_BIT_KHR) }, SWS_SHADOW_MISS_SHADERS_IDX);
+	shaderBindingTable->AddStageToMissGroup({ shaders[2]->GetShaderStage(VK_SHADER_STAGE_MISS_BIT_KHR, specializationInfo) }, SWS_PRIMARY_MISS_SHADERS_IDX);
+	shaderBindingTable->AddStageToMissGroup({ shaders[4]->GetShaderStage(VK_SHADER_STAGE_MISS_BIT_KHR, specializationInfo) }, SWS_SHADOW_MISS_SHADERS_IDX);
 
 	VkRayTracingPipelineCreateInfoKHR rayPipelineInfo = {};
 	rayPipelineInfo.sType = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR;
-	rayPipelineInfo.stageCount = mShaderBindingTable->GetNumStages();
-	rayPipelineInfo.pStages = mShaderBindingTable->GetStages();
-	rayPipelineInfo.groupCount = mShaderBindingTable->GetNumGroups();
-	rayPipelineInfo.pGroups = mShaderBindingTable->GetGroups();
+	rayPipelineInfo.stageCount = shaderBindingTable->GetNumStages();
+	rayPipelineInfo.pStages = shaderBindingTable->GetStages();
+	rayPipelineInfo.groupCount = shaderBindingTable->GetNumGroups();
+	rayPipelineInfo.pGroups = shaderBindingTable->GetGroups();
 	rayPipelineInfo.maxPipelineRayRecursionDepth = SWS_MAX_RECURSION;
 	rayPipelineInfo.layout = mRTPipelineLayout;
 
+	// 让驱动报告整条管线和每个Stage的编译耗时，以及有没有命中管线缓存
+	VkPipelineCreationFeedbackEXT pipelineFeedback = {};
+	std::vector<VkPipelineCreationFeedbackEXT> stageFeedbacks(rayPipelineInfo.stageCount);
+	VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo = {};
+	feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+	feedbackInfo.pPipelineCreationFeedback = &pipelineFeedback;
+	feedbackInfo.pipelineStageCreationFeedbackCount = rayPipelineInfo.stageCount;
+	feedbackInfo.pPipelineStageCreationFeedbacks = stageFeedbacks.data();
+	if (Device::GetPipelineCreationFeedbackSupported())
+	{
+		rayPipelineInfo.pNext = &feedbackInfo;
+	}
+
+	// 管线缓存本身是线程安全的，热重载的时候这里在后台线程上执行
+	const auto startTime = std::chrono::steady_clock::now();
 	const auto error = vkCreateRayTracingPipelinesKHR(
 		Device::GetLogicalDevice(),
 		VK_NULL_HANDLE,
-		VK_NULL_HANDLE,
+		mPipelineCache->GetVkPipelineCache(),
 		1,
 		&rayPipelineInfo,
 		VK_NULL_HANDLE,
-		&mRTPipeline);
-	assert(error == VK_SUCCESS);
+		&result.pipeline);
+	if (error != VK_SUCCESS)
+	{
+		result.pipeline = VK_NULL_HANDLE;
+		result.errors = "Failed to create the ray tracing pipeline (VkResult " + std::to_string(error) + ").\n";
+		return result;
+	}
+
+	result.creationMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+	if (Device::GetPipelineCreationFeedbackSupported() && (pipelineFeedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT))
+	{
+		result.creationMs = static_cast<double>(pipelineFeedback.duration) / 1e6;
+		result.cacheHitStages = 0;
+		for (const auto& stageFeedback : stageFeedbacks)
+		{
+			if (stageFeedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT)
+			{
+				result.cacheHitStages++;
+			}
+		}
+		// 整条管线命中的话驱动可能不再填每个Stage的信息
+		if (pipelineFeedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT)
+		{
+			result.cacheHitStages = static_cast<int>(rayPipelineInfo.stageCount);
+		}
+	}
+	std::cout << "Ray tracing pipeline created in " << result.creationMs << " ms";
+	if (result.cacheHitStages >= 0)
+	{
+		std::cout << ", " << result.cacheHitStages << " / " << rayPipelineInfo.stageCount << " stages from the pipeline cache";
+	}
+	std::cout << std::endl;
 
-	mShaderBindingTable->CreateSBT(Device::GetLogicalDevice(), mRTPipeline);
+	shaderBindingTable->CreateSBT(Device::GetLogicalDevice(), result.pipeline);
+	result.shaderBindingTable = std::move(shaderBindingTable);
+	return result;
 }
 
-void VKRTApp::UpdateDescriptorSets()
+void VKRTApp::SetRayTracingPipeline(RayTracingPipeline&& pipeline)
 {
-	// Shaderʵʴ
-	const uint32_t numMeshes = mMeshes.size();
-	const uint32_t numMaterials = mMeshes.size();
-	auto& mRTDescriptorSets = mDescriptorSet->GetDescriptorSets();
-
-	VkWriteDescriptorSetAccelerationStructureKHR descriptorAccelerationStructureInfo;
-	descriptorAccelerationStructureInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
-	descriptorAccelerationStructureInfo.pNext = nullptr;
-	descriptorAccelerationStructureInfo.accelerationStructureCount = 1;
-	descriptorAccelerationStructureInfo.pAccelerationStructures = &mTopLvlAccStruct->GetAccelerationStructure().accelerationStructure;
-
-	VkWriteDescriptorSet accelerationStructureWrite;
-	accelerationStructureWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	accelerationStructureWrite.pNext = &descriptorAccelerationStructureInfo; // Notice that pNext is assigned here!
-	accelerationStructureWrite.dstSet = mRTDescriptorSets[SWS_SCENE_AS_SET];
-	accelerationStructureWrite.dstBinding = SWS_SCENE_AS_BINDING;
-	accelerationStructureWrite.dstArrayElement = 0;
-	accelerationStructureWrite.descriptorCount = 1;
-	accelerationStructureWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
-	accelerationStructureWrite.pImageInfo = nullptr;
-	accelerationStructureWrite.pBufferInfo = nullptr;
-	accelerationStructureWrite.pTexelBufferView = nullptr;
-
-	/////////////////////////////////////////////////////////////
-
-	VkDescriptorImageInfo descriptorOutputImageInfo;
-	descriptorOutputImageInfo.sampler = VK_NULL_HANDLE;
-	descriptorOutputImageInfo.imageView = mOffscreenImage->GetImageView();
-	descriptorOutputImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-
-	VkWriteDescriptorSet resultImageWrite;
-	resultImageWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	resultImageWrite.pNext = nullptr;
-	resultImageWrite.dstSet = mRTDescriptorSets[SWS_RESULT_IMAGE_SET];
-	resultImageWrite.dstBinding = SWS_RESULT_IMAGE_BINDING;
-	resultImageWrite.dstArrayElement = 0;
-	resultImageWrite.descriptorCount = 1;
-	resultImageWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-	resultImageWrite.pImageInfo = &descriptorOutputImageInfo;
-	resultImageWrite.pBufferInfo = nullptr;
-	resultImageWrite.pTexelBufferView = nullptr;
+	mRTPipeline = std::move(pipeline);
+}
 
-	VkDescriptorBufferInfo camdataBufferInfo;
-	camdataBufferInfo.buffer = mCameraBuffer->GetVkBuffer();
-	camdataBufferInfo.offset = 0;
-	camdataBufferInfo.range = mCameraBuffer->GetSize();
+VKRTApp::RayTracingPipeline VKRTApp::TakeRayTracingPipeline()
+{
+	RayTracingPipeline pipeline = std::move(mRTPipeline);
+	mRTPipeline = RayTracingPipeline();
+	return pipeline;
+}
 
-	VkWriteDescriptorSet camdataBufferWrite;
-	camdataBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	camdataBufferWrite.pNext = nullptr;
-	camdataBufferWrite.dstSet = mRTDescriptorSets[SWS_CAMDATA_SET];
-	camdataBufferWrite.dstBinding = SWS_CAMDATA_BINDING;
-	camdataBufferWrite.dstArrayElement = 0;
-	camdataBufferWrite.descriptorCount = 1;
-	camdataBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	camdataBufferWrite.pImageInfo = nullptr;
-	camdataBufferWrite.pBufferInfo = &camdataBufferInfo;
-	camdataBufferWrite.pTexelBufferView = nullptr;
+void VKRTApp::DestroyRayTracingPipeline(RayTracingPipeline&& pipeline)
+{
+	// Shader可能还被其它变体用着，跟着shared_ptr释放
+	mDeletionQueue.Push([oldPipeline = pipeline.pipeline,
+		oldShaderBindingTable = std::shared_ptr<ShaderBindingTable>(std::move(pipeline.shaderBindingTable)),
+		oldShaders = std::move(pipeline.shaders)]()
+	{
+		vkDestroyPipeline(Device::GetLogicalDevice(), oldPipeline, VK_NULL_HANDLE);
+		oldShaderBindingTable->Dispose();
+	});
+}
 
-	/////////////////////////////////////////////////////////////
+void VKRTApp::UpdateRayTracingPipeline(const bool& shadersChanged)
+{
+	// 后台建好了就在帧与帧之间（GPU空闲）换上；编译失败的话继续用原来的管线，把错误显示出来
+	if (mPipelineBuild.valid() && mPipelineBuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		auto pipeline = mPipelineBuild.get();
+		if (!pipeline.errors.empty())
+		{
+			mShaderErrors = pipeline.errors;
+			std::cerr << mShaderErrors;
+			// 变体建不出来的话退回正在用的开关，不然每一帧都会再建一次
+			mRequestedFeatures = mRTPipeline.features;
+		}
+		else if (pipeline.shaderGeneration != mRTPipeline.shaderGeneration)
+		{
+			// Shader重新编译过，之前建的变体全都过时了
+			for (auto& [key, variant] : mPipelineVariants)
+			{
+				DestroyRayTracingPipeline(std::move(variant));
+			}
+			mPipelineVariants.clear();
+			DestroyRayTracingPipeline(TakeRayTracingPipeline());
+			SetRayTracingPipeline(std::move(pipeline));
+			mShaderErrors.clear();
+			std::cout << "Reloaded shaders" << std::endl;
+		}
+		else
+		{
+			auto current = TakeRayTracingPipeline();
+			mPipelineVariants.emplace(current.features.GetKey(), std::move(current));
+			SetRayTracingPipeline(std::move(pipeline));
+		}
+	}
 
-	std::vector<VkDescriptorBufferInfo> matIDsBufferInfo(numMeshes);
-	for (size_t i = 0; i < numMeshes; i++)
+	// 正在建的时候又改了的话，等这一次完成再建
+	mShaderReloadPending = mShaderReloadPending || shadersChanged;
+	if (mPipelineBuild.valid())
 	{
-		auto& curInfo = matIDsBufferInfo[i];
-		curInfo.offset = 0;
-		curInfo.buffer = mMatIDsBuffers[i]->GetVkBuffer();
-		curInfo.range = mMatIDsBuffers[i]->GetSize();
+		return;
 	}
 
-	VkWriteDescriptorSet matIDsBufferWrite;
-	matIDsBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	matIDsBufferWrite.pNext = nullptr;
-	matIDsBufferWrite.dstSet = mRTDescriptorSets[SWS_MATIDS_SET];
-	matIDsBufferWrite.dstBinding = 0;
-	matIDsBufferWrite.dstArrayElement = 0;
-	matIDsBufferWrite.descriptorCount = numMeshes;
-	matIDsBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	matIDsBufferWrite.pImageInfo = nullptr;
-	matIDsBufferWrite.pBufferInfo = matIDsBufferInfo.data();
-	matIDsBufferWrite.pTexelBufferView = nullptr;
+	const auto features = mRequestedFeatures;
+	if (mShaderReloadPending)
+	{
+		mShaderReloadPending = false;
+		// 所有Stage都重新走一遍ShaderCache，没改过的直接命中缓存，只有改过的才会真正编译
+		mPipelineBuild = std::async(std::launch::async, [this, features, generation = mRTPipeline.shaderGeneration + 1]()
+		{
+			auto pipeline = BuildRayTracingPipeline(ShaderModule::CreateModules(Device::GetLogicalDevice(), GetShaderFiles()), features);
+			pipeline.shaderGeneration = generation;
+			return pipeline;
+		});
+	}
+	else if (features != mRTPipeline.features)
+	{
+		const auto variant = mPipelineVariants.find(features.GetKey());
+		if (variant != mPipelineVariants.end())
+		{
+			// 之前建过的变体直接换上
+			auto pipeline = std::move(variant->second);
+			mPipelineVariants.erase(variant);
+			auto current = TakeRayTracingPipeline();
+			mPipelineVariants.emplace(current.features.GetKey(), std::move(current));
+			SetRayTracingPipeline(std::move(pipeline));
+		}
+		else
+		{
+			// 同一份SPIR-V，只是特化常量不同，只有驱动需要编译
+			mPipelineBuild = std::async(std::launch::async,
+				[this, features, generation = mRTPipeline.shaderGeneration, shaders = mRTPipeline.shaders]()
+			{
+				auto pipeline = BuildRayTracingPipeline(shaders, features);
+				pipeline.shaderGeneration = generation;
+				return pipeline;
+			});
+		}
+	}
+}
 
-	/////////////////////////////////////////////////////////////
+void VKRTApp::UpdateGeometryDescriptorSets()
+{
+	// 顶点属性和面的描述符按几何体槽位来写，没有常驻的模型指向替身的Buffer
+	const uint32_t numGeometrySlots = mMeshStreamer->GetGeometrySlotCount();
+	auto& mRTDescriptorSets = mDescriptorSet->GetDescriptorSets();
 
-	std::vector<VkDescriptorBufferInfo> vertAttriBufferInfo(numMeshes);
-	for (size_t i = 0; i < numMeshes; i++)
+	std::vector<VkDescriptorBufferInfo> vertAttriBufferInfo(numGeometrySlots);
+	for (uint32_t i = 0; i < numGeometrySlots; i++)
 	{
 		auto& curInfo = vertAttriBufferInfo[i];
 		curInfo.offset = 0;
-		curInfo.buffer = mMeshes[i]->GetVertAttriBuffer().GetVkBuffer();
-		curInfo.range = mMeshes[i]->GetVertAttriBuffer().GetSize();
+		curInfo.buffer = mMeshStreamer->GetSlotMesh(i).GetVertAttriBuffer().GetVkBuffer();
+		curInfo.range = mMeshStreamer->GetSlotMesh(i).GetVertAttriBuffer().GetSize();
 	}
 
 	VkWriteDescriptorSet attribsBufferWrite;
@@ -696,21 +839,21 @@ void VKRTApp::UpdateDescriptorSets()
 	attribsBufferWrite.dstSet = mRTDescriptorSets[SWS_ATTRIBS_SET];
 	attribsBufferWrite.dstBinding = 0;
 	attribsBufferWrite.dstArrayElement = 0;
-	attribsBufferWrite.descriptorCount = numMeshes;
+	attribsBufferWrite.descriptorCount = numGeometrySlots;
 	attribsBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 	attribsBufferWrite.pImageInfo = nullptr;
 	attribsBufferWrite.pBufferInfo = vertAttriBufferInfo.data();
 	attribsBufferWrite.pTexelBufferView = nullptr;
 
 	/////////////////////////////////////////////////////////////
-	std::vector<VkDescriptorBufferInfo> facesBufferInfos(numMeshes);
-	for (size_t i = 0; i < numMeshes; i++)
+	std::vector<VkDescriptorBufferInfo> facesBufferInfos(numGeometrySlots);
+	for (uint32_t i = 0; i < numGeometrySlots; i++)
 	{
 		facesBufferInfos[i] =
 		{
-			mMeshes[i]->GetFacesBuffer().GetVkBuffer(),
+			mMeshStreamer->GetSlotMesh(i).GetFacesBuffer(mMeshStreamer->GetSlotLod(i)).GetVkBuffer(),
 			0,
-			mMeshes[i]->GetFacesBuffer().GetSize(),
+			mMeshStreamer->GetSlotMesh(i).GetFacesBuffer(mMeshStreamer->GetSlotLod(i)).GetSize(),
 		};
 	}
 
@@ -720,24 +863,218 @@ void VKRTApp::UpdateDescriptorSets()
 	facesBufferWrite.dstSet = mRTDescriptorSets[SWS_FACES_SET];
 	facesBufferWrite.dstBinding = 0;
 	facesBufferWrite.dstArrayElement = 0;
-	facesBufferWrite.descriptorCount = numMeshes;
+	facesBufferWrite.descriptorCount = numGeometrySlots;
 	facesBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 	facesBufferWrite.pImageInfo = nullptr;
 	facesBufferWrite.pBufferInfo = facesBufferInfos.data();
 	facesBufferWrite.pTexelBufferView = nullptr;
 
-	/////////////////////////////////////////////////////////////
+	const std::vector<VkWriteDescriptorSet> descriptorWrites({
+		attribsBufferWrite,
+		facesBufferWrite,
+		});
+
+	vkUpdateDescriptorSets(Device::GetLogicalDevice(),
+		static_cast<uint32_t>(descriptorWrites.size()),
+		descriptorWrites.data(),
+		0,
+		VK_NULL_HANDLE);
+}
 
-	std::vector<VkDescriptorImageInfo> textureInfos(numMaterials);
+const std::vector<std::pair<std::string, EShLanguage>>& VKRTApp::GetShaderFiles()
+{
+	static const std::vector<std::pair<std::string, EShLanguage>> shaderFiles =
+	{
+		{ DEFAULT_SHADER_DIR"ray_gen.glsl", EShLangRayGen },
+		{ DEFAULT_SHADER_DIR"ray_chit.glsl", EShLangClosestHit },
+		{ DEFAULT_SHADER_DIR"ray_miss.glsl", EShLangMiss },
+		{ DEFAULT_SHADER_DIR"shadow_ray_chit.glsl", EShLangClosestHit },
+		{ DEFAULT_SHADER_DIR"shadow_ray_miss.glsl", EShLangMiss },
+	};
+	return shaderFiles;
+}
 
-	for (int i = 0; i < numMaterials; i++)
+std::unique_ptr<Image> VKRTApp::CreateSkyBoxImage()
+{
+	// 加载时转换成立方体贴图，Miss Shader直接用光线方向采样
+	auto skyBoxImage = EnvironmentMap::LoadCubemap(mScene.GetEnvironmentMap().c_str(),
+		mVmaAllocator,
+		Device::GetLogicalDevice(),
+		mCommandPool,
+		Device::GetGraphicsQueue());
+	// 和材质贴图的采样状态一样，共用同一个Sampler（立方体贴图忽略寻址模式）
+	skyBoxImage->SetSampler(mTextureCache->GetSamplerCache().Get({}));
+	return skyBoxImage;
+}
+
+void VKRTApp::ProcessAssetChanges()
+{
+	bool materialsChanged = false;
+	bool shadersChanged = false;
+	const std::string shaderDirectory = FileWatcher::NormalizePath(DEFAULT_SHADER_DIR);
+	for (const auto& path : mFileWatcher->PollChanges())
+	{
+		// Shader和它们包含的头文件；同一个目录下的SPIR-V缓存和管线缓存不算
+		if (path.rfind(shaderDirectory, 0) == 0)
+		{
+			const auto extension = std::filesystem::path(path).extension();
+			shadersChanged = shadersChanged || extension == ".glsl" || extension == ".h";
+			continue;
+		}
+
+		// 模型：只重新导入这一个资源，换掉它的Mesh，底层加速结构交给MeshStreamer重建
+		const int asset = mScene.FindAsset(path);
+		if (asset >= 0)
+		{
+			std::vector<std::shared_ptr<Mesh>> newMeshes;
+			uint32_t firstMesh = 0;
+			std::vector<size_t> updatedInstances;
+			if (mScene.ReloadAsset(Device::GetLogicalDevice(), mCommandPool, Device::GetGraphicsQueue(), mVmaAllocator, *mTextureCache, mModelCache.get(), STREAMED,
+				static_cast<uint32_t>(asset), newMeshes, firstMesh, mMeshInstances, mObjAttris, updatedInstances))
+			{
+				for (size_t i = 0; i < newMeshes.size(); i++)
+				{
+					auto& mesh = mMeshes[firstMesh + i];
+					mMeshStreamer->ReplaceMesh(firstMesh + i, newMeshes[i]);
+					// 旧的Mesh在上一帧的命令里可能还被用着，等GPU用完再释放
+					mDeletionQueue.Push([oldMesh = mesh]() { oldMesh->Dispose(); });
+					mesh = newMeshes[i];
+				}
+				// 节点的变换改了的话TLAS在下一次MeshStreamer::Update之后Refit，属性的Buffer这时候GPU没有在用，可以直接写
+				for (const auto& index : updatedInstances)
+				{
+					mMeshStreamer->UpdateInstance(index, mMeshInstances[index]);
+					mObjectAttrisBuffer[index].UploadData(&mObjAttris[index]);
+				}
+				materialsChanged = true;
+				std::cout << "Reloaded " << path << std::endl;
+			}
+			continue;
+		}
+
+		// 贴图：所有材质共用一份，重新读取一次就行
+		if (mTextureCache->Reload(path, mDeletionQueue))
+		{
+			materialsChanged = true;
+		}
+		if (FileWatcher::NormalizePath(mScene.GetEnvironmentMap()) == path)
+		{
+			mDeletionQueue.Push([oldSkyBox = std::shared_ptr<Image>(std::move(mSkyBoxImage))]() { oldSkyBox->Dispose(); });
+			mSkyBoxImage = CreateSkyBoxImage();
+			materialsChanged = true;
+		}
+	}
+
+	if (materialsChanged)
+	{
+		UpdateMaterialDescriptorSets();
+	}
+	UpdateRayTracingPipeline(shadersChanged);
+}
+
+void VKRTApp::UpdateMemoryBudget()
+{
+	// 各类资源自己统计的显存，只用来显示和分预算；要不要降级看的是整个堆的用量
+	const VkDeviceSize blasBytes = mMeshStreamer->GetResidentBLASBytes();
+	const auto& tlasBuffer = mTopLvlAccStruct->GetAccelerationStructure().buffer;
+	mMemoryBudget->SetUsage(MEMORY_GEOMETRY, mMeshStreamer->GetResidentBytes() - blasBytes);
+	mMemoryBudget->SetUsage(MEMORY_ACCELERATION_STRUCTURES, blasBytes + (tlasBuffer ? tlasBuffer->GetSize() : 0));
+	mMemoryBudget->SetUsage(MEMORY_TEXTURES, mTextureCache->GetMemoryBytes() + mSkyBoxImage->GetMemorySize()
+		+ mVirtualTextures->GetPageCache().GetMemorySize());
+	mMemoryBudget->SetUsage(MEMORY_RENDER_TARGETS, mOffscreenImage->GetMemorySize() + mDepthImage->GetMemorySize());
+
+	// 降级的顺序：先去掉贴图最大的一级Mip，再缩小模型流式加载的预算，最后降低光线追踪的分辨率；恢复的时候倒过来
+	const auto step = mMemoryBudget->Update();
+	switch (step.response)
+	{
+	case DROP_TEXTURE_MIPS:
+		if (step.undo ? mTextureCache->RestoreTopMips(mDeletionQueue) : mTextureCache->DropTopMips(mDeletionQueue))
+		{
+			UpdateMaterialDescriptorSets();
+		}
+		break;
+	case SHRINK_RENDER_RESOLUTION:
+		SetRenderScale(step.undo ? 1.0f : RENDER_SCALE_UNDER_PRESSURE);
+		break;
+	default:
+		break;
+	}
+
+	// 模型和底层加速结构的预算跟着显存预算走；减半之后最不重要的Mesh在MeshStreamer下一次Update的时候卸载
+	VkDeviceSize streamingBudget = std::min(MeshStreamer::DEFAULT_BUDGET_BYTES,
+		mMemoryBudget->GetBudget(MEMORY_GEOMETRY) + mMemoryBudget->GetBudget(MEMORY_ACCELERATION_STRUCTURES));
+	if (mMemoryBudget->GetLevel() >= SHRINK_GEOMETRY_BUDGET)
+	{
+		streamingBudget /= 2;
+	}
+	mMeshStreamer->SetBudgetBytes(streamingBudget);
+}
+
+void VKRTApp::SetRenderScale(const float& scale)
+{
+	const uint32_t width = std::max(static_cast<uint32_t>(static_cast<float>(mWidth) * scale), 1u);
+	const uint32_t height = std::max(static_cast<uint32_t>(static_cast<float>(mHeight) * scale), 1u);
+	if (width == mRenderWidth && height == mRenderHeight)
 	{
-		auto& diffuseImage = mMeshes[i]->GetDiffuseTex();
+		return;
+	}
+
+	// 光线的方向是按gl_LaunchSizeEXT算的，换了分辨率Shader不用改，只要换输出图片和它的描述符
+	mDeletionQueue.Push([oldImage = std::shared_ptr<Image>(std::move(mOffscreenImage))]() { oldImage->Dispose(); });
+	mRenderWidth = width;
+	mRenderHeight = height;
+	CHECK_VK_ERROR(InitializeOffscreenImage(), "Failed to init offscreen image.");
+	UpdateDescriptorSets();
+}
+
+void VKRTApp::UpdateTextureDescriptors(const std::vector<uint32_t>& textureIndices)
+{
+	auto& mRTDescriptorSets = mDescriptorSet->GetDescriptorSets();
+
+	std::vector<VkDescriptorImageInfo> textureInfos;
+	textureInfos.reserve(textureIndices.size());
+	std::vector<VkWriteDescriptorSet> descriptorWrites;
+	descriptorWrites.reserve(textureIndices.size());
+	for (const auto& index : textureIndices)
+	{
+		const auto image = mTextureCache->GetTexture(index);
+		textureInfos.push_back({ image->GetSampler(), image->GetImageView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
+
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = mRTDescriptorSets[SWS_TEXTURES_SET];
+		write.dstBinding = 0;
+		write.dstArrayElement = index;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.pImageInfo = &textureInfos.back();
+		descriptorWrites.push_back(write);
+	}
+
+	vkUpdateDescriptorSets(Device::GetLogicalDevice(),
+		static_cast<uint32_t>(descriptorWrites.size()),
+		descriptorWrites.data(),
+		0,
+		VK_NULL_HANDLE);
+}
+
+void VKRTApp::UpdateMaterialDescriptorSets()
+{
+	// 贴图、天空盒和颜色，热重载换掉了这些资源之后也要重写
+	const uint32_t numMaterials = mMeshes.size();
+	auto& mRTDescriptorSets = mDescriptorSet->GetDescriptorSets();
+
+	// 整个数组都要写上有效的描述符，还没用到的位置先指向错误贴图
+	std::vector<VkDescriptorImageInfo> textureInfos(mTextureArraySize);
+
+	for (uint32_t i = 0; i < mTextureArraySize; i++)
+	{
+		const auto diffuseImage = mTextureCache->GetTexture(i < mTextureCache->GetTextureCount() ? i : TextureCache::ERROR_TEXTURE_INDEX);
 
 		textureInfos[i] =
 		{
-			diffuseImage.GetSampler(),
-			diffuseImage.GetImageView(),
+			diffuseImage->GetSampler(),
+			diffuseImage->GetImageView(),
 			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
 		};
 	}
@@ -748,7 +1085,7 @@ void VKRTApp::UpdateDescriptorSets()
 	texturesBufferWrite.dstSet = mRTDescriptorSets[SWS_TEXTURES_SET];
 	texturesBufferWrite.dstBinding = 0;
 	texturesBufferWrite.dstArrayElement = 0;
-	texturesBufferWrite.descriptorCount = numMaterials;
+	texturesBufferWrite.descriptorCount = mTextureArraySize;
 	texturesBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	texturesBufferWrite.pImageInfo = textureInfos.data();
 	texturesBufferWrite.pBufferInfo = nullptr;
@@ -803,6 +1140,80 @@ void VKRTApp::UpdateDescriptorSets()
 	colorsBufferWrite.pBufferInfo = colorInfos.data();
 	colorsBufferWrite.pTexelBufferView = nullptr;
 
+	const std::vector<VkWriteDescriptorSet> descriptorWrites({
+		texturesBufferWrite,
+		envTexturesWrite,
+		colorsBufferWrite,
+		});
+
+	vkUpdateDescriptorSets(Device::GetLogicalDevice(),
+		static_cast<uint32_t>(descriptorWrites.size()),
+		descriptorWrites.data(),
+		0,
+		VK_NULL_HANDLE);
+}
+
+void VKRTApp::UpdateDescriptorSets()
+{
+	// 往Shader里面实际传数据
+	auto& mRTDescriptorSets = mDescriptorSet->GetDescriptorSets();
+
+	VkWriteDescriptorSetAccelerationStructureKHR descriptorAccelerationStructureInfo;
+	descriptorAccelerationStructureInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+	descriptorAccelerationStructureInfo.pNext = nullptr;
+	descriptorAccelerationStructureInfo.accelerationStructureCount = 1;
+	descriptorAccelerationStructureInfo.pAccelerationStructures = &mTopLvlAccStruct->GetAccelerationStructure().accelerationStructure;
+
+	VkWriteDescriptorSet accelerationStructureWrite;
+	accelerationStructureWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	accelerationStructureWrite.pNext = &descriptorAccelerationStructureInfo; // Notice that pNext is assigned here!
+	accelerationStructureWrite.dstSet = mRTDescriptorSets[SWS_SCENE_AS_SET];
+	accelerationStructureWrite.dstBinding = SWS_SCENE_AS_BINDING;
+	accelerationStructureWrite.dstArrayElement = 0;
+	accelerationStructureWrite.descriptorCount = 1;
+	accelerationStructureWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+	accelerationStructureWrite.pImageInfo = nullptr;
+	accelerationStructureWrite.pBufferInfo = nullptr;
+	accelerationStructureWrite.pTexelBufferView = nullptr;
+
+	/////////////////////////////////////////////////////////////
+
+	VkDescriptorImageInfo descriptorOutputImageInfo;
+	descriptorOutputImageInfo.sampler = VK_NULL_HANDLE;
+	descriptorOutputImageInfo.imageView = mOffscreenImage->GetImageView();
+	descriptorOutputImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkWriteDescriptorSet resultImageWrite;
+	resultImageWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	resultImageWrite.pNext = nullptr;
+	resultImageWrite.dstSet = mRTDescriptorSets[SWS_RESULT_IMAGE_SET];
+	resultImageWrite.dstBinding = SWS_RESULT_IMAGE_BINDING;
+	resultImageWrite.dstArrayElement = 0;
+	resultImageWrite.descriptorCount = 1;
+	resultImageWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	resultImageWrite.pImageInfo = &descriptorOutputImageInfo;
+	resultImageWrite.pBufferInfo = nullptr;
+	resultImageWrite.pTexelBufferView = nullptr;
+
+	VkDescriptorBufferInfo camdataBufferInfo;
+	camdataBufferInfo.buffer = mCameraBuffer->GetVkBuffer();
+	camdataBufferInfo.offset = 0;
+	camdataBufferInfo.range = mCameraBuffer->GetSize();
+
+	VkWriteDescriptorSet camdataBufferWrite;
+	camdataBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	camdataBufferWrite.pNext = nullptr;
+	camdataBufferWrite.dstSet = mRTDescriptorSets[SWS_CAMDATA_SET];
+	camdataBufferWrite.dstBinding = SWS_CAMDATA_BINDING;
+	camdataBufferWrite.dstArrayElement = 0;
+	camdataBufferWrite.descriptorCount = 1;
+	camdataBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	camdataBufferWrite.pImageInfo = nullptr;
+	camdataBufferWrite.pBufferInfo = &camdataBufferInfo;
+	camdataBufferWrite.pTexelBufferView = nullptr;
+
+	/////////////////////////////////////////////////////////////
+
 	std::vector<VkDescriptorBufferInfo> objAttrisInfos(mObjAttris.size());
 
 	for (int i = 0; i < mObjectAttrisBuffer.size(); i++)
@@ -833,18 +1244,6 @@ void VKRTApp::UpdateDescriptorSets()
 		accelerationStructureWrite,
 		resultImageWrite,
 		camdataBufferWrite,
-		//
-		matIDsBufferWrite,
-		//
-		attribsBufferWrite,
-		//
-		facesBufferWrite,
-		//
-		texturesBufferWrite,
-		//
-		envTexturesWrite,
-		//
-		colorsBufferWrite,
 		objAttrisBufferWrite,
 		});
 
@@ -853,9 +1252,57 @@ void VKRTApp::UpdateDescriptorSets()
 		descriptorWrites.data(),
 		0,
 		VK_NULL_HANDLE);
+
+	UpdateMaterialDescriptorSets();
+	UpdateGeometryDescriptorSets();
+	UpdateVirtualTextureDescriptorSet();
 }
 
-#pragma region Ⱦָ
+void VKRTApp::UpdateVirtualTextureDescriptorSet()
+{
+	// 页表和贴图信息的Buffer在贴图变多的时候会重新分配，那时候要重写
+	auto& mRTDescriptorSets = mDescriptorSet->GetDescriptorSets();
+
+	const auto& pageCache = mVirtualTextures->GetPageCache();
+	const VkDescriptorImageInfo pageCacheInfo =
+	{
+		pageCache.GetSampler(),
+		pageCache.GetImageView(),
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	};
+	const std::array<VkDescriptorBufferInfo, 3> bufferInfos =
+	{ {
+		{ mVirtualTextures->GetPageTableBuffer().GetVkBuffer(), 0, VK_WHOLE_SIZE },
+		{ mVirtualTextures->GetInfoBuffer().GetVkBuffer(), 0, VK_WHOLE_SIZE },
+		{ mVirtualTextures->GetFeedbackBuffer().GetVkBuffer(), 0, VK_WHOLE_SIZE },
+	} };
+
+	std::array<VkWriteDescriptorSet, 4> descriptorWrites = {};
+	for (auto& write : descriptorWrites)
+	{
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = mRTDescriptorSets[SWS_VIRTUAL_TEXTURE_SET];
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	}
+	descriptorWrites[0].dstBinding = SWS_VT_PAGE_CACHE_BINDING;
+	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrites[0].pImageInfo = &pageCacheInfo;
+	descriptorWrites[1].dstBinding = SWS_VT_PAGE_TABLE_BINDING;
+	descriptorWrites[1].pBufferInfo = &bufferInfos[0];
+	descriptorWrites[2].dstBinding = SWS_VT_INFO_BINDING;
+	descriptorWrites[2].pBufferInfo = &bufferInfos[1];
+	descriptorWrites[3].dstBinding = SWS_VT_FEEDBACK_BINDING;
+	descriptorWrites[3].pBufferInfo = &bufferInfos[2];
+
+	vkUpdateDescriptorSets(Device::GetLogicalDevice(),
+		static_cast<uint32_t>(descriptorWrites.size()),
+		descriptorWrites.data(),
+		0,
+		VK_NULL_HANDLE);
+}
+
+#pragma region 构建渲染的指令
 void VKRTApp::FillCommandBuffers()
 {
 	VkCommandBufferBeginInfo commandBufferBeginInfo;
@@ -898,19 +1345,39 @@ void VKRTApp::FillCommandBuffers()
 			VK_IMAGE_LAYOUT_GENERAL,
 			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
 
-		VkImageCopy copyRegion;
-		copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-		copyRegion.srcOffset = { 0, 0, 0 };
-		copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-		copyRegion.dstOffset = { 0, 0, 0 };
-		copyRegion.extent = { mWidth, mHeight, 1 };
-		vkCmdCopyImage(commandBuffer,
-			mOffscreenImage->GetImage(),
-			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			mSwapchain->GetImage(i),
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1,
-			&copyRegion);
+		if (mRenderWidth == mWidth && mRenderHeight == mHeight)
+		{
+			VkImageCopy copyRegion;
+			copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			copyRegion.srcOffset = { 0, 0, 0 };
+			copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			copyRegion.dstOffset = { 0, 0, 0 };
+			copyRegion.extent = { mWidth, mHeight, 1 };
+			vkCmdCopyImage(commandBuffer,
+				mOffscreenImage->GetImage(),
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				mSwapchain->GetImage(i),
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				1,
+				&copyRegion);
+		}
+		else
+		{
+			// 降低了分辨率的话，用线性过滤放大到整个交换链图片
+			VkImageBlit blitRegion = {};
+			blitRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			blitRegion.srcOffsets[1] = { static_cast<int32_t>(mRenderWidth), static_cast<int32_t>(mRenderHeight), 1 };
+			blitRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			blitRegion.dstOffsets[1] = { static_cast<int32_t>(mWidth), static_cast<int32_t>(mHeight), 1 };
+			vkCmdBlitImage(commandBuffer,
+				mOffscreenImage->GetImage(),
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				mSwapchain->GetImage(i),
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				1,
+				&blitRegion,
+				VK_FILTER_LINEAR);
+		}
 
 		ImageBarrier(commandBuffer,
 			mSwapchain->GetImage(i), subresourceRange,
@@ -944,7 +1411,7 @@ void VKRTApp::FillCommandBuffer(VkCommandBuffer commandBuffer, const size_t& ima
 {
 	vkCmdBindPipeline(commandBuffer,
 		VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
-		mRTPipeline);
+		mRTPipeline.pipeline);
 
 	const auto& rtDescriptorSets = mDescriptorSet->GetDescriptorSets();
 
@@ -955,21 +1422,21 @@ void VKRTApp::FillCommandBuffer(VkCommandBuffer commandBuffer, const size_t& ima
 		0, 0);
 
 	VkStridedDeviceAddressRegionKHR raygenRegion = {
-		mShaderBindingTable->GetSBTAddress() + mShaderBindingTable->GetRaygenOffset(),
-		mShaderBindingTable->GetGroupsStride(),
-		mShaderBindingTable->GetRaygenSize()
+		mRTPipeline.shaderBindingTable->GetSBTAddress() + mRTPipeline.shaderBindingTable->GetRaygenOffset(),
+		mRTPipeline.shaderBindingTable->GetGroupsStride(),
+		mRTPipeline.shaderBindingTable->GetRaygenSize()
 	};
 
 	VkStridedDeviceAddressRegionKHR missRegion = {
-		mShaderBindingTable->GetSBTAddress() + mShaderBindingTable->GetMissGroupsOffset(),
-		mShaderBindingTable->GetGroupsStride(),
-		mShaderBindingTable->GetMissGroupsSize()
+		mRTPipeline.shaderBindingTable->GetSBTAddress() + mRTPipeline.shaderBindingTable->GetMissGroupsOffset(),
+		mRTPipeline.shaderBindingTable->GetGroupsStride(),
+		mRTPipeline.shaderBindingTable->GetMissGroupsSize()
 	};
 
 	VkStridedDeviceAddressRegionKHR hitRegion = {
-		mShaderBindingTable->GetSBTAddress() + mShaderBindingTable->GetHitGroupsOffset(),
-		mShaderBindingTable->GetGroupsStride(),
-		mShaderBindingTable->GetHitGroupsSize()
+		mRTPipeline.shaderBindingTable->GetSBTAddress() + mRTPipeline.shaderBindingTable->GetHitGroupsOffset(),
+		mRTPipeline.shaderBindingTable->GetGroupsStride(),
+		mRTPipeline.shaderBindingTable->GetHitGroupsSize()
 	};
 
 	VkStridedDeviceAddressRegionKHR callableRegion = {};
@@ -979,7 +1446,7 @@ void VKRTApp::FillCommandBuffer(VkCommandBuffer commandBuffer, const size_t& ima
 		&missRegion,
 		&hitRegion,
 		&callableRegion,
-		mWidth, mHeight,
+		mRenderWidth, mRenderHeight,
 		1u);
 }
 
@@ -987,7 +1454,7 @@ void VKRTApp::FillCommandBuffer(VkCommandBuffer commandBuffer, const size_t& ima
 
 void VKRTApp::InitImGUI()
 {
-	// ʼIMGUI
+	// 初始化IMGUI
 	// VK_NO_PROTOTYPES must be added to the pre-processor define!
 	mDepthImage = std::make_unique<Image>(mVmaAllocator, Device::GetLogicalDevice(), VK_FORMAT_D32_SFLOAT);
 	mDepthImage->Create(
@@ -1044,7 +1511,7 @@ void VKRTApp::InitImGUI()
 	init_info.Device = Device::GetLogicalDevice();
 	init_info.QueueFamily = Device::GetQueue().GraphicsQueueFamilyIndex;
 	init_info.Queue = Device::GetGraphicsQueue();
-	init_info.PipelineCache = VK_NULL_HANDLE;
+	init_info.PipelineCache = mPipelineCache->GetVkPipelineCache();
 	init_info.DescriptorPool = mImguiPool;
 	init_info.Subpass = 0;
 	init_info.MinImageCount = mSwapchain->GetImageCount();
@@ -1079,8 +1546,8 @@ void VKRTApp::InitImGUI()
 
 void VKRTApp::CreateFrameBuffers()
 {
-	// ΪImGUIFrameBuffer
-	// ʵPost ProcessingҲڸոչ׷ٹ߻õͼƬ滭UI
+	// 为ImGUI创建FrameBuffer
+	// 实际上是Post Processing。也就是在刚刚光线追踪管线画好的图片上面画UI
 	mFrameBuffers.resize(mSwapchain->GetImageCount());
 
 	for (size_t i = 0; i < mSwapchain->GetImageCount(); i++)
@@ -1108,8 +1575,33 @@ void VKRTApp::CreateFrameBuffers()
 
 void VKRTApp::ProcessFrame(const double& deltaTime)
 {
-	// ÿһ֡Ķ
+	// 处理每一帧的动作
 	vkDeviceWaitIdle(Device::GetLogicalDevice());
+
+	// 上一帧已经执行完了，热重载换下来的资源可以释放；再看看有没有资源文件被改过
+	mDeletionQueue.NextFrame();
+	ProcessAssetChanges();
+
+	// 解码好的贴图先传Mip尾巴再传整张，材质在那之前用的是占位图
+	std::vector<uint32_t> changedTextures;
+	if (mTextureCache->Update(mDeletionQueue, changedTextures))
+	{
+		UpdateTextureDescriptors(changedTextures);
+	}
+	UpdateMemoryBudget();
+
+	// 读回上一帧光线请求的虚拟贴图页，把读盘线程切好的页拷贝进物理缓存
+	if (mVirtualTextures->Update())
+	{
+		UpdateVirtualTextureDescriptorSet();
+	}
+
+	// 设备空闲的时候处理流式加载，常驻的模型有变化就重写几何体描述符并更新顶层加速结构
+	if (mMeshStreamer->Update(mCamera))
+	{
+		UpdateGeometryDescriptorSets();
+		mTopLvlAccStruct->Update(Device::GetLogicalDevice(), mCommandPool, Device::GetGraphicsQueue(), mMeshStreamer->GetInstances());
+	}
 	const auto& cameraPos = mCamera.GetPosition();
 	const auto& cameraRot = mCamera.GetDirection();
 	ImGui::Text("Camera Position: (%.3f, %.3f, %.3f)", cameraPos.x, cameraPos.y, cameraPos.z);
@@ -1127,9 +1619,70 @@ void VKRTApp::ProcessFrame(const double& deltaTime)
 
 	size_t index = 0;
 
+	size_t totalCPUBytes = 0;
 	for (const auto& mesh : mMeshes)
 	{
-		ImGui::Text("%lld: %s", index, mesh->GetName().c_str());
+		totalCPUBytes += mesh->GetCPUMemoryBytes();
+	}
+	ImGui::Text("Mesh CPU Memory: %.2f KB", static_cast<double>(totalCPUBytes) / 1024.0);
+	ImGui::Text("Streaming: %zu / %zu meshes resident, %.2f / %.2f MB",
+		mMeshStreamer->GetResidentCount(), mMeshes.size(),
+		static_cast<double>(mMeshStreamer->GetResidentBytes()) / (1024.0 * 1024.0),
+		static_cast<double>(mMeshStreamer->GetBudgetBytes()) / (1024.0 * 1024.0));
+	ImGui::Text("GPU Memory: %.2f / %.2f MB, pressure level %u, rendering at %ux%u",
+		static_cast<double>(mMemoryBudget->GetDeviceLocalUsage()) / (1024.0 * 1024.0),
+		static_cast<double>(mMemoryBudget->GetDeviceLocalBudget()) / (1024.0 * 1024.0),
+		mMemoryBudget->GetLevel(), mRenderWidth, mRenderHeight);
+	for (uint32_t i = 0; i < MEMORY_CLASS_MAX; i++)
+	{
+		const auto memoryClass = static_cast<MemoryClass>(i);
+		ImGui::Text("    %s: %.2f / %.2f MB", MemoryBudgetManager::GetMemoryClassName(memoryClass),
+			static_cast<double>(mMemoryBudget->GetUsage(memoryClass)) / (1024.0 * 1024.0),
+			static_cast<double>(mMemoryBudget->GetBudget(memoryClass)) / (1024.0 * 1024.0));
+	}
+	if (!mShaderErrors.empty())
+	{
+		ImGui::TextColored(ImVec4(0.9f, 0.1f, 0.1f, 1.0f), "Shader reload failed, still running the last good pipeline:");
+		ImGui::TextUnformatted(mShaderErrors.c_str());
+	}
+
+	// 光线追踪管线的功能开关，改了之后换成对应的管线变体
+	int maxBounces = static_cast<int>(mRequestedFeatures.maxBounces);
+	if (ImGui::SliderInt("Max Bounces", &maxBounces, 1, static_cast<int>(PipelineFeatures::MAX_BOUNCES_LIMIT)))
+	{
+		mRequestedFeatures.maxBounces = static_cast<uint32_t>(maxBounces);
+	}
+	ImGui::Checkbox("Refraction Rays", &mRequestedFeatures.refraction);
+	ImGui::SameLine();
+	ImGui::Checkbox("Shadow Rays", &mRequestedFeatures.shadows);
+	int textureLodMode = static_cast<int>(mRequestedFeatures.textureLodMode);
+	if (ImGui::Combo("Texture LOD", &textureLodMode, "Ray cone\0Full resolution\0"))
+	{
+		mRequestedFeatures.textureLodMode = static_cast<uint32_t>(textureLodMode);
+	}
+	ImGui::Text("Pipeline variants: %zu built%s", mPipelineVariants.size() + 1, mPipelineBuild.valid() ? ", building..." : "");
+	if (mRTPipeline.cacheHitStages >= 0)
+	{
+		ImGui::Text("RT Pipeline: %.2f ms, %d / %u stages from the pipeline cache", mRTPipeline.creationMs, mRTPipeline.cacheHitStages,
+			mRTPipeline.shaderBindingTable->GetNumStages());
+	}
+	else
+	{
+		ImGui::Text("RT Pipeline: %.2f ms (%s pipeline cache)", mRTPipeline.creationMs, mPipelineCache->IsLoadedFromDisk() ? "warm" : "cold");
+	}
+	ImGui::Text("Textures: %u / %u streamed in", mTextureCache->GetTextureCount() - mTextureCache->GetStreamingCount(),
+		mTextureCache->GetTextureCount());
+	if (mScene.UsesVirtualTextures())
+	{
+		ImGui::Text("Virtual Textures: %u textures, %u / %u pages resident",
+			mVirtualTextures->GetTextureCount(), mVirtualTextures->GetResidentPageCount(), mVirtualTextures->GetSlotCount());
+	}
+
+	for (const auto& instance : mMeshInstances)
+	{
+		const auto& mesh = mMeshes[instance.meshIndex];
+		ImGui::Text("%zu: %s / %s (CPU %.2f KB)", index, instance.name.c_str(), mesh->GetName().c_str(),
+			static_cast<double>(mesh->GetCPUMemoryBytes()) / 1024.0);
 
 		ImGui::PushID(&mObjAttris[index]);
 		ImGui::SameLine();
@@ -1146,6 +1699,21 @@ void VKRTApp::ProcessFrame(const double& deltaTime)
 		index++;
 	}
 
+	// 导入时顶点缓存局部性的优化效果和生成的LOD
+	if (ImGui::CollapsingHeader("Mesh Stats"))
+	{
+		for (const auto& mesh : mMeshes)
+		{
+			ImGui::Text("%s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", mesh->GetName().c_str(),
+				mesh->GetLocalityBefore().acmr, mesh->GetLocalityAfter().acmr,
+				mesh->GetLocalityBefore().atvr, mesh->GetLocalityAfter().atvr);
+			for (uint32_t lod = 1; lod < mesh->GetLodCount(); lod++)
+			{
+				ImGui::Text("    LOD %u: %zu triangles, error %.4f", lod, mesh->GetIndexCount(lod) / FACE_NUM, mesh->GetLodError(lod));
+			}
+		}
+	}
+
 	ImGui::Render();
 
 	FillCommandBuffers();
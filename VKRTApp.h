@@ -1,19 +1,27 @@
 #pragma once
 /*
- * еĺ͹׷ٹȾĴ룬߳ʼ˳ڹ캯
+ * 这里面包含了所有的和光线追踪管线渲染的代码，管线初始化顺序都在构造函数里面了
  */
 
 #define VMA_VULKAN_VERSION 1002000
 
+#include <future>
+
 #include "Common.h"
 
 #include "Image.h"
 #include "Mesh.h"
 #include "Surface.h"
 #include "Swapchain.h"
-#include "BottomLevelAccelerationStructureBuilder.h"
+#include "MeshStreamer.h"
+#include "MemoryBudgetManager.h"
+#include "VirtualTextureStreamer.h"
+#include "Scene.h"
+#include "DeletionQueue.h"
 #include "Camera.h"
 #include "ShaderModule.h"
+#include "PipelineCache.h"
+#include "PipelineFeatures.h"
 #include "TopLevelAccelerationStructure.h"
 #include "ShaderBindingTable.h"
 #include "DescriptorSetLayout.h"
@@ -25,6 +33,7 @@
 #include "ImGUI/imgui_impl_vulkan.h"
 
 class DescriptorSet;
+class FileWatcher;
 using vec2 = glm::highp_vec2;
 using vec3 = glm::highp_vec3;
 using vec4 = glm::highp_vec4;
@@ -41,7 +50,7 @@ using quat = glm::highp_quat;
 class VKRTApp
 {
 public:
-	VKRTApp(GLFWwindow* window, const uint32_t& width, const uint32_t& height);
+	VKRTApp(GLFWwindow* window, const uint32_t& width, const uint32_t& height, const std::string& scenePath);
 
 	virtual ~VKRTApp();
 
@@ -91,10 +100,20 @@ public:
 	}
 
 	void UpdateCameraBuffer();
+
+	// GLSL files of the ray tracing pipeline and their stages; --embed-shaders precompiles the same list
+	static const std::vector<std::pair<std::string, EShLanguage>>& GetShaderFiles();
 private:
+	// 贴图描述符数组在启动时的贴图数量之外多留的位置
+	static constexpr uint32_t TEXTURE_ARRAY_HEADROOM = 32;
+	// 显存紧张时光线追踪的分辨率（相对窗口），像素数只剩四分之一
+	static constexpr float RENDER_SCALE_UNDER_PRESSURE = 0.5f;
+
 	GLFWwindow* mWindow;
 
 	uint32_t mWidth, mHeight;
+	// 光线追踪的分辨率；显存紧张的时候比窗口小，拷贝到交换链图片的时候再放大
+	uint32_t mRenderWidth, mRenderHeight;
 
 	void InitInstance();
 
@@ -114,8 +133,47 @@ private:
 	void AddOffscreenImageBinding();
 	void AddCameraBinding();
 	void CreatePipelineLayout();
-	void CreateRayTracingPipeline();
+	// 启动时Shader编译不过或者管线创建失败就抛出异常，这时候没有可以退回去用的管线
+	void CreateRayTracingPipeline(const std::vector<std::shared_ptr<ShaderModule>>& shaders);
+
+	// 一整套光线追踪管线：Shader、管线和它的SBT。热重载的时候在后台线程上整个建好，再在帧与帧之间换上
+	struct RayTracingPipeline
+	{
+		// 顺序和GetShaderFiles一致
+		std::vector<std::shared_ptr<ShaderModule>> shaders;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		std::unique_ptr<ShaderBindingTable> shaderBindingTable;
+		// 创建管线的耗时，以及有多少个Stage命中了管线缓存（没有creation feedback扩展的话是-1）
+		double creationMs = 0.0;
+		int cacheHitStages = -1;
+		PipelineFeatures features;
+		// 每次热重载Shader加一，代数不同的变体不能混用
+		uint32_t shaderGeneration = 0;
+		// 编译或者创建管线失败的原因；不为空的时候管线和SBT都没有创建
+		std::string errors;
+	};
+	// 只读取管线布局和管线缓存，可以在后台线程上调用
+	RayTracingPipeline BuildRayTracingPipeline(const std::vector<std::shared_ptr<ShaderModule>>& shaders, const PipelineFeatures& features);
+	void SetRayTracingPipeline(RayTracingPipeline&& pipeline);
+	// 把正在用的管线取出来（放进变体缓存或者销毁）
+	RayTracingPipeline TakeRayTracingPipeline();
+	// 上一帧的命令可能还引用着，放进DeletionQueue
+	void DestroyRayTracingPipeline(RayTracingPipeline&& pipeline);
+	// Shader改动了就在后台重新编译；选择了别的功能开关就换成对应的变体，没建过的在后台建
+	void UpdateRayTracingPipeline(const bool& shadersChanged);
 	void UpdateDescriptorSets();
+	void UpdateMaterialDescriptorSets();
+	// 只重写流式加载换了Image的那几个贴图描述符
+	void UpdateTextureDescriptors(const std::vector<uint32_t>& textureIndices);
+	void UpdateGeometryDescriptorSets();
+	void UpdateVirtualTextureDescriptorSet();
+	std::unique_ptr<Image> CreateSkyBoxImage();
+	// 热重载：重新导入改动过的模型和贴图，只替换受影响的资源和描述符
+	void ProcessAssetChanges();
+	// 统计各类资源的显存，按MemoryBudgetManager的决定降低或者恢复画质
+	void UpdateMemoryBudget();
+	// 按窗口大小的比例重新创建光线追踪的输出图片
+	void SetRenderScale(const float& scale);
 	void FillCommandBuffers();
 	void FillCommandBuffer(VkCommandBuffer, const size_t&);
 
@@ -139,34 +197,52 @@ private:
 
 	std::unique_ptr<Image> mOffscreenImage;
 	std::unique_ptr<Image> mSkyBoxImage;
+	// 按路径共享的材质贴图，以及所有贴图共用的Sampler
+	std::unique_ptr<TextureCache> mTextureCache;
+	// 贴图描述符数组的大小，比启动时的贴图数量多留一些给热重载时新出现的贴图
+	uint32_t mTextureArraySize = 0;
+	// 虚拟贴图的页表和物理页缓存，场景没有开启的时候只有一个最小的缓存让描述集完整
+	std::unique_ptr<VirtualTextureStreamer> mVirtualTextures;
 
 	std::vector<std::shared_ptr<Mesh>> mMeshes;
-	std::vector<std::shared_ptr<Buffer>> mMatIDsBuffers;
-
-	std::unique_ptr<BottomLevelAccelerationStructureBuilder> mBtmLvlAccStructBuilder;
-	std::unique_ptr<TopLevelAccelerationStructure> mTopLvlAccStruct;
+	// 场景里每一次摆放，多个Instance可以共用一个Mesh
+	std::vector<MeshInstance> mMeshInstances;
 
-	std::shared_ptr<ShaderModule> mRayGen;
-	std::shared_ptr<ShaderModule> mRayHit;
-	std::shared_ptr<ShaderModule> mRayMiss;
-	std::shared_ptr<ShaderModule> mShadowRayHit;
-	std::shared_ptr<ShaderModule> mShadowRayMiss;
+	Scene mScene;
+	std::unique_ptr<FileWatcher> mFileWatcher;
+	// 热重载换下来的资源，等用到它们的帧执行完再释放
+	DeletionQueue mDeletionQueue;
+	std::unique_ptr<MemoryBudgetManager> mMemoryBudget;
 
-	std::unique_ptr<ShaderBindingTable> mShaderBindingTable;
+	std::unique_ptr<ModelCache> mModelCache;
+	std::unique_ptr<MeshStreamer> mMeshStreamer;
+	std::unique_ptr<TopLevelAccelerationStructure> mTopLvlAccStruct;
 
 	std::unique_ptr<DescriptorSetLayout> mLayoutRaygen;
-	std::unique_ptr<DescriptorSetLayout> mLayoutMaterialIDs;
 	std::unique_ptr<DescriptorSetLayout> mLayoutVertices;
 	std::unique_ptr<DescriptorSetLayout> mLayoutFaces;
 	std::unique_ptr<DescriptorSetLayout> mLayoutTexs;
 	std::unique_ptr<DescriptorSetLayout> mLayoutSkyBox;
 	std::unique_ptr<DescriptorSetLayout> mLayoutColor;
 	std::unique_ptr<DescriptorSetLayout> mLayoutObjAttris;
+	std::unique_ptr<DescriptorSetLayout> mLayoutVirtualTextures;
 
 	std::unique_ptr<DescriptorSet> mDescriptorSet;
 
 	VkPipelineLayout mRTPipelineLayout;
-	VkPipeline mRTPipeline;
+	// 正在用的光线追踪管线，包括它的Shader、SBT、功能开关和创建耗时
+	RayTracingPipeline mRTPipeline;
+	// 光线追踪管线和ImGUI的管线共用，退出时存盘
+	std::unique_ptr<PipelineCache> mPipelineCache;
+	// ImGUI上选择的功能开关，和正在用的管线不一样的时候换成对应的变体
+	PipelineFeatures mRequestedFeatures;
+	// 建好了但是没在用的变体，按PipelineFeatures::GetKey索引，切换回来不用再建
+	std::unordered_map<uint32_t, RayTracingPipeline> mPipelineVariants;
+	// 后台正在建的管线（热重载或者新的变体），同一时间只有一个
+	std::future<RayTracingPipeline> mPipelineBuild;
+	bool mShaderReloadPending = false;
+	// 最近一次热重载失败的编译错误，显示在ImGUI上
+	std::string mShaderErrors;
 
 	Camera mCamera;
 	UniformParams mParams;
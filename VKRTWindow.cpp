@@ -4,23 +4,23 @@
 
 #define TARGET_FPS 144
 
-VKRTWindow::VKRTWindow(const int& width, const int& height)
+VKRTWindow::VKRTWindow(const std::string& scenePath, const int& width, const int& height)
 {
-    glfwInit(); // ʼVKRTWindow
+    glfwInit(); // 初始化VKRTWindow
 
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    // ڲܱţΪ漰VulkanҪдĴ룬ֱӱ
+    // 窗口不能被缩放，因为窗口缩放涉及Vulkan需要写更多的代码，否则程序会直接崩溃
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE); 
 
-    // 
+    // 创建窗口
 	window = glfwCreateWindow(width, height, "VulkanRT", nullptr, nullptr);
 	glfwSetWindowUserPointer(window, this);
-    // 漰Ļص
+    // 以下是涉及到键盘鼠标操作的回调
 	glfwSetKeyCallback(window, keyCallback);
     glfwSetCursorPosCallback(window, mouseCallback);
     glfwSetMouseButtonCallback(window, mouseButtonCallback);
-    // ½ĴVKRTAppҪȾࣩ
-    vkRTApp = std::make_unique<VKRTApp>(window, width, height);
+    // 将新建的窗口用于VKRTApp（主要管理渲染的类）
+    vkRTApp = std::make_unique<VKRTApp>(window, width, height, scenePath);
 }
 
 void VKRTWindow::keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -101,7 +101,7 @@ void VKRTWindow::run()
     while (!glfwWindowShouldClose(window))
     {
         glfwPollEvents();
-#pragma region ImGUIйأʱԲ
+#pragma region 与ImGUI有关，暂时可以不管
         auto isIconified = glfwGetWindowAttrib(window, GLFW_ICONIFIED);
 
         if (isIconified == GLFW_TRUE)
@@ -0,0 +1,120 @@
+﻿#include "VertexCompression.h"
+
+#include <algorithm>
+
+// x64一定有SSE2；F16C要看编译选项，MSVC没有__F16C__，只在/arch:AVX2（x64的工程配置里打开了）的时候定义__AVX2__
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+#define VERTEX_COMPRESSION_SSE 1
+#include <emmintrin.h>
+#if defined(__F16C__) || defined(__AVX2__)
+#define VERTEX_COMPRESSION_F16C 1
+#include <immintrin.h>
+#endif
+#endif
+
+uint32_t VertexCompression::EncodeOctNormal(const vec3& normal)
+{
+	// 先把法线投影到八面体上：|x| + |y| + |z| = 1
+	const float l1 = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+	vec2 oct = l1 > 0.0f ? vec2(normal.x, normal.y) / l1 : vec2(0.0f);
+	// 下半球需要折叠到上半球的外侧
+	if (normal.z < 0.0f)
+	{
+		oct = vec2((1.0f - std::abs(oct.y)) * (oct.x >= 0.0f ? 1.0f : -1.0f),
+			(1.0f - std::abs(oct.x)) * (oct.y >= 0.0f ? 1.0f : -1.0f));
+	}
+	// 与GLSL的unpackSnorm2x16对应
+	return glm::packSnorm2x16(oct);
+}
+
+uint32_t VertexCompression::EncodeHalfUV(const vec2& uv)
+{
+	// 与GLSL的unpackHalf2x16对应
+	return glm::packHalf2x16(uv);
+}
+
+void VertexCompression::EncodeVertexAttributes(const float* normals, const size_t& normalStride,
+	const float* uvs, const size_t& uvStride,
+	const size_t& count,
+	VertexAttribute* out)
+{
+	size_t i = 0;
+
+#ifdef VERTEX_COMPRESSION_SSE
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 snormScale = _mm_set1_ps(32767.0f);
+	const __m128i lowMask = _mm_set1_epi32(0xFFFF);
+
+	// 每次处理4个顶点，把AoS转换成SoA之后一起计算
+	for (; i + 4 <= count; i += 4)
+	{
+		const float* n0 = normals + (i + 0) * normalStride;
+		const float* n1 = normals + (i + 1) * normalStride;
+		const float* n2 = normals + (i + 2) * normalStride;
+		const float* n3 = normals + (i + 3) * normalStride;
+
+		__m128 x = _mm_setr_ps(n0[0], n1[0], n2[0], n3[0]);
+		__m128 y = _mm_setr_ps(n0[1], n1[1], n2[1], n3[1]);
+		const __m128 z = _mm_setr_ps(n0[2], n1[2], n2[2], n3[2]);
+
+		// 投影到八面体
+		const __m128 l1 = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(signMask, x), _mm_andnot_ps(signMask, y)), _mm_andnot_ps(signMask, z));
+		const __m128 validL1 = _mm_cmpgt_ps(l1, zero);
+		const __m128 invL1 = _mm_and_ps(_mm_div_ps(one, _mm_or_ps(l1, _mm_andnot_ps(validL1, one))), validL1);
+		x = _mm_mul_ps(x, invL1);
+		y = _mm_mul_ps(y, invL1);
+
+		// 下半球折叠：(1 - |y|) * sign(x), (1 - |x|) * sign(y)
+		const __m128 signX = _mm_or_ps(_mm_and_ps(x, signMask), one);
+		const __m128 signY = _mm_or_ps(_mm_and_ps(y, signMask), one);
+		const __m128 foldX = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, y)), signX);
+		const __m128 foldY = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, x)), signY);
+		const __m128 lowerHemisphere = _mm_cmplt_ps(z, zero);
+		x = _mm_or_ps(_mm_and_ps(lowerHemisphere, foldX), _mm_andnot_ps(lowerHemisphere, x));
+		y = _mm_or_ps(_mm_and_ps(lowerHemisphere, foldY), _mm_andnot_ps(lowerHemisphere, y));
+
+		// 量化为snorm16，x放在低16位
+		x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-1.0f)), one);
+		y = _mm_min_ps(_mm_max_ps(y, _mm_set1_ps(-1.0f)), one);
+		const __m128i ix = _mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(x, snormScale)), lowMask);
+		const __m128i iy = _mm_slli_epi32(_mm_cvtps_epi32(_mm_mul_ps(y, snormScale)), 16);
+		alignas(16) uint32_t packedNormals[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(packedNormals), _mm_or_si128(ix, iy));
+
+		alignas(16) uint32_t packedUVs[4] = { 0, 0, 0, 0 };
+		if (uvs)
+		{
+			const float* t0 = uvs + (i + 0) * uvStride;
+			const float* t1 = uvs + (i + 1) * uvStride;
+			const float* t2 = uvs + (i + 2) * uvStride;
+			const float* t3 = uvs + (i + 3) * uvStride;
+#ifdef VERTEX_COMPRESSION_F16C
+			const __m128i h01 = _mm_cvtps_ph(_mm_setr_ps(t0[0], t0[1], t1[0], t1[1]), _MM_FROUND_TO_NEAREST_INT);
+			const __m128i h23 = _mm_cvtps_ph(_mm_setr_ps(t2[0], t2[1], t3[0], t3[1]), _MM_FROUND_TO_NEAREST_INT);
+			_mm_store_si128(reinterpret_cast<__m128i*>(packedUVs), _mm_unpacklo_epi64(h01, h23));
+#else
+			packedUVs[0] = EncodeHalfUV(vec2(t0[0], t0[1]));
+			packedUVs[1] = EncodeHalfUV(vec2(t1[0], t1[1]));
+			packedUVs[2] = EncodeHalfUV(vec2(t2[0], t2[1]));
+			packedUVs[3] = EncodeHalfUV(vec2(t3[0], t3[1]));
+#endif
+		}
+
+		for (size_t j = 0; j < 4; j++)
+		{
+			out[i + j].normalOct = packedNormals[j];
+			out[i + j].uvHalf = packedUVs[j];
+		}
+	}
+#endif
+
+	// 剩下不足4个的顶点（或者没有SSE的平台）逐个编码
+	for (; i < count; i++)
+	{
+		const float* n = normals + i * normalStride;
+		out[i].normalOct = EncodeOctNormal(vec3(n[0], n[1], n[2]));
+		out[i].uvHalf = uvs ? EncodeHalfUV(vec2(uvs[i * uvStride], uvs[i * uvStride + 1])) : 0u;
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+
+#include "shared_with_shaders.h"
+
+// Encodes normals and texture coordinates into the compact VertexAttribute layout of shared_with_shaders.h.
+// The decode side lives in the shaders (DecodeOctNormal / DecodeHalfUV).
+class VertexCompression
+{
+public:
+	static uint32_t EncodeOctNormal(const vec3& normal);
+	static uint32_t EncodeHalfUV(const vec2& uv);
+
+	/*
+	 * normals: xyz triples, normalStride floats apart
+	 * uvs: uv pairs, uvStride floats apart, may be nullptr (uv = 0)
+	 * Four vertices are encoded at a time with SSE when it is available.
+	 */
+	static void EncodeVertexAttributes(const float* normals, const size_t& normalStride,
+		const float* uvs, const size_t& uvStride,
+		const size_t& count,
+		VertexAttribute* out);
+};
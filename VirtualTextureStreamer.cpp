@@ -0,0 +1,662 @@
+﻿#include "VirtualTextureStreamer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "Constants.h"
+#include "TextureCooker.h"
+
+namespace
+{
+	constexpr size_t SLOT_BYTES = static_cast<size_t>(SWS_VT_SLOT_SIZE) * SWS_VT_SLOT_SIZE * 4;
+
+	uint32_t MipExtent(const uint32_t& size, const uint32_t& mip)
+	{
+		return std::max(size >> mip, 1u);
+	}
+
+	uint32_t PageCount(const uint32_t& size, const uint32_t& mip)
+	{
+		return (MipExtent(size, mip) + SWS_VT_PAGE_SIZE - 1) / SWS_VT_PAGE_SIZE;
+	}
+
+	// 一张贴图所有Mip的页表项总数
+	uint32_t PageTableRangeSize(const VirtualTextureInfo& info)
+	{
+		uint32_t size = 0;
+		for (uint32_t mip = 0; mip <= info.tailMip; mip++)
+		{
+			size += PageCount(info.width, mip) * PageCount(info.height, mip);
+		}
+		return size;
+	}
+
+	// REPEAT寻址，和Shader里对UV取fract一致
+	uint32_t Wrap(const int64_t& value, const uint32_t& size)
+	{
+		const int64_t wrapped = value % static_cast<int64_t>(size);
+		return static_cast<uint32_t>(wrapped < 0 ? wrapped + size : wrapped);
+	}
+}
+
+VirtualTextureStreamer::VirtualTextureStreamer(VmaAllocator& allocator,
+	VkDevice& logicalDevice,
+	VkCommandPool& commandPool,
+	VkQueue& graphicsQueue,
+	SamplerCache& samplerCache,
+	const uint32_t& cacheRows) :
+	mAllocator(allocator),
+	mLogicalDevice(logicalDevice),
+	mCommandPool(commandPool),
+	mGraphicsQueue(graphicsQueue),
+	mPageTableBuffer(allocator),
+	mInfoBuffer(allocator),
+	mFeedbackBuffer(allocator),
+	mStagingBuffer(allocator)
+{
+	// 物理页缓存：一张sRGB的大图，每个槽位放一页加上四周的边
+	mPageCache = std::make_unique<Image>(allocator, logicalDevice, VK_FORMAT_R8G8B8A8_SRGB);
+	auto error = mPageCache->Create(VK_IMAGE_TYPE_2D,
+		{ SWS_VT_CACHE_SLOTS_X * SWS_VT_SLOT_SIZE, cacheRows * SWS_VT_SLOT_SIZE, 1 },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	assert(error == VK_SUCCESS);
+	mPageCache->CreateTextureView();
+	// 边已经带在槽位里了，只在一级Mip里做双线性过滤
+	mPageCache->SetSampler(samplerCache.Get({ VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE }));
+	error = DoOneTimeCommand(logicalDevice, commandPool, graphicsQueue, [this](VkCommandBuffer& commandBuffer)
+		{
+			Image::ImageBarrier(commandBuffer, mPageCache->GetImage(), { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+				0, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			return VK_SUCCESS;
+		});
+	assert(error == VK_SUCCESS);
+
+	mSlots.resize(static_cast<size_t>(SWS_VT_CACHE_SLOTS_X) * cacheRows);
+	for (uint32_t slot = static_cast<uint32_t>(mSlots.size()); slot > 0; slot--)
+	{
+		mFreeSlots.push_back(slot - 1);
+	}
+
+	// 反馈要在CPU上读，用可以随机访问的内存
+	error = mFeedbackBuffer.CreateBuffer(sizeof(VirtualTextureFeedbackHeader) + 2 * SWS_VT_FEEDBACK_CAPACITY * sizeof(uint32_t),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+	assert(error == VK_SUCCESS);
+	mFeedback = static_cast<VirtualTextureFeedbackHeader*>(mFeedbackBuffer.Map());
+	*mFeedback = {};
+	mFeedbackBuffer.Flush();
+
+	error = mStagingBuffer.CreateBuffer(MAX_UPLOADS_PER_FRAME * SLOT_BYTES,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+	assert(error == VK_SUCCESS);
+	mStaging = static_cast<uint8_t*>(mStagingBuffer.Map());
+
+	AllocateTables();
+
+	mLoaderThread = std::thread(&VirtualTextureStreamer::LoaderLoop, this);
+}
+
+VirtualTextureStreamer::~VirtualTextureStreamer()
+{
+	StopLoader();
+}
+
+uint32_t VirtualTextureStreamer::Register(const std::string& path)
+{
+	if (mTextures.size() >= SWS_VT_MAX_TEXTURES)
+	{
+		return UINT32_MAX;
+	}
+
+	const auto id = static_cast<uint32_t>(mTextures.size());
+	mTextures.emplace_back().path = path;
+	ReadLayout(id);
+	return id;
+}
+
+void VirtualTextureStreamer::Reload(const uint32_t& id)
+{
+	for (uint32_t slot = 0; slot < mSlots.size(); slot++)
+	{
+		if (mSlots[slot].page != UINT32_MAX && (mSlots[slot].page >> SWS_VT_REQUEST_TEXTURE_SHIFT) == id)
+		{
+			EvictSlot(slot);
+		}
+	}
+	mPageTableBuffer.Flush();
+
+	// 还没开始读的旧请求直接丢掉；正在读的旧页回来的时候会因为generation对不上被丢掉，
+	// 它们的mInFlight标记在这里清掉，之后同一页的新请求自己再加
+	{
+		std::lock_guard<std::mutex> lock(mLoaderMutex);
+		const auto isOld = [id](const PageRequest& request) { return (request.page >> SWS_VT_REQUEST_TEXTURE_SHIFT) == id; };
+		std::erase_if(mPinnedRequests, isOld);
+		std::erase_if(mRequests, isOld);
+	}
+	std::erase_if(mInFlight, [id](const uint32_t page) { return (page >> SWS_VT_REQUEST_TEXTURE_SHIFT) == id; });
+	mTextures[id].generation++;
+	ReadLayout(id);
+}
+
+bool VirtualTextureStreamer::Update()
+{
+	const bool reallocated = AllocateTables();
+	if (mInfoDirty)
+	{
+		auto* infos = static_cast<VirtualTextureInfo*>(mInfoBuffer.Map());
+		for (size_t i = 0; i < mTextures.size(); i++)
+		{
+			infos[i] = mTextures[i].info;
+		}
+		mInfoBuffer.Flush();
+		mInfoBuffer.Unmap();
+		mInfoDirty = false;
+	}
+
+	ReadFeedback();
+	UploadLoadedPages();
+
+	// 这一帧的Shader写另一半，先清零
+	mFeedback->frame = static_cast<uint32_t>(mFrame);
+	mFeedback->counts[mFrame & 1] = 0;
+	mFeedbackBuffer.Flush();
+	mFrame++;
+	return reallocated;
+}
+
+uint32_t VirtualTextureStreamer::GetResidentPageCount() const
+{
+	return static_cast<uint32_t>(mSlots.size() - mFreeSlots.size());
+}
+
+void VirtualTextureStreamer::Dispose()
+{
+	StopLoader();
+
+	mFeedbackBuffer.Unmap();
+	mFeedbackBuffer.Free();
+	mStagingBuffer.Unmap();
+	mStagingBuffer.Free();
+	mPageTableBuffer.Unmap();
+	mPageTableBuffer.Free();
+	mInfoBuffer.Free();
+	mPageCache->Dispose();
+}
+
+void VirtualTextureStreamer::ReadLayout(const uint32_t& id)
+{
+	// 只读文件头拿到尺寸，真正的解码等到第一次有页被用到的时候
+	auto& texture = mTextures[id];
+	int width = 0, height = 0, channels = 0;
+	if (!stbi_info(texture.path.c_str(), &width, &height, &channels)
+		&& !stbi_info(DEFAULT_TEXTURE_DIR"error.png", &width, &height, &channels))
+	{
+		width = height = 1;
+	}
+
+	// 尺寸没变的话页表还用原来的位置；变了的时候新的放得下就原地用，多出来的还回去，放不下就换一段。
+	// Reload已经把这张贴图的页都换出去了，旧区间里的页表项都是0，可以直接给别的贴图用
+	if (texture.mipOffsets.empty() || texture.info.width != static_cast<uint32_t>(width) || texture.info.height != static_cast<uint32_t>(height))
+	{
+		const uint32_t oldOffset = texture.info.pageTableOffset;
+		const uint32_t oldSize = texture.mipOffsets.empty() ? 0 : PageTableRangeSize(texture.info);
+		texture.info.width = static_cast<uint32_t>(width);
+		texture.info.height = static_cast<uint32_t>(height);
+		texture.info.tailMip = ComputeTailMip(texture.info.width, texture.info.height);
+		const uint32_t size = PageTableRangeSize(texture.info);
+		if (size <= oldSize)
+		{
+			FreePageTableRange(oldOffset + size, oldSize - size);
+		}
+		else
+		{
+			FreePageTableRange(oldOffset, oldSize);
+			texture.info.pageTableOffset = AllocatePageTableRange(size);
+		}
+
+		uint32_t offset = texture.info.pageTableOffset;
+		texture.mipOffsets.clear();
+		for (uint32_t mip = 0; mip <= texture.info.tailMip; mip++)
+		{
+			texture.mipOffsets.push_back(offset);
+			offset += PageCount(texture.info.width, mip) * PageCount(texture.info.height, mip);
+		}
+		mInfoDirty = true;
+	}
+
+	// Mip尾先加载，之后一直常驻
+	const uint32_t tailPage = PackPageRequest(id, texture.info.tailMip, 0, 0);
+	mInFlight.insert(tailPage);
+	{
+		std::lock_guard<std::mutex> lock(mLoaderMutex);
+		mPinnedRequests.push_back({ tailPage, texture.path, texture.generation, true });
+	}
+	mLoaderCondition.notify_one();
+}
+
+uint32_t VirtualTextureStreamer::AllocatePageTableRange(const uint32_t& size)
+{
+	// 先找第一段放得下的空闲区间，没有的话接在页表末尾，由下一次Update扩容
+	for (auto range = mFreePageTableRanges.begin(); range != mFreePageTableRanges.end(); ++range)
+	{
+		if (range->second >= size)
+		{
+			const uint32_t offset = range->first;
+			range->first += size;
+			range->second -= size;
+			if (range->second == 0)
+			{
+				mFreePageTableRanges.erase(range);
+			}
+			return offset;
+		}
+	}
+	const uint32_t offset = mPageTableSize;
+	mPageTableSize += size;
+	return offset;
+}
+
+void VirtualTextureStreamer::FreePageTableRange(const uint32_t& offset, const uint32_t& size)
+{
+	if (size == 0)
+	{
+		return;
+	}
+
+	auto next = std::lower_bound(mFreePageTableRanges.begin(), mFreePageTableRanges.end(), std::make_pair(offset, 0u));
+	auto range = mFreePageTableRanges.insert(next, { offset, size });
+	// 和后面、前面挨着的区间合并
+	if (range + 1 != mFreePageTableRanges.end() && range->first + range->second == (range + 1)->first)
+	{
+		range->second += (range + 1)->second;
+		mFreePageTableRanges.erase(range + 1);
+	}
+	if (range != mFreePageTableRanges.begin() && (range - 1)->first + (range - 1)->second == range->first)
+	{
+		(range - 1)->second += range->second;
+		range = mFreePageTableRanges.erase(range) - 1;
+	}
+	// 在页表末尾的话直接缩回去，之后追加的贴图接着用
+	if (range->first + range->second == mPageTableSize)
+	{
+		mPageTableSize = range->first;
+		mFreePageTableRanges.erase(range);
+	}
+}
+
+uint32_t VirtualTextureStreamer::ComputeTailMip(const uint32_t& width, const uint32_t& height)
+{
+	// 第一级整张图都放得进一页的Mip
+	uint32_t mip = 0;
+	while (MipExtent(width, mip) > SWS_VT_PAGE_SIZE || MipExtent(height, mip) > SWS_VT_PAGE_SIZE)
+	{
+		mip++;
+	}
+	return mip;
+}
+
+uint32_t& VirtualTextureStreamer::PageTableEntry(const uint32_t& page)
+{
+	const auto& texture = mTextures[page >> SWS_VT_REQUEST_TEXTURE_SHIFT];
+	const uint32_t mip = (page >> SWS_VT_REQUEST_MIP_SHIFT) & 0xF;
+	const uint32_t pageY = (page >> SWS_VT_REQUEST_PAGE_Y_SHIFT) & 0xFF;
+	const uint32_t pageX = page & 0xFF;
+	return mPageTable[texture.mipOffsets[mip] + pageY * PageCount(texture.info.width, mip) + pageX];
+}
+
+bool VirtualTextureStreamer::IsValidPage(const uint32_t& page) const
+{
+	// 反馈是GPU写的，用之前检查一下范围
+	const uint32_t id = page >> SWS_VT_REQUEST_TEXTURE_SHIFT;
+	if (id >= mTextures.size())
+	{
+		return false;
+	}
+	const auto& info = mTextures[id].info;
+	const uint32_t mip = (page >> SWS_VT_REQUEST_MIP_SHIFT) & 0xF;
+	return mip <= info.tailMip
+		&& ((page >> SWS_VT_REQUEST_PAGE_Y_SHIFT) & 0xFF) < PageCount(info.height, mip)
+		&& (page & 0xFF) < PageCount(info.width, mip);
+}
+
+void VirtualTextureStreamer::ReadFeedback()
+{
+	if (mFrame == 0)
+	{
+		return;
+	}
+
+	// 上一帧写的那一半，设备已经空闲了
+	mFeedbackBuffer.Invalidate();
+	const uint32_t bank = (mFrame - 1) & 1;
+	const uint32_t count = std::min(mFeedback->counts[bank], SWS_VT_FEEDBACK_CAPACITY);
+	const auto* requests = reinterpret_cast<const uint32_t*>(mFeedback + 1) + bank * SWS_VT_FEEDBACK_CAPACITY;
+
+	std::unordered_set<uint32_t> unique(requests, requests + count);
+	std::vector<uint32_t> missing;
+	for (const uint32_t page : unique)
+	{
+		if (!IsValidPage(page))
+		{
+			continue;
+		}
+		const uint32_t entry = PageTableEntry(page);
+		if (entry != 0)
+		{
+			mSlots[entry - 1].lastUsedFrame = mFrame;
+		}
+		else if (!mInFlight.contains(page))
+		{
+			missing.push_back(page);
+		}
+	}
+	QueueLoads(missing);
+}
+
+void VirtualTextureStreamer::QueueLoads(std::vector<uint32_t>& pages)
+{
+	// 粗的Mip先加载，细的页到之前Shader可以先用它
+	std::sort(pages.begin(), pages.end(), [](const uint32_t a, const uint32_t b)
+		{
+			return ((a >> SWS_VT_REQUEST_MIP_SHIFT) & 0xF) > ((b >> SWS_VT_REQUEST_MIP_SHIFT) & 0xF);
+		});
+
+	std::lock_guard<std::mutex> lock(mLoaderMutex);
+	// 上一帧还没开始读的请求可能已经看不到了，换成这一帧的
+	for (const auto& request : mRequests)
+	{
+		mInFlight.erase(request.page);
+	}
+	mRequests.clear();
+	for (const uint32_t page : pages)
+	{
+		const auto& texture = mTextures[page >> SWS_VT_REQUEST_TEXTURE_SHIFT];
+		mRequests.push_back({ page, texture.path, texture.generation, false });
+		mInFlight.insert(page);
+	}
+	if (!mRequests.empty())
+	{
+		mLoaderCondition.notify_one();
+	}
+}
+
+bool VirtualTextureStreamer::AllocateTables()
+{
+	const uint32_t textureCount = std::max(static_cast<uint32_t>(mTextures.size()), 1u);
+	const uint32_t pageTableSize = std::max(mPageTableSize, 1u);
+	if (textureCount <= mAllocatedTextureCount && pageTableSize <= mAllocatedPageTableSize)
+	{
+		return false;
+	}
+
+	// 留一倍的余量，热重载时新出现的贴图不用每次都重新分配；设备是空闲的，旧的Buffer可以直接释放
+	std::vector<uint32_t> pageTable(pageTableSize * 2, 0);
+	if (mPageTable)
+	{
+		std::memcpy(pageTable.data(), mPageTable, mAllocatedPageTableSize * sizeof(uint32_t));
+		mPageTableBuffer.Unmap();
+		mPageTableBuffer.Free();
+		mInfoBuffer.Free();
+	}
+	mAllocatedPageTableSize = static_cast<uint32_t>(pageTable.size());
+	mAllocatedTextureCount = textureCount * 2;
+
+	auto error = mPageTableBuffer.CreateBuffer(mAllocatedPageTableSize * sizeof(uint32_t),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+	assert(error == VK_SUCCESS);
+	mPageTable = static_cast<uint32_t*>(mPageTableBuffer.Map());
+	std::memcpy(mPageTable, pageTable.data(), pageTable.size() * sizeof(uint32_t));
+	mPageTableBuffer.Flush();
+
+	error = mInfoBuffer.CreateBuffer(mAllocatedTextureCount * sizeof(VirtualTextureInfo),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+	assert(error == VK_SUCCESS);
+	mInfoDirty = true;
+	return true;
+}
+
+void VirtualTextureStreamer::UploadLoadedPages()
+{
+	std::vector<LoadedPage> loaded;
+	{
+		std::lock_guard<std::mutex> lock(mLoaderMutex);
+		const size_t count = std::min(mLoadedPages.size(), MAX_UPLOADS_PER_FRAME);
+		loaded.assign(std::make_move_iterator(mLoadedPages.begin()), std::make_move_iterator(mLoadedPages.begin() + count));
+		mLoadedPages.erase(mLoadedPages.begin(), mLoadedPages.begin() + count);
+	}
+
+	std::vector<VkBufferImageCopy> regions;
+	for (auto& page : loaded)
+	{
+		// 热重载之前读的页：标记已经在Reload里清掉了，现在的标记属于新的请求，不能动
+		const uint32_t id = page.page >> SWS_VT_REQUEST_TEXTURE_SHIFT;
+		if (page.generation != mTextures[id].generation)
+		{
+			continue;
+		}
+		mInFlight.erase(page.page);
+		if (PageTableEntry(page.page) != 0)
+		{
+			continue;
+		}
+		const uint32_t slot = AcquireSlot();
+		if (slot == UINT32_MAX)
+		{
+			// 这一帧用到的页已经把缓存占满了，还需要的话下一帧会再请求
+			continue;
+		}
+
+		const size_t offset = regions.size() * SLOT_BYTES;
+		std::memcpy(mStaging + offset, page.texels.data(), SLOT_BYTES);
+		VkBufferImageCopy region = {};
+		region.bufferOffset = offset;
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		region.imageOffset = { static_cast<int32_t>(slot % SWS_VT_CACHE_SLOTS_X * SWS_VT_SLOT_SIZE), static_cast<int32_t>(slot / SWS_VT_CACHE_SLOTS_X * SWS_VT_SLOT_SIZE), 0 };
+		region.imageExtent = { SWS_VT_SLOT_SIZE, SWS_VT_SLOT_SIZE, 1 };
+		regions.push_back(region);
+
+		auto& target = mSlots[slot];
+		target.page = page.page;
+		target.lastUsedFrame = mFrame;
+		target.pinned = page.pin && mPinnedSlots < mSlots.size() / 2;
+		mPinnedSlots += target.pinned ? 1 : 0;
+		PageTableEntry(page.page) = slot + 1;
+	}
+
+	if (regions.empty())
+	{
+		return;
+	}
+	mStagingBuffer.Flush();
+	mPageTableBuffer.Flush();
+
+	const auto error = DoOneTimeCommand(mLogicalDevice, mCommandPool, mGraphicsQueue, [&](VkCommandBuffer& commandBuffer)
+		{
+			const VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+			Image::ImageBarrier(commandBuffer, mPageCache->GetImage(), range,
+				VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+			vkCmdCopyBufferToImage(commandBuffer, mStagingBuffer.GetVkBuffer(), mPageCache->GetImage(),
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+			Image::ImageBarrier(commandBuffer, mPageCache->GetImage(), range,
+				VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			return VK_SUCCESS;
+		});
+	assert(error == VK_SUCCESS);
+}
+
+uint32_t VirtualTextureStreamer::AcquireSlot()
+{
+	if (mFreeSlots.empty())
+	{
+		// 换掉最久没用过的页，这一帧还在用的和常驻的Mip尾不动
+		uint32_t oldest = UINT32_MAX;
+		for (uint32_t slot = 0; slot < mSlots.size(); slot++)
+		{
+			const auto& candidate = mSlots[slot];
+			if (!candidate.pinned && candidate.lastUsedFrame < mFrame
+				&& (oldest == UINT32_MAX || candidate.lastUsedFrame < mSlots[oldest].lastUsedFrame))
+			{
+				oldest = slot;
+			}
+		}
+		if (oldest == UINT32_MAX)
+		{
+			return UINT32_MAX;
+		}
+		EvictSlot(oldest);
+	}
+
+	const uint32_t slot = mFreeSlots.back();
+	mFreeSlots.pop_back();
+	return slot;
+}
+
+void VirtualTextureStreamer::EvictSlot(const uint32_t& slot)
+{
+	auto& target = mSlots[slot];
+	PageTableEntry(target.page) = 0;
+	mPinnedSlots -= target.pinned ? 1 : 0;
+	target = {};
+	mFreeSlots.push_back(slot);
+}
+
+void VirtualTextureStreamer::StopLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mLoaderMutex);
+		mStopLoader = true;
+	}
+	mLoaderCondition.notify_all();
+	if (mLoaderThread.joinable())
+	{
+		mLoaderThread.join();
+	}
+}
+
+void VirtualTextureStreamer::LoaderLoop()
+{
+	while (true)
+	{
+		PageRequest request;
+		{
+			std::unique_lock<std::mutex> lock(mLoaderMutex);
+			mLoaderCondition.wait(lock, [this]() { return mStopLoader || !mPinnedRequests.empty() || !mRequests.empty(); });
+			if (mStopLoader)
+			{
+				return;
+			}
+			auto& queue = mPinnedRequests.empty() ? mRequests : mPinnedRequests;
+			request = std::move(queue.front());
+			queue.pop_front();
+		}
+
+		// 解码和切页不持有锁，渲染线程可以继续提交新的请求
+		const uint32_t id = request.page >> SWS_VT_REQUEST_TEXTURE_SHIFT;
+		const SourceImage& source = GetSource(id, request.path, request.generation);
+		LoadedPage loaded{ request.page, request.generation, request.pin, {} };
+		CutPage(source,
+			(request.page >> SWS_VT_REQUEST_MIP_SHIFT) & 0xF,
+			request.page & 0xFF,
+			(request.page >> SWS_VT_REQUEST_PAGE_Y_SHIFT) & 0xFF,
+			loaded.texels);
+
+		std::lock_guard<std::mutex> lock(mLoaderMutex);
+		mLoadedPages.push_back(std::move(loaded));
+	}
+}
+
+const VirtualTextureStreamer::SourceImage& VirtualTextureStreamer::GetSource(const uint32_t& id, const std::string& path, const uint32_t& generation)
+{
+	mSourceOrder.remove(id);
+	mSourceOrder.push_front(id);
+	const auto found = mSources.find(id);
+	if (found != mSources.end() && found->second.generation == generation)
+	{
+		return found->second;
+	}
+	if (found != mSources.end())
+	{
+		mSourceBytes -= found->second.bytes;
+		mSources.erase(found);
+	}
+
+	// 和Register里读文件头的结果保持一致：读不了就用错误贴图
+	int width, height, channels;
+	stbi_uc* pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+	if (!pixels)
+	{
+		pixels = stbi_load(DEFAULT_TEXTURE_DIR"error.png", &width, &height, &channels, STBI_rgb_alpha);
+	}
+
+	SourceImage source;
+	source.generation = generation;
+	if (pixels)
+	{
+		source.mips.emplace_back(pixels, pixels + static_cast<size_t>(width) * height * 4);
+		stbi_image_free(pixels);
+	}
+	else
+	{
+		width = height = 1;
+		source.mips.push_back({ 128, 128, 128, 255 });
+	}
+	source.widths.push_back(static_cast<uint32_t>(width));
+	source.heights.push_back(static_cast<uint32_t>(height));
+
+	// 只生成到Mip尾，更小的Mip Shader不会用到
+	const uint32_t tailMip = ComputeTailMip(source.widths[0], source.heights[0]);
+	for (uint32_t mip = 1; mip <= tailMip; mip++)
+	{
+		source.mips.push_back(TextureCooker::DownsampleRGBA(source.mips.back().data(), source.widths.back(), source.heights.back()));
+		source.widths.push_back(MipExtent(source.widths[0], mip));
+		source.heights.push_back(MipExtent(source.heights[0], mip));
+	}
+	for (const auto& mip : source.mips)
+	{
+		source.bytes += mip.size();
+	}
+
+	// 源图超出上限就丢掉最久没用过的
+	mSourceBytes += source.bytes;
+	while (mSourceBytes > MAX_SOURCE_BYTES && mSourceOrder.size() > 1)
+	{
+		const uint32_t oldest = mSourceOrder.back();
+		mSourceOrder.pop_back();
+		const auto evicted = mSources.find(oldest);
+		if (evicted != mSources.end())
+		{
+			mSourceBytes -= evicted->second.bytes;
+			mSources.erase(evicted);
+		}
+	}
+	return mSources[id] = std::move(source);
+}
+
+void VirtualTextureStreamer::CutPage(const SourceImage& source, const uint32_t& mip, const uint32_t& pageX, const uint32_t& pageY, std::vector<uint8_t>& texels)
+{
+	// 页四周的边按REPEAT从相邻的页（或者另一侧）取，这样槽位里的双线性过滤不会采到别的页
+	// 文件在Register之后又被改过的话，源图的Mip数可能和页表对不上
+	const size_t level = std::min<size_t>(mip, source.mips.size() - 1);
+	const uint32_t width = source.widths[level];
+	const uint32_t height = source.heights[level];
+	const auto& pixels = source.mips[level];
+	texels.resize(SLOT_BYTES);
+	const int64_t originX = static_cast<int64_t>(pageX) * SWS_VT_PAGE_SIZE - SWS_VT_PAGE_BORDER;
+	const int64_t originY = static_cast<int64_t>(pageY) * SWS_VT_PAGE_SIZE - SWS_VT_PAGE_BORDER;
+	for (uint32_t y = 0; y < SWS_VT_SLOT_SIZE; y++)
+	{
+		const size_t row = static_cast<size_t>(Wrap(originY + y, height)) * width;
+		for (uint32_t x = 0; x < SWS_VT_SLOT_SIZE; x++)
+		{
+			std::memcpy(&texels[(static_cast<size_t>(y) * SWS_VT_SLOT_SIZE + x) * 4], &pixels[(row + Wrap(originX + x, width)) * 4], 4);
+		}
+	}
+}
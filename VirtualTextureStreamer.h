@@ -0,0 +1,202 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "Buffer.h"
+#include "Image.h"
+#include "SamplerCache.h"
+#include "shared_with_shaders.h"
+
+/*
+ * Virtual texturing for material textures: only the pages that rays actually hit are kept on the GPU.
+ * Every texture gets a page table (one entry per SWS_VT_PAGE_SIZE page of every mip down to its mip tail),
+ * and resident pages live in slots of one physical page cache image, with a border for bilinear filtering.
+ * The closest hit shader appends the page it wants to a feedback buffer; the requests are read back one
+ * frame late, pages are cut out of the decoded source on a loader thread and copied into least recently
+ * used slots. The shader falls back to the finest resident coarser mip until a page arrives.
+ */
+class VirtualTextureStreamer
+{
+public:
+	// 物理页缓存默认的行数，每行SWS_VT_CACHE_SLOTS_X个页
+	static constexpr uint32_t DEFAULT_CACHE_ROWS = 16;
+
+	VirtualTextureStreamer(VmaAllocator& allocator,
+		VkDevice& logicalDevice,
+		VkCommandPool& commandPool,
+		VkQueue& graphicsQueue,
+		SamplerCache& samplerCache,
+		const uint32_t& cacheRows = DEFAULT_CACHE_ROWS);
+	~VirtualTextureStreamer();
+
+	VirtualTextureStreamer(const VirtualTextureStreamer&) = delete;
+	VirtualTextureStreamer& operator=(const VirtualTextureStreamer&) = delete;
+
+	// Adds the texture read from path (only its header is read here) and returns its virtual texture ID.
+	// The page table is allocated by the next Update.
+	uint32_t Register(const std::string& path);
+	// Drops every page of the texture after its file changed; they are loaded again on demand.
+	void Reload(const uint32_t& id);
+
+	// Call once per frame while the device is idle, before the frame is recorded.
+	// Returns true when the page table / info buffers were reallocated, so the descriptor set has to be rewritten.
+	bool Update();
+
+	const Image& GetPageCache() const
+	{
+		return *mPageCache;
+	}
+
+	const Buffer& GetPageTableBuffer() const
+	{
+		return mPageTableBuffer;
+	}
+
+	const Buffer& GetInfoBuffer() const
+	{
+		return mInfoBuffer;
+	}
+
+	const Buffer& GetFeedbackBuffer() const
+	{
+		return mFeedbackBuffer;
+	}
+
+	uint32_t GetTextureCount() const
+	{
+		return static_cast<uint32_t>(mTextures.size());
+	}
+
+	uint32_t GetResidentPageCount() const;
+	uint32_t GetSlotCount() const
+	{
+		return static_cast<uint32_t>(mSlots.size());
+	}
+
+	void Dispose();
+
+private:
+	// 每帧最多拷贝进物理缓存的页数，避免一帧里面卡太久
+	static constexpr size_t MAX_UPLOADS_PER_FRAME = 32;
+	// 读盘线程缓存的解码后的源图（带Mip）总大小上限
+	static constexpr size_t MAX_SOURCE_BYTES = 512ull * 1024 * 1024;
+
+	struct VirtualTexture
+	{
+		std::string path;
+		VirtualTextureInfo info{};
+		// 每一级Mip在这张贴图的页表里的起始位置
+		std::vector<uint32_t> mipOffsets;
+		// 热重载之后加一，读盘线程用旧的源图切出来的页要丢掉
+		uint32_t generation = 0;
+	};
+
+	struct Slot
+	{
+		// 占用这个槽位的页（PackPageRequest的格式），空槽是UINT32_MAX
+		uint32_t page = UINT32_MAX;
+		uint64_t lastUsedFrame = 0;
+		// Mip尾常驻，保证Shader总有一页可以退回去用
+		bool pinned = false;
+	};
+
+	struct PageRequest
+	{
+		uint32_t page;
+		std::string path;
+		uint32_t generation;
+		bool pin;
+	};
+
+	struct LoadedPage
+	{
+		uint32_t page;
+		uint32_t generation;
+		bool pin;
+		std::vector<uint8_t> texels;
+	};
+
+	// 解码过的源图和它的Mip链，只在读盘线程里用
+	struct SourceImage
+	{
+		uint32_t generation = 0;
+		std::vector<std::vector<uint8_t>> mips;
+		std::vector<uint32_t> widths;
+		std::vector<uint32_t> heights;
+		size_t bytes = 0;
+	};
+
+	static uint32_t ComputeTailMip(const uint32_t& width, const uint32_t& height);
+	// 从文件头读尺寸、分配页表位置，再请求加载Mip尾
+	void ReadLayout(const uint32_t& id);
+	uint32_t AllocatePageTableRange(const uint32_t& size);
+	void FreePageTableRange(const uint32_t& offset, const uint32_t& size);
+	uint32_t& PageTableEntry(const uint32_t& page);
+	bool IsValidPage(const uint32_t& page) const;
+	void ReadFeedback();
+	void QueueLoads(std::vector<uint32_t>& pages);
+	bool AllocateTables();
+	void UploadLoadedPages();
+	uint32_t AcquireSlot();
+	void EvictSlot(const uint32_t& slot);
+
+	void StopLoader();
+	void LoaderLoop();
+	const SourceImage& GetSource(const uint32_t& id, const std::string& path, const uint32_t& generation);
+	static void CutPage(const SourceImage& source, const uint32_t& mip, const uint32_t& pageX, const uint32_t& pageY, std::vector<uint8_t>& texels);
+
+	VmaAllocator& mAllocator;
+	VkDevice& mLogicalDevice;
+	VkCommandPool& mCommandPool;
+	VkQueue& mGraphicsQueue;
+
+	std::unique_ptr<Image> mPageCache;
+	std::vector<Slot> mSlots;
+	std::vector<uint32_t> mFreeSlots;
+	uint32_t mPinnedSlots = 0;
+
+	std::vector<VirtualTexture> mTextures;
+	uint32_t mPageTableSize = 0;
+	// 热重载改了尺寸的贴图腾出来的页表区间（起始位置，长度），按位置排序，相邻的合并
+	std::vector<std::pair<uint32_t, uint32_t>> mFreePageTableRanges;
+	// 页表和贴图信息都在CPU可见的显存里，设备空闲的时候直接改
+	Buffer mPageTableBuffer;
+	Buffer mInfoBuffer;
+	uint32_t* mPageTable = nullptr;
+	uint32_t mAllocatedPageTableSize = 0;
+	uint32_t mAllocatedTextureCount = 0;
+	bool mInfoDirty = false;
+
+	// 两半轮流写：这一帧的Shader写一半，CPU读上一帧写的另一半
+	Buffer mFeedbackBuffer;
+	VirtualTextureFeedbackHeader* mFeedback = nullptr;
+	uint64_t mFrame = 0;
+
+	Buffer mStagingBuffer;
+	uint8_t* mStaging = nullptr;
+
+	// 已经交给读盘线程、还没拷贝进缓存的页
+	std::unordered_set<uint32_t> mInFlight;
+
+	// 读盘线程
+	std::thread mLoaderThread;
+	std::mutex mLoaderMutex;
+	std::condition_variable mLoaderCondition;
+	// Mip尾优先，不会被每帧新的请求冲掉
+	std::deque<PageRequest> mPinnedRequests;
+	std::deque<PageRequest> mRequests;
+	std::vector<LoadedPage> mLoadedPages;
+	bool mStopLoader = false;
+	// 下面这些只有读盘线程访问
+	std::unordered_map<uint32_t, SourceImage> mSources;
+	std::list<uint32_t> mSourceOrder;
+	size_t mSourceBytes = 0;
+};
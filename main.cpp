@@ -1,18 +1,42 @@
 #include <iostream>
 #include "VKRTWindow.h"
+#include "TextureCooker.h"
+#include "ShaderCache.h"
 
 int main(int argc, char* argv[])
 {
+    // --cook-textures [目录]：把贴图离线编码成带Mip的BC1/BC7 KTX2文件，不启动渲染器
+    if (argc > 1 && std::string(argv[1]) == "--cook-textures")
+    {
+        const std::string directory = argc > 2 ? argv[2] : DEFAULT_TEXTURE_DIR;
+        std::cout << "Cooked " << TextureCooker::CookDirectory(directory) << " textures." << std::endl;
+        return 0;
+    }
+
+    // --embed-shaders [文件]：预先编译光线追踪的Shader，写成C++数组；定义VKRT_EMBEDDED_SHADERS重新编译之后启动时就不用编译Shader了
+    if (argc > 1 && std::string(argv[1]) == "--embed-shaders")
+    {
+        const std::string outputPath = argc > 2 ? argv[2] : ShaderCache::EMBEDDED_SHADERS_FILE;
+        glslang::InitializeProcess();
+        const bool succeeded = ShaderCache::WriteEmbeddedShaders(VKRTApp::GetShaderFiles(), outputPath);
+        glslang::FinalizeProcess();
+        std::cout << (succeeded ? "Wrote " : "Failed to write ") << outputPath << std::endl;
+        return succeeded ? 0 : 1;
+    }
+
     std::cout << glslang::GetEsslVersionString() << std::endl;
     std::cout << glslang::GetGlslVersionString() << std::endl;
-    // ʼGLSL JIT
+    // 初始化GLSL JIT编译器
     glslang::InitializeProcess();
 
-    // һRTXOnĴ
-	VKRTWindow window;
+    // 场景文件可以从命令行传入，不用重新编译就能切换场景
+    const std::string scenePath = argc > 1 ? argv[1] : DEFAULT_SCENE_DIR"Loft.json";
+
+    // 一个带有RTXOn的窗口
+	VKRTWindow window(scenePath);
 
     window.run();
-    // ͷGLSL JIT༭
+    // 释放GLSL JIT编辑器
     glslang::FinalizeProcess();
 	return 0;
 }
\ No newline at end of file
@@ -5,10 +5,6 @@
 
 #include "../shared_with_shaders.h"
 
-layout(set = SWS_MATIDS_SET, binding = 0, std430) readonly buffer MatIDsBuffer {
-    uint MatIDs[];
-} MatIDsArray[];
-
 layout(set = SWS_ATTRIBS_SET, binding = 0, std430) readonly buffer AttribsBuffer {
     VertexAttribute VertexAttribs[];
 } AttribsArray[];
@@ -19,40 +15,123 @@ layout(set = SWS_FACES_SET, binding = 0, std430) readonly buffer FacesBuffer {
 
 layout(set = SWS_TEXTURES_SET, binding = 0) uniform sampler2D TexturesArray[];
 
+// virtual textures: resident pages live in the page cache, the page table says which slot holds a page (slot + 1, 0 = not resident)
+layout(set = SWS_VIRTUAL_TEXTURE_SET, binding = SWS_VT_PAGE_CACHE_BINDING) uniform sampler2D PageCache;
+layout(set = SWS_VIRTUAL_TEXTURE_SET, binding = SWS_VT_PAGE_TABLE_BINDING, std430) readonly buffer PageTableBuffer {
+    uint PageTable[];
+};
+layout(set = SWS_VIRTUAL_TEXTURE_SET, binding = SWS_VT_INFO_BINDING, std430) readonly buffer VirtualTextureInfoBuffer {
+    VirtualTextureInfo VirtualTextures[];
+};
+layout(set = SWS_VIRTUAL_TEXTURE_SET, binding = SWS_VT_FEEDBACK_BINDING, std430) buffer FeedbackBuffer {
+    VirtualTextureFeedbackHeader Feedback;
+    uint FeedbackRequests[];
+};
+
 layout(location = SWS_LOC_PRIMARY_RAY) rayPayloadInEXT RayPayload PrimaryRay;
                                        hitAttributeEXT vec2 HitAttribs;
 
+// set per pipeline variant (see PipelineFeatures)
+layout(constant_id = SWS_SPEC_TEXTURE_LOD_MODE) const uint TextureLodMode = SWS_TEXTURE_LOD_RAY_CONE;
+
 layout(set = SWS_COLORS_SET, binding = 0, std430) readonly buffer ColorsBuffer
 {
-    vec4 Color;
+    MaterialData Material;
 } ColorsArray[];
 
+vec3 SampleVirtualTexture(uint id, vec2 uv, float lod) {
+    const VirtualTextureInfo info = VirtualTextures[id];
+    const uvec2 size = uvec2(info.width, info.height);
+    uv = fract(uv);
+    const uint wantedMip = uint(clamp(floor(lod + 0.5f), 0.0f, float(info.tailMip)));
+
+    // a different 1/16 of the pixels reports the page it wants every frame, which keeps the feedback small
+    const uvec2 pixel = gl_LaunchIDEXT.xy & 3u;
+    if (pixel.x + pixel.y * 4u == (Feedback.frame & 15u))
+    {
+        const uvec2 mipSize = max(size >> wantedMip, uvec2(1u));
+        const uvec2 page = min(uvec2(uv * vec2(mipSize)), mipSize - 1u) / SWS_VT_PAGE_SIZE;
+        const uint bank = Feedback.frame & 1u;
+        const uint index = atomicAdd(Feedback.counts[bank], 1u);
+        if (index < SWS_VT_FEEDBACK_CAPACITY)
+        {
+            FeedbackRequests[bank * SWS_VT_FEEDBACK_CAPACITY + index] = PackPageRequest(id, wantedMip, page.x, page.y);
+        }
+    }
+
+    // the wanted mip if its page is resident, otherwise the next coarser one that is
+    uint tableOffset = info.pageTableOffset;
+    for (uint mip = 0u; mip <= info.tailMip; mip++)
+    {
+        const uvec2 mipSize = max(size >> mip, uvec2(1u));
+        const uvec2 pageCount = (mipSize + SWS_VT_PAGE_SIZE - 1u) / SWS_VT_PAGE_SIZE;
+        if (mip >= wantedMip)
+        {
+            const vec2 texel = uv * vec2(mipSize);
+            const uvec2 page = min(uvec2(texel), mipSize - 1u) / SWS_VT_PAGE_SIZE;
+            const uint entry = PageTable[tableOffset + page.y * pageCount.x + page.x];
+            if (entry != 0u)
+            {
+                const uint slot = entry - 1u;
+                const vec2 slotOrigin = vec2(slot % SWS_VT_CACHE_SLOTS_X, slot / SWS_VT_CACHE_SLOTS_X) * float(SWS_VT_SLOT_SIZE) + float(SWS_VT_PAGE_BORDER);
+                const vec2 cacheTexel = slotOrigin + texel - vec2(page * SWS_VT_PAGE_SIZE);
+                return textureLod(PageCache, cacheTexel / vec2(textureSize(PageCache, 0)), 0.0f).rgb;
+            }
+        }
+        tableOffset += pageCount.x * pageCount.y;
+    }
+    // not even the mip tail has arrived yet
+    return vec3(0.5f);
+}
+
 void main() {
     const vec3 barycentrics = vec3(1.0f - HitAttribs.x - HitAttribs.y, HitAttribs.x, HitAttribs.y);
 
-    const uint matID = MatIDsArray[nonuniformEXT(gl_InstanceCustomIndexEXT)].MatIDs[gl_PrimitiveID];
-    const uvec4 face = FacesArray[nonuniformEXT(gl_InstanceCustomIndexEXT)].Faces[gl_PrimitiveID];
-    const vec4 color = ColorsArray[nonuniformEXT(matID)].Color;
+    // the material comes with the instance
+    const uint geometryID = InstanceGeometryIndex(gl_InstanceCustomIndexEXT);
+    const uvec4 face = FacesArray[nonuniformEXT(geometryID)].Faces[gl_PrimitiveID];
+    const uint matID = InstanceMaterialIndex(gl_InstanceCustomIndexEXT);
+    const vec4 color = ColorsArray[nonuniformEXT(matID)].Material.color;
+    // textures are shared between materials, the material says which one it uses
+    const uint textureID = ColorsArray[nonuniformEXT(matID)].Material.textureIndex;
 
-    VertexAttribute v0 = AttribsArray[nonuniformEXT(gl_InstanceCustomIndexEXT)].VertexAttribs[int(face.x)];
-    VertexAttribute v1 = AttribsArray[nonuniformEXT(gl_InstanceCustomIndexEXT)].VertexAttribs[int(face.y)];
-    VertexAttribute v2 = AttribsArray[nonuniformEXT(gl_InstanceCustomIndexEXT)].VertexAttribs[int(face.z)];
+    VertexAttribute v0 = AttribsArray[nonuniformEXT(geometryID)].VertexAttribs[int(face.x)];
+    VertexAttribute v1 = AttribsArray[nonuniformEXT(geometryID)].VertexAttribs[int(face.y)];
+    VertexAttribute v2 = AttribsArray[nonuniformEXT(geometryID)].VertexAttribs[int(face.z)];
 
-    // interpolate our vertex attribs
-    const vec3 normal = normalize(BaryLerp(v0.normal.xyz, v1.normal.xyz, v2.normal.xyz, barycentrics));
-    const vec2 uv = BaryLerp(v0.uv.xy, v1.uv.xy, v2.uv.xy, barycentrics);
+    // decode and interpolate our vertex attribs
+    const vec3 objectNormal = BaryLerp(DecodeOctNormal(v0.normalOct), DecodeOctNormal(v1.normalOct), DecodeOctNormal(v2.normalOct), barycentrics);
+    // instances can be rotated and scaled, so the normal has to be taken to world space
+    const mat3 objectToWorld = mat3(gl_ObjectToWorldEXT);
+    const vec3 normal = normalize(transpose(inverse(objectToWorld)) * objectNormal);
+    const vec2 uv = BaryLerp(DecodeHalfUV(v0.uvHalf), DecodeHalfUV(v1.uvHalf), DecodeHalfUV(v2.uvHalf), barycentrics);
 
     vec3 texel;
     if (color.r < 0)
     {
-        texel = textureLod(TexturesArray[nonuniformEXT(matID)], uv, 0.0f).rgb;
+        // ray cone texture LOD: the per-face constant 0.5 * log2(uv area / object area) is taken to world space
+        // with the instance scale, then widened by the texture size and the cone footprint at the hit
+        const float instanceScale = pow(abs(determinant(objectToWorld)), 1.0f / 3.0f);
+        const bool virtualTexture = (textureID & SWS_VIRTUAL_TEXTURE_BIT) != 0u;
+        const uint virtualID = textureID & ~SWS_VIRTUAL_TEXTURE_BIT;
+        const vec2 texSize = virtualTexture ? vec2(VirtualTextures[virtualID].width, VirtualTextures[virtualID].height)
+                                            : vec2(textureSize(TexturesArray[nonuniformEXT(textureID)], 0));
+        const float coneWidth = abs(PrimaryRay.cone.x + PrimaryRay.cone.y * gl_HitTEXT);
+        const float cosine = max(abs(dot(normal, gl_WorldRayDirectionEXT)), 1e-3f);
+        const float lod = TextureLodMode == SWS_TEXTURE_LOD_BASE ? 0.0f
+                        : FaceTexLodConstant(face.w) - log2(max(instanceScale, 1e-6f))
+                          + 0.5f * log2(texSize.x * texSize.y)
+                          + log2(max(coneWidth, 1e-8f) / cosine);
+        texel = virtualTexture ? SampleVirtualTexture(virtualID, uv, lod)
+                               : textureLod(TexturesArray[nonuniformEXT(textureID)], uv, lod).rgb;
     }
     else
     {
-        texel = color.rgb;
+        // material colours are picked in sRGB like the textures, lighting happens in linear space
+        texel = SrgbToLinear(color.rgb);
     }
 
-    const float objId = float(gl_InstanceCustomIndexEXT);
+    const float objId = float(gl_InstanceID);
 
     PrimaryRay.colorAndDist = vec4(texel, gl_HitTEXT);
     PrimaryRay.normalAndObjId = vec4(normal, objId);
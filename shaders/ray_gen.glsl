@@ -19,6 +19,11 @@ layout(set = SWS_OBJ_ATTR_SET, binding = 0) readonly buffer ObjectAttribute
 layout(location = SWS_LOC_PRIMARY_RAY) rayPayloadEXT RayPayload PrimaryRay;
 layout(location = SWS_LOC_SHADOW_RAY)  rayPayloadEXT ShadowRayPayload ShadowRay;
 
+// feature switches, set per pipeline variant (see PipelineFeatures); the compiler drops the disabled paths
+layout(constant_id = SWS_SPEC_MAX_BOUNCES) const int MaxBounces = SWS_MAX_RECURSION;
+layout(constant_id = SWS_SPEC_REFRACTION)  const bool RefractionEnabled = true;
+layout(constant_id = SWS_SPEC_SHADOWS)     const bool ShadowsEnabled = true;
+
 const float kBunnyRefractionIndex = 1.0f / 1.31f; // ice
 
 vec3 CalcRayDir(vec2 screenUV, float aspect) {
@@ -57,9 +62,13 @@ void main() {
 
     vec3 finalColor = vec3(0.0f);
 
-    int recursion = SWS_MAX_RECURSION;
-    for (int i = 0; i < recursion; ++i) 
+    // ray cone for texture LOD: starts as a point at the camera and spreads by one pixel's angle
+    const float pixelSpreadAngle = atan(2.0f * tan(Params.camNearFarFov.z * 0.5f) / float(gl_LaunchSizeEXT.y));
+    vec2 cone = vec2(0.0f, pixelSpreadAngle);
+
+    for (int i = 0; i < MaxBounces; ++i) 
     {
+        PrimaryRay.cone = vec4(cone, 0.0f, 0.0f);
         traceRayEXT(Scene,
                     rayFlags,
                     cullMask,
@@ -99,6 +108,8 @@ void main() {
             const float objectId = PrimaryRay.normalAndObjId.w;
 
             const vec3 hitPos = origin + direction * hitDistance;
+            // the cone widens along the segment; surfaces are treated as planar, so a reflection keeps the spread angle
+            cone.x += cone.y * hitDistance;
 
             bool needsReflection = ObjAttris[int(objectId)].objAttri.reflection > 0;
             origin = hitPos + hitNormal * 0.01f;
@@ -109,12 +120,13 @@ void main() {
             //     needsReflection = true;
             //     // if (int(objectId) == 17 || int(objectId) == 13)
             // }            
-            if (ObjAttris[int(objectId)].objAttri.refraction > 0)
+            if (RefractionEnabled && ObjAttris[int(objectId)].objAttri.refraction > 0)
             {
                 if (i == 0)
                 {
                     vec3 refractionLight = refract(direction, hitNormal, 1.1f);
                     vec3 refractionOrigin = hitPos - hitNormal * 0.1f;
+                    PrimaryRay.cone = vec4(cone, 0.0f, 0.0f);
                     traceRayEXT(Scene,
                         rayFlags,
                         cullMask,
@@ -133,19 +145,24 @@ void main() {
                 }
             }
             const vec3 toLight = normalize(Params.sunPosAndAmbient.xyz);
-            const vec3 shadowRayOrigin = hitPos + hitNormal * 0.001f;
-            traceRayEXT(Scene,
-                shadowRayFlags,
-                0xFD,
-                SWS_SHADOW_HIT_SHADERS_IDX,
-                stbRecordStride,
-                SWS_SHADOW_MISS_SHADERS_IDX,
-                shadowRayOrigin,
-                0.0f,
-                toLight,
-                tmax,
-                SWS_LOC_SHADOW_RAY);
-            const float lighting = (ShadowRay.distance > 0.0f) ? Params.sunPosAndAmbient.w : max(Params.sunPosAndAmbient.w, dot(hitNormal, toLight));
+            bool inShadow = false;
+            if (ShadowsEnabled)
+            {
+                const vec3 shadowRayOrigin = hitPos + hitNormal * 0.001f;
+                traceRayEXT(Scene,
+                    shadowRayFlags,
+                    0xFD,
+                    SWS_SHADOW_HIT_SHADERS_IDX,
+                    stbRecordStride,
+                    SWS_SHADOW_MISS_SHADERS_IDX,
+                    shadowRayOrigin,
+                    0.0f,
+                    toLight,
+                    tmax,
+                    SWS_LOC_SHADOW_RAY);
+                inShadow = ShadowRay.distance > 0.0f;
+            }
+            const float lighting = inShadow ? Params.sunPosAndAmbient.w : max(Params.sunPosAndAmbient.w, dot(hitNormal, toLight));
             finalColor += hitColor * lighting;
             if (!needsReflection)
             {
@@ -154,5 +171,6 @@ void main() {
         }
     }
 
-    imageStore(ResultImage, ivec2(gl_LaunchIDEXT.xy), vec4(finalColor, 1.0f));
+    // textures are sampled as linear values (sRGB / half float formats), the result image is a UNORM one shown as is
+    imageStore(ResultImage, ivec2(gl_LaunchIDEXT.xy), vec4(LinearToSrgb(clamp(finalColor, 0.0f, 1.0f)), 1.0f));
 }
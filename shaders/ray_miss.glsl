@@ -4,23 +4,20 @@
 
 #include "../shared_with_shaders.h"
 
-layout(set = SWS_ENVS_SET, binding = 0) uniform sampler2D EnvTexture;
+layout(set = SWS_ENVS_SET, binding = 0) uniform samplerCube EnvTexture;
 
 layout(location = SWS_LOC_PRIMARY_RAY) rayPayloadInEXT RayPayload PrimaryRay;
 
-const float MY_PI = 3.1415926535897932384626433832795;
-const float MY_INV_PI  = 1.0 / MY_PI;
-
-vec2 DirToLatLong(vec3 dir) {
-    float phi = atan(dir.x, dir.z);
-    float theta = acos(dir.y);
+// set per pipeline variant (see PipelineFeatures)
+layout(constant_id = SWS_SPEC_TEXTURE_LOD_MODE) const uint TextureLodMode = SWS_TEXTURE_LOD_RAY_CONE;
 
-    return vec2((MY_PI + phi) * (0.5 / MY_PI), theta * MY_INV_PI);
-}
+const float MY_PI = 3.1415926535897932384626433832795;
 
 void main() {
-    vec2 uv = DirToLatLong(gl_WorldRayDirectionEXT);
-    vec3 envColor = textureLod(EnvTexture, uv, 0.0).rgb;
+    // a cube face spans pi/2 radians, so a cone of the given spread angle covers that many texels
+    const float faceSize = float(textureSize(EnvTexture, 0).x);
+    const float lod = TextureLodMode == SWS_TEXTURE_LOD_BASE ? 0.0 : log2(max(abs(PrimaryRay.cone.y) * faceSize * 2.0 / MY_PI, 1e-8));
+    vec3 envColor = textureLod(EnvTexture, gl_WorldRayDirectionEXT, lod).rgb;
     // vec3 envColor = vec3(0.2, 0.3, 0.8);
     PrimaryRay.colorAndDist = vec4(envColor, -1.0);
     PrimaryRay.normalAndObjId = vec4(0.0);
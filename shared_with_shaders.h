@@ -4,6 +4,7 @@
 #ifdef __cplusplus
 // include vec & mat types (same namings as in GLSL)
 #include "Common.h"
+typedef uint32_t uint;
 #else
 #define VkBool32 uint
 #endif // __cplusplus
@@ -29,19 +30,45 @@
 #define SWS_CAMDATA_SET                 0
 #define SWS_CAMDATA_BINDING             2
 
-#define SWS_MATIDS_SET                  1
-#define SWS_ATTRIBS_SET                 2
-#define SWS_FACES_SET                   3
-#define SWS_TEXTURES_SET                4
-#define SWS_ENVS_SET                    5
-#define SWS_COLORS_SET                  6
-#define SWS_OBJ_ATTR_SET                    7
+#define SWS_ATTRIBS_SET                 1
+#define SWS_FACES_SET                   2
+#define SWS_TEXTURES_SET                3
+#define SWS_ENVS_SET                    4
+#define SWS_COLORS_SET                  5
+#define SWS_OBJ_ATTR_SET                6
+#define SWS_VIRTUAL_TEXTURE_SET         7
 
 // #define SWS_NUM_SETS                    6
 // #define SWS_NUM_SETS                    7
 
 #define SWS_NUM_SETS                    8
-#define SWS_NUM_SETS_NO_SKYBOX          5
+#define SWS_NUM_SETS_NO_SKYBOX          4
+
+// instance custom index (24 bits): geometry index in the low bits, material index in the high bits
+#define SWS_INSTANCE_GEOMETRY_BITS      12
+#define SWS_INSTANCE_GEOMETRY_MASK      0xFFF
+#define SWS_INSTANCE_MATERIAL_MASK      0xFFF
+
+// faces.w: ray cone texture LOD constant 0.5 * log2(uv area / object space area) as a half float in the low 16 bits
+
+// virtual textures: a material texture index with SWS_VIRTUAL_TEXTURE_BIT set is a virtual texture ID
+#define SWS_VIRTUAL_TEXTURE_BIT         0x80000000u
+#define SWS_VT_PAGE_CACHE_BINDING       0
+#define SWS_VT_PAGE_TABLE_BINDING       1
+#define SWS_VT_INFO_BINDING             2
+#define SWS_VT_FEEDBACK_BINDING         3
+// a page is PAGE_SIZE^2 texels; its slot in the page cache has a BORDER texel wide apron for bilinear filtering
+#define SWS_VT_PAGE_SIZE                128u
+#define SWS_VT_PAGE_BORDER              4u
+#define SWS_VT_SLOT_SIZE                136u
+#define SWS_VT_CACHE_SLOTS_X            32u
+#define SWS_VT_MAX_TEXTURES             4096u
+// page requests per frame; the feedback buffer holds two banks of them
+#define SWS_VT_FEEDBACK_CAPACITY        8192u
+// page request: texture ID in the high 12 bits, then the mip (4 bits), page y and page x (8 bits each)
+#define SWS_VT_REQUEST_TEXTURE_SHIFT    20
+#define SWS_VT_REQUEST_MIP_SHIFT        16
+#define SWS_VT_REQUEST_PAGE_Y_SHIFT     8
 
 // cross-shader locations
 #define SWS_LOC_PRIMARY_RAY             0
@@ -51,6 +78,15 @@
 // #define SWS_MAX_RECURSION               20
 #define SWS_MAX_RECURSION               3
 
+// specialization constant IDs of the ray tracing shaders, see PipelineFeatures
+#define SWS_SPEC_MAX_BOUNCES            0
+#define SWS_SPEC_REFRACTION             1
+#define SWS_SPEC_SHADOWS                2
+#define SWS_SPEC_TEXTURE_LOD_MODE       3
+// SWS_SPEC_TEXTURE_LOD_MODE values: pick the mip from the ray cone, or always sample the full resolution
+#define SWS_TEXTURE_LOD_RAY_CONE        0u
+#define SWS_TEXTURE_LOD_BASE            1u
+
 #define OBJECT_ID_BUNNY                 0.0f
 #define OBJECT_ID_PLANE                 1.0f
 #define OBJECT_ID_TEAPOT                2.0f
@@ -60,6 +96,8 @@ struct RayPayload
 {
 	vec4 colorAndDist;
 	vec4 normalAndObjId;
+	// ray cone for texture LOD: x = width at the ray origin, y = spread angle (set by the caller)
+	vec4 cone;
 };
 
 struct ShadowRayPayload
@@ -67,10 +105,13 @@ struct ShadowRayPayload
 	float distance;
 };
 
+// compact per-vertex attributes, 8 bytes per vertex
+// normalOct: octahedral encoded normal, two snorm16 (x in the low 16 bits)
+// uvHalf:    texture coordinates as two half floats (u in the low 16 bits)
 struct VertexAttribute
 {
-	vec4 normal;
-	vec4 uv;
+	uint normalOct;
+	uint uvHalf;
 };
 
 // packed std140
@@ -87,6 +128,34 @@ struct UniformParams
 	vec4 camNearFarFov;
 };
 
+// per material: the diffuse color (r < 0 means textured) and the slot of its texture in the texture array
+struct MaterialData
+{
+	vec4 color;
+	uint textureIndex;
+	uint padding0;
+	uint padding1;
+	uint padding2;
+};
+
+// per virtual texture: where its page table starts, the size of mip 0 and the last mip that is paged (one page)
+struct VirtualTextureInfo
+{
+	uint pageTableOffset;
+	uint width;
+	uint height;
+	uint tailMip;
+};
+
+// start of the feedback buffer, followed by 2 * SWS_VT_FEEDBACK_CAPACITY page requests
+// frame: written by the CPU, selects the bank (frame & 1) and the pixels that report this frame
+struct VirtualTextureFeedbackHeader
+{
+	uint frame;
+	uint counts[2];
+	uint padding;
+};
+
 struct ObjAttri
 {
 	ShaderBool reflection;
@@ -103,6 +172,35 @@ vec3 BaryLerp(vec3 a, vec3 b, vec3 c, vec3 barycentrics) {
 	return a * barycentrics.x + b * barycentrics.y + c * barycentrics.z;
 }
 
+uint InstanceGeometryIndex(uint customIndex) {
+	return customIndex & SWS_INSTANCE_GEOMETRY_MASK;
+}
+
+uint InstanceMaterialIndex(uint customIndex) {
+	return (customIndex >> SWS_INSTANCE_GEOMETRY_BITS) & SWS_INSTANCE_MATERIAL_MASK;
+}
+
+vec3 DecodeOctNormal(uint packedNormal) {
+	const vec2 f = unpackSnorm2x16(packedNormal);
+	vec3 n = vec3(f.x, f.y, 1.0f - abs(f.x) - abs(f.y));
+	const float t = max(-n.z, 0.0f);
+	n.x += (n.x >= 0.0f) ? -t : t;
+	n.y += (n.y >= 0.0f) ? -t : t;
+	return normalize(n);
+}
+
+vec2 DecodeHalfUV(uint packedUV) {
+	return unpackHalf2x16(packedUV);
+}
+
+uint PackPageRequest(uint textureID, uint mip, uint pageX, uint pageY) {
+	return (textureID << SWS_VT_REQUEST_TEXTURE_SHIFT) | (mip << SWS_VT_REQUEST_MIP_SHIFT) | (pageY << SWS_VT_REQUEST_PAGE_Y_SHIFT) | pageX;
+}
+
+float FaceTexLodConstant(uint faceW) {
+	return unpackHalf2x16(faceW & 0xFFFFu).x;
+}
+
 float LinearToSrgb(float channel) {
 	if (channel <= 0.0031308f) {
 		return 12.92f * channel;
@@ -115,6 +213,35 @@ float LinearToSrgb(float channel) {
 vec3 LinearToSrgb(vec3 linear) {
 	return vec3(LinearToSrgb(linear.r), LinearToSrgb(linear.g), LinearToSrgb(linear.b));
 }
+
+float SrgbToLinear(float channel) {
+	if (channel <= 0.04045f) {
+		return channel / 12.92f;
+	}
+	else {
+		return pow((channel + 0.055f) / 1.055f, 2.4f);
+	}
+}
+
+vec3 SrgbToLinear(vec3 srgb) {
+	return vec3(SrgbToLinear(srgb.r), SrgbToLinear(srgb.g), SrgbToLinear(srgb.b));
+}
+#else
+inline uint32_t PackFaceW(const float texLodConstant)
+{
+	return glm::packHalf2x16(vec2(texLodConstant, 0.0f)) & 0xFFFFu;
+}
+
+inline uint32_t PackPageRequest(const uint32_t textureID, const uint32_t mip, const uint32_t pageX, const uint32_t pageY)
+{
+	return (textureID << SWS_VT_REQUEST_TEXTURE_SHIFT) | (mip << SWS_VT_REQUEST_MIP_SHIFT) | (pageY << SWS_VT_REQUEST_PAGE_Y_SHIFT) | pageX;
+}
+
+inline uint32_t PackInstanceCustomIndex(const uint32_t geometryIndex, const uint32_t materialIndex)
+{
+	assert(geometryIndex <= SWS_INSTANCE_GEOMETRY_MASK && materialIndex <= SWS_INSTANCE_MATERIAL_MASK);
+	return geometryIndex | (materialIndex << SWS_INSTANCE_GEOMETRY_BITS);
+}
 #endif
 
 #endif // SHARED_WITH_SHADERS_H